@@ -70,6 +70,8 @@ static const char *desc = ""
 " b      - Only save audio to the file while the channel is bridged.\n"
 "          Note: Does not include conferences or sounds played to each bridged\n"
 "                party.\n"
+" D      - Defer encoding: keep the audio as signed linear while the call\n"
+"          is up, and only convert it to <ext> once the recording is over.\n"
 " v(<x>) - Adjust the heard volume by a factor of <x> (range -4 to 4)\n"	
 " V(<x>) - Adjust the spoken volume by a factor of <x> (range -4 to 4)\n"	
 " W(<x>) - Adjust the both heard and spoken volumes by a factor of <x>\n"
@@ -92,13 +94,31 @@ struct module_symbols *me;
 
 static const char *mixmonitor_spy_type = "MixMonitor";
 
+/*! \brief How many threads do all the recording */
+#define MIXMONITOR_WORKERS 4
+
+#define SAMPLES_PER_FRAME 160
+
+/*! \brief How much mixed audio is gathered before it is encoded and written out (200 ms) */
+#define MIXMONITOR_BATCH (SAMPLES_PER_FRAME * 10)
+
 struct mixmonitor {
 	struct ast_audiohook audiohook;
 	char *filename;
+	char *ext;
 	char *post_process;
 	char *name;
 	unsigned int flags;
 	struct ast_channel *chan;
+	struct ast_filestream *fs;
+	unsigned int errflag:1;
+	unsigned int queued:1;		/*!< On the ready queue */
+	unsigned int busy:1;		/*!< A worker has it */
+	unsigned int again:1;		/*!< Triggered while a worker had it */
+	int samples;			/*!< How much of batch is used */
+	short batch[MIXMONITOR_BATCH];
+	AST_LIST_ENTRY(mixmonitor) list;
+	AST_LIST_ENTRY(mixmonitor) ready;
 };
 
 enum {
@@ -107,6 +127,7 @@ enum {
 	MUXFLAG_VOLUME = (1 << 3),
 	MUXFLAG_READVOLUME = (1 << 4),
 	MUXFLAG_WRITEVOLUME = (1 << 5),
+	MUXFLAG_DEFER = (1 << 6),
 } mixmonitor_flags;
 
 enum {
@@ -119,11 +140,23 @@ enum {
 AST_APP_OPTIONS(mixmonitor_opts, {
 	AST_APP_OPTION('a', MUXFLAG_APPEND),
 	AST_APP_OPTION('b', MUXFLAG_BRIDGED),
+	AST_APP_OPTION('D', MUXFLAG_DEFER),
 	AST_APP_OPTION_ARG('v', MUXFLAG_READVOLUME, OPT_ARG_READVOLUME),
 	AST_APP_OPTION_ARG('V', MUXFLAG_WRITEVOLUME, OPT_ARG_WRITEVOLUME),
 	AST_APP_OPTION_ARG('W', MUXFLAG_VOLUME, OPT_ARG_VOLUME),
 });
 
+/*! \brief Every recording in progress; the lock also covers the ready queue and the flags on each recording */
+static AST_LIST_HEAD_STATIC(recordings, mixmonitor);
+
+/*! \brief Recordings with audio (or news) waiting for a worker */
+static AST_LIST_HEAD_NOLOCK_STATIC(ready, mixmonitor);
+
+static ast_cond_t ready_cond;
+static pthread_t workers[MIXMONITOR_WORKERS];
+static int idle_workers;
+static int shutting_down;
+
 static int startmon(struct ast_channel *chan, struct ast_audiohook *audiohook) 
 {
 	struct ast_channel *peer;
@@ -140,68 +173,146 @@ static int startmon(struct ast_channel *chan, struct ast_audiohook *audiohook)
 	return res;
 }
 
-#define SAMPLES_PER_FRAME 160
+/*! \brief Audio came in, or the hook is done: put the recording on the ready queue
+ * \note Called by the channel with the audiohook locked
+ */
+static void mixmonitor_trigger(struct ast_audiohook *audiohook)
+{
+	struct mixmonitor *mixmonitor = (struct mixmonitor *) audiohook;
+
+	AST_LIST_LOCK(&recordings);
+	if (mixmonitor->busy)
+		mixmonitor->again = 1;
+	else if (!mixmonitor->queued) {
+		mixmonitor->queued = 1;
+		AST_LIST_INSERT_TAIL(&ready, mixmonitor, ready);
+		if (idle_workers)
+			ast_cond_signal(&ready_cond);
+	}
+	AST_LIST_UNLOCK(&recordings);
+}
 
-static void *mixmonitor_thread(void *obj) 
+/*! \brief Encode and write out the audio gathered so far, opening the file if need be */
+static void mixmonitor_flush(struct mixmonitor *mixmonitor)
 {
-	struct mixmonitor *mixmonitor = obj;
-	struct ast_filestream *fs = NULL;
+	struct ast_frame frame = {
+		.frametype = AST_FRAME_VOICE,
+		.subclass = AST_FORMAT_SLINEAR,
+		.data = mixmonitor->batch,
+		.datalen = mixmonitor->samples * sizeof(mixmonitor->batch[0]),
+		.samples = mixmonitor->samples,
+		.src = mixmonitor_spy_type,
+	};
 	unsigned int oflags;
-	char *ext;
-	int errflag = 0;
-
-	if (option_verbose > 1)
-		ast_verbose(VERBOSE_PREFIX_2 "Begin MixMonitor Recording %s\n", mixmonitor->name);
-	
-	ast_audiohook_lock(&mixmonitor->audiohook);
+	char *tmp;
 
-	while (mixmonitor->audiohook.status == AST_AUDIOHOOK_STATUS_RUNNING) {
-		struct ast_frame *fr = NULL;
-		
-		ast_audiohook_trigger_wait(&mixmonitor->audiohook);
-		
-		if (mixmonitor->audiohook.status != AST_AUDIOHOOK_STATUS_RUNNING)
-			break;
-		
-		if (!(fr = ast_audiohook_read_frame(&mixmonitor->audiohook, SAMPLES_PER_FRAME, AST_AUDIOHOOK_DIRECTION_BOTH, AST_FORMAT_SLINEAR)))
-			continue;
-		
-		if (!ast_test_flag(mixmonitor, MUXFLAG_BRIDGED) || ast_bridged_channel(mixmonitor->chan)) {
-			/* Initialize the file if not already done so */
-			if (!fs && !errflag) {
-				oflags = O_CREAT | O_WRONLY;
-				oflags |= ast_test_flag(mixmonitor, MUXFLAG_APPEND) ? O_APPEND : O_TRUNC;
-				
-				if ((ext = strrchr(mixmonitor->filename, '.')))
-					*(ext++) = '\0';
-				else
-					ext = "raw";
-				
-				if (!(fs = ast_writefile(mixmonitor->filename, ext, NULL, oflags, 0, 0644))) {
-					ast_log(LOG_ERROR, "Cannot open %s.%s\n", mixmonitor->filename, ext);
-					errflag = 1;
-				}
+	if (!mixmonitor->samples)
+		return;
+	mixmonitor->samples = 0;
+
+	/* Initialize the file if not already done so */
+	if (!mixmonitor->fs && !mixmonitor->errflag) {
+		oflags = O_CREAT | O_WRONLY;
+		if (ast_test_flag(mixmonitor, MUXFLAG_DEFER)) {
+			/* Keep the audio as it is until the call is over */
+			tmp = alloca(strlen(mixmonitor->filename) + 6);
+			sprintf(tmp, "%s.part", mixmonitor->filename);
+			if (!(mixmonitor->fs = ast_writefile(tmp, "sln", NULL, oflags | O_TRUNC, 0, 0644))) {
+				ast_log(LOG_WARNING, "Cannot open %s.sln, encoding as the call goes\n", tmp);
+				ast_clear_flag(mixmonitor, MUXFLAG_DEFER);
 			}
+		}
+		if (!ast_test_flag(mixmonitor, MUXFLAG_DEFER)) {
+			oflags |= ast_test_flag(mixmonitor, MUXFLAG_APPEND) ? O_APPEND : O_TRUNC;
+			mixmonitor->fs = ast_writefile(mixmonitor->filename, mixmonitor->ext, NULL, oflags, 0, 0644);
+		}
+		if (!mixmonitor->fs) {
+			ast_log(LOG_ERROR, "Cannot open %s.%s\n", mixmonitor->filename, mixmonitor->ext);
+			mixmonitor->errflag = 1;
+		}
+	}
+
+	if (mixmonitor->fs)
+		ast_writestream(mixmonitor->fs, &frame);
+}
 
-			/* Write out the frame */
-			if (fs)
-				ast_writestream(fs, fr);
+/*! \brief Take in whatever audio the hook has, writing it out a batch at a time
+ * \return non-zero once the hook is done with and the recording should be finished
+ */
+static int mixmonitor_service(struct mixmonitor *mixmonitor)
+{
+	struct ast_frame *fr;
+	int status, full;
+
+	for (;;) {
+		full = 0;
+		ast_audiohook_lock(&mixmonitor->audiohook);
+		while ((status = mixmonitor->audiohook.status) == AST_AUDIOHOOK_STATUS_RUNNING &&
+			(fr = ast_audiohook_read_frame(&mixmonitor->audiohook, SAMPLES_PER_FRAME, AST_AUDIOHOOK_DIRECTION_BOTH, AST_FORMAT_SLINEAR))) {
+			if (!ast_test_flag(mixmonitor, MUXFLAG_BRIDGED) || ast_bridged_channel(mixmonitor->chan)) {
+				memcpy(mixmonitor->batch + mixmonitor->samples, fr->data, fr->samples * sizeof(mixmonitor->batch[0]));
+				mixmonitor->samples += fr->samples;
+			}
+			ast_frame_free(fr, 0);
+			if ((full = (mixmonitor->samples + SAMPLES_PER_FRAME > MIXMONITOR_BATCH)))
+				break;
 		}
+		ast_audiohook_unlock(&mixmonitor->audiohook);
 
-		/* All done! free it. */
-		ast_frame_free(fr, 0);
+		/* The file is written without the hook locked, so the channel never waits on the disk */
+		if (!full)
+			break;
+		mixmonitor_flush(mixmonitor);
+	}
+
+	return status == AST_AUDIOHOOK_STATUS_DONE;
+}
+
+/*! \brief Encode a deferred recording into the format asked for */
+static void mixmonitor_encode(struct mixmonitor *mixmonitor)
+{
+	struct ast_filestream *in, *out;
+	struct ast_frame *fr;
+	unsigned int oflags;
+	char *tmp;
+
+	tmp = alloca(strlen(mixmonitor->filename) + 6);
+	sprintf(tmp, "%s.part", mixmonitor->filename);
+
+	if (!(in = ast_readfile(tmp, "sln", NULL, O_RDONLY, 0, 0))) {
+		ast_log(LOG_ERROR, "Cannot open %s.sln\n", tmp);
+		return;
+	}
+
+	oflags = O_CREAT | O_WRONLY;
+	oflags |= ast_test_flag(mixmonitor, MUXFLAG_APPEND) ? O_APPEND : O_TRUNC;
+	if ((out = ast_writefile(mixmonitor->filename, mixmonitor->ext, NULL, oflags, 0, 0644))) {
+		while ((fr = ast_readframe(in)))
+			ast_writestream(out, fr);
+		ast_closestream(out);
+		ast_closestream(in);
+		ast_filedelete(tmp, "sln");
+	} else {
+		/* Leave the audio where it is, rather than lose it */
+		ast_log(LOG_ERROR, "Cannot open %s.%s, the recording is left in %s.sln\n", mixmonitor->filename, mixmonitor->ext, tmp);
+		ast_closestream(in);
+	}
+}
+
+/*! \brief Close the file, then do whatever was asked for when the recording is over */
+static void *mixmonitor_finish(void *obj)
+{
+	struct mixmonitor *mixmonitor = obj;
+
+	if (mixmonitor->fs) {
+		ast_closestream(mixmonitor->fs);
+		if (ast_test_flag(mixmonitor, MUXFLAG_DEFER))
+			mixmonitor_encode(mixmonitor);
 	}
 
-	ast_audiohook_detach(&mixmonitor->audiohook);
-	ast_audiohook_unlock(&mixmonitor->audiohook);
-	ast_audiohook_destroy(&mixmonitor->audiohook);
-	
 	if (option_verbose > 1)
 		ast_verbose(VERBOSE_PREFIX_2 "End MixMonitor Recording %s\n", mixmonitor->name);
 
-	if (fs)
-		ast_closestream(fs);
-
 	if (mixmonitor->post_process) {
 		if (option_verbose > 2)
 			ast_verbose(VERBOSE_PREFIX_2 "Executing [%s]\n", mixmonitor->post_process);
@@ -210,6 +321,68 @@ static void *mixmonitor_thread(void *obj)
 
 	free(mixmonitor);
 
+	return NULL;
+}
+
+/*! \brief The hook is off the channel: write out the last of the audio and let go of the recording */
+static void mixmonitor_done(struct mixmonitor *mixmonitor)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+
+	ast_audiohook_destroy(&mixmonitor->audiohook);
+	mixmonitor_flush(mixmonitor);
+
+	/* Encoding the whole call or running a command would hold up every other recording
+	   this worker looks after, so those get a thread of their own */
+	if (mixmonitor->post_process || (mixmonitor->fs && ast_test_flag(mixmonitor, MUXFLAG_DEFER))) {
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (!ast_pthread_create_background(&thread, &attr, mixmonitor_finish, mixmonitor)) {
+			pthread_attr_destroy(&attr);
+			return;
+		}
+		pthread_attr_destroy(&attr);
+	}
+
+	mixmonitor_finish(mixmonitor);
+}
+
+static void *mixmonitor_worker(void *data)
+{
+	struct mixmonitor *mixmonitor;
+
+	AST_LIST_LOCK(&recordings);
+	while (!shutting_down) {
+		if (!(mixmonitor = AST_LIST_REMOVE_HEAD(&ready, ready))) {
+			idle_workers++;
+			ast_cond_wait(&ready_cond, &recordings.lock);
+			idle_workers--;
+			continue;
+		}
+		mixmonitor->queued = 0;
+		mixmonitor->busy = 1;
+		AST_LIST_UNLOCK(&recordings);
+
+		if (mixmonitor_service(mixmonitor)) {
+			/* Nothing triggers a hook that is done, so nobody else can have it now */
+			AST_LIST_LOCK(&recordings);
+			AST_LIST_REMOVE(&recordings, mixmonitor, list);
+			AST_LIST_UNLOCK(&recordings);
+			mixmonitor_done(mixmonitor);
+			AST_LIST_LOCK(&recordings);
+			continue;
+		}
+
+		AST_LIST_LOCK(&recordings);
+		mixmonitor->busy = 0;
+		if (mixmonitor->again) {
+			mixmonitor->again = 0;
+			mixmonitor->queued = 1;
+			AST_LIST_INSERT_TAIL(&ready, mixmonitor, ready);
+		}
+	}
+	AST_LIST_UNLOCK(&recordings);
 
 	return NULL;
 }
@@ -217,8 +390,6 @@ static void *mixmonitor_thread(void *obj)
 static void launch_monitor_thread(struct ast_channel *chan, const char *filename, unsigned int flags,
 				  int readvol, int writevol, const char *post_process) 
 {
-	pthread_attr_t attr;
-	pthread_t thread;
 	struct mixmonitor *mixmonitor;
 	char postprocess2[1024] = "";
 	size_t len;
@@ -259,33 +430,48 @@ static void launch_monitor_thread(struct ast_channel *chan, const char *filename
 	mixmonitor->filename = (char *) mixmonitor + sizeof(*mixmonitor) + strlen(chan->name) + 1;
 	strcpy(mixmonitor->filename, filename);
 
-	/* Setup the actual spy before creating our thread */
+	if ((mixmonitor->ext = strrchr(mixmonitor->filename, '.')))
+		*(mixmonitor->ext++) = '\0';
+	else
+		mixmonitor->ext = "raw";
+
+	/* Signed linear is what would be kept anyway */
+	if (!strcasecmp(mixmonitor->ext, "sln") || !strcasecmp(mixmonitor->ext, "raw"))
+		ast_clear_flag(mixmonitor, MUXFLAG_DEFER);
+
+	/* Setup the actual spy before handing it to the workers */
 	if (ast_audiohook_init(&mixmonitor->audiohook, AST_AUDIOHOOK_TYPE_SPY, mixmonitor_spy_type)) {
 		free(mixmonitor);
 		return;
 	}
 	
 	ast_set_flag(&mixmonitor->audiohook, AST_AUDIOHOOK_TRIGGER_SYNC);
+	mixmonitor->audiohook.trigger_callback = mixmonitor_trigger;
 	
 	if (readvol)
 		mixmonitor->audiohook.options.read_volume = readvol;
 	if (writevol)
 		mixmonitor->audiohook.options.write_volume = writevol;
 
+	/* It must be on the list before the channel can trigger it */
+	AST_LIST_LOCK(&recordings);
+	AST_LIST_INSERT_TAIL(&recordings, mixmonitor, list);
+	AST_LIST_UNLOCK(&recordings);
+
 	if (startmon(chan, &mixmonitor->audiohook)) {
 		ast_log(LOG_WARNING, "Unable to add '%s' spy to channel '%s'\n",
 			mixmonitor_spy_type, chan->name);
 		/* Since we couldn't add ourselves - bail out! */
+		AST_LIST_LOCK(&recordings);
+		AST_LIST_REMOVE(&recordings, mixmonitor, list);
+		AST_LIST_UNLOCK(&recordings);
 		ast_audiohook_destroy(&mixmonitor->audiohook);
 		free(mixmonitor);
 		return;
 	}
 
-	pthread_attr_init(&attr);
-	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-	ast_pthread_create_background(&thread, &attr, mixmonitor_thread, mixmonitor);
-	pthread_attr_destroy(&attr);
-
+	if (option_verbose > 1)
+		ast_verbose(VERBOSE_PREFIX_2 "Begin MixMonitor Recording %s\n", mixmonitor->name);
 }
 
 static int mixmonitor_exec(struct ast_channel *chan, void *data)
@@ -421,7 +607,24 @@ static struct ast_cli_entry cli_mixmonitor[] = {
 
 static int unload_module(void)
 {
-	int res;
+	int res, i;
+
+	/* The workers can't be stopped while they have calls to record */
+	AST_LIST_LOCK(&recordings);
+	if (!AST_LIST_EMPTY(&recordings)) {
+		AST_LIST_UNLOCK(&recordings);
+		ast_log(LOG_WARNING, "Calls are still being recorded, not unloading\n");
+		return -1;
+	}
+	shutting_down = 1;
+	ast_cond_broadcast(&ready_cond);
+	AST_LIST_UNLOCK(&recordings);
+
+	for (i = 0; i < MIXMONITOR_WORKERS; i++) {
+		if (workers[i] != AST_PTHREADT_NULL)
+			pthread_join(workers[i], NULL);
+	}
+	ast_cond_destroy(&ready_cond);
 
 	ast_cli_unregister_multiple(cli_mixmonitor, sizeof(cli_mixmonitor) / sizeof(struct ast_cli_entry));
 	res = ast_unregister_application(stop_app);
@@ -434,7 +637,15 @@ static int unload_module(void)
 
 static int load_module(void)
 {
-	int res;
+	int res, i;
+
+	ast_cond_init(&ready_cond, NULL);
+	for (i = 0; i < MIXMONITOR_WORKERS; i++) {
+		if (ast_pthread_create_background(&workers[i], NULL, mixmonitor_worker, NULL)) {
+			ast_log(LOG_WARNING, "Unable to start a MixMonitor worker\n");
+			workers[i] = AST_PTHREADT_NULL;
+		}
+	}
 
 	ast_cli_register_multiple(cli_mixmonitor, sizeof(cli_mixmonitor) / sizeof(struct ast_cli_entry));
 	res = ast_register_application(app, mixmonitor_exec, synopsis, desc);
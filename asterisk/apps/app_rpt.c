@@ -497,6 +497,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 
 #include <signal.h>
 #include <stdio.h>
+#include <stddef.h>
 #include <unistd.h>
 #include <string.h>
 #include <stdlib.h>
@@ -538,6 +539,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include "asterisk/astdb.h"
 #include "asterisk/app.h"
 #include "asterisk/indications.h"
+#include "asterisk/dsp.h"
 #include <termios.h>
 
 #ifdef	NEW_ASTERISK
@@ -738,6 +740,8 @@ LOCAL_USER_DECL;
 #define	IDTIME 300000
 #define	MAXRPTS 500
 #define MAX_STAT_LINKS 32
+#define RPT_SNAPSHOT_TIME 250	/* ms between status snapshot refreshes */
+#define RPT_SNAPSHOT_STALE 2000	/* ms before readers stop trusting a snapshot */
 #define POLITEID 30000
 #define FUNCTDELAY 1500
 
@@ -820,6 +824,9 @@ struct rpt_link
 	long long connecttime;
 	struct ast_channel *chan;	
 	struct ast_channel *pchan;	
+	char	peer[MAXPEERSTR];		/* cached ${IAXPEER()} of chan */
+	struct ast_channel *peerchan;
+	int	peerreconnects;
 	char	linklist[MAXLINKLIST];
 	time_t	linklistreceived;
 	long	linklisttimer;
@@ -865,6 +872,72 @@ struct rpt_lstat
 	struct	rpt_chan_stat chan_stat[NRPTSTAT];
 } ;
 
+
+/*
+ * Status snapshot published by the rpt thread. It holds everything that
+ * the stats, lstats and xnode CLI commands and the RptStatus manager actions
+ * report, so they can be answered without taking myrpt->lock. Snapshots are
+ * never modified once published; readers hold a reference while formatting.
+ * The version only moves when something other than a running timer changed.
+ * XStat still lists the rx channel variables live, so a hash of them is kept
+ * to move the version when they change.
+ */
+
+struct rpt_snap_link
+{
+	char	name[MAXNODESTR];
+	char	peer[MAXPEERSTR];
+	char	mode;
+	char	outbound;
+	char	thisconnected;
+	char	lastrx1;
+	int	reconnects;
+	time_t	lastkeytime;
+	time_t	lastunkeytime;
+	/* running timers from here on, not part of the version */
+	long long	connecttime;
+} ;
+
+struct rpt_snap_state
+{
+	int	sysstate_cur;
+	char	keyed;
+	char	txkeyed;
+	char	parrotmode;
+	char	txdisable;
+	char	totdisable;
+	char	linkfundisable;
+	char	autopatchdisable;
+	char	schedulerdisable;
+	char	userfundisable;
+	char	alternatetail;
+	char	noincomingconns;
+	char	totstate;		/* index into rpt_totstates[] */
+	char	iderstate;		/* index into rpt_iderstates[] */
+	char	patchstate;		/* index into rpt_patchstates[] */
+	char	telmode;		/* 0 local, 1 global, 2 timed, 3 not dynamic */
+	char	reversepatch;		/* a '0' (phone/iaxrpt) link is up */
+	int	timeouts;
+	int	dailykerchunks,totalkerchunks,dailykeyups,totalkeyups;
+	int	dailyexecdcommands,totalexecdcommands;
+	unsigned int	varshash;	/* rx channel variables */
+	char	exten[AST_MAX_EXTENSION];
+	char	lastdtmfcommand[MAXDTMF];
+	char	linkednodes[MAXLINKLIST * 2];	/* sorted, ", " separated */
+} ;
+
+struct rpt_snapshot
+{
+	int	refcount;
+	unsigned int version;
+	struct timeval built;
+	struct rpt_snap_state st;
+	int	dailytxtime;
+	long long totaltxtime;
+	int	nlinks;
+	struct	rpt_snap_link links[0];
+} ;
+
 struct rpt_tele
 {
 	struct rpt_tele *next;
@@ -985,25 +1058,12 @@ struct rpt_cmd_struct
     int command_source;
 };
 
-typedef struct {
-	int v2;
-	int v3;
-	int chunky;
-	int fac;
-	int samples;
-} goertzel_state_t;
-
-typedef struct {
-	int value;
-	int power;
-} goertzel_result_t;
-
 typedef struct
 {
 	int freq;
 	int block_size;
 	int squelch;		/* Remove (squelch) tone */
-	goertzel_state_t tone;
+	struct ast_goertzel tone;
 	float energy;		/* Accumulated energy of the current block */
 	int samples_pending;	/* Samples remain to complete the current block */
 	int mute_samples;	/* How many additional samples needs to be muted to suppress already detected tone */
@@ -1021,6 +1081,10 @@ static struct rpt
 	ast_mutex_t lock;
 	ast_mutex_t remlock;
 	ast_mutex_t statpost_lock;
+	ast_mutex_t snaplock;
+	struct rpt_snapshot *snap;	/* protected by snaplock */
+	unsigned int snapversion;
+	int snaptimer;
 	struct ast_config *cfg;
 	char reload;
 	char reload1;
@@ -1202,6 +1266,7 @@ static struct rpt
 	struct ast_channel *pchannel,*txpchannel, *zaprxchannel, *zaptxchannel;
 	struct ast_channel *voxchannel;
 	struct ast_frame *lastf1,*lastf2;
+	struct timeval confingress,confwritten;	/* latency tracing: voice last put into the conference */
 	struct rpt_tele tele;
 	struct timeval lasttv,curtv;
 	pthread_t rpt_call_thread,rpt_thread;
@@ -2003,54 +2068,6 @@ static struct telem_defaults tele_defs[] = {
 	{"pfxtone","|t(350,440,30000,3072)"}
 } ;
 
-static inline void goertzel_sample(goertzel_state_t *s, short sample)
-{
-	int v1;
-	
-	v1 = s->v2;
-	s->v2 = s->v3;
-	
-	s->v3 = (s->fac * s->v2) >> 15;
-	s->v3 = s->v3 - v1 + (sample >> s->chunky);
-	if (abs(s->v3) > 32768) {
-		s->chunky++;
-		s->v3 = s->v3 >> 1;
-		s->v2 = s->v2 >> 1;
-		v1 = v1 >> 1;
-	}
-}
-
-static inline void goertzel_update(goertzel_state_t *s, short *samps, int count)
-{
-	int i;
-	
-	for (i = 0; i < count; i++) {
-		goertzel_sample(s, samps[i]);
-	}
-}
-
-
-static inline float goertzel_result(goertzel_state_t *s)
-{
-	goertzel_result_t r;
-	r.value = (s->v3 * s->v3) + (s->v2 * s->v2);
-	r.value -= ((s->v2 * s->v3) >> 15) * s->fac;
-	r.power = s->chunky * 2;
-	return (float)r.value * (float)(1 << r.power);
-}
-
-static inline void goertzel_init(goertzel_state_t *s, float freq, int samples)
-{
-	s->v2 = s->v3 = s->chunky = 0.0;
-	s->fac = (int)(32768.0 * 2.0 * cos(2.0 * M_PI * freq / TONE_SAMPLE_RATE));
-	s->samples = samples;
-}
-
-static inline void goertzel_reset(goertzel_state_t *s)
-{
-	s->v2 = s->v3 = s->chunky = 0.0;
-}
-
 static void tone_detect_init(tone_detect_state_t *s, int freq, int duration, int amp)
 {
 	int duration_samples;
@@ -2088,7 +2105,7 @@ static void tone_detect_init(tone_detect_state_t *s, int freq, int duration, int
 	   and thus no tone will be detected in them */
 	s->hits_required = (duration_samples - (s->block_size - 1)) / s->block_size;
 
-	goertzel_init(&s->tone, freq, s->block_size);
+	ast_goertzel_init(&s->tone, freq);
 
 	s->samples_pending = s->block_size;
 	s->hit_count = 0;
@@ -2115,11 +2132,10 @@ static void tone_detect_init(tone_detect_state_t *s, int freq, int duration, int
 static int tone_detect(tone_detect_state_t *s, int16_t *amp, int samples)
 {
 	float tone_energy;
-	int i;
+	struct ast_goertzel *bank[1] = { &s->tone };
 	int hit = 0;
 	int limit;
 	int res = 0;
-	int16_t *ptr;
 	int start, end;
 
 	for (start = 0;  start < samples;  start = end) {
@@ -2130,12 +2146,7 @@ static int tone_detect(tone_detect_state_t *s, int16_t *amp, int samples)
 		}
 		end = start + limit;
 
-		for (i = limit, ptr = amp ; i > 0; i--, ptr++) {
-			/* signed 32 bit int should be enough to suqare any possible signed 16 bit value */
-			s->energy += (int32_t) *ptr * (int32_t) *ptr;
-
-			goertzel_sample(&s->tone, *ptr);
-		}
+		ast_goertzel_update(bank, 1, amp, limit, &s->energy);
 
 		s->samples_pending -= limit;
 
@@ -2144,7 +2155,7 @@ static int tone_detect(tone_detect_state_t *s, int16_t *amp, int samples)
 			break;
 		}
 
-		tone_energy = goertzel_result(&s->tone);
+		tone_energy = ast_goertzel_result(&s->tone);
 
 		/* Scale to make comparable */
 		tone_energy *= 2.0;
@@ -2180,7 +2191,7 @@ static int tone_detect(tone_detect_state_t *s, int16_t *amp, int samples)
 
 		/* Reinitialise the detector for the next block */
 		/* Reset for the next block */
-		goertzel_reset(&s->tone);
+		ast_goertzel_reset(&s->tone);
 
 		/* Advance to the next block */
 		s->energy = 0.0;
@@ -4149,6 +4160,32 @@ int	src;
 	return;
 }
 
+/*
+ * The conference mixes audio in and out of the kernel, so what comes out of it
+ * no longer knows when its audio came into Asterisk.  While latency tracing,
+ * note that about the voice last written into it, and give that to what is
+ * read out again shortly after.
+ */
+static void rpt_conf_in(struct rpt *myrpt,struct ast_frame *f)
+{
+	if (!ast_latency_tracing) return;
+	if (f->frametype != AST_FRAME_VOICE) return;
+	if (ast_tvzero(f->ingress)) return;
+	myrpt->confingress = f->ingress;
+	myrpt->confwritten = ast_tvnow();
+}
+
+static void rpt_conf_out(struct rpt *myrpt,struct ast_frame *f)
+{
+	if (!ast_latency_tracing) return;
+	if (f->frametype != AST_FRAME_VOICE) return;
+	if (ast_tvzero(myrpt->confingress)) return;
+	/* nothing has gone in lately; this is tones or silence */
+	if (ast_tvdiff_ms(ast_tvnow(),myrpt->confwritten) > 100) return;
+	f->ingress = myrpt->confingress;
+	ast_latency_mark(f,AST_LATENCY_CONFERENCE,"rpt");
+}
+
 static int altlink(struct rpt *myrpt,struct rpt_link *mylink)
 {
 	if (!myrpt) return(0);
@@ -5776,6 +5813,189 @@ struct rpt_topkey *y = (struct rpt_topkey *) b;
 	return(x->timesince - y->timesince);
 }
 
+
+static char *rpt_totstates[] = {"TIMED OUT!","ARMED","RESET"};
+static char *rpt_iderstates[] = {"QUEUED IN TAIL","QUEUED FOR CLEANUP","CLEAN"};
+static char *rpt_patchstates[] = {"DIALING","CONNECTING","UP","CALL FAILED","DOWN"};
+
+static void rpt_snapshot_release(struct rpt_snapshot *snap)
+{
+	if (snap && ast_atomic_dec_and_test(&snap->refcount))
+		ast_free(snap);
+}
+
+/* must be called locked */
+static unsigned int rpt_snapshot_varshash(struct rpt *myrpt)
+{
+struct ast_var_t *newvariable;
+unsigned int hash = 0;
+
+	if (!myrpt->rxchannel) return 0;
+	ast_channel_lock(myrpt->rxchannel);
+	AST_LIST_TRAVERSE (&myrpt->rxchannel->varshead, newvariable, entries) {
+		hash = hash * 31 + ast_str_hash(ast_var_name(newvariable));
+		hash = hash * 31 + ast_str_hash(ast_var_value(newvariable));
+	}
+	ast_channel_unlock(myrpt->rxchannel);
+	return hash;
+}
+
+/* must be called locked */
+static struct rpt_snapshot *rpt_snapshot_build(struct rpt *myrpt)
+{
+struct rpt_snapshot *snap;
+struct rpt_snap_link *sl;
+struct rpt_link *l;
+char lbuf[MAXLINKLIST],*strs[MAXLINKLIST];
+int i,n,ns,pos;
+
+	n = 0;
+	for(l = myrpt->links.next; l && (l != &myrpt->links); l = l->next) n++;
+	snap = ast_calloc(1,sizeof(struct rpt_snapshot) + n * sizeof(struct rpt_snap_link));
+	if (!snap) return NULL;
+	snap->refcount = 1;
+	snap->built = ast_tvnow();
+	snap->st.sysstate_cur = myrpt->p.sysstate_cur;
+	snap->st.keyed = myrpt->keyed;
+	snap->st.txkeyed = myrpt->txkeyed;
+	snap->st.parrotmode = myrpt->p.parrotmode;
+	snap->st.txdisable = myrpt->p.s[myrpt->p.sysstate_cur].txdisable;
+	snap->st.totdisable = myrpt->p.s[myrpt->p.sysstate_cur].totdisable;
+	snap->st.linkfundisable = myrpt->p.s[myrpt->p.sysstate_cur].linkfundisable;
+	snap->st.autopatchdisable = myrpt->p.s[myrpt->p.sysstate_cur].autopatchdisable;
+	snap->st.schedulerdisable = myrpt->p.s[myrpt->p.sysstate_cur].schedulerdisable;
+	snap->st.userfundisable = myrpt->p.s[myrpt->p.sysstate_cur].userfundisable;
+	snap->st.alternatetail = myrpt->p.s[myrpt->p.sysstate_cur].alternatetail;
+	snap->st.noincomingconns = myrpt->p.s[myrpt->p.sysstate_cur].noincomingconns;
+	if (!myrpt->totimer) snap->st.totstate = 0;
+	else if (myrpt->totimer != myrpt->p.totime) snap->st.totstate = 1;
+	else snap->st.totstate = 2;
+	if (myrpt->tailid) snap->st.iderstate = 0;
+	else if (myrpt->mustid) snap->st.iderstate = 1;
+	else snap->st.iderstate = 2;
+	if ((myrpt->callmode >= 1) && (myrpt->callmode <= 4))
+		snap->st.patchstate = myrpt->callmode - 1;
+	else
+		snap->st.patchstate = 4;
+	if (myrpt->p.telemdynamic)
+	{
+		if (myrpt->telemmode == 0x7fffffff) snap->st.telmode = 1;
+		else if (myrpt->telemmode == 0x00) snap->st.telmode = 0;
+		else snap->st.telmode = 2;
+	}
+	else snap->st.telmode = 3;
+	snap->st.timeouts = myrpt->timeouts;
+	snap->st.dailykerchunks = myrpt->dailykerchunks;
+	snap->st.totalkerchunks = myrpt->totalkerchunks;
+	snap->st.dailykeyups = myrpt->dailykeyups;
+	snap->st.totalkeyups = myrpt->totalkeyups;
+	snap->st.dailyexecdcommands = myrpt->dailyexecdcommands;
+	snap->st.totalexecdcommands = myrpt->totalexecdcommands;
+	snap->st.varshash = rpt_snapshot_varshash(myrpt);
+	ast_copy_string(snap->st.exten,myrpt->exten,sizeof(snap->st.exten));
+	ast_copy_string(snap->st.lastdtmfcommand,myrpt->lastdtmfcommand,sizeof(snap->st.lastdtmfcommand));
+	snap->dailytxtime = myrpt->dailytxtime;
+	snap->totaltxtime = myrpt->totaltxtime;
+	for(l = myrpt->links.next; l && (l != &myrpt->links); l = l->next)
+	{
+		if (l->name[0] == '0') /* phone or iaxrpt connection */
+		{
+			snap->st.reversepatch = 1;
+			continue;
+		}
+		sl = &snap->links[snap->nlinks++];
+		ast_copy_string(sl->name,l->name,sizeof(sl->name));
+		if (l->chan)
+		{
+			/* the peer of a link channel never changes, only look it up once */
+			if ((l->peerchan != l->chan) || (l->peerreconnects != l->reconnects))
+			{
+				l->peer[0] = 0;
+				pbx_substitute_variables_helper(l->chan, "${IAXPEER(CURRENTCHANNEL)}", l->peer, MAXPEERSTR - 1);
+				l->peerchan = l->chan;
+				l->peerreconnects = l->reconnects;
+			}
+			ast_copy_string(sl->peer,l->peer,sizeof(sl->peer));
+		}
+		else strcpy(sl->peer,"(none)");
+		sl->mode = l->mode;
+		sl->outbound = l->outbound;
+		sl->thisconnected = l->thisconnected;
+		sl->lastrx1 = l->lastrx1;
+		sl->reconnects = l->reconnects;
+		sl->lastkeytime = l->lastkeytime;
+		sl->lastunkeytime = l->lastunkeytime;
+		sl->connecttime = l->connecttime;
+	}
+	__mklinklist(myrpt,NULL,lbuf,0);
+	ns = finddelim(lbuf,strs,MAXLINKLIST);
+	if (ns) qsort((void *)strs,ns,sizeof(char *),mycompar);
+	pos = 0;
+	for(i = 0; (i < ns) && (pos < sizeof(snap->st.linkednodes)); i++)
+	{
+		pos += snprintf(snap->st.linkednodes + pos,sizeof(snap->st.linkednodes) - pos,
+			"%s%s",(i) ? ", " : "",strs[i]);
+	}
+	return snap;
+}
+
+/* must be called locked */
+static void rpt_snapshot_publish(struct rpt *myrpt)
+{
+struct rpt_snapshot *snap,*old;
+int	i;
+
+	if (!(snap = rpt_snapshot_build(myrpt))) return;
+	ast_mutex_lock(&myrpt->snaplock);
+	old = myrpt->snap;
+	snap->version = (old) ? old->version : 0;
+	if ((!old) || (old->nlinks != snap->nlinks) ||
+	    memcmp(&old->st,&snap->st,sizeof(snap->st)))
+		snap->version = ++myrpt->snapversion;
+	else
+	{
+		for(i = 0; i < snap->nlinks; i++)
+		{
+			if (memcmp(&old->links[i],&snap->links[i],
+			    offsetof(struct rpt_snap_link,connecttime))) break;
+		}
+		if (i < snap->nlinks) snap->version = ++myrpt->snapversion;
+	}
+	myrpt->snap = snap;
+	ast_mutex_unlock(&myrpt->snaplock);
+	rpt_snapshot_release(old);
+}
+
+/*
+ * Get a reference to the current snapshot of a node. If the rpt thread
+ * is not publishing (remote bases, thread restarting) build one on the spot.
+ */
+static struct rpt_snapshot *rpt_snapshot_get(struct rpt *myrpt)
+{
+struct rpt_snapshot *snap;
+
+	ast_mutex_lock(&myrpt->snaplock);
+	snap = myrpt->snap;
+	if (snap && (ast_tvdiff_ms(ast_tvnow(),snap->built) > RPT_SNAPSHOT_STALE))
+		snap = NULL;
+	if (snap) ast_atomic_fetchadd_int(&snap->refcount,1);
+	ast_mutex_unlock(&myrpt->snaplock);
+	if (snap) return snap;
+	rpt_mutex_lock(&myrpt->lock);
+	snap = rpt_snapshot_build(myrpt);
+	rpt_mutex_unlock(&myrpt->lock);
+	return snap;
+}
+
+/*
+ * Links in the order the lstats/xnode reports have always listed them in
+ * (first link, then the rest newest first)
+ */
+static struct rpt_snap_link *rpt_snapshot_link(struct rpt_snapshot *snap, int n)
+{
+	return(&snap->links[(n) ? snap->nlinks - n : 0]);
+}
+
 #ifdef	__RPT_NOTCH
 
 /* rpt filter routine */
@@ -6560,187 +6780,51 @@ static int rpt_do_dump(int fd, int argc, char *argv[])
 
 static int rpt_do_stats(int fd, int argc, char *argv[])
 {
-	int i,j,numoflinks;
-	int dailytxtime, dailykerchunks;
+	int i,j;
+	int dailytxtime;
 	time_t now;
-	int totalkerchunks, dailykeyups, totalkeyups, timeouts;
-	int totalexecdcommands, dailyexecdcommands, hours, minutes, seconds;
+	int hours, minutes, seconds;
 	int uptime;
 	long long totaltxtime;
-	struct	rpt_link *l;
-	char *listoflinks[MAX_STAT_LINKS];	
-	char *lastdtmfcommand,*parrot_ena;
-	char *tot_state, *ider_state, *patch_state;
-	char *reverse_patch_state, *sys_ena, *tot_ena, *link_ena, *patch_ena;
-	char *sch_ena, *input_signal, *called_number, *user_funs, *tail_type;
-	char *iconns;
 	struct rpt *myrpt;
+	struct rpt_snapshot *snap;
 
 	static char *not_applicable = "N/A";
 
 	if(argc != 3)
 		return RESULT_SHOWUSAGE;
 
-	tot_state = ider_state = 
-	patch_state = reverse_patch_state = 
-	input_signal = not_applicable;
-	called_number = lastdtmfcommand = NULL;
-
 	time(&now);
 	for(i = 0; i < nrpts; i++)
 	{
 		if (!strcmp(argv[2],rpt_vars[i].name)){
-			/* Make a copy of all stat variables while locked */
 			myrpt = &rpt_vars[i];
-			rpt_mutex_lock(&myrpt->lock); /* LOCK */
+			if (!(snap = rpt_snapshot_get(myrpt)))
+				return RESULT_FAILURE;
 			uptime = (int)(now - starttime);
-			dailytxtime = myrpt->dailytxtime;
-			totaltxtime = myrpt->totaltxtime;
-			dailykeyups = myrpt->dailykeyups;
-			totalkeyups = myrpt->totalkeyups;
-			dailykerchunks = myrpt->dailykerchunks;
-			totalkerchunks = myrpt->totalkerchunks;
-			dailyexecdcommands = myrpt->dailyexecdcommands;
-			totalexecdcommands = myrpt->totalexecdcommands;
-			timeouts = myrpt->timeouts;
-
-			/* Traverse the list of connected nodes */
-			reverse_patch_state = "DOWN";
-			numoflinks = 0;
-			l = myrpt->links.next;
-			while(l && (l != &myrpt->links)){
-				if(numoflinks >= MAX_STAT_LINKS){
-					ast_log(LOG_NOTICE,
-					"maximum number of links exceeds %d in rpt_do_stats()!",MAX_STAT_LINKS);
-					break;
-				}
-				if (l->name[0] == '0'){ /* Skip '0' nodes */
-					reverse_patch_state = "UP";
-					l = l->next;
-					continue;
-				}
-				listoflinks[numoflinks] = ast_strdup(l->name);
-				if(listoflinks[numoflinks] == NULL){
-					break;
-				}
-				else{
-					numoflinks++;
-				}
-				l = l->next;
-			}
-
-			if(myrpt->keyed)
-				input_signal = "YES";
-			else
-				input_signal = "NO";
-
-			if(myrpt->p.parrotmode)
-				parrot_ena = "ENABLED";
-			else
-				parrot_ena = "DISABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].txdisable)
-				sys_ena = "DISABLED";
-			else
-				sys_ena = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].totdisable)
-				tot_ena = "DISABLED";
-			else
-				tot_ena = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].linkfundisable)
-				link_ena = "DISABLED";
-			else
-				link_ena = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].autopatchdisable)
-				patch_ena = "DISABLED";
-			else
-				patch_ena = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].schedulerdisable)
-				sch_ena = "DISABLED";
-			else
-				sch_ena = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].userfundisable)
-				user_funs = "DISABLED";
-			else
-				user_funs = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].alternatetail)
-				tail_type = "ALTERNATE";
-			else
-				tail_type = "STANDARD";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].noincomingconns)
-				iconns = "DISABLED";
-			else
-				iconns = "ENABLED";
-
-			if(!myrpt->totimer)
-				tot_state = "TIMED OUT!";
-			else if(myrpt->totimer != myrpt->p.totime)
-				tot_state = "ARMED";
-			else
-				tot_state = "RESET";
-
-			if(myrpt->tailid)
-				ider_state = "QUEUED IN TAIL";
-			else if(myrpt->mustid)
-				ider_state = "QUEUED FOR CLEANUP";
-			else
-				ider_state = "CLEAN";
-
-			switch(myrpt->callmode){
-				case 1:
-					patch_state = "DIALING";
-					break;
-				case 2:
-					patch_state = "CONNECTING";
-					break;
-				case 3:
-					patch_state = "UP";
-					break;
-
-				case 4:
-					patch_state = "CALL FAILED";
-					break;
-
-				default:
-					patch_state = "DOWN";
-			}
-
-			if(strlen(myrpt->exten)){
-				called_number = ast_strdup(myrpt->exten);
-			}
-
-			if(strlen(myrpt->lastdtmfcommand)){
-				lastdtmfcommand = ast_strdup(myrpt->lastdtmfcommand);
-			}
-			rpt_mutex_unlock(&myrpt->lock); /* UNLOCK */
+			dailytxtime = snap->dailytxtime;
+			totaltxtime = snap->totaltxtime;
 
 			ast_cli(fd, "************************ NODE %s STATISTICS *************************\n\n", myrpt->name);
-			ast_cli(fd, "Selected system state............................: %d\n", myrpt->p.sysstate_cur);
-			ast_cli(fd, "Signal on input..................................: %s\n", input_signal);
-			ast_cli(fd, "System...........................................: %s\n", sys_ena);
-			ast_cli(fd, "Parrot Mode......................................: %s\n", parrot_ena);
-			ast_cli(fd, "Scheduler........................................: %s\n", sch_ena);
-			ast_cli(fd, "Tail Time........................................: %s\n", tail_type);
-			ast_cli(fd, "Time out timer...................................: %s\n", tot_ena);
-			ast_cli(fd, "Incoming connections.............................: %s\n", iconns);
-			ast_cli(fd, "Time out timer state.............................: %s\n", tot_state);
-			ast_cli(fd, "Time outs since system initialization............: %d\n", timeouts);
-			ast_cli(fd, "Identifier state.................................: %s\n", ider_state);
-			ast_cli(fd, "Kerchunks today..................................: %d\n", dailykerchunks);
-			ast_cli(fd, "Kerchunks since system initialization............: %d\n", totalkerchunks);
-			ast_cli(fd, "Keyups today.....................................: %d\n", dailykeyups);
-			ast_cli(fd, "Keyups since system initialization...............: %d\n", totalkeyups);
-			ast_cli(fd, "DTMF commands today..............................: %d\n", dailyexecdcommands);
-			ast_cli(fd, "DTMF commands since system initialization........: %d\n", totalexecdcommands);
+			ast_cli(fd, "Selected system state............................: %d\n", snap->st.sysstate_cur);
+			ast_cli(fd, "Signal on input..................................: %s\n", (snap->st.keyed) ? "YES" : "NO");
+			ast_cli(fd, "System...........................................: %s\n", (snap->st.txdisable) ? "DISABLED" : "ENABLED");
+			ast_cli(fd, "Parrot Mode......................................: %s\n", (snap->st.parrotmode) ? "ENABLED" : "DISABLED");
+			ast_cli(fd, "Scheduler........................................: %s\n", (snap->st.schedulerdisable) ? "DISABLED" : "ENABLED");
+			ast_cli(fd, "Tail Time........................................: %s\n", (snap->st.alternatetail) ? "ALTERNATE" : "STANDARD");
+			ast_cli(fd, "Time out timer...................................: %s\n", (snap->st.totdisable) ? "DISABLED" : "ENABLED");
+			ast_cli(fd, "Incoming connections.............................: %s\n", (snap->st.noincomingconns) ? "DISABLED" : "ENABLED");
+			ast_cli(fd, "Time out timer state.............................: %s\n", rpt_totstates[(int)snap->st.totstate]);
+			ast_cli(fd, "Time outs since system initialization............: %d\n", snap->st.timeouts);
+			ast_cli(fd, "Identifier state.................................: %s\n", rpt_iderstates[(int)snap->st.iderstate]);
+			ast_cli(fd, "Kerchunks today..................................: %d\n", snap->st.dailykerchunks);
+			ast_cli(fd, "Kerchunks since system initialization............: %d\n", snap->st.totalkerchunks);
+			ast_cli(fd, "Keyups today.....................................: %d\n", snap->st.dailykeyups);
+			ast_cli(fd, "Keyups since system initialization...............: %d\n", snap->st.totalkeyups);
+			ast_cli(fd, "DTMF commands today..............................: %d\n", snap->st.dailyexecdcommands);
+			ast_cli(fd, "DTMF commands since system initialization........: %d\n", snap->st.totalexecdcommands);
 			ast_cli(fd, "Last DTMF command executed.......................: %s\n", 
-			(lastdtmfcommand && strlen(lastdtmfcommand)) ? lastdtmfcommand : not_applicable);
+			(strlen(snap->st.lastdtmfcommand)) ? snap->st.lastdtmfcommand : not_applicable);
 			hours = dailytxtime/3600000;
 			dailytxtime %= 3600000;
 			minutes = dailytxtime/60000;
@@ -6770,41 +6854,33 @@ static int rpt_do_stats(int fd, int argc, char *argv[])
                                 hours, minutes, uptime);
 
 			ast_cli(fd, "Nodes currently connected to us..................: ");
-                        if(!numoflinks){
+                        if(!snap->nlinks){
   	                      ast_cli(fd,"<NONE>");
                         }
 			else{
-				for(j = 0 ;j < numoflinks; j++){
-					ast_cli(fd, "%s", listoflinks[j]);
+				for(j = 0 ;j < snap->nlinks; j++){
+					ast_cli(fd, "%s", snap->links[j].name);
 					if(j % 4 == 3){
 						ast_cli(fd, "\n");
 						ast_cli(fd, "                                                 : ");
 					}	
 					else{
-						if((numoflinks - 1) - j  > 0)
+						if((snap->nlinks - 1) - j  > 0)
 							ast_cli(fd, ", ");
 					}
 				}
 			}
 			ast_cli(fd,"\n");
 
-			ast_cli(fd, "Autopatch........................................: %s\n", patch_ena);
-			ast_cli(fd, "Autopatch state..................................: %s\n", patch_state);
+			ast_cli(fd, "Autopatch........................................: %s\n", (snap->st.autopatchdisable) ? "DISABLED" : "ENABLED");
+			ast_cli(fd, "Autopatch state..................................: %s\n", rpt_patchstates[(int)snap->st.patchstate]);
 			ast_cli(fd, "Autopatch called number..........................: %s\n",
-			(called_number && strlen(called_number)) ? called_number : not_applicable);
-			ast_cli(fd, "Reverse patch/IAXRPT connected...................: %s\n", reverse_patch_state);
-			ast_cli(fd, "User linking commands............................: %s\n", link_ena);
-			ast_cli(fd, "User functions...................................: %s\n\n", user_funs);
+			(strlen(snap->st.exten)) ? snap->st.exten : not_applicable);
+			ast_cli(fd, "Reverse patch/IAXRPT connected...................: %s\n", (snap->st.reversepatch) ? "UP" : "DOWN");
+			ast_cli(fd, "User linking commands............................: %s\n", (snap->st.linkfundisable) ? "DISABLED" : "ENABLED");
+			ast_cli(fd, "User functions...................................: %s\n\n", (snap->st.userfundisable) ? "DISABLED" : "ENABLED");
 
-			for(j = 0; j < numoflinks; j++){ /* ast_free() all link names */
-				ast_free(listoflinks[j]);
-			}
-			if(called_number){
-				ast_free(called_number);
-			}
-			if(lastdtmfcommand){
-				ast_free(lastdtmfcommand);
-			}
+			rpt_snapshot_release(snap);
 		        return RESULT_SUCCESS;
 		}
 	}
@@ -6820,57 +6896,26 @@ static int rpt_do_lstats(int fd, int argc, char *argv[])
 	int i,j;
 	char *connstate;
 	struct rpt *myrpt;
-	struct rpt_link *l;
-	struct rpt_lstat *s,*t;
-	struct rpt_lstat s_head;
+	struct rpt_snap_link *s;
+	struct rpt_snapshot *snap;
 	if(argc != 3)
 		return RESULT_SHOWUSAGE;
 
-	s = NULL;
-	s_head.next = &s_head;
-	s_head.prev = &s_head;
-
 	for(i = 0; i < nrpts; i++)
 	{
 		if (!strcmp(argv[2],rpt_vars[i].name)){
-			/* Make a copy of all stat variables while locked */
 			myrpt = &rpt_vars[i];
-			rpt_mutex_lock(&myrpt->lock); /* LOCK */
-			/* Traverse the list of connected nodes */
-			j = 0;
-			l = myrpt->links.next;
-			while(l && (l != &myrpt->links)){
-				if (l->name[0] == '0'){ /* Skip '0' nodes */
-					l = l->next;
-					continue;
-				}
-				if((s = (struct rpt_lstat *) ast_malloc(sizeof(struct rpt_lstat))) == NULL){
-					ast_log(LOG_ERROR, "Malloc failed in rpt_do_lstats\n");
-					rpt_mutex_unlock(&myrpt->lock); /* UNLOCK */
-					return RESULT_FAILURE;
-				}
-				memset(s, 0, sizeof(struct rpt_lstat));
-				strncpy(s->name, l->name, MAXREMSTR - 1);
-				if (l->chan) pbx_substitute_variables_helper(l->chan, "${IAXPEER(CURRENTCHANNEL)}", s->peer, MAXPEERSTR - 1);
-				else strcpy(s->peer,"(none)");
-				s->mode = l->mode;
-				s->outbound = l->outbound;
-				s->reconnects = l->reconnects;
-				s->connecttime = l->connecttime;
-				s->thisconnected = l->thisconnected;
-				memcpy(s->chan_stat,l->chan_stat,NRPTSTAT * sizeof(struct rpt_chan_stat));
-				insque((struct qelem *) s, (struct qelem *) s_head.next);
-				memset(l->chan_stat,0,NRPTSTAT * sizeof(struct rpt_chan_stat));
-				l = l->next;
-			}
-			rpt_mutex_unlock(&myrpt->lock); /* UNLOCK */
+			if (!(snap = rpt_snapshot_get(myrpt)))
+				return RESULT_FAILURE;
 			ast_cli(fd, "NODE      PEER                RECONNECTS  DIRECTION  CONNECT TIME        CONNECT STATE\n");
 			ast_cli(fd, "----      ----                ----------  ---------  ------------        -------------\n");
 
-			for(s = s_head.next; s != &s_head; s = s->next){
+			for(j = 0; j < snap->nlinks; j++){
 				int hours, minutes, seconds;
-				long long connecttime = s->connecttime;
+				long long connecttime;
 				char conntime[21];
+				s = rpt_snapshot_link(snap,j);
+				connecttime = s->connecttime;
 				hours = (int) connecttime/3600000;
 				connecttime %= 3600000;
 				minutes = (int) connecttime/60000;
@@ -6887,14 +6932,7 @@ static int rpt_do_lstats(int fd, int argc, char *argv[])
 				ast_cli(fd, "%-10s%-20s%-12d%-11s%-20s%-20s\n",
 					s->name, s->peer, s->reconnects, (s->outbound)? "OUT":"IN", conntime, connstate);
 			}	
-			/* destroy our local link queue */
-			s = s_head.next;
-			while(s != &s_head){
-				t = s;
-				s = s->next;
-				remque((struct qelem *)t);
-				ast_free(t);
-			}			
+			rpt_snapshot_release(snap);
 			return RESULT_SUCCESS;
 		}
 	}
@@ -6904,163 +6942,30 @@ static int rpt_do_lstats(int fd, int argc, char *argv[])
 static int rpt_do_xnode(int fd, int argc, char *argv[])
 {
 	int i,j;
-	char ns;
-	char lbuf[MAXLINKLIST],*strs[MAXLINKLIST];
 	struct rpt *myrpt;
 	struct ast_var_t *newvariable;
 	char *connstate;
-	struct rpt_link *l;
-	struct rpt_lstat *s,*t;
-	struct rpt_lstat s_head;
+	struct rpt_snap_link *s;
+	struct rpt_snapshot *snap;
+	static char *patch_states[] = {"0","1","2","3","4"};
+	static char *tel_modes[] = {"0","1","2","3"};
 	if(argc != 3)
 		return RESULT_SHOWUSAGE;
 
-	s = NULL;
-	s_head.next = &s_head;
-	s_head.prev = &s_head;
-
-
-	char *parrot_ena, *sys_ena, *tot_ena, *link_ena, *patch_ena, *patch_state;
-	char *sch_ena, *user_funs, *tail_type, *iconns, *tot_state, *ider_state, *tel_mode; 
-
 	for(i = 0; i < nrpts; i++)
 	{
 		if (!strcmp(argv[2],rpt_vars[i].name)){
-			/* Make a copy of all stat variables while locked */
 			myrpt = &rpt_vars[i];
-			rpt_mutex_lock(&myrpt->lock); /* LOCK */
-
-//### GET RPT STATUS STATES WHILE LOCKED ########################
-			if(myrpt->p.parrotmode)
-				parrot_ena = "1";	//"ENABLED";
-			else
-				parrot_ena = "0";	//"DISABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].txdisable)
-				sys_ena = "0";	//"DISABLED";
-			else
-				sys_ena = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].totdisable)
-				tot_ena = "0";	//"DISABLED";
-			else
-				tot_ena = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].linkfundisable)
-				link_ena = "0";	//"DISABLED";
-			else
-				link_ena = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].autopatchdisable)
-				patch_ena = "0";	//"DISABLED";
-			else
-				patch_ena = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].schedulerdisable)
-				sch_ena = "0";	//"DISABLED";
-			else
-				sch_ena = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].userfundisable)
-				user_funs = "0";	//"DISABLED";
-			else
-				user_funs = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].alternatetail)
-				tail_type = "1";	//"ALTERNATE";
-			else
-				tail_type = "0";	//"STANDARD";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].noincomingconns)
-				iconns = "0";	//"DISABLED";
-			else
-				iconns = "1";	//"ENABLED";
-
-			if(!myrpt->totimer)
-				tot_state = "0";	//"TIMED OUT!";
-			else if(myrpt->totimer != myrpt->p.totime)
-				tot_state = "1";	//"ARMED";
-			else
-				tot_state = "2";	//"RESET";
-
-			if(myrpt->tailid)
-				ider_state = "0";	//"QUEUED IN TAIL";
-			else if(myrpt->mustid)
-				ider_state = "1";	//"QUEUED FOR CLEANUP";
-			else
-				ider_state = "2";	//"CLEAN";
+			if (!(snap = rpt_snapshot_get(myrpt)))
+				return RESULT_FAILURE;
 
-
-			switch(myrpt->callmode){
-				case 1:
-					patch_state = "0";		//"DIALING";
-					break;
-				case 2:
-					patch_state = "1";		//"CONNECTING";
-					break;
-				case 3:
-					patch_state = "2";		//"UP";
-					break;
-
-				case 4:
-					patch_state = "3";		//"CALL FAILED";
-					break;
-
-				default:
-					patch_state = "4";		//"DOWN";
-			}
-
-
-			if (myrpt->p.telemdynamic)
-			{
-				if(myrpt->telemmode == 0x7fffffff)
-					tel_mode = "1";
-				else if(myrpt->telemmode == 0x00)
-					tel_mode = "0";
-				else
-					tel_mode = "2";
-			}
-			else{
-				tel_mode= "3";
-			}
-
-
-//### GET CONNECTED NODE INFO ####################
-			// Traverse the list of connected nodes 
-
-			__mklinklist(myrpt,NULL,lbuf,0);
-
-			j = 0;
-			l = myrpt->links.next;
-			while(l && (l != &myrpt->links)){
-				if (l->name[0] == '0'){ // Skip '0' nodes 
-					l = l->next;
-					continue;
-				}
-				if((s = (struct rpt_lstat *) ast_malloc(sizeof(struct rpt_lstat))) == NULL){
-					ast_log(LOG_ERROR, "Malloc failed in rpt_do_lstats\n");
-					rpt_mutex_unlock(&myrpt->lock); // UNLOCK 
-					return RESULT_FAILURE;
-				}
-				memset(s, 0, sizeof(struct rpt_lstat));
-				strncpy(s->name, l->name, MAXREMSTR - 1);
-				if (l->chan) pbx_substitute_variables_helper(l->chan, "${IAXPEER(CURRENTCHANNEL)}", s->peer, MAXPEERSTR - 1);
-				else strcpy(s->peer,"(none)");
-				s->mode = l->mode;
-				s->outbound = l->outbound;
-				s->reconnects = l->reconnects;
-				s->connecttime = l->connecttime;
-				s->thisconnected = l->thisconnected;
-				memcpy(s->chan_stat,l->chan_stat,NRPTSTAT * sizeof(struct rpt_chan_stat));
-				insque((struct qelem *) s, (struct qelem *) s_head.next);
-				memset(l->chan_stat,0,NRPTSTAT * sizeof(struct rpt_chan_stat));
-				l = l->next;
-			}
-			rpt_mutex_unlock(&myrpt->lock); // UNLOCK 
-			for(s = s_head.next; s != &s_head; s = s->next){
+//### CONNECTED NODE INFO ####################
+			for(j = 0; j < snap->nlinks; j++){
 				int hours, minutes, seconds;
-				long long connecttime = s->connecttime;
+				long long connecttime;
 				char conntime[21];
+				s = rpt_snapshot_link(snap,j);
+				connecttime = s->connecttime;
 				hours = (int) connecttime/3600000;
 				connecttime %= 3600000;
 				minutes = (int) connecttime/60000;
@@ -7078,32 +6983,9 @@ static int rpt_do_xnode(int fd, int argc, char *argv[])
 					s->name, s->peer, s->reconnects, (s->outbound)? "OUT":"IN", conntime, connstate);
 			}	
 			ast_cli(fd,"\n\n");
-			// destroy our local link queue 
-			s = s_head.next;
-			while(s != &s_head){
-				t = s;
-				s = s->next;
-				remque((struct qelem *)t);
-				ast_free(t);
-			}	
-
-//### GET ALL LINKED NODES INFO ####################
-			/* parse em */
-			ns = finddelim(lbuf,strs,MAXLINKLIST);
-			/* sort em */
-			if (ns) qsort((void *)strs,ns,sizeof(char *),mycompar);
-			for(j = 0 ;; j++){
-				if(!strs[j]){
-					if(!j){
-						ast_cli(fd,"<NONE>");
-					}
-					break;
-				}
-				ast_cli(fd, "%s", strs[j]);
-				if(strs[j + 1])
-					ast_cli(fd, ", ");
 
-			}
+//### ALL LINKED NODES INFO ####################
+			ast_cli(fd, "%s", (snap->st.linkednodes[0]) ? snap->st.linkednodes : "<NONE>");
 			ast_cli(fd,"\n\n");
 
 //### GET VARIABLES INFO ####################
@@ -7117,20 +6999,21 @@ static int rpt_do_xnode(int fd, int argc, char *argv[])
 			ast_cli(fd,"\n");
 
 //### OUTPUT RPT STATUS STATES ##############
-			ast_cli(fd, "parrot_ena=%s\n", parrot_ena);
-			ast_cli(fd, "sys_ena=%s\n", sys_ena);
-			ast_cli(fd, "tot_ena=%s\n", tot_ena);
-			ast_cli(fd, "link_ena=%s\n", link_ena);
-			ast_cli(fd, "patch_ena=%s\n", patch_ena);
-			ast_cli(fd, "patch_state=%s\n", patch_state);
-			ast_cli(fd, "sch_ena=%s\n", sch_ena);
-			ast_cli(fd, "user_funs=%s\n", user_funs);
-			ast_cli(fd, "tail_type=%s\n", tail_type);
-			ast_cli(fd, "iconns=%s\n", iconns);
-			ast_cli(fd, "tot_state=%s\n", tot_state);
-			ast_cli(fd, "ider_state=%s\n", ider_state);
-			ast_cli(fd, "tel_mode=%s\n\n", tel_mode);
-
+			ast_cli(fd, "parrot_ena=%s\n", (snap->st.parrotmode) ? "1" : "0");
+			ast_cli(fd, "sys_ena=%s\n", (snap->st.txdisable) ? "0" : "1");
+			ast_cli(fd, "tot_ena=%s\n", (snap->st.totdisable) ? "0" : "1");
+			ast_cli(fd, "link_ena=%s\n", (snap->st.linkfundisable) ? "0" : "1");
+			ast_cli(fd, "patch_ena=%s\n", (snap->st.autopatchdisable) ? "0" : "1");
+			ast_cli(fd, "patch_state=%s\n", patch_states[(int)snap->st.patchstate]);
+			ast_cli(fd, "sch_ena=%s\n", (snap->st.schedulerdisable) ? "0" : "1");
+			ast_cli(fd, "user_funs=%s\n", (snap->st.userfundisable) ? "0" : "1");
+			ast_cli(fd, "tail_type=%s\n", (snap->st.alternatetail) ? "1" : "0");
+			ast_cli(fd, "iconns=%s\n", (snap->st.noincomingconns) ? "0" : "1");
+			ast_cli(fd, "tot_state=%d\n", snap->st.totstate);
+			ast_cli(fd, "ider_state=%d\n", snap->st.iderstate);
+			ast_cli(fd, "tel_mode=%s\n\n", tel_modes[(int)snap->st.telmode]);
+
+			rpt_snapshot_release(snap);
 			return RESULT_SUCCESS;
 		}
 	}
@@ -20384,6 +20267,11 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			myrpt->dailytxtime += elap;
 			myrpt->totaltxtime += elap;
 		}
+		if ((myrpt->snaptimer -= elap) <= 0)
+		{
+			myrpt->snaptimer = RPT_SNAPSHOT_TIME;
+			rpt_snapshot_publish(myrpt);
+		}
 		i = myrpt->tailtimer;
 		if (myrpt->tailtimer) myrpt->tailtimer -= elap;
 		if (myrpt->tailtimer < 0) myrpt->tailtimer = 0;
@@ -20523,7 +20411,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 					if ((!myrpt->reallykeyed) || myrpt->keyed)
 					{
 						myrpt->lastrxburst = 0;
-						goertzel_reset(&myrpt->burst_tone_state.tone);
+						ast_goertzel_reset(&myrpt->burst_tone_state.tone);
 						myrpt->burst_tone_state.last_hit = 0;
 						myrpt->burst_tone_state.hit_count = 0;
 						myrpt->burst_tone_state.energy = 0.0;
@@ -20686,6 +20574,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 				}
 				if (f1)
 				{
+					rpt_conf_in(myrpt,f1);
 					if (myrpt->localoverride)
 						ast_write(myrpt->txpchannel,f1);
 					else
@@ -21000,6 +20889,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 			}
 			if (f->frametype == AST_FRAME_VOICE)
 			{
+				rpt_conf_out(myrpt,f);
 				if (!myrpt->localoverride)
 				{
 					ast_write(myrpt->txpchannel,f);
@@ -21401,6 +21291,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 						}
 						if (f1)
 						{
+							rpt_conf_in(myrpt,f1);
 							ast_write(l->pchan,f1);
 							ast_frfree(f1);
 						}
@@ -21409,6 +21300,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 					{
 						if (!l->lastrx)
 							memset(AST_FRAME_DATAP(f),0,f->datalen);
+						rpt_conf_in(myrpt,f);
 						ast_write(l->pchan,f);
 					}
 				}
@@ -21613,6 +21505,7 @@ char tmpstr[300],lstr[MAXLINKLIST],lat[100],lon[100],elev[100];
 				{
 					float fac,fsamp;
 
+					rpt_conf_out(myrpt,f);
 					fac = 1.0;
 					if (l->chan && (!strncasecmp(l->chan->name,"echolink",8)))
 						fac = myrpt->p.etxgain;
@@ -21932,6 +21825,7 @@ char *this,*val;
 		ast_mutex_init(&rpt_vars[n].lock);
 		ast_mutex_init(&rpt_vars[n].remlock);
 		ast_mutex_init(&rpt_vars[n].statpost_lock);
+		ast_mutex_init(&rpt_vars[n].snaplock);
 		rpt_vars[n].tele.next = &rpt_vars[n].tele;
 		rpt_vars[n].tele.prev = &rpt_vars[n].tele;
 		rpt_vars[n].rpt_thread = AST_PTHREADT_NULL;
@@ -24121,10 +24015,31 @@ static void rpt_manager_success(struct mansession *s, const struct message *m)
 }
 
 
+/*
+ * Answer a conditional (IfChangedSince: <version>) status request whose
+ * snapshot has not changed. Returns 1 if the short response was sent.
+ */
+
+static int rpt_manager_unchanged(struct mansession *ses, const struct message *m, struct rpt_snapshot *snap)
+{
+	const char *since = astman_get_header(m, "IfChangedSince");
+
+	if (ast_strlen_zero(since) || (!snap->version) ||
+	    (strtoul(since,NULL,10) != snap->version))
+		return 0;
+	rpt_manager_success(ses,m);
+	astman_append(ses,"Node: %s\r\n",astman_get_header(m, "Node"));
+	astman_append(ses,"Version: %u\r\n",snap->version);
+	astman_append(ses,"Unchanged: YES\r\n\r\n");
+	return 1;
+}
+
+
 static int rpt_manager_do_sawstat(struct mansession *ses, const struct message *m, char *str)
 {
-	int i;
-	struct rpt_link *l;
+	int i,j;
+	struct rpt_snap_link *l;
+	struct rpt_snapshot *snap;
 	const char *node = astman_get_header(m, "Node");
 	time_t now;
 
@@ -24132,23 +24047,25 @@ static int rpt_manager_do_sawstat(struct mansession *ses, const struct message *
 	for(i = 0; i < nrpts; i++)
 	{
 		if ((node)&&(!strcmp(node,rpt_vars[i].name))){
+			if (!(snap = rpt_snapshot_get(&rpt_vars[i]))){
+				astman_send_error(ses, m, "RptStatus out of memory");
+				return 0;
+			}
+			if (rpt_manager_unchanged(ses,m,snap)){
+				rpt_snapshot_release(snap);
+				return 0;
+			}
 			rpt_manager_success(ses,m);
 			astman_append(ses,"Node: %s\r\n",node);
+			astman_append(ses,"Version: %u\r\n",snap->version);
 
-			rpt_mutex_lock(&rpt_vars[i].lock); /* LOCK */
-
-			l = rpt_vars[i].links.next;
-			while(l && (l != &rpt_vars[i].links)){
-				if (l->name[0] == '0'){ // Skip '0' nodes 
-					l = l->next;
-					continue;
-				}
+			for(j = 0; j < snap->nlinks; j++){
+				l = &snap->links[j];
 				astman_append(ses, "Conn: %s %d %d %d\r\n",l->name,l->lastrx1,
 					(l->lastkeytime) ? (int)(now - l->lastkeytime) : -1,
 					(l->lastunkeytime) ? (int)(now - l->lastunkeytime) : -1);
-				l = l->next;
 			}
-			rpt_mutex_unlock(&rpt_vars[i].lock); // UNLOCK 
+			rpt_snapshot_release(snap);
 			astman_append(ses, "\r\n");
 			return(0);
 		}
@@ -24161,165 +24078,38 @@ static int rpt_manager_do_sawstat(struct mansession *ses, const struct message *
 static int rpt_manager_do_xstat(struct mansession *ses, const struct message *m, char *str)
 {
 	int i,j;
-	char ns;
-	char lbuf[MAXLINKLIST],*strs[MAXLINKLIST];
 	struct rpt *myrpt;
 	struct ast_var_t *newvariable;
 	char *connstate;
-	struct rpt_link *l;
-	struct rpt_lstat *s,*t;
-	struct rpt_lstat s_head;
+	struct rpt_snap_link *s;
+	struct rpt_snapshot *snap;
 	const char *node = astman_get_header(m, "Node");
-
-	s = NULL;
-	s_head.next = &s_head;
-	s_head.prev = &s_head;
-
-
-	char *parrot_ena, *sys_ena, *tot_ena, *link_ena, *patch_ena, *patch_state;
-	char *sch_ena, *user_funs, *tail_type, *iconns, *tot_state, *ider_state, *tel_mode; 
+	static char *patch_states[] = {"0","1","2","3","4"};
+	static char *tel_modes[] = {"0","1","2","3"};
 
 	for(i = 0; i < nrpts; i++)
 	{
 		if ((node)&&(!strcmp(node,rpt_vars[i].name))){
-			rpt_manager_success(ses,m);
-			astman_append(ses,"Node: %s\r\n",node);
-
-			/* Make a copy of all stat variables while locked */
 			myrpt = &rpt_vars[i];
-			rpt_mutex_lock(&myrpt->lock); /* LOCK */
-
-//### GET RPT STATUS STATES WHILE LOCKED ########################
-			if(myrpt->p.parrotmode)
-				parrot_ena = "1";	//"ENABLED";
-			else
-				parrot_ena = "0";	//"DISABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].txdisable)
-				sys_ena = "0";	//"DISABLED";
-			else
-				sys_ena = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].totdisable)
-				tot_ena = "0";	//"DISABLED";
-			else
-				tot_ena = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].linkfundisable)
-				link_ena = "0";	//"DISABLED";
-			else
-				link_ena = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].autopatchdisable)
-				patch_ena = "0";	//"DISABLED";
-			else
-				patch_ena = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].schedulerdisable)
-				sch_ena = "0";	//"DISABLED";
-			else
-				sch_ena = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].userfundisable)
-				user_funs = "0";	//"DISABLED";
-			else
-				user_funs = "1";	//"ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].alternatetail)
-				tail_type = "1";	//"ALTERNATE";
-			else
-				tail_type = "0";	//"STANDARD";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].noincomingconns)
-				iconns = "0";	//"DISABLED";
-			else
-				iconns = "1";	//"ENABLED";
-
-			if(!myrpt->totimer)
-				tot_state = "0";	//"TIMED OUT!";
-			else if(myrpt->totimer != myrpt->p.totime)
-				tot_state = "1";	//"ARMED";
-			else
-				tot_state = "2";	//"RESET";
-
-			if(myrpt->tailid)
-				ider_state = "0";	//"QUEUED IN TAIL";
-			else if(myrpt->mustid)
-				ider_state = "1";	//"QUEUED FOR CLEANUP";
-			else
-				ider_state = "2";	//"CLEAN";
-
-
-			switch(myrpt->callmode){
-				case 1:
-					patch_state = "0";		//"DIALING";
-					break;
-				case 2:
-					patch_state = "1";		//"CONNECTING";
-					break;
-				case 3:
-					patch_state = "2";		//"UP";
-					break;
-
-				case 4:
-					patch_state = "3";		//"CALL FAILED";
-					break;
-
-				default:
-					patch_state = "4";		//"DOWN";
-			}
-
-
-			if (myrpt->p.telemdynamic)
-			{
-				if(myrpt->telemmode == 0x7fffffff)
-					tel_mode = "1";
-				else if(myrpt->telemmode == 0x00)
-					tel_mode = "0";
-				else
-					tel_mode = "2";
+			if (!(snap = rpt_snapshot_get(myrpt))){
+				astman_send_error(ses, m, "RptStatus out of memory");
+				return 0;
 			}
-			else{
-				tel_mode= "3";
+			if (rpt_manager_unchanged(ses,m,snap)){
+				rpt_snapshot_release(snap);
+				return 0;
 			}
+			rpt_manager_success(ses,m);
+			astman_append(ses,"Node: %s\r\n",node);
+			astman_append(ses,"Version: %u\r\n",snap->version);
 
-
-//### GET CONNECTED NODE INFO ####################
-			// Traverse the list of connected nodes 
-
-			__mklinklist(myrpt,NULL,lbuf,0);
-
-			j = 0;
-			l = myrpt->links.next;
-			while(l && (l != &myrpt->links)){
-				if (l->name[0] == '0'){ // Skip '0' nodes 
-					l = l->next;
-					continue;
-				}
-				if((s = (struct rpt_lstat *) ast_malloc(sizeof(struct rpt_lstat))) == NULL){
-					ast_log(LOG_ERROR, "Malloc failed in rpt_do_lstats\r\n");
-					rpt_mutex_unlock(&myrpt->lock); // UNLOCK 
-					return -1;
-				}
-				memset(s, 0, sizeof(struct rpt_lstat));
-				strncpy(s->name, l->name, MAXREMSTR - 1);
-				if (l->chan) pbx_substitute_variables_helper(l->chan, "${IAXPEER(CURRENTCHANNEL)}", s->peer, MAXPEERSTR - 1);
-				else strcpy(s->peer,"(none)");
-				s->mode = l->mode;
-				s->outbound = l->outbound;
-				s->reconnects = l->reconnects;
-				s->connecttime = l->connecttime;
-				s->thisconnected = l->thisconnected;
-				memcpy(s->chan_stat,l->chan_stat,NRPTSTAT * sizeof(struct rpt_chan_stat));
-				insque((struct qelem *) s, (struct qelem *) s_head.next);
-				memset(l->chan_stat,0,NRPTSTAT * sizeof(struct rpt_chan_stat));
-				l = l->next;
-			}
-			rpt_mutex_unlock(&myrpt->lock); // UNLOCK 
-			for(s = s_head.next; s != &s_head; s = s->next){
+//### CONNECTED NODE INFO ####################
+			for(j = 0; j < snap->nlinks; j++){
 				int hours, minutes, seconds;
-				long long connecttime = s->connecttime;
+				long long connecttime;
 				char conntime[21];
+				s = rpt_snapshot_link(snap,j);
+				connecttime = s->connecttime;
 				hours = (int) connecttime/3600000;
 				connecttime %= 3600000;
 				minutes = (int) connecttime/60000;
@@ -24336,34 +24126,10 @@ static int rpt_manager_do_xstat(struct mansession *ses, const struct message *m,
 				astman_append(ses, "Conn: %-10s%-20s%-12d%-11s%-20s%-20s\r\n",
 					s->name, s->peer, s->reconnects, (s->outbound)? "OUT":"IN", conntime, connstate);
 			}	
-			// destroy our local link queue 
-			s = s_head.next;
-			while(s != &s_head){
-				t = s;
-				s = s->next;
-				remque((struct qelem *)t);
-				ast_free(t);
-			}	
-
-			astman_append(ses,"LinkedNodes: ");
-//### GET ALL LINKED NODES INFO ####################
-			/* parse em */
-			ns = finddelim(lbuf,strs,MAXLINKLIST);
-			/* sort em */
-			if (ns) qsort((void *)strs,ns,sizeof(char *),mycompar);
-			for(j = 0 ;; j++){
-				if(!strs[j]){
-					if(!j){
-						astman_append(ses,"<NONE>");
-					}
-					break;
-				}
-				astman_append(ses, "%s", strs[j]);
-				if(strs[j + 1])
-					astman_append(ses, ", ");
 
-			}
-			astman_append(ses,"\r\n");
+//### ALL LINKED NODES INFO ####################
+			astman_append(ses,"LinkedNodes: %s\r\n",
+				(snap->st.linkednodes[0]) ? snap->st.linkednodes : "<NONE>");
 
 //### GET VARIABLES INFO ####################
 			j = 0;
@@ -24375,20 +24141,21 @@ static int rpt_manager_do_xstat(struct mansession *ses, const struct message *m,
 			ast_channel_unlock(rpt_vars[i].rxchannel);
 
 //### OUTPUT RPT STATUS STATES ##############
-			astman_append(ses, "parrot_ena: %s\r\n", parrot_ena);
-			astman_append(ses, "sys_ena: %s\r\n", sys_ena);
-			astman_append(ses, "tot_ena: %s\r\n", tot_ena);
-			astman_append(ses, "link_ena: %s\r\n", link_ena);
-			astman_append(ses, "patch_ena: %s\r\n", patch_ena);
-			astman_append(ses, "patch_state: %s\r\n", patch_state);
-			astman_append(ses, "sch_ena: %s\r\n", sch_ena);
-			astman_append(ses, "user_funs: %s\r\n", user_funs);
-			astman_append(ses, "tail_type: %s\r\n", tail_type);
-			astman_append(ses, "iconns: %s\r\n", iconns);
-			astman_append(ses, "tot_state: %s\r\n", tot_state);
-			astman_append(ses, "ider_state: %s\r\n", ider_state);
-			astman_append(ses, "tel_mode: %s\r\n\r\n", tel_mode);
-
+			astman_append(ses, "parrot_ena: %s\r\n", (snap->st.parrotmode) ? "1" : "0");
+			astman_append(ses, "sys_ena: %s\r\n", (snap->st.txdisable) ? "0" : "1");
+			astman_append(ses, "tot_ena: %s\r\n", (snap->st.totdisable) ? "0" : "1");
+			astman_append(ses, "link_ena: %s\r\n", (snap->st.linkfundisable) ? "0" : "1");
+			astman_append(ses, "patch_ena: %s\r\n", (snap->st.autopatchdisable) ? "0" : "1");
+			astman_append(ses, "patch_state: %s\r\n", patch_states[(int)snap->st.patchstate]);
+			astman_append(ses, "sch_ena: %s\r\n", (snap->st.schedulerdisable) ? "0" : "1");
+			astman_append(ses, "user_funs: %s\r\n", (snap->st.userfundisable) ? "0" : "1");
+			astman_append(ses, "tail_type: %s\r\n", (snap->st.alternatetail) ? "1" : "0");
+			astman_append(ses, "iconns: %s\r\n", (snap->st.noincomingconns) ? "0" : "1");
+			astman_append(ses, "tot_state: %d\r\n", snap->st.totstate);
+			astman_append(ses, "ider_state: %d\r\n", snap->st.iderstate);
+			astman_append(ses, "tel_mode: %s\r\n\r\n", tel_modes[(int)snap->st.telmode]);
+
+			rpt_snapshot_release(snap);
 			return 0;
 		}
 	}
@@ -24403,38 +24170,26 @@ static int rpt_manager_do_xstat(struct mansession *ses, const struct message *m,
 
 static int rpt_manager_do_stats(struct mansession *s, const struct message *m, char *str)
 {
-	int i,j,numoflinks;
-	int dailytxtime, dailykerchunks;
+	int i,j;
+	int dailytxtime;
 	time_t now;
-	int totalkerchunks, dailykeyups, totalkeyups, timeouts;
-	int totalexecdcommands, dailyexecdcommands, hours, minutes, seconds;
+	int hours, minutes, seconds;
 	long long totaltxtime;
-	struct	rpt_link *l;
-	char *listoflinks[MAX_STAT_LINKS];	
-	char *lastdtmfcommand,*parrot_ena;
-	char *tot_state, *ider_state, *patch_state;
-	char *reverse_patch_state, *sys_ena, *tot_ena, *link_ena, *patch_ena;
-	char *sch_ena, *input_signal, *called_number, *user_funs, *tail_type;
-	char *transmitterkeyed;
 	const char *node = astman_get_header(m, "Node");
 	struct rpt *myrpt;
+	struct rpt_snapshot *snap;
 
 	static char *not_applicable = "N/A";
 
-	tot_state = ider_state = 
-	patch_state = reverse_patch_state = 
-	input_signal = not_applicable;
-	called_number = lastdtmfcommand = transmitterkeyed = NULL;
-
 	time(&now);
 	for(i = 0; i < nrpts; i++)
 	{
 		if ((node)&&(!strcmp(node,rpt_vars[i].name))){
-			rpt_manager_success(s,m);
 
 			myrpt = &rpt_vars[i];
 
 			if(myrpt->remote){ /* Remote base ? */
+				rpt_manager_success(s,m);
 				char *loginuser, *loginlevel, *freq, *rxpl, *txpl, *modestr;
 				char offset = 0,powerlevel = 0,rxplon = 0,txplon = 0,remoteon,remmode = 0,reportfmstuff;
 				char offsetc,powerlevelc;
@@ -24532,156 +24287,39 @@ static int rpt_manager_do_stats(struct mansession *s, const struct message *m, c
 			}	
 
 			/* ELSE Process as a repeater node */
-			/* Make a copy of all stat variables while locked */
-			rpt_mutex_lock(&myrpt->lock); /* LOCK */
-			dailytxtime = myrpt->dailytxtime;
-			totaltxtime = myrpt->totaltxtime;
-			dailykeyups = myrpt->dailykeyups;
-			totalkeyups = myrpt->totalkeyups;
-			dailykerchunks = myrpt->dailykerchunks;
-			totalkerchunks = myrpt->totalkerchunks;
-			dailyexecdcommands = myrpt->dailyexecdcommands;
-			totalexecdcommands = myrpt->totalexecdcommands;
-			timeouts = myrpt->timeouts;
-
-
-			/* Traverse the list of connected nodes */
-			reverse_patch_state = "DOWN";
-			numoflinks = 0;
-			l = myrpt->links.next;
-			while(l && (l != &myrpt->links)){
-				if(numoflinks >= MAX_STAT_LINKS){
-					ast_log(LOG_NOTICE,
-					"maximum number of links exceeds %d in rpt_do_stats()!",MAX_STAT_LINKS);
-					break;
-				}
-				if (l->name[0] == '0'){ /* Skip '0' nodes */
-					reverse_patch_state = "UP";
-					l = l->next;
-					continue;
-				}
-				listoflinks[numoflinks] = ast_strdup(l->name);
-				if(listoflinks[numoflinks] == NULL){
-					break;
-				}
-				else{
-					numoflinks++;
-				}
-				l = l->next;
-			}
-
-			if(myrpt->keyed)
-				input_signal = "YES";
-			else
-				input_signal = "NO";
-			
-			if(myrpt->txkeyed)
-				transmitterkeyed = "YES";
-			else
-				transmitterkeyed = "NO";
-
-			if(myrpt->p.parrotmode)
-				parrot_ena = "ENABLED";
-			else
-				parrot_ena = "DISABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].txdisable)
-				sys_ena = "DISABLED";
-			else
-				sys_ena = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].totdisable)
-				tot_ena = "DISABLED";
-			else
-				tot_ena = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].linkfundisable)
-				link_ena = "DISABLED";
-			else
-				link_ena = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].autopatchdisable)
-				patch_ena = "DISABLED";
-			else
-				patch_ena = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].schedulerdisable)
-				sch_ena = "DISABLED";
-			else
-				sch_ena = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].userfundisable)
-				user_funs = "DISABLED";
-			else
-				user_funs = "ENABLED";
-
-			if(myrpt->p.s[myrpt->p.sysstate_cur].alternatetail)
-				tail_type = "ALTERNATE";
-			else
-				tail_type = "STANDARD";
-
-			if(!myrpt->totimer)
-				tot_state = "TIMED OUT!";
-			else if(myrpt->totimer != myrpt->p.totime)
-				tot_state = "ARMED";
-			else
-				tot_state = "RESET";
-
-			if(myrpt->tailid)
-				ider_state = "QUEUED IN TAIL";
-			else if(myrpt->mustid)
-				ider_state = "QUEUED FOR CLEANUP";
-			else
-				ider_state = "CLEAN";
-
-			switch(myrpt->callmode){
-				case 1:
-					patch_state = "DIALING";
-					break;
-				case 2:
-					patch_state = "CONNECTING";
-					break;
-				case 3:
-					patch_state = "UP";
-					break;
-
-				case 4:
-					patch_state = "CALL FAILED";
-					break;
-
-				default:
-					patch_state = "DOWN";
-			}
-
-			if(strlen(myrpt->exten)){
-				called_number = ast_strdup(myrpt->exten);
+			if (!(snap = rpt_snapshot_get(myrpt))){
+				astman_send_error(s, m, "RptStatus out of memory");
+				return 0;
 			}
-
-			if(strlen(myrpt->lastdtmfcommand)){
-				lastdtmfcommand = ast_strdup(myrpt->lastdtmfcommand);
+			if (rpt_manager_unchanged(s,m,snap)){
+				rpt_snapshot_release(snap);
+				return 0;
 			}
-			rpt_mutex_unlock(&myrpt->lock); /* UNLOCK */
+			rpt_manager_success(s,m);
+			dailytxtime = snap->dailytxtime;
+			totaltxtime = snap->totaltxtime;
 
+			astman_append(s, "Version: %u\r\n", snap->version);
 			astman_append(s, "IsRemoteBase: NO\r\n");
-			astman_append(s, "NodeState: %d\r\n", myrpt->p.sysstate_cur);
-			astman_append(s, "SignalOnInput: %s\r\n", input_signal);
-			astman_append(s, "TransmitterKeyed: %s\r\n", transmitterkeyed);
-			astman_append(s, "Transmitter: %s\r\n", sys_ena);
-			astman_append(s, "Parrot: %s\r\n", parrot_ena);
-			astman_append(s, "Scheduler: %s\r\n", sch_ena);
-			astman_append(s, "TailLength: %s\r\n", tail_type);
-			astman_append(s, "TimeOutTimer: %s\r\n", tot_ena);
-			astman_append(s, "TimeOutTimerState: %s\r\n", tot_state);
-			astman_append(s, "TimeOutsSinceSystemInitialization: %d\r\n", timeouts);
-			astman_append(s, "IdentifierState: %s\r\n", ider_state);
-			astman_append(s, "KerchunksToday: %d\r\n", dailykerchunks);
-			astman_append(s, "KerchunksSinceSystemInitialization: %d\r\n", totalkerchunks);
-			astman_append(s, "KeyupsToday: %d\r\n", dailykeyups);
-			astman_append(s, "KeyupsSinceSystemInitialization: %d\r\n", totalkeyups);
-			astman_append(s, "DtmfCommandsToday: %d\r\n", dailyexecdcommands);
-			astman_append(s, "DtmfCommandsSinceSystemInitialization: %d\r\n", totalexecdcommands);
+			astman_append(s, "NodeState: %d\r\n", snap->st.sysstate_cur);
+			astman_append(s, "SignalOnInput: %s\r\n", (snap->st.keyed) ? "YES" : "NO");
+			astman_append(s, "TransmitterKeyed: %s\r\n", (snap->st.txkeyed) ? "YES" : "NO");
+			astman_append(s, "Transmitter: %s\r\n", (snap->st.txdisable) ? "DISABLED" : "ENABLED");
+			astman_append(s, "Parrot: %s\r\n", (snap->st.parrotmode) ? "ENABLED" : "DISABLED");
+			astman_append(s, "Scheduler: %s\r\n", (snap->st.schedulerdisable) ? "DISABLED" : "ENABLED");
+			astman_append(s, "TailLength: %s\r\n", (snap->st.alternatetail) ? "ALTERNATE" : "STANDARD");
+			astman_append(s, "TimeOutTimer: %s\r\n", (snap->st.totdisable) ? "DISABLED" : "ENABLED");
+			astman_append(s, "TimeOutTimerState: %s\r\n", rpt_totstates[(int)snap->st.totstate]);
+			astman_append(s, "TimeOutsSinceSystemInitialization: %d\r\n", snap->st.timeouts);
+			astman_append(s, "IdentifierState: %s\r\n", rpt_iderstates[(int)snap->st.iderstate]);
+			astman_append(s, "KerchunksToday: %d\r\n", snap->st.dailykerchunks);
+			astman_append(s, "KerchunksSinceSystemInitialization: %d\r\n", snap->st.totalkerchunks);
+			astman_append(s, "KeyupsToday: %d\r\n", snap->st.dailykeyups);
+			astman_append(s, "KeyupsSinceSystemInitialization: %d\r\n", snap->st.totalkeyups);
+			astman_append(s, "DtmfCommandsToday: %d\r\n", snap->st.dailyexecdcommands);
+			astman_append(s, "DtmfCommandsSinceSystemInitialization: %d\r\n", snap->st.totalexecdcommands);
 			astman_append(s, "LastDtmfCommandExecuted: %s\r\n", 
-			(lastdtmfcommand && strlen(lastdtmfcommand)) ? lastdtmfcommand : not_applicable);
+			(strlen(snap->st.lastdtmfcommand)) ? snap->st.lastdtmfcommand : not_applicable);
 			hours = dailytxtime/3600000;
 			dailytxtime %= 3600000;
 			minutes = dailytxtime/60000;
@@ -24702,36 +24340,27 @@ static int rpt_manager_do_stats(struct mansession *s, const struct message *m, c
 			astman_append(s, "TxTimeSinceSystemInitialization: %02d:%02d:%02d.%d\r\n",
 				 hours, minutes, seconds, (int) totaltxtime);
 
-  			sprintf(str, "NodesCurrentlyConnectedToUs: ");
-                        if(!numoflinks){
-  	                      strcat(str,"<NONE>");
+			astman_append(s, "NodesCurrentlyConnectedToUs: ");
+                        if(!snap->nlinks){
+  	                      astman_append(s,"<NONE>");
                         }
 			else{
-				for(j = 0 ;j < numoflinks; j++){
-					sprintf(str+strlen(str), "%s", listoflinks[j]);
-					if(j < numoflinks - 1)
-						strcat(str,",");
+				for(j = 0 ;j < snap->nlinks; j++){
+					astman_append(s, "%s%s", snap->links[j].name,
+						(j < snap->nlinks - 1) ? "," : "");
 				}
 			}
-			astman_append(s,"%s\r\n", str);
+			astman_append(s,"\r\n");
 
-			astman_append(s, "Autopatch: %s\r\n", patch_ena);
-			astman_append(s, "AutopatchState: %s\r\n", patch_state);
+			astman_append(s, "Autopatch: %s\r\n", (snap->st.autopatchdisable) ? "DISABLED" : "ENABLED");
+			astman_append(s, "AutopatchState: %s\r\n", rpt_patchstates[(int)snap->st.patchstate]);
 			astman_append(s, "AutopatchCalledNumber: %s\r\n",
-			(called_number && strlen(called_number)) ? called_number : not_applicable);
-			astman_append(s, "ReversePatchIaxrptConnected: %s\r\n", reverse_patch_state);
-			astman_append(s, "UserLinkingCommands: %s\r\n", link_ena);
-			astman_append(s, "UserFunctions: %s\r\n", user_funs);
+			(strlen(snap->st.exten)) ? snap->st.exten : not_applicable);
+			astman_append(s, "ReversePatchIaxrptConnected: %s\r\n", (snap->st.reversepatch) ? "UP" : "DOWN");
+			astman_append(s, "UserLinkingCommands: %s\r\n", (snap->st.linkfundisable) ? "DISABLED" : "ENABLED");
+			astman_append(s, "UserFunctions: %s\r\n", (snap->st.userfundisable) ? "DISABLED" : "ENABLED");
 
-			for(j = 0; j < numoflinks; j++){ /* ast_free() all link names */
-				ast_free(listoflinks[j]);
-			}
-			if(called_number){
-				ast_free(called_number);
-			}
-			if(lastdtmfcommand){
-				ast_free(lastdtmfcommand);
-			}
+			rpt_snapshot_release(snap);
 			astman_append(s, "\r\n"); /* We're Done! */
 		        return 0;
 		}
@@ -24744,6 +24373,10 @@ static int rpt_manager_do_stats(struct mansession *s, const struct message *m, c
 
 /*
  * Implement the RptStatus Manager Interface
+ *
+ * NodeStat, XStat and SawStat replies carry a Version: header. A client
+ * that sends it back as IfChangedSince: gets a short Unchanged: YES reply
+ * until the node state (other than running timers) changes.
  */
 
 static int manager_rpt_status(struct mansession *s, const struct message *m)
@@ -25269,6 +24902,7 @@ char	*val,*this;
 				ast_log(LOG_ERROR,"Attempting to add repeater node %s would exceed max. number of repeaters (%d)\n",this,MAXRPTS);
 				continue;
 			}
+			rpt_snapshot_release(rpt_vars[n].snap);
 			memset(&rpt_vars[n],0,sizeof(rpt_vars[n]));
 			rpt_vars[n].name = ast_strdup(this);
 			val = (char *) ast_variable_retrieve(cfg,this,"rxchannel");
@@ -25290,6 +24924,7 @@ char	*val,*this;
 			ast_mutex_init(&rpt_vars[n].lock);
 			ast_mutex_init(&rpt_vars[n].remlock);
 			ast_mutex_init(&rpt_vars[n].statpost_lock);
+			ast_mutex_init(&rpt_vars[n].snaplock);
 			rpt_vars[n].tele.next = &rpt_vars[n].tele;
 			rpt_vars[n].tele.prev = &rpt_vars[n].tele;
 			rpt_vars[n].rpt_thread = AST_PTHREADT_NULL;
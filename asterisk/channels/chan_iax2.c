@@ -60,6 +60,11 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
 #include <sys/stat.h>
 #include <regex.h>
 
+#if defined(__linux__) && defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 8))
+#include <sys/timerfd.h>
+#define IAX_TIMERFD
+#endif
+
 #if defined(HAVE_ZAPTEL) || defined (HAVE_DAHDI)
 #include <sys/ioctl.h>
 #include "asterisk/dahdi_compat.h"
@@ -145,6 +150,9 @@ static int nochecksums = 0;
 
 #define DEFAULT_THREAD_COUNT 10
 #define DEFAULT_MAX_THREAD_COUNT 100
+#define MAX_READER_COUNT 32
+#define IAX_READER_BATCH 16
+#define IAX_INGEST_SLOTS 256	/* must be a power of two */
 #define DEFAULT_RETRY_TIME 1000
 #define MEMORY_SIZE 100
 #define DEFAULT_DROP 3
@@ -188,6 +196,7 @@ static int min_reg_expire;
 static int max_reg_expire;
 
 static int timingfd = -1;				/* Timing file descriptor */
+static int timing_is_timerfd = 0;			/* timingfd is a timerfd rather than a DAHDI timer */
 
 static struct ast_netsock_list *netsock;
 static struct ast_netsock_list *outsock;		/*!< used if sourceaddress specified and bindaddr == INADDR_ANY */
@@ -398,6 +407,8 @@ struct iax2_peer {
 
 #define IAX2_TRUNK_PREFACE (sizeof(struct iax_frame) + sizeof(struct ast_iax2_meta_hdr) + sizeof(struct ast_iax2_meta_trunk_hdr))
 
+#define TPEER_BUCKETS 64
+
 static struct iax2_trunk_peer {
 	ast_mutex_t lock;
 	int sockfd;
@@ -411,12 +422,27 @@ static struct iax2_trunk_peer {
 	unsigned char *trunkdata;
 	unsigned int trunkdatalen;
 	unsigned int trunkdataalloc;
+	/*! Buffer being transmitted while trunkdata fills up again.  Only
+	    the trunk timer touches it, so sending needs no lock. */
+	unsigned char *senddata;
+	unsigned int senddataalloc;
 	struct iax2_trunk_peer *next;
 	int trunkerror;
 	int calls;
-} *tpeers = NULL;
+	/* Transmit statistics, shown by "iax2 show netstats" */
+	unsigned int txframes;
+	unsigned int txchunks;
+	unsigned int txbytes;
+	int maxchunks;
+} *tpeers[TPEER_BUCKETS];
+
+/*! Protects the tpeers table; each trunk peer's data is under its own lock */
+AST_RWLOCK_DEFINE_STATIC(tpeerlock);
 
-AST_MUTEX_DEFINE_STATIC(tpeerlock);
+static inline unsigned int tpeer_hash(const struct sockaddr_in *sin)
+{
+	return (ntohl(sin->sin_addr.s_addr) ^ ntohs(sin->sin_port)) % TPEER_BUCKETS;
+}
 
 struct iax_firmware {
 	struct iax_firmware *next;
@@ -491,6 +517,7 @@ static int iaxmaxthreadcount = DEFAULT_MAX_THREAD_COUNT;
 static int iaxdynamicthreadcount = 0;
 static int iaxdynamicthreadnum = 0;
 static int iaxactivethreadcount = 0;
+static int iaxreaders = 0;
 
 struct iax_rr {
 	int jitter;
@@ -825,9 +852,12 @@ static int ast_cli_netstats(struct mansession *s, int fd, int limit_fmt);
 
 #define IAX_TYPE_POOL    1
 #define IAX_TYPE_DYNAMIC 2
+#define IAX_TYPE_INGEST  3
 
 struct iax2_pkt_buf {
 	AST_LIST_ENTRY(iax2_pkt_buf) entry;
+	struct sockaddr_in sin;
+	int fd;
 	size_t len;
 	unsigned char buf[1];
 };
@@ -877,6 +907,49 @@ static AST_LIST_HEAD_STATIC(idle_list, iax2_thread);
 static AST_LIST_HEAD_STATIC(active_list, iax2_thread);
 static AST_LIST_HEAD_STATIC(dynamic_list, iax2_thread);
 
+/*!
+ * \brief A reader thread, used instead of socket_read() when iaxreaders is set
+ *
+ * Each reader owns one SO_REUSEPORT socket per bound address and waits on
+ * them with its own io context, so the kernel keeps every sender on the
+ * same reader and packets for a call stay in order.  Full frames are handed
+ * to the ingest thread picked by hashing the sender.  Mini, meta and video
+ * frames are processed inline by the reader, unless frames from the same
+ * sender are still waiting on (or being processed by) that ingest thread,
+ * in which case they are queued behind them so the order holds.  Frames
+ * from other senders on the same ingest thread don't hold them up.
+ */
+struct iax2_reader {
+	int num;
+	pthread_t threadid;
+	struct io_context *io;
+	/*! Sockets of readers after the first; the first reader uses netsock */
+	struct ast_netsock_list *socks;
+	/*! Passed to socket_process() for frames processed inline */
+	struct iax2_thread thread;
+	unsigned int packets;
+	unsigned int batches;
+	unsigned int queued;
+	int lens[IAX_READER_BATCH];
+	struct sockaddr_in sins[IAX_READER_BATCH];
+#ifdef MSG_WAITFORONE
+	struct mmsghdr msgs[IAX_READER_BATCH];
+	struct iovec iov[IAX_READER_BATCH];
+#endif
+	unsigned char bufs[IAX_READER_BATCH][4096];
+};
+
+static struct iax2_reader *readers;
+/*! Serial frame queues, one per reader */
+static struct iax2_thread *ingest_threads;
+/*!
+ * Frames each ingest thread has queued or in hand, counted by sender (see
+ * ingest_slot()) under the ingest thread's lock.  Senders sharing a slot
+ * just wait for each other, which keeps the order all the same.
+ */
+static unsigned int (*ingest_pending)[IAX_INGEST_SLOTS];
+static int ingest_shutdown;
+
 static void *iax2_process_thread(void *data);
 
 static void signal_condition(ast_mutex_t *lock, ast_cond_t *cond)
@@ -3602,6 +3675,10 @@ static int schedule_delivery(struct iax_frame *fr, int updatehistory, int fromtr
 	struct ast_channel *owner = NULL;
 	struct ast_channel *bridge = NULL;
 	
+	/* Note when it came in, so the time it spends in the jitterbuffer is counted */
+	if (fr->af.frametype == AST_FRAME_VOICE)
+		ast_frame_stamp(&fr->af);
+
 	/* Attempt to recover wrapped timestamps */
 	unwrap_timestamp(fr);
 
@@ -5260,16 +5337,29 @@ static unsigned int calc_rxstamp(struct chan_iax2_pvt *p, unsigned int offset)
 static struct iax2_trunk_peer *find_tpeer(struct sockaddr_in *sin, int fd)
 {
 	struct iax2_trunk_peer *tpeer;
+	unsigned int bucket = tpeer_hash(sin);
 	
 	/* Finds and locks trunk peer */
-	ast_mutex_lock(&tpeerlock);
-	for (tpeer = tpeers; tpeer; tpeer = tpeer->next) {
+	ast_rwlock_rdlock(&tpeerlock);
+	for (tpeer = tpeers[bucket]; tpeer; tpeer = tpeer->next) {
 		/* We don't lock here because tpeer->addr *never* changes */
 		if (!inaddrcmp(&tpeer->addr, sin)) {
 			ast_mutex_lock(&tpeer->lock);
 			break;
 		}
 	}
+	ast_rwlock_unlock(&tpeerlock);
+	if (tpeer)
+		return tpeer;
+
+	ast_rwlock_wrlock(&tpeerlock);
+	/* It may have been added while the table was unlocked */
+	for (tpeer = tpeers[bucket]; tpeer; tpeer = tpeer->next) {
+		if (!inaddrcmp(&tpeer->addr, sin)) {
+			ast_mutex_lock(&tpeer->lock);
+			break;
+		}
+	}
 	if (!tpeer) {
 		if ((tpeer = ast_calloc(1, sizeof(*tpeer)))) {
 			ast_mutex_init(&tpeer->lock);
@@ -5277,9 +5367,9 @@ static struct iax2_trunk_peer *find_tpeer(struct sockaddr_in *sin, int fd)
 			memcpy(&tpeer->addr, sin, sizeof(tpeer->addr));
 			tpeer->trunkact = ast_tvnow();
 			ast_mutex_lock(&tpeer->lock);
-			tpeer->next = tpeers;
+			tpeer->next = tpeers[bucket];
 			tpeer->sockfd = fd;
-			tpeers = tpeer;
+			tpeers[bucket] = tpeer;
 #ifdef SO_NO_CHECK
 			setsockopt(tpeer->sockfd, SOL_SOCKET, SO_NO_CHECK, &nochecksums, sizeof(nochecksums));
 #endif
@@ -5287,7 +5377,7 @@ static struct iax2_trunk_peer *find_tpeer(struct sockaddr_in *sin, int fd)
 				ast_log(LOG_DEBUG, "Created trunk peer for '%s:%d'\n", ast_inet_ntoa(tpeer->addr.sin_addr), ntohs(tpeer->addr.sin_port));
 		}
 	}
-	ast_mutex_unlock(&tpeerlock);
+	ast_rwlock_unlock(&tpeerlock);
 	return tpeer;
 }
 
@@ -5387,17 +5477,8 @@ static void memcpy_decrypt(unsigned char *dst, const unsigned char *src, int len
 	for (x=0;x<len;x++)
 		dst[x] = src[x] ^ 0xff;
 #else	
-	unsigned char lastblock[16] = { 0 };
-	int x;
-	while(len > 0) {
-		aes_decrypt(src, dst, dcx);
-		for (x=0;x<16;x++)
-			dst[x] ^= lastblock[x];
-		memcpy(lastblock, src, sizeof(lastblock));
-		dst += 16;
-		src += 16;
-		len -= 16;
-	}
+	unsigned char iv[16] = { 0 };
+	aes_cbc_decrypt(src, dst, len, iv, dcx);
 #endif
 }
 
@@ -5411,17 +5492,8 @@ static void memcpy_encrypt(unsigned char *dst, const unsigned char *src, int len
 	for (x=0;x<len;x++)
 		dst[x] = src[x] ^ 0xff;
 #else
-	unsigned char curblock[16] = { 0 };
-	int x;
-	while(len > 0) {
-		for (x=0;x<16;x++)
-			curblock[x] ^= src[x];
-		aes_encrypt(curblock, dst, ecx);
-		memcpy(curblock, dst, sizeof(curblock)); 
-		dst += 16;
-		src += 16;
-		len -= 16;
-	}
+	unsigned char iv[16] = { 0 };
+	aes_cbc_encrypt(src, dst, len, iv, ecx);
 #endif
 }
 
@@ -5926,6 +5998,7 @@ static int iax2_show_threads(int fd, int argc, char *argv[])
 	struct iax2_thread *thread = NULL;
 	time_t t;
 	int threadcount = 0, dynamiccount = 0;
+	int x;
 	char type;
 
 	if (argc != 3)
@@ -5976,6 +6049,29 @@ static int iax2_show_threads(int fd, int argc, char *argv[])
 		dynamiccount++;
         }
         AST_LIST_UNLOCK(&dynamic_list);
+	if (iaxreaders) {
+		struct iax2_pkt_buf *pkt_buf;
+		int queued;
+
+		ast_cli(fd, "Reader Threads:\n");
+		for (x = 0; x < iaxreaders; x++) {
+			ast_cli(fd, "Reader %d: packets=%u, batches=%u (%.1f per batch), queued=%u\n",
+				readers[x].num, readers[x].packets, readers[x].batches,
+				readers[x].batches ? (double) readers[x].packets / readers[x].batches : 0.0,
+				readers[x].queued);
+		}
+		ast_cli(fd, "Ingest Threads:\n");
+		for (x = 0; x < iaxreaders; x++) {
+			thread = &ingest_threads[x];
+			queued = 0;
+			ast_mutex_lock(&thread->lock);
+			AST_LIST_TRAVERSE(&thread->full_frames, pkt_buf, entry)
+				queued++;
+			ast_mutex_unlock(&thread->lock);
+			ast_cli(fd, "Thread I%d: state=%d, update=%d, actions=%d, pending=%d\n",
+				thread->threadnum, thread->iostate, (int)(t - thread->checktime), thread->actions, queued);
+		}
+	}
 	ast_cli(fd, "%d of %d threads accounted for with %d dynamic threads\n", threadcount, iaxthreadcount, dynamiccount);
 	return RESULT_SUCCESS;
 }
@@ -6222,6 +6318,34 @@ static int ast_cli_netstats(struct mansession *s, int fd, int limit_fmt)
 	return numchans;
 }
 
+/*! \brief Per trunk peer batching, appended to "iax2 show netstats" */
+static void show_trunk_netstats(int fd)
+{
+#define FORMAT "%-21s  %8u  %8u  %7.1f  %5d  %10u  %7u\n"
+	struct iax2_trunk_peer *tpeer;
+	char addr[32];
+	int bucket, count = 0;
+
+	ast_rwlock_rdlock(&tpeerlock);
+	for (bucket = 0; bucket < TPEER_BUCKETS; bucket++) {
+		for (tpeer = tpeers[bucket]; tpeer; tpeer = tpeer->next) {
+			if (!count++) {
+				ast_cli(fd, "\n%-21s  %8s  %8s  %7s  %5s  %10s  %7s\n", "Trunk Peer", "Frames", "Chunks", "Per Frm", "Max", "Bytes", "Backlog");
+			}
+			snprintf(addr, sizeof(addr), "%s:%d", ast_inet_ntoa(tpeer->addr.sin_addr), ntohs(tpeer->addr.sin_port));
+			ast_mutex_lock(&tpeer->lock);
+			ast_cli(fd, FORMAT, addr, tpeer->txframes, tpeer->txchunks,
+				tpeer->txframes ? (double) tpeer->txchunks / tpeer->txframes : 0.0,
+				tpeer->maxchunks, tpeer->txbytes, tpeer->trunkdatalen);
+			ast_mutex_unlock(&tpeer->lock);
+		}
+	}
+	ast_rwlock_unlock(&tpeerlock);
+	if (count)
+		ast_cli(fd, "%d trunk peer%s\n", count, (count != 1) ? "s" : "");
+#undef FORMAT
+}
+
 static int iax2_show_netstats(int fd, int argc, char *argv[])
 {
 	int numchans = 0;
@@ -6231,6 +6355,7 @@ static int iax2_show_netstats(int fd, int argc, char *argv[])
 	ast_cli(fd, "Channel                    RTT  Jit  Del  Lost   %%  Drop  OOO  Kpkts  Jit  Del  Lost   %%  Drop  OOO  Kpkts FirstMsg    LastMsg\n");
 	numchans = ast_cli_netstats(NULL, fd, 1);
 	ast_cli(fd, "%d active IAX channel%s\n", numchans, (numchans != 1) ? "s" : "");
+	show_trunk_netstats(fd);
 	return RESULT_SUCCESS;
 }
 
@@ -7862,50 +7987,79 @@ static int iax2_poke_peer_s(const void *data)
 	return 0;
 }
 
-static int send_trunk(struct iax2_trunk_peer *tpeer, struct timeval *now)
+/*!
+ * \brief Move the queued trunk data to senddata and fill in its headers
+ * \note Don't call without tpeer->lock held.  The frame is then sent with
+ *       send_trunk() after the lock is released, so queueing never waits
+ *       on the network.
+ * \return the number of call chunks in the frame
+ */
+static int prepare_trunk(struct iax2_trunk_peer *tpeer, struct timeval *now)
 {
-	int res = 0;
 	struct iax_frame *fr;
 	struct ast_iax2_meta_hdr *meta;
 	struct ast_iax2_meta_trunk_hdr *mth;
-	int calls = 0;
-	
+	unsigned char *tmp;
+	unsigned int alloc;
+	int calls;
+
+	if (!tpeer->trunkdatalen)
+		return 0;
+
+	/* Swap buffers; the old send buffer is reused for queueing */
+	tmp = tpeer->senddata;
+	alloc = tpeer->senddataalloc;
+	tpeer->senddata = tpeer->trunkdata;
+	tpeer->senddataalloc = tpeer->trunkdataalloc;
+	tpeer->trunkdata = tmp;
+	tpeer->trunkdataalloc = alloc;
+
 	/* Point to frame */
-	fr = (struct iax_frame *)tpeer->trunkdata;
+	fr = (struct iax_frame *)tpeer->senddata;
 	/* Point to meta data */
 	meta = (struct ast_iax2_meta_hdr *)fr->afdata;
 	mth = (struct ast_iax2_meta_trunk_hdr *)meta->data;
-	if (tpeer->trunkdatalen) {
-		/* We're actually sending a frame, so fill the meta trunk header and meta header */
-		meta->zeros = 0;
-		meta->metacmd = IAX_META_TRUNK;
-		if (ast_test_flag(&globalflags, IAX_TRUNKTIMESTAMPS))
-			meta->cmddata = IAX_META_TRUNK_MINI;
-		else
-			meta->cmddata = IAX_META_TRUNK_SUPERMINI;
-		mth->ts = htonl(calc_txpeerstamp(tpeer, trunkfreq, now));
-		/* And the rest of the ast_iax2 header */
-		fr->direction = DIRECTION_OUTGRESS;
-		fr->retrans = -1;
-		fr->transfer = 0;
-		/* Any appropriate call will do */
-		fr->data = fr->afdata;
-		fr->datalen = tpeer->trunkdatalen + sizeof(struct ast_iax2_meta_hdr) + sizeof(struct ast_iax2_meta_trunk_hdr);
-		res = transmit_trunk(fr, &tpeer->addr, tpeer->sockfd);
-		calls = tpeer->calls;
+	/* We're actually sending a frame, so fill the meta trunk header and meta header */
+	meta->zeros = 0;
+	meta->metacmd = IAX_META_TRUNK;
+	if (ast_test_flag(&globalflags, IAX_TRUNKTIMESTAMPS))
+		meta->cmddata = IAX_META_TRUNK_MINI;
+	else
+		meta->cmddata = IAX_META_TRUNK_SUPERMINI;
+	mth->ts = htonl(calc_txpeerstamp(tpeer, trunkfreq, now));
+	/* And the rest of the ast_iax2 header */
+	fr->direction = DIRECTION_OUTGRESS;
+	fr->retrans = -1;
+	fr->transfer = 0;
+	/* Any appropriate call will do */
+	fr->data = fr->afdata;
+	fr->datalen = tpeer->trunkdatalen + sizeof(struct ast_iax2_meta_hdr) + sizeof(struct ast_iax2_meta_trunk_hdr);
+	calls = tpeer->calls;
 #if 0
-		if (option_debug)
-			ast_log(LOG_DEBUG, "Trunking %d call chunks in %d bytes to %s:%d, ts=%d\n", calls, fr->datalen, ast_inet_ntoa(tpeer->addr.sin_addr), ntohs(tpeer->addr.sin_port), ntohl(mth->ts));
+	if (option_debug)
+		ast_log(LOG_DEBUG, "Trunking %d call chunks in %d bytes to %s:%d, ts=%d\n", calls, fr->datalen, ast_inet_ntoa(tpeer->addr.sin_addr), ntohs(tpeer->addr.sin_port), ntohl(mth->ts));
 #endif		
-		/* Reset transmit trunk side data */
-		tpeer->trunkdatalen = 0;
-		tpeer->calls = 0;
-	}
-	if (res < 0)
-		return res;
+	tpeer->txframes++;
+	tpeer->txchunks += calls;
+	tpeer->txbytes += fr->datalen;
+	if (calls > tpeer->maxchunks)
+		tpeer->maxchunks = calls;
+
+	/* Reset transmit trunk side data */
+	tpeer->trunkdatalen = 0;
+	tpeer->calls = 0;
+
 	return calls;
 }
 
+/*! \brief Transmit the frame left in senddata by prepare_trunk() */
+static int send_trunk(struct iax2_trunk_peer *tpeer)
+{
+	struct iax_frame *fr = (struct iax_frame *)tpeer->senddata;
+
+	return transmit_trunk(fr, &tpeer->addr, tpeer->sockfd);
+}
+
 static inline int iax2_trunk_expired(struct iax2_trunk_peer *tpeer, struct timeval *now)
 {
 	/* Drop when trunk is about 5 seconds idle */
@@ -7918,9 +8072,11 @@ static int timing_read(int *id, int fd, short events, void *cbdata)
 {
 	char buf[1024];
 	int res;
-	struct iax2_trunk_peer *tpeer, *prev = NULL, *drop=NULL;
+	struct iax2_trunk_peer *tpeer, *prev, *next, *drop = NULL;
 	int processed = 0;
 	int totalcalls = 0;
+	int expired = 0;
+	int bucket;
 #ifdef DAHDI_TIMERACK
 	int x = 1;
 #endif
@@ -7946,48 +8102,68 @@ static int timing_read(int *id, int fd, short events, void *cbdata)
 		}
 	}
 	/* For each peer that supports trunking... */
-	ast_mutex_lock(&tpeerlock);
-	tpeer = tpeers;
-	while(tpeer) {
-		processed++;
-		res = 0;
-		ast_mutex_lock(&tpeer->lock);
-		/* We can drop a single tpeer per pass.  That makes all this logic
-		   substantially easier */
-		if (!drop && iax2_trunk_expired(tpeer, &now)) {
-			/* Take it out of the list, but don't free it yet, because it
-			   could be in use */
-			if (prev)
-				prev->next = tpeer->next;
-			else
-				tpeers = tpeer->next;
-			drop = tpeer;
-		} else {
-			res = send_trunk(tpeer, &now);
+	ast_rwlock_rdlock(&tpeerlock);
+	for (bucket = 0; bucket < TPEER_BUCKETS; bucket++) {
+		for (tpeer = tpeers[bucket]; tpeer; tpeer = tpeer->next) {
+			processed++;
+			ast_mutex_lock(&tpeer->lock);
+			/* Expired peers are dropped below, with the table write locked */
+			if (iax2_trunk_expired(tpeer, &now)) {
+				expired++;
+				ast_mutex_unlock(&tpeer->lock);
+				continue;
+			}
+			res = prepare_trunk(tpeer, &now);
 			if (iaxtrunkdebug)
 				ast_verbose(" - Trunk peer (%s:%d) has %d call chunk%s in transit, %d bytes backloged and has hit a high water mark of %d bytes\n", ast_inet_ntoa(tpeer->addr.sin_addr), ntohs(tpeer->addr.sin_port), res, (res != 1) ? "s" : "", tpeer->trunkdatalen, tpeer->trunkdataalloc);
-		}		
-		totalcalls += res;	
-		res = 0;
-		ast_mutex_unlock(&tpeer->lock);
-		prev = tpeer;
-		tpeer = tpeer->next;
+			ast_mutex_unlock(&tpeer->lock);
+			if (res > 0 && send_trunk(tpeer) < 0)
+				res = -1;
+			totalcalls += res;
+		}
+	}
+	ast_rwlock_unlock(&tpeerlock);
+	if (expired) {
+		ast_rwlock_wrlock(&tpeerlock);
+		for (bucket = 0; bucket < TPEER_BUCKETS; bucket++) {
+			prev = NULL;
+			for (tpeer = tpeers[bucket]; tpeer; tpeer = next) {
+				next = tpeer->next;
+				ast_mutex_lock(&tpeer->lock);
+				res = iax2_trunk_expired(tpeer, &now);
+				ast_mutex_unlock(&tpeer->lock);
+				if (!res) {
+					prev = tpeer;
+					continue;
+				}
+				if (prev)
+					prev->next = next;
+				else
+					tpeers[bucket] = next;
+				tpeer->next = drop;
+				drop = tpeer;
+			}
+		}
+		ast_rwlock_unlock(&tpeerlock);
 	}
-	ast_mutex_unlock(&tpeerlock);
-	if (drop) {
-		ast_mutex_lock(&drop->lock);
+	while ((tpeer = drop)) {
+		drop = tpeer->next;
+		ast_mutex_lock(&tpeer->lock);
 		/* Once we have this lock, we're sure nobody else is using it or could use it once we release it, 
 		   because by the time they could get tpeerlock, we've already grabbed it */
 		if (option_debug)
-			ast_log(LOG_DEBUG, "Dropping unused iax2 trunk peer '%s:%d'\n", ast_inet_ntoa(drop->addr.sin_addr), ntohs(drop->addr.sin_port));
-		if (drop->trunkdata) {
-			free(drop->trunkdata);
-			drop->trunkdata = NULL;
-		}
-		ast_mutex_unlock(&drop->lock);
-		ast_mutex_destroy(&drop->lock);
-		free(drop);
-		
+			ast_log(LOG_DEBUG, "Dropping unused iax2 trunk peer '%s:%d'\n", ast_inet_ntoa(tpeer->addr.sin_addr), ntohs(tpeer->addr.sin_port));
+		if (tpeer->trunkdata) {
+			free(tpeer->trunkdata);
+			tpeer->trunkdata = NULL;
+		}
+		if (tpeer->senddata) {
+			free(tpeer->senddata);
+			tpeer->senddata = NULL;
+		}
+		ast_mutex_unlock(&tpeer->lock);
+		ast_mutex_destroy(&tpeer->lock);
+		free(tpeer);
 	}
 	if (iaxtrunkdebug)
 		ast_verbose("Ending trunk processing with %d peers and %d call chunks processed\n", processed, totalcalls);
@@ -8212,6 +8388,8 @@ static void handle_deferred_full_frames(struct iax2_thread *thread)
 		thread->buf = pkt_buf->buf;
 		thread->buf_len = pkt_buf->len;
 		thread->buf_size = pkt_buf->len + 1;
+		thread->iofd = pkt_buf->fd;
+		memcpy(&thread->iosin, &pkt_buf->sin, sizeof(thread->iosin));
 		
 		socket_process(thread);
 
@@ -8239,6 +8417,8 @@ static void defer_full_frame(struct iax2_thread *from_here, struct iax2_thread *
 		return;
 
 	pkt_buf->len = from_here->buf_len;
+	pkt_buf->fd = from_here->iofd;
+	memcpy(&pkt_buf->sin, &from_here->iosin, sizeof(pkt_buf->sin));
 	memcpy(pkt_buf->buf, from_here->buf, pkt_buf->len);
 
 	fh = (struct ast_iax2_full_hdr *) pkt_buf->buf;
@@ -8337,6 +8517,304 @@ static int socket_read(int *id, int fd, short events, void *cbdata)
 	return 1;
 }
 
+/*!
+ * \brief Which ingest thread handles a sender
+ *
+ * Not the call number as well: a trunk (meta) frame carries mini frames
+ * for many calls, and has to stay in order with their full frames.
+ */
+static inline unsigned int ingest_hash(const struct sockaddr_in *sin)
+{
+	return ntohl(sin->sin_addr.s_addr) ^ ntohs(sin->sin_port);
+}
+
+/*! \brief Where an ingest thread counts a sender's frames in ingest_pending */
+static inline unsigned int ingest_slot(const struct sockaddr_in *sin)
+{
+	return (ingest_hash(sin) * 2654435761U >> 16) & (IAX_INGEST_SLOTS - 1);
+}
+
+/*!
+ * \brief Append a frame to an ingest thread's queue
+ *
+ * Frames from one sender always land on the same queue, which is processed
+ * in arrival order, so no other thread needs to be consulted.
+ */
+static int queue_ingest_frame(struct iax2_thread *to_here, unsigned char *buf, int len, struct sockaddr_in *sin, int fd)
+{
+	struct iax2_pkt_buf *pkt_buf;
+
+	if (!(pkt_buf = ast_calloc(1, sizeof(*pkt_buf) + len)))
+		return -1;
+
+	pkt_buf->len = len;
+	pkt_buf->fd = fd;
+	memcpy(&pkt_buf->sin, sin, sizeof(pkt_buf->sin));
+	memcpy(pkt_buf->buf, buf, len);
+
+	ast_mutex_lock(&to_here->lock);
+	AST_LIST_INSERT_TAIL(&to_here->full_frames, pkt_buf, entry);
+	ingest_pending[to_here - ingest_threads][ingest_slot(sin)]++;
+	ast_cond_signal(&to_here->cond);
+	ast_mutex_unlock(&to_here->lock);
+
+	return 0;
+}
+
+/*! \brief Read up to IAX_READER_BATCH datagrams without blocking */
+static int reader_recv(struct iax2_reader *reader, int fd)
+{
+	int x;
+#ifdef MSG_WAITFORONE
+	int res;
+
+	for (x = 0; x < IAX_READER_BATCH; x++)
+		reader->msgs[x].msg_hdr.msg_namelen = sizeof(reader->sins[x]);
+	if ((res = recvmmsg(fd, reader->msgs, IAX_READER_BATCH, MSG_DONTWAIT, NULL)) < 0)
+		return -1;
+	for (x = 0; x < res; x++)
+		reader->lens[x] = reader->msgs[x].msg_len;
+	return res;
+#else
+	socklen_t len;
+	ssize_t res;
+
+	for (x = 0; x < IAX_READER_BATCH; x++) {
+		len = sizeof(reader->sins[x]);
+		res = recvfrom(fd, reader->bufs[x], sizeof(reader->bufs[x]), MSG_DONTWAIT, (struct sockaddr *) &reader->sins[x], &len);
+		if (res < 0)
+			break;
+		reader->lens[x] = res;
+	}
+	return x ? x : -1;
+#endif
+}
+
+static int socket_read_batch(int *id, int fd, short events, void *cbdata)
+{
+	struct iax2_reader *reader = ast_netsock_data(cbdata);
+	struct iax2_thread *thread = &reader->thread;
+	struct iax2_thread *ingest;
+	struct ast_iax2_full_hdr *fh;
+	int count, x, queue;
+
+	if ((count = reader_recv(reader, fd)) < 0) {
+		if (errno != ECONNREFUSED && errno != EAGAIN)
+			ast_log(LOG_WARNING, "Error: %s\n", strerror(errno));
+		handle_error();
+		return 1;
+	}
+	reader->batches++;
+	reader->packets += count;
+
+	for (x = 0; x < count; x++) {
+		if (test_losspct && ((100.0 * ast_random() / (RAND_MAX + 1.0)) < test_losspct)) /* simulate random loss condition */
+			continue;
+
+		ingest = &ingest_threads[ingest_hash(&reader->sins[x]) % iaxreaders];
+		fh = (struct ast_iax2_full_hdr *) reader->bufs[x];
+		if (ntohs(fh->scallno) & IAX_FLAG_FULL)
+			queue = 1;
+		else {
+			/* Only this reader queues this sender's frames, so once none
+			 * are counted, none can be left there */
+			ast_mutex_lock(&ingest->lock);
+			queue = ingest_pending[ingest - ingest_threads][ingest_slot(&reader->sins[x])] != 0;
+			ast_mutex_unlock(&ingest->lock);
+		}
+		if (queue) {
+			if (!queue_ingest_frame(ingest, reader->bufs[x], reader->lens[x], &reader->sins[x], fd))
+				reader->queued++;
+			continue;
+		}
+
+		thread->buf = reader->bufs[x];
+		thread->buf_len = reader->lens[x];
+		thread->buf_size = sizeof(reader->bufs[x]);
+		thread->iofd = fd;
+		memcpy(&thread->iosin, &reader->sins[x], sizeof(thread->iosin));
+		socket_process(thread);
+	}
+	thread->buf = NULL;
+
+	return 1;
+}
+
+static void *iax2_reader_thread(void *data)
+{
+	struct iax2_reader *reader = data;
+
+	while (!ingest_shutdown)
+		ast_io_wait(reader->io, 1000);
+
+	return NULL;
+}
+
+static void *iax2_ingest_thread(void *data)
+{
+	struct iax2_thread *thread = data;
+	unsigned int *pending = ingest_pending[thread - ingest_threads];
+	struct iax2_pkt_buf *pkt_buf;
+	unsigned int slot;
+
+	ast_mutex_lock(&thread->lock);
+	while (!ingest_shutdown) {
+		if (!(pkt_buf = AST_LIST_REMOVE_HEAD(&thread->full_frames, entry))) {
+			thread->iostate = IAX_IOSTATE_IDLE;
+			ast_cond_wait(&thread->cond, &thread->lock);
+			continue;
+		}
+		thread->iostate = IAX_IOSTATE_PROCESSING;
+		thread->actions++;
+		ast_mutex_unlock(&thread->lock);
+
+		thread->buf = pkt_buf->buf;
+		thread->buf_len = pkt_buf->len;
+		thread->buf_size = pkt_buf->len + 1;
+		thread->iofd = pkt_buf->fd;
+		memcpy(&thread->iosin, &pkt_buf->sin, sizeof(thread->iosin));
+		socket_process(thread);
+		thread->buf = NULL;
+		slot = ingest_slot(&pkt_buf->sin);
+		ast_free(pkt_buf);
+
+		/* Only now can the reader go back to processing this sender's
+		 * mini frames itself */
+		ast_mutex_lock(&thread->lock);
+		pending[slot]--;
+		time(&thread->checktime);
+	}
+	ast_mutex_unlock(&thread->lock);
+
+	return NULL;
+}
+
+static void free_readers(void)
+{
+	struct iax2_pkt_buf *pkt_buf;
+	int count = iaxreaders;
+	int x;
+
+	iaxreaders = 0;
+	for (x = 0; readers && x < count; x++) {
+		if (readers[x].socks) {
+			ast_netsock_release(readers[x].socks);
+			free(readers[x].socks);
+		}
+		if (readers[x].io)
+			io_context_destroy(readers[x].io);
+	}
+	for (x = 0; ingest_threads && x < count; x++) {
+		while ((pkt_buf = AST_LIST_REMOVE_HEAD(&ingest_threads[x].full_frames, entry)))
+			free(pkt_buf);
+		ast_mutex_destroy(&ingest_threads[x].lock);
+		ast_cond_destroy(&ingest_threads[x].cond);
+	}
+	free(readers);
+	free(ingest_threads);
+	free(ingest_pending);
+	readers = NULL;
+	ingest_threads = NULL;
+	ingest_pending = NULL;
+}
+
+/*! \brief Set up iaxreaders readers and ingest queues; must run before netsock is bound */
+static int alloc_readers(void)
+{
+	struct iax2_reader *reader;
+	int x;
+#ifdef MSG_WAITFORONE
+	int y;
+#endif
+
+	if (!(readers = ast_calloc(iaxreaders, sizeof(*readers))) ||
+	    !(ingest_threads = ast_calloc(iaxreaders, sizeof(*ingest_threads))) ||
+	    !(ingest_pending = ast_calloc(iaxreaders, sizeof(*ingest_pending)))) {
+		free(readers);
+		free(ingest_threads);
+		readers = NULL;
+		ingest_threads = NULL;
+		iaxreaders = 0;
+		return -1;
+	}
+	ingest_shutdown = 0;
+	if (ast_netsock_set_reuseport(netsock, iaxreaders > 1)) {
+		ast_log(LOG_WARNING, "SO_REUSEPORT is not available, using a single IAX2 reader\n");
+		iaxreaders = 1;
+	}
+	for (x = 0; x < iaxreaders; x++) {
+		reader = &readers[x];
+		reader->num = x + 1;
+		reader->threadid = AST_PTHREADT_NULL;
+#ifdef MSG_WAITFORONE
+		for (y = 0; y < IAX_READER_BATCH; y++) {
+			reader->iov[y].iov_base = reader->bufs[y];
+			reader->iov[y].iov_len = sizeof(reader->bufs[y]);
+			reader->msgs[y].msg_hdr.msg_name = &reader->sins[y];
+			reader->msgs[y].msg_hdr.msg_iov = &reader->iov[y];
+			reader->msgs[y].msg_hdr.msg_iovlen = 1;
+		}
+#endif
+		ingest_threads[x].type = IAX_TYPE_INGEST;
+		ingest_threads[x].threadnum = x + 1;
+		ingest_threads[x].threadid = AST_PTHREADT_NULL;
+		time(&ingest_threads[x].checktime);
+		ast_mutex_init(&ingest_threads[x].lock);
+		ast_cond_init(&ingest_threads[x].cond, NULL);
+
+		if (!(reader->io = io_context_create())) {
+			free_readers();
+			return -1;
+		}
+		if (x) {
+			if (!(reader->socks = ast_netsock_list_alloc())) {
+				free_readers();
+				return -1;
+			}
+			ast_netsock_init(reader->socks);
+			ast_netsock_set_reuseport(reader->socks, 1);
+		}
+	}
+
+	return 0;
+}
+
+static void stop_readers(void)
+{
+	int x;
+
+	ingest_shutdown = 1;
+	for (x = 0; x < iaxreaders; x++) {
+		if (readers[x].threadid != AST_PTHREADT_NULL)
+			pthread_join(readers[x].threadid, NULL);
+	}
+	for (x = 0; x < iaxreaders; x++) {
+		if (ingest_threads[x].threadid == AST_PTHREADT_NULL)
+			continue;
+		signal_condition(&ingest_threads[x].lock, &ingest_threads[x].cond);
+		pthread_join(ingest_threads[x].threadid, NULL);
+	}
+}
+
+/*! \brief Bind an address into netsock, plus a sibling socket for every extra reader */
+static struct ast_netsock *iax2_netsock_bind(const char *bindinfo, int portno)
+{
+	struct ast_netsock *ns, *extra;
+	int x;
+
+	if (!iaxreaders)
+		return ast_netsock_bind(netsock, io, bindinfo, portno, tos, socket_read, NULL);
+
+	if (!(ns = ast_netsock_bind(netsock, readers[0].io, bindinfo, portno, tos, socket_read_batch, &readers[0])))
+		return NULL;
+	for (x = 1; x < iaxreaders; x++) {
+		if ((extra = ast_netsock_bind(readers[x].socks, readers[x].io, bindinfo, portno, tos, socket_read_batch, &readers[x])))
+			ast_netsock_unref(extra);
+	}
+
+	return ns;
+}
+
 static int socket_process(struct iax2_thread *thread)
 {
 	struct sockaddr_in sin;
@@ -10623,10 +11101,23 @@ static int start_network_thread(void)
 			AST_LIST_UNLOCK(&idle_list);
 		}
 	}
+	for (x = 0; x < iaxreaders; x++) {
+		if (ast_pthread_create_background(&ingest_threads[x].threadid, NULL, iax2_ingest_thread, &ingest_threads[x])) {
+			ingest_threads[x].threadid = AST_PTHREADT_NULL;
+			ast_log(LOG_WARNING, "Failed to create IAX2 ingest thread!\n");
+		}
+		if (ast_pthread_create_background(&readers[x].threadid, NULL, iax2_reader_thread, &readers[x])) {
+			readers[x].threadid = AST_PTHREADT_NULL;
+			ast_log(LOG_WARNING, "Failed to create IAX2 reader thread!\n");
+		}
+	}
 	ast_pthread_create_background(&schedthreadid, NULL, sched_thread, NULL);
 	ast_pthread_create_background(&netthreadid, NULL, network_thread, NULL);
-	if (option_verbose > 1)
+	if (option_verbose > 1) {
 		ast_verbose(VERBOSE_PREFIX_2 "%d helper threads started\n", threadcount);
+		if (iaxreaders)
+			ast_verbose(VERBOSE_PREFIX_2 "%d reader threads started\n", iaxreaders);
+	}
 	return 0;
 }
 
@@ -11339,6 +11830,20 @@ static void set_timing(void)
 {
 #ifdef HAVE_DAHDI
 	int bs = trunkfreq * 8;
+#endif
+#ifdef IAX_TIMERFD
+	struct itimerspec its;
+
+	if (timing_is_timerfd) {
+		its.it_interval.tv_sec = trunkfreq / 1000;
+		its.it_interval.tv_nsec = (trunkfreq % 1000) * 1000000;
+		its.it_value = its.it_interval;
+		if (timerfd_settime(timingfd, 0, &its, NULL))
+			ast_log(LOG_WARNING, "Unable to set trunk timer: %s\n", strerror(errno));
+		return;
+	}
+#endif
+#ifdef HAVE_DAHDI
 	if (timingfd > -1) {
 		if (
 #ifdef DAHDI_TIMERACK
@@ -11376,6 +11881,7 @@ static int set_config(const char *config_file, int reload)
 	char *cat;
 	const char *utype;
 	const char *tosval;
+	const char *readerval;
 	int format;
 	int portno = IAX_DEFAULT_PORTNO;
 	int  x;
@@ -11424,6 +11930,22 @@ static int set_config(const char *config_file, int reload)
 		if (ast_str2tos(tosval, &tos))
 			ast_log(LOG_WARNING, "Invalid tos value, see doc/ip-tos.txt for more information.\n");
 	}
+	/* Readers must exist before anything is bound */
+	readerval = ast_variable_retrieve(cfg, "general", "iaxreaders");
+	if (!reload && readerval) {
+		iaxreaders = atoi(readerval);
+		if (iaxreaders < 0) {
+			ast_log(LOG_NOTICE, "iaxreaders must be at least 0.\n");
+			iaxreaders = 0;
+		} else if (iaxreaders > MAX_READER_COUNT) {
+			ast_log(LOG_NOTICE, "Limiting iaxreaders to %d\n", MAX_READER_COUNT);
+			iaxreaders = MAX_READER_COUNT;
+		}
+		if (iaxreaders && alloc_readers())
+			ast_log(LOG_WARNING, "Unable to set up IAX2 reader threads, falling back to the network thread\n");
+	} else if (reload && readerval && atoi(readerval) != iaxreaders) {
+		ast_log(LOG_NOTICE, "Ignoring any changes to iaxreaders during reload\n");
+	}
 	while(v) {
 		if (!strcasecmp(v->name, "bindport")){ 
 			if (reload)
@@ -11488,7 +12010,7 @@ static int set_config(const char *config_file, int reload)
 			if (reload) {
 				ast_log(LOG_NOTICE, "Ignoring bindaddr on reload\n");
 			} else {
-				if (!(ns = ast_netsock_bind(netsock, io, v->value, portno, tos, socket_read, NULL))) {
+				if (!(ns = iax2_netsock_bind(v->value, portno))) {
 					ast_log(LOG_WARNING, "Unable apply binding to '%s' at line %d\n", v->value, v->lineno);
 				} else {
 					if (option_verbose > 1) {
@@ -11636,7 +12158,7 @@ static int set_config(const char *config_file, int reload)
 	}
 	
 	if (defaultsockfd < 0) {
-		if (!(ns = ast_netsock_bind(netsock, io, "0.0.0.0", portno, tos, socket_read, NULL))) {
+		if (!(ns = iax2_netsock_bind("0.0.0.0", portno))) {
 			ast_log(LOG_ERROR, "Unable to create network socket: %s\n", strerror(errno));
 		} else {
 			if (option_verbose > 1)
@@ -12331,7 +12853,8 @@ static char show_channels_usage[] =
 
 static char show_netstats_usage[] = 
 "Usage: iax2 show netstats\n"
-"       Lists network status for all currently active IAX channels.\n";
+"       Lists network status for all currently active IAX channels,\n"
+"       followed by how many call chunks each trunk peer batches per frame.\n";
 
 static char show_threads_usage[] = 
 "Usage: iax2 show threads\n"
@@ -12544,6 +13067,8 @@ static int __unload_module(void)
 		pthread_join(schedthreadid, NULL);
 	}
 	
+	stop_readers();
+
 	/* Call for all threads to halt */
 	AST_LIST_LOCK(&idle_list);
 	AST_LIST_TRAVERSE_SAFE_BEGIN(&idle_list, thread, list) {
@@ -12577,6 +13102,7 @@ static int __unload_module(void)
 	
 	ast_netsock_release(netsock);
 	ast_netsock_release(outsock);
+	free_readers();
 	for (x = 0; x < ARRAY_LEN(iaxs); x++) {
 		if (iaxs[x]) {
 			iax2_destroy(x);
@@ -12740,14 +13266,21 @@ static int load_module(void)
 	iax_set_error(iax_error_output);
 	jb_setoutput(jb_error_output, jb_warning_output, NULL);
 	
+#ifdef IAX_TIMERFD
+	/* A timerfd needs no hardware and ticks at exactly trunkfreq */
+	if ((timingfd = timerfd_create(CLOCK_MONOTONIC, 0)) > -1)
+		timing_is_timerfd = 1;
+#endif
 #ifdef HAVE_DAHDI
+	if (timingfd < 0) {
 #ifdef DAHDI_TIMERACK
-	timingfd = open(DAHDI_FILE_TIMER, O_RDWR);
-	if (timingfd < 0)
+		timingfd = open(DAHDI_FILE_TIMER, O_RDWR);
+		if (timingfd < 0)
 #endif
-		timingfd = open(DAHDI_FILE_PSEUDO, O_RDWR);
-	if (timingfd < 0) 
-		ast_log(LOG_WARNING, "Unable to open IAX timing interface: %s\n", strerror(errno));
+			timingfd = open(DAHDI_FILE_PSEUDO, O_RDWR);
+		if (timingfd < 0) 
+			ast_log(LOG_WARNING, "Unable to open IAX timing interface: %s\n", strerror(errno));
+	}
 #endif
 
 	memset(iaxs, 0, sizeof(iaxs));
@@ -554,8 +554,22 @@ static int local_hangup(struct ast_channel *ast)
 	} else {
 		p->owner = NULL;
 		ast_module_user_remove(p->u_owner);
+		/* Deadlock avoidance, since the other side may be in local_write()
+		   with its channel locked, waiting on p->lock */
+		while (p->chan && ast_channel_trylock(p->chan)) {
+			ast_mutex_unlock(&p->lock);
+			if (ast) {
+				ast_channel_unlock(ast);
+			}
+			usleep(1);
+			if (ast) {
+				ast_channel_lock(ast);
+			}
+			ast_mutex_lock(&p->lock);
+		}
 		if (p->chan) {
 			ast_queue_hangup(p->chan);
+			ast_channel_unlock(p->chan);
 		}
 	}
 	
@@ -2882,6 +2882,7 @@ static struct ast_frame *simpleusb_read(struct ast_channel *c)
         f->datalen = FRAME_SIZE * 2;
         f->data = o->simpleusb_read_frame_buf + AST_FRIENDLY_OFFSET;
 	if (!o->rxkeyed) memset(f->data,0,f->datalen);
+	ast_frame_stamp(f);
 	if (o->usedtmf && o->dsp)
 	{
 	    f1 = ast_dsp_process(c,o->dsp,f);
@@ -591,6 +591,21 @@ static struct ast_flags global_flags[2] = {{0}};        /*!< global SIP_ flags *
 /*! \brief Protect the SIP dialog list (of sip_pvt's) */
 AST_MUTEX_DEFINE_STATIC(iflock);
 
+/*! \brief Hash tables kept alongside the dialog list and the peer container.
+	dialogs_hash is keyed on Call-ID and protected by iflock. The peer tables
+	are keyed on name, IP:port and (for insecure=port peers) IP alone, and
+	are protected by peerhashlock. */
+#define HASH_DIALOG_SIZE	563
+#define HASH_PEER_SIZE		563
+
+static struct sip_pvt *dialogs_hash[HASH_DIALOG_SIZE];
+static int dialog_objs = 0;			/*!< Dialogs in dialogs_hash */
+static struct sip_peer *peers_by_name[HASH_PEER_SIZE];
+static struct sip_peer *peers_by_addr[HASH_PEER_SIZE];
+static struct sip_peer *peers_by_ip[HASH_PEER_SIZE];
+static int peer_hash_objs = 0;			/*!< Peers in peers_by_name */
+AST_RWLOCK_DEFINE_STATIC(peerhashlock);
+
 /*! \brief Protect the monitoring thread, so only one process can kill or start it, and not
    when it's doing something critical. */
 AST_MUTEX_DEFINE_STATIC(netlock);
@@ -615,6 +630,60 @@ static int *sipsock_read_id;            /*!< ID of IO entry for sipsock FD */
 #define DEC_CALL_RINGING 2
 #define INC_CALL_RINGING 3
 
+/*! \brief Structure for conversion between compressed SIP and "normal" SIP.
+	Every header listed here is indexed by parse_request(), the long form
+	in slot 2n and the compact form (if any) in slot 2n + 1, so get_header()
+	does not have to scan the message for them. */
+static const struct cfalias {
+	char * const fullname;
+	char * const shortname;
+	const int fulllen;
+} sip_headers[] = {
+#define SIP_HDR(full, compact) { full, compact, sizeof(full) - 1 }
+	SIP_HDR("Content-Type",		"c"),
+	SIP_HDR("Content-Encoding",	"e"),
+	SIP_HDR("From",			"f"),
+	SIP_HDR("Call-ID",		"i"),
+	SIP_HDR("Contact",		"m"),
+	SIP_HDR("Content-Length",	"l"),
+	SIP_HDR("Subject",		"s"),
+	SIP_HDR("To",			"t"),
+	SIP_HDR("Supported",		"k"),
+	SIP_HDR("Refer-To",		"r"),
+	SIP_HDR("Referred-By",		"b"),
+	SIP_HDR("Allow-Events",		"u"),
+	SIP_HDR("Event",		"o"),
+	SIP_HDR("Via",			"v"),
+	SIP_HDR("Accept-Contact",	"a"),
+	SIP_HDR("Reject-Contact",	"j"),
+	SIP_HDR("Request-Disposition",	"d"),
+	SIP_HDR("Session-Expires",	"x"),
+	SIP_HDR("Identity",		"y"),
+	SIP_HDR("Identity-Info",	"n"),
+	SIP_HDR("CSeq",			NULL),
+	SIP_HDR("Max-Forwards",		NULL),
+	SIP_HDR("Expires",		NULL),
+	SIP_HDR("Record-Route",		NULL),
+	SIP_HDR("Route",		NULL),
+	SIP_HDR("User-Agent",		NULL),
+	SIP_HDR("Require",		NULL),
+	SIP_HDR("Proxy-Require",	NULL),
+	SIP_HDR("Accept",		NULL),
+	SIP_HDR("Allow",		NULL),
+	SIP_HDR("Authorization",	NULL),
+	SIP_HDR("Proxy-Authorization",	NULL),
+	SIP_HDR("WWW-Authenticate",	NULL),
+	SIP_HDR("Proxy-Authenticate",	NULL),
+	SIP_HDR("Replaces",		NULL),
+	SIP_HDR("Remote-Party-ID",	NULL),
+	SIP_HDR("Diversion",		NULL),
+	SIP_HDR("Also",			NULL),
+	SIP_HDR("X-ClientCode",		NULL),
+#undef SIP_HDR
+};
+
+#define SIP_HDR_SLOTS	(2 * (sizeof(sip_headers) / sizeof(sip_headers[0])))
+
 /*! \brief sip_request: The data grabbed from the UDP socket */
 struct sip_request {
 	char *rlPart1; 	        /*!< SIP Method Name or "SIP/2.0" protocol version */
@@ -629,6 +698,8 @@ struct sip_request {
 	char data[SIP_MAX_PACKET];
 	unsigned int sdp_start; /*!< the line number where the SDP begins */
 	unsigned int sdp_end;   /*!< the line number where the SDP ends */
+	unsigned char header_first[SIP_HDR_SLOTS];	/*!< First header[] of each sip_headers slot, plus one, 0 if absent */
+	unsigned char header_next[SIP_MAX_HEADERS];	/*!< Next header[] in the same slot, plus one, 0 at the end */
 };
 
 /*
@@ -812,6 +883,7 @@ struct sip_auth {
 #define SIP_PKT_IGNORE 		(1 << 2)	/*!< This is a re-transmit, ignore it */
 #define SIP_PKT_IGNORE_RESP	(1 << 3)	/*!< Resp ignore - ??? */
 #define SIP_PKT_IGNORE_REQ	(1 << 4)	/*!< Req ignore - ??? */
+#define SIP_PKT_INDEXED		(1 << 5)	/*!< header_first/header_next are valid for header[] */
 
 /* T.38 set of flags */
 #define T38FAX_FILL_BIT_REMOVAL		(1 << 0)	/*!< Default: 0 (unset)*/
@@ -1023,6 +1095,9 @@ static struct sip_pvt {
 	size_t history_entries;			/*!< Number of entires in the history */
 	struct ast_variable *chanvars;		/*!< Channel variables to set for inbound call */
 	struct sip_pvt *next;			/*!< Next dialog in chain */
+	struct sip_pvt *hashnext;		/*!< Next dialog in the same Call-ID hash bucket */
+	unsigned int hashbucket;		/*!< Call-ID hash bucket this dialog is linked into */
+	unsigned int callid_hashed:1;		/*!< Linked into the Call-ID hash */
 	struct sip_invite_param *options;	/*!< Options for INVITE */
 	int autoframing;
 } *iflist = NULL;
@@ -1081,7 +1156,6 @@ struct sip_user {
 };
 
 /*! \brief Structure for SIP peer data, we place calls to peers if registered  or fixed IP address (host) */
-/* XXX field 'name' must be first otherwise sip_addrcmp() will fail */
 struct sip_peer {
 	ASTOBJ_COMPONENTS(struct sip_peer);	/*!< name, refcount, objflags,  object pointers */
 					/*!< peer->name is the unique name of this object */
@@ -1141,6 +1215,13 @@ struct sip_peer {
 	struct sip_pvt *mwipvt;		/*!<  Subscription for MWI */
 	int lastmsg;
 	int autoframing;
+	struct sip_peer *namenext;	/*!<  Next peer in the name hash bucket */
+	struct sip_peer *addrnext;	/*!<  Next peer in the IP:port hash bucket */
+	struct sip_peer *ipnext;	/*!<  Next insecure=port peer in the IP hash bucket */
+	struct sockaddr_in hashaddr;	/*!<  Address the peer is indexed under */
+	unsigned int hashed:1;		/*!<  Linked into the peer hash tables */
+	unsigned int addrhashed:1;	/*!<  Linked into the IP:port hash */
+	unsigned int iphashed:1;	/*!<  Linked into the IP-only hash */
 };
 
 
@@ -1351,8 +1432,14 @@ static int expire_register(const void *data);
 static void *do_monitor(void *data);
 static int restart_monitor(void);
 static int sip_send_mwi_to_peer(struct sip_peer *peer);
-static int sip_addrcmp(char *name, struct sockaddr_in *sin);	/* Support for peer matching */
 static int sip_refer_allocate(struct sip_pvt *p);
+static void dialog_hash_link(struct sip_pvt *p);
+static void dialog_hash_unlink(struct sip_pvt *p);
+static void dialog_hash_update(struct sip_pvt *p);
+static void peer_hash_link(struct sip_peer *peer);
+static void peer_hash_unlink(struct sip_peer *peer);
+static void peer_hash_update_addr(struct sip_peer *peer);
+static void peer_hash_unlink_marked(void);
 static void ast_quiet_chan(struct ast_channel *chan);
 static int attempt_transfer(struct sip_dual *transferer, struct sip_dual *target);
 
@@ -2657,6 +2744,7 @@ static struct sip_peer *realtime_peer(const char *newpeername, struct sockaddr_i
 			}
 		}
 		ASTOBJ_CONTAINER_LINK(&peerl,peer);
+		peer_hash_link(peer);
 	}
 	ast_set_flag(&peer->flags[0], SIP_REALTIME);
 	if(peerlist)
@@ -2666,14 +2754,221 @@ static struct sip_peer *realtime_peer(const char *newpeername, struct sockaddr_i
 	return peer;
 }
 
-/*! \brief Support routine for find_peer */
-static int sip_addrcmp(char *name, struct sockaddr_in *sin)
+/*! \brief Call-ID bucket for a dialog */
+static unsigned int dialog_hash_key(const char *callid)
+{
+	return (unsigned int) ast_str_hash(callid) % HASH_DIALOG_SIZE;
+}
+
+/*! \brief Link a dialog into the Call-ID hash
+ * \note Don't call without iflock locked */
+static void dialog_hash_link(struct sip_pvt *p)
+{
+	p->hashbucket = dialog_hash_key(p->callid);
+	p->hashnext = dialogs_hash[p->hashbucket];
+	dialogs_hash[p->hashbucket] = p;
+	p->callid_hashed = 1;
+	dialog_objs++;
+}
+
+/*! \brief Remove a dialog from the Call-ID hash
+ * \note Don't call without iflock locked */
+static void dialog_hash_unlink(struct sip_pvt *p)
+{
+	struct sip_pvt **pp;
+
+	if (!p->callid_hashed)
+		return;
+	for (pp = &dialogs_hash[p->hashbucket]; *pp; pp = &(*pp)->hashnext) {
+		if (*pp == p) {
+			*pp = p->hashnext;
+			break;
+		}
+	}
+	p->hashnext = NULL;
+	p->callid_hashed = 0;
+	dialog_objs--;
+}
+
+/*! \brief Move a dialog to the bucket of its current Call-ID after the Call-ID changed
+ * \note Don't call with the dialog locked, find_call() locks dialogs while holding iflock */
+static void dialog_hash_update(struct sip_pvt *p)
+{
+	ast_mutex_lock(&iflock);
+	if (p->callid_hashed && p->hashbucket != dialog_hash_key(p->callid)) {
+		dialog_hash_unlink(p);
+		dialog_hash_link(p);
+	}
+	ast_mutex_unlock(&iflock);
+}
+
+/*! \brief Peer name bucket, case insensitive like the peer name comparison */
+static unsigned int peer_name_key(const char *name)
+{
+	unsigned int hash = 5381;
+
+	while (*name)
+		hash = hash * 33 ^ tolower((unsigned char) *name++);
+	return hash % HASH_PEER_SIZE;
+}
+
+/*! \brief Peer address bucket, on IP:port or on the IP alone for insecure=port peers */
+static unsigned int peer_addr_key(const struct sockaddr_in *sin, int withport)
+{
+	unsigned int hash = ntohl(sin->sin_addr.s_addr);
+
+	if (withport)
+		hash = hash * 31 + ntohs(sin->sin_port);
+	hash *= 2654435761U;
+	return (hash ^ (hash >> 16)) % HASH_PEER_SIZE;
+}
+
+/*! \note Don't call without peerhashlock write locked */
+static void peer_hash_addr_link(struct sip_peer *peer)
+{
+	unsigned int key;
+
+	peer->hashaddr = peer->addr;
+	/* A peer without an address (not registered) can't match any packet */
+	if (!peer->hashaddr.sin_addr.s_addr)
+		return;
+	key = peer_addr_key(&peer->hashaddr, 1);
+	peer->addrnext = peers_by_addr[key];
+	peers_by_addr[key] = peer;
+	peer->addrhashed = 1;
+	if (ast_test_flag(&peer->flags[0], SIP_INSECURE_PORT)) {
+		key = peer_addr_key(&peer->hashaddr, 0);
+		peer->ipnext = peers_by_ip[key];
+		peers_by_ip[key] = peer;
+		peer->iphashed = 1;
+	}
+}
+
+/*! \note Don't call without peerhashlock write locked */
+static void peer_hash_addr_unlink(struct sip_peer *peer)
+{
+	struct sip_peer **pp;
+
+	if (peer->addrhashed) {
+		for (pp = &peers_by_addr[peer_addr_key(&peer->hashaddr, 1)]; *pp; pp = &(*pp)->addrnext) {
+			if (*pp == peer) {
+				*pp = peer->addrnext;
+				break;
+			}
+		}
+		peer->addrnext = NULL;
+		peer->addrhashed = 0;
+	}
+	if (peer->iphashed) {
+		for (pp = &peers_by_ip[peer_addr_key(&peer->hashaddr, 0)]; *pp; pp = &(*pp)->ipnext) {
+			if (*pp == peer) {
+				*pp = peer->ipnext;
+				break;
+			}
+		}
+		peer->ipnext = NULL;
+		peer->iphashed = 0;
+	}
+}
+
+/*! \brief Index a peer that has just been linked into peerl.
+	The tables hold no reference of their own, a peer must be
+	unindexed before the container drops its reference. */
+static void peer_hash_link(struct sip_peer *peer)
+{
+	unsigned int key;
+
+	ast_rwlock_wrlock(&peerhashlock);
+	if (!peer->hashed) {
+		key = peer_name_key(peer->name);
+		peer->namenext = peers_by_name[key];
+		peers_by_name[key] = peer;
+		peer->hashed = 1;
+		peer_hash_addr_link(peer);
+		peer_hash_objs++;
+	}
+	ast_rwlock_unlock(&peerhashlock);
+}
+
+/*! \brief Remove a peer from the hash tables, before unlinking it from peerl */
+static void peer_hash_unlink(struct sip_peer *peer)
+{
+	struct sip_peer **pp;
+
+	ast_rwlock_wrlock(&peerhashlock);
+	if (peer->hashed) {
+		for (pp = &peers_by_name[peer_name_key(peer->name)]; *pp; pp = &(*pp)->namenext) {
+			if (*pp == peer) {
+				*pp = peer->namenext;
+				break;
+			}
+		}
+		peer->namenext = NULL;
+		peer->hashed = 0;
+		peer_hash_addr_unlink(peer);
+		peer_hash_objs--;
+	}
+	ast_rwlock_unlock(&peerhashlock);
+}
+
+/*! \brief Re-index a peer after its address changed (registration, expiry) */
+static void peer_hash_update_addr(struct sip_peer *peer)
+{
+	ast_rwlock_wrlock(&peerhashlock);
+	if (peer->hashed && inaddrcmp(&peer->hashaddr, &peer->addr)) {
+		peer_hash_addr_unlink(peer);
+		peer_hash_addr_link(peer);
+	}
+	ast_rwlock_unlock(&peerhashlock);
+}
+
+/*! \brief Remove marked peers from the hash tables ahead of ASTOBJ_CONTAINER_PRUNE_MARKED() */
+static void peer_hash_unlink_marked(void)
 {
-	/* We know name is the first field, so we can cast */
-	struct sip_peer *p = (struct sip_peer *) name;
-	return 	!(!inaddrcmp(&p->addr, sin) || 
-					(ast_test_flag(&p->flags[0], SIP_INSECURE_PORT) &&
-					(p->addr.sin_addr.s_addr == sin->sin_addr.s_addr)));
+	ASTOBJ_CONTAINER_TRAVERSE(&peerl, 1, do {
+		if (iterator->objflags & ASTOBJ_FLAG_MARKED)
+			peer_hash_unlink(iterator);
+	} while (0) );
+}
+
+/*! \brief Find a peer by name in the name hash, returns a reference */
+static struct sip_peer *peer_hash_find_name(const char *name)
+{
+	struct sip_peer *p;
+
+	ast_rwlock_rdlock(&peerhashlock);
+	for (p = peers_by_name[peer_name_key(name)]; p; p = p->namenext) {
+		if (!strcasecmp(p->name, name)) {
+			ASTOBJ_REF(p);
+			break;
+		}
+	}
+	ast_rwlock_unlock(&peerhashlock);
+	return p;
+}
+
+/*! \brief Find a peer by source address, returns a reference.
+	An exact IP:port match wins, then an insecure=port peer on the same IP. */
+static struct sip_peer *peer_hash_find_addr(struct sockaddr_in *sin)
+{
+	struct sip_peer *p;
+
+	ast_rwlock_rdlock(&peerhashlock);
+	for (p = peers_by_addr[peer_addr_key(sin, 1)]; p; p = p->addrnext) {
+		if (!inaddrcmp(&p->addr, sin))
+			break;
+	}
+	if (!p) {
+		for (p = peers_by_ip[peer_addr_key(sin, 0)]; p; p = p->ipnext) {
+			if (ast_test_flag(&p->flags[0], SIP_INSECURE_PORT) &&
+			    p->addr.sin_addr.s_addr == sin->sin_addr.s_addr)
+				break;
+		}
+	}
+	if (p)
+		ASTOBJ_REF(p);
+	ast_rwlock_unlock(&peerhashlock);
+	return p;
 }
 
 /*! \brief Locate peer by name or ip address 
@@ -2684,9 +2979,9 @@ static struct sip_peer *find_peer(const char *peer, struct sockaddr_in *sin, int
 	struct sip_peer *p = NULL;
 
 	if (peer)
-		p = ASTOBJ_CONTAINER_FIND(&peerl, peer);
+		p = peer_hash_find_name(peer);
 	else
-		p = ASTOBJ_CONTAINER_FIND_FULL(&peerl, sin, name, sip_addr_hashfunc, 1, sip_addrcmp);
+		p = peer_hash_find_addr(sin);
 
 	if (!p && (realtime || devstate_only))
 		p = realtime_peer(peer, sin, devstate_only);
@@ -2863,6 +3158,7 @@ static int create_addr_from_peer(struct sip_pvt *dialog, struct sip_peer *peer)
 		if (c) {
 			*c = '\0';
 			ast_string_field_build(dialog, callid, "%s@%s", tmpcall, peer->fromdomain);
+			dialog_hash_update(dialog);
 		}
 	}
 	if (ast_strlen_zero(dialog->tohost))
@@ -3185,6 +3481,7 @@ static int __sip_destroy(struct sip_pvt *p, int lockowner)
 	for (prev = NULL, cur = iflist; cur; prev = cur, cur = cur->next) {
 		if (cur == p) {
 			UNLINK(cur, iflist, prev);
+			dialog_hash_unlink(cur);
 			break;
 		}
 	}
@@ -4240,42 +4537,59 @@ static char *get_body(struct sip_request *req, char *name)
 	return "";
 }
 
+/*! \brief Find the sip_headers slot for a header name, -1 if it isn't indexed */
+static int find_header_slot(const char *name, int len)
+{
+	int x;
+
+	if (len == 1) {
+		for (x = 0; x < SIP_HDR_SLOTS / 2; x++) {
+			if (sip_headers[x].shortname && tolower(*name) == *sip_headers[x].shortname)
+				return 2 * x + 1;
+		}
+		return -1;
+	}
+	for (x = 0; x < SIP_HDR_SLOTS / 2; x++) {
+		if (sip_headers[x].fulllen == len && !strncasecmp(sip_headers[x].fullname, name, len))
+			return 2 * x;
+	}
+	return -1;
+}
+
 /*! \brief Find compressed SIP alias */
 static const char *find_alias(const char *name, const char *_default)
 {
-	/*! \brief Structure for conversion between compressed SIP and "normal" SIP */
-	static const struct cfalias {
-		char * const fullname;
-		char * const shortname;
-	} aliases[] = {
-		{ "Content-Type",	 "c" },
-		{ "Content-Encoding",	 "e" },
-		{ "From",		 "f" },
-		{ "Call-ID",		 "i" },
-		{ "Contact",		 "m" },
-		{ "Content-Length",	 "l" },
-		{ "Subject",		 "s" },
-		{ "To",			 "t" },
-		{ "Supported",		 "k" },
-		{ "Refer-To",		 "r" },
-		{ "Referred-By",	 "b" },
-		{ "Allow-Events",	 "u" },
-		{ "Event",		 "o" },
-		{ "Via",		 "v" },
-		{ "Accept-Contact",      "a" },
-		{ "Reject-Contact",      "j" },
-		{ "Request-Disposition", "d" },
-		{ "Session-Expires",     "x" },
-		{ "Identity",            "y" },
-		{ "Identity-Info",       "n" },
-	};
-	int x;
+	int slot = find_header_slot(name, strlen(name));
 
-	for (x=0; x<sizeof(aliases) / sizeof(aliases[0]); x++) 
-		if (!strcasecmp(aliases[x].fullname, name))
-			return aliases[x].shortname;
+	if (slot < 0 || (slot & 1) || !sip_headers[slot / 2].shortname)
+		return _default;
+	return sip_headers[slot / 2].shortname;
+}
 
-	return _default;
+/*! \brief Add header[x] of a message being parsed to the header index
+	\param tail last header[] seen in each slot so far, plus one */
+static void index_header(struct sip_request *req, int x, unsigned char *tail)
+{
+	const char *h = req->header[x];
+	int len, slot;
+
+	len = strcspn(h, ": \t");
+	if (!len)
+		return;
+	/* Same rule as __get_header(): blanks before the ':' only when pedantic */
+	if (pedanticsipchecking) {
+		if (*ast_skip_blanks(h + len) != ':')
+			return;
+	} else if (h[len] != ':')
+		return;
+	if ((slot = find_header_slot(h, len)) < 0)
+		return;
+	req->header_next[x] = 0;
+	if (tail[slot])
+		req->header_next[tail[slot] - 1] = x + 1;
+	else
+		req->header_first[slot] = x + 1;
+	tail[slot] = x + 1;
 }
 
 static const char *__get_header(const struct sip_request *req, const char *name, int *start)
@@ -4291,6 +4605,28 @@ static const char *__get_header(const struct sip_request *req, const char *name,
 	 * Anyways, pedanticsipchecking controls whether we allow spaces before ':',
 	 * and we always allow spaces after that for compatibility.
 	 */
+	if (name && ast_test_flag(req, SIP_PKT_INDEXED)) {
+		int x, slot = find_header_slot(name, strlen(name));
+
+		/* Headers in sip_headers[] are found through the index parse_request()
+		   built, the long form first and then the compact form, just like the
+		   two passes below */
+		for (pass = 0; slot > -1 && pass < 2; pass++) {
+			for (x = req->header_first[slot]; x; x = req->header_next[x - 1]) {
+				if (x - 1 >= *start) {
+					*start = x;
+					return ast_skip_blanks(strchr(req->header[x - 1], ':') + 1);
+				}
+			}
+			if (pass == 0 && !(slot & 1) && sip_headers[slot / 2].shortname)
+				slot++;
+			else
+				break;
+		}
+		if (slot > -1)
+			return "";
+	}
+
 	for (pass = 0; name && pass < 2;pass++) {
 		int x, len = strlen(name);
 		for (x=*start; x<req->headers; x++) {
@@ -4451,7 +4787,7 @@ static void build_callid_pvt(struct sip_pvt *pvt)
 	const char *host = S_OR(pvt->fromdomain, ast_inet_ntoa(pvt->ourip));
 	
 	ast_string_field_build(pvt, callid, "%s@%s", generate_random_string(buf, sizeof(buf)), host);
-
+	dialog_hash_update(pvt);
 }
 
 /*! \brief Build SIP Call-ID value for a REGISTER transaction */
@@ -4592,6 +4928,7 @@ static struct sip_pvt *sip_alloc(ast_string_field callid, struct sockaddr_in *si
 	ast_mutex_lock(&iflock);
 	p->next = iflist;
 	iflist = p;
+	dialog_hash_link(p);
 	ast_mutex_unlock(&iflock);
 	if (option_debug)
 		ast_log(LOG_DEBUG, "Allocating new SIP dialog for %s - %s (%s)\n", callid ? callid : "(No Call-ID)", sip_methods[intended_method].text, p->rtp ? "With RTP" : "No RTP");
@@ -4635,7 +4972,7 @@ static struct sip_pvt *find_call(struct sip_request *req, struct sockaddr_in *si
 	}
 
 	ast_mutex_lock(&iflock);
-	for (p = iflist; p; p = p->next) {
+	for (p = dialogs_hash[dialog_hash_key(callid)]; p; p = p->hashnext) {
 		/* In pedantic, we do not want packets with bad syntax to be connected to a PVT */
 		int found = FALSE;
 		if (ast_strlen_zero(p->callid))
@@ -4849,8 +5186,11 @@ static int parse_request(struct sip_request *req)
 	/* Divide fields by NULL's */
 	char *c;
 	int f = 0;
+	unsigned char tail[SIP_HDR_SLOTS];
 
 	c = req->data;
+	memset(req->header_first, 0, sizeof(req->header_first));
+	memset(tail, 0, sizeof(tail));
 
 	/* First header starts immediately */
 	req->header[f] = c;
@@ -4869,7 +5209,7 @@ static int parse_request(struct sip_request *req)
 			if (f >= SIP_MAX_HEADERS - 1) {
 				ast_log(LOG_WARNING, "Too many SIP headers. Ignoring.\n");
 			} else
-				f++;
+				index_header(req, f++, tail);
 			req->header[f] = c + 1;
 		} else if (*c == '\r') {
 			/* Ignore but eliminate \r's */
@@ -4881,9 +5221,10 @@ static int parse_request(struct sip_request *req)
 	if (!ast_strlen_zero(req->header[f])) {
 		if (sipdebug && option_debug > 3)
 			ast_log(LOG_DEBUG, "Header %d: %s (%d)\n", f, req->header[f], (int) strlen(req->header[f]));
-		f++;
+		index_header(req, f++, tail);
 	}
 	req->headers = f;
+	ast_set_flag(req, SIP_PKT_INDEXED);
 	/* Now we process any mime content */
 	f = 0;
 	req->line[f] = c;
@@ -5665,6 +6006,7 @@ static int add_header(struct sip_request *req, const char *var, const char *valu
 	}
 
 	req->header[req->headers] = req->data + req->len;
+	ast_clear_flag(req, SIP_PKT_INDEXED);
 
 	if (compactheaders)
 		var = find_alias(var, var);
@@ -7974,6 +8316,7 @@ static int expire_register(const void *data)
 		return 0;
 
 	memset(&peer->addr, 0, sizeof(peer->addr));
+	peer_hash_update_addr(peer);
 
 	destroy_association(peer);	/* remove registration data from storage */
 	
@@ -7988,6 +8331,7 @@ static int expire_register(const void *data)
 	if (ast_test_flag(&peer->flags[1], SIP_PAGE2_SELFDESTRUCT) ||
 	    ast_test_flag(&peer->flags[1], SIP_PAGE2_RTAUTOCLEAR)) {
 		struct sip_peer *peer_ptr = peer_ptr;
+		peer_hash_unlink(peer);
 		peer_ptr = ASTOBJ_CONTAINER_UNLINK(&peerl, peer);
 		if (peer_ptr) {
 			ASTOBJ_UNREF(peer_ptr, sip_destroy_peer);
@@ -8221,6 +8565,7 @@ static enum parse_register_result parse_register_contact(struct sip_pvt *pvt, st
 	} else if (!strcasecmp(curi, "*") || !expiry) {	/* Unregister this peer */
 		/* This means remove all registrations and return OK */
 		memset(&peer->addr, 0, sizeof(peer->addr));
+		peer_hash_update_addr(peer);
 		if (!AST_SCHED_DEL(sched, peer->expire)) {
 			struct sip_peer *peer_ptr = peer;
 			ASTOBJ_UNREF(peer_ptr, sip_destroy_peer);
@@ -8296,6 +8641,7 @@ static enum parse_register_result parse_register_contact(struct sip_pvt *pvt, st
 		   with */
 		peer->addr = pvt->recv;
 	}
+	peer_hash_update_addr(peer);
 
 	/* Save SIP options profile */
 	peer->sipoptions = pvt->sipoptions;
@@ -8832,6 +9178,7 @@ static enum check_auth_result register_verify(struct sip_pvt *p, struct sockaddr
 		peer = temp_peer(name);
 		if (peer) {
 			ASTOBJ_CONTAINER_LINK(&peerl, peer);
+			peer_hash_link(peer);
 			if (sip_cancel_destroy(p))
 				ast_log(LOG_WARNING, "Unable to cancel SIP destruction.  Expect bad things.\n");
 			switch (parse_register_contact(p, peer, req)) {
@@ -9060,7 +9407,7 @@ static struct sip_pvt *get_sip_pvt_byid_locked(const char *callid, const char *t
 		ast_log(LOG_DEBUG, "Looking for callid %s (fromtag %s totag %s)\n", callid, fromtag ? fromtag : "<no fromtag>", totag ? totag : "<no totag>");
 
 	/* Search interfaces and find the match */
-	for (sip_pvt_ptr = iflist; sip_pvt_ptr; sip_pvt_ptr = sip_pvt_ptr->next) {
+	for (sip_pvt_ptr = dialogs_hash[dialog_hash_key(callid)]; sip_pvt_ptr; sip_pvt_ptr = sip_pvt_ptr->hashnext) {
 		if (!strcmp(sip_pvt_ptr->callid, callid)) {
 			int match = 1;
 
@@ -10347,6 +10694,7 @@ static int sip_prune_realtime(int fd, int argc, char *argv[])
 				ASTOBJ_UNLOCK(iterator);
 			} while (0) );
 			if (pruned) {
+				peer_hash_unlink_marked();
 				ASTOBJ_CONTAINER_PRUNE_MARKED(&peerl, sip_destroy_peer);
 				ast_cli(fd, "%d peers pruned.\n", pruned);
 			} else
@@ -10379,9 +10727,11 @@ static int sip_prune_realtime(int fd, int argc, char *argv[])
 	} else {
 		if (prunepeer) {
 			if ((peer = ASTOBJ_CONTAINER_FIND_UNLINK(&peerl, name))) {
+				peer_hash_unlink(peer);
 				if (!ast_test_flag(&peer->flags[1], SIP_PAGE2_RTCACHEFRIENDS)) {
 					ast_cli(fd, "Peer '%s' is not a Realtime peer, cannot be pruned.\n", name);
 					ASTOBJ_CONTAINER_LINK(&peerl, peer);
+					peer_hash_link(peer);
 				} else
 					ast_cli(fd, "Peer '%s' pruned.\n", name);
 				ASTOBJ_UNREF(peer, sip_destroy_peer);
@@ -10790,6 +11140,56 @@ static int sip_show_registry(int fd, int argc, char *argv[])
 #undef FORMAT2
 }
 
+/*! \brief Print object counts and bucket usage of the dialog and peer hash tables */
+static void show_hash_stats(int fd)
+{
+	struct sip_pvt *cur;
+	struct sip_peer *peer;
+	int dialogs, peers, addrs = 0, used, longest, chain, x;
+
+	ast_cli(fd, "\nObject Hash Tables:\n");
+	ast_cli(fd, "-------------------\n");
+
+	ast_mutex_lock(&iflock);
+	dialogs = dialog_objs;
+	for (x = 0, used = 0, longest = 0; x < HASH_DIALOG_SIZE; x++) {
+		for (cur = dialogs_hash[x], chain = 0; cur; cur = cur->hashnext)
+			chain++;
+		if (chain)
+			used++;
+		if (chain > longest)
+			longest = chain;
+	}
+	ast_mutex_unlock(&iflock);
+	ast_cli(fd, "  Dialogs (by Call-ID):   %d in %d/%d buckets, load %.2f, longest chain %d\n",
+		dialogs, used, HASH_DIALOG_SIZE, (double) dialogs / HASH_DIALOG_SIZE, longest);
+
+	ast_rwlock_rdlock(&peerhashlock);
+	peers = peer_hash_objs;
+	for (x = 0, used = 0, longest = 0; x < HASH_PEER_SIZE; x++) {
+		for (peer = peers_by_name[x], chain = 0; peer; peer = peer->namenext)
+			chain++;
+		if (chain)
+			used++;
+		if (chain > longest)
+			longest = chain;
+	}
+	ast_cli(fd, "  Peers (by name):        %d in %d/%d buckets, load %.2f, longest chain %d\n",
+		peers, used, HASH_PEER_SIZE, (double) peers / HASH_PEER_SIZE, longest);
+	for (x = 0, used = 0, longest = 0; x < HASH_PEER_SIZE; x++) {
+		for (peer = peers_by_addr[x], chain = 0; peer; peer = peer->addrnext)
+			chain++;
+		addrs += chain;
+		if (chain)
+			used++;
+		if (chain > longest)
+			longest = chain;
+	}
+	ast_rwlock_unlock(&peerhashlock);
+	ast_cli(fd, "  Peers (by IP:port):     %d in %d/%d buckets, load %.2f, longest chain %d\n",
+		addrs, used, HASH_PEER_SIZE, (double) addrs / HASH_PEER_SIZE, longest);
+}
+
 /*! \brief List global settings for the SIP channel */
 static int sip_show_settings(int fd, int argc, char *argv[])
 {
@@ -10893,6 +11293,7 @@ static int sip_show_settings(int fd, int argc, char *argv[])
 		ast_cli(fd, "  Save sys. name:         %s\n", ast_test_flag(&global_flags[1], SIP_PAGE2_RTSAVE_SYSNAME) ? "Yes" : "No");
 		ast_cli(fd, "  Auto Clear:             %d\n", global_rtautoclear);
 	}
+	show_hash_stats(fd);
 	ast_cli(fd, "\n----\n");
 	return RESULT_SUCCESS;
 }
@@ -17076,6 +17477,7 @@ static struct sip_peer *build_peer(const char *name, struct ast_variable *v, str
 
 	if (peer) {
 		/* Already in the list, remove it and it will be added back (or FREE'd)  */
+		peer_hash_unlink(peer);
 		found = 1;
 		if (!(peer->objflags & ASTOBJ_FLAG_MARKED))
 			firstpass = 0;
@@ -17770,6 +18172,7 @@ static int reload_config(enum channelreloadreason reason)
 					if (peer) {
 						ast_device_state_changed("SIP/%s", peer->name);
 						ASTOBJ_CONTAINER_LINK(&peerl,peer);
+						peer_hash_link(peer);
 						ASTOBJ_UNREF(peer, sip_destroy_peer);
 						peer_count++;
 					}
@@ -17838,6 +18241,7 @@ static int reload_config(enum channelreloadreason reason)
 				peer = build_peer(cat, ast_variable_browse(cfg, cat), NULL, 0);
 				if (peer) {
 					ASTOBJ_CONTAINER_LINK(&peerl,peer);
+					peer_hash_link(peer);
 					ASTOBJ_UNREF(peer, sip_destroy_peer);
 					peer_count++;
 				}
@@ -18420,6 +18824,7 @@ static int sip_do_reload(enum channelreloadreason reason)
 	reload_config(reason);
 
 	/* Prune peers who still are supposed to be deleted */
+	peer_hash_unlink_marked();
 	ASTOBJ_CONTAINER_PRUNE_MARKED(&peerl, sip_destroy_peer);
 	if (option_debug > 3)
 		ast_log(LOG_DEBUG, "--------------- Done destroying pruned peers\n");
@@ -18705,6 +19110,7 @@ restartdestroy:
 
 	ASTOBJ_CONTAINER_DESTROYALL(&userl, sip_destroy_user);
 	ASTOBJ_CONTAINER_DESTROY(&userl);
+	ASTOBJ_CONTAINER_TRAVERSE(&peerl, 1, peer_hash_unlink(iterator));
 	ASTOBJ_CONTAINER_DESTROYALL(&peerl, sip_destroy_peer);
 	ASTOBJ_CONTAINER_DESTROY(&peerl);
 	ASTOBJ_CONTAINER_DESTROYALL(&regl, sip_registry_destroy);
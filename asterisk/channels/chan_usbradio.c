@@ -3045,6 +3045,7 @@ static struct ast_frame *usbradio_read(struct ast_channel *c)
 	}
 	if (!o->rxkeyed) memset(f->data,0,f->datalen);
 	f->offset = AST_FRIENDLY_OFFSET;
+	ast_frame_stamp(f);
 	if (o->usedtmf && o->dsp)
 	{
 	    f1 = ast_dsp_process(c,o->dsp,f);
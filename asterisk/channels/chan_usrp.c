@@ -94,6 +94,7 @@ struct usrp_rxq {
 	struct usrp_rxq *qe_forw;
 	struct usrp_rxq *qe_back;
 	char buf[USRP_VOICE_FRAME_SIZE];
+	struct timeval rxtime;		/* when it came in, while latency tracing */
 } ;
 
 struct usrp_pvt {
@@ -434,6 +435,7 @@ static struct ast_frame  *usrp_xread(struct ast_channel *ast)
 					ast_log(LOG_NOTICE,"Cannot malloc for qp\n");
 				} else {
 					memcpy(qp->buf,bufdata,USRP_VOICE_FRAME_SIZE);
+					qp->rxtime = ast_latency_tracing ? ast_tvnow() : ast_tv(0,0);
 					insque((struct qelem *) qp,(struct qelem *) p->rxq.qe_back);
 				}
 			}
@@ -521,6 +523,7 @@ static int usrp_xwrite(struct ast_channel *ast, struct ast_frame *frame)
 			qp = p->rxq.qe_forw;
 			remque((struct qelem *) qp);
 			memcpy(buf + AST_FRIENDLY_OFFSET,qp->buf,USRP_VOICE_FRAME_SIZE);
+			fr.ingress = qp->rxtime;
 			ast_free(qp);
 
 			fr.datalen = USRP_VOICE_FRAME_SIZE;
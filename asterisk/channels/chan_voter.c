@@ -408,6 +408,7 @@ struct voter_client {
 	char pswd[VOTER_NAME_LEN];
 	uint8_t *audio;
 	uint8_t *rssi;
+	struct timeval *rxtime;		/* when each frame's worth of audio came in, while latency tracing */
 	uint32_t respdigest;
 	struct sockaddr_in sin;
 	int drainindex;
@@ -470,6 +471,7 @@ struct voter_pvt {
 	char rxkey;
 	struct ast_module_user *u;
 	struct timeval lastrxtime;
+	struct timeval rxingress;	/* when the winner's audio now being sent came in */
 	char drained_once;
 	int testcycle;
 	int testindex;
@@ -920,9 +922,15 @@ long long btime;
 struct voter_client *client;
 
 	if (p == NULL) return;
+	p->rxingress = ast_tv(0,0);
 	for(client = clients; client; client = client->next)
 	{
 		if (client->nodenum != p->nodenum) continue;
+		if (client->rxtime)
+		{
+			if (client == p->winner) p->rxingress = client->rxtime[client->drainindex / FRAME_SIZE];
+			client->rxtime[client->drainindex / FRAME_SIZE] = ast_tv(0,0);
+		}
 		if (!client->drain40ms) 
 		{
 			client->drainindex_40ms = client->drainindex;
@@ -1254,40 +1262,27 @@ static int voter_write(struct ast_channel *ast, struct ast_frame *frame)
 static struct ast_frame *ast_frcat(struct ast_frame *f1, struct ast_frame *f2)
 {
 
-struct ast_frame *f;
+struct ast_frame fr;
 char *cp;
-int len;
 
 	if ((f1->subclass != f2->subclass) || (f1->frametype != f2->frametype))
 	{
 		ast_log(LOG_ERROR,"ast_frcat() called with non-matching frame types!!\n");
 		return NULL;
 	}
-	f = (struct ast_frame *)ast_malloc(sizeof(struct ast_frame));
-	if (!f)
-	{
-		ast_log(LOG_ERROR,"Cant malloc()\n");
-		return NULL;
-	}
-	memset(f,0,sizeof(struct ast_frame));
-	len = f1->datalen + f2->datalen + AST_FRIENDLY_OFFSET;
-	cp = malloc(len);
-	if (!cp)
-	{
-		ast_log(LOG_ERROR,"Cant malloc()\n");
-		return NULL;
-	}
-	memcpy(cp + AST_FRIENDLY_OFFSET,AST_FRAME_DATAP(f1),f1->datalen);
-	memcpy(cp + AST_FRIENDLY_OFFSET + f1->datalen,AST_FRAME_DATAP(f2),f2->datalen);
-	f->frametype = f1->frametype;
-	f->subclass = f1->subclass;
-	f->datalen = f1->datalen + f2->datalen;
-	f->samples = f1->samples + f2->samples;
-	AST_FRAME_DATAP(f) = cp + AST_FRIENDLY_OFFSET;;
-	f->mallocd = AST_MALLOCD_HDR | AST_MALLOCD_DATA;
-	f->src = "ast_frcat";
-	f->offset = AST_FRIENDLY_OFFSET;
-	return(f);
+	/* glue the payloads together on the stack, ast_frdup() then makes
+	   the frame in one (slab) allocation */
+	cp = alloca(f1->datalen + f2->datalen);
+	memcpy(cp,AST_FRAME_DATAP(f1),f1->datalen);
+	memcpy(cp + f1->datalen,AST_FRAME_DATAP(f2),f2->datalen);
+	memset(&fr,0,sizeof(fr));
+	fr.frametype = f1->frametype;
+	fr.subclass = f1->subclass;
+	fr.datalen = f1->datalen + f2->datalen;
+	fr.samples = f1->samples + f2->samples;
+	AST_FRAME_DATA(fr) = cp;
+	fr.src = "ast_frcat";
+	return(ast_frdup(&fr));
 }
 
 
@@ -1537,7 +1532,11 @@ static int voter_mix_and_send(struct voter_pvt *p, struct voter_client *maxclien
 			x = 1;
 		}
 	}
-	if (!x) ast_queue_frame(p->owner,f1);
+	if (!x)
+	{
+		f1->ingress = p->rxingress;
+		ast_queue_frame(p->owner,f1);
+	}
 	else
 	{
 		memset(silbuf,0,sizeof(silbuf));
@@ -2051,6 +2050,7 @@ struct timeval tv;
 		{
 			short *sap,s;
 			unsigned char nubuf[FRAME_SIZE];
+			short nulin[FRAME_SIZE];
 
 			if (p->nulawf1 == NULL) p->nulawf1 = ast_frdup(f1);
 			else
@@ -2081,8 +2081,9 @@ struct timeval tv;
 					s = *sap++;
 					if (s > 14000) s = 14000;
 					if (s < -14000) s = -14000;
-					nubuf[i] = AST_LIN2MU(lpass4(s,p->tlpx,p->tlpy));
+					nulin[i] = lpass4(s,p->tlpx,p->tlpy);
 				}
+				ast_lin2mu_buf(nubuf,nulin,i);
 				memcpy(audiopacket.audio,nubuf,sizeof(nubuf));
 				audiopacket.vp.curtime.vtime_sec = htonl(master_time.vtime_sec);
 				audiopacket.vp.payload_type = htons(4);
@@ -3212,15 +3213,52 @@ static void rpt_manager_success(struct mansession *s, const struct message *m)
 	astman_append(s, "Response: Success\r\n");
 }
 
-static int manager_voter_status(struct mansession *ses, const struct message *m)
+/*
+ * VoterStatus output is built at most once per voter timer tick for a given
+ * Node list, and the same text is handed to every manager session that asks
+ * for it during that tick. Dashboards polling many nodes then cost one walk
+ * of the client list instead of one per request.
+ */
+
+static char *voter_status_buf = NULL;
+static int voter_status_len = 0;
+static int voter_status_size = 0;
+static int voter_status_tick = -1;
+static char voter_status_nodes[100];
+
+static void voter_status_append(const char *fmt, ...) __attribute__ ((format (printf, 1, 2)));
+
+static void voter_status_append(const char *fmt, ...)
+{
+va_list ap;
+int n;
+char *newbuf;
+
+	for(;;)
+	{
+		va_start(ap,fmt);
+		n = vsnprintf(voter_status_buf + voter_status_len,voter_status_size - voter_status_len,fmt,ap);
+		va_end(ap);
+		if (n < 0) return;
+		if (voter_status_len + n < voter_status_size) break;
+		newbuf = ast_realloc(voter_status_buf,voter_status_size + n + 1024);
+		if (!newbuf) return;
+		voter_status_buf = newbuf;
+		voter_status_size += n + 1024;
+	}
+	voter_status_len += n;
+}
+
+/* build VoterStatus body into voter_status_buf, must be called with voter_lock held */
+static void voter_build_status(const char *node)
 {
-int success = 0,i,j,n;
+int i,j,n;
 struct voter_pvt *p;
 struct voter_client *client;
-const char *node = astman_get_header(m, "Node");
 char *str,*strs[100];
 
-	ast_mutex_lock(&voter_lock);
+	voter_status_len = 0;
+	if (voter_status_buf) *voter_status_buf = 0;
 	str = NULL;
 	if (node) str = ast_strdup(node);
 	n = 0;
@@ -3241,44 +3279,59 @@ char *str,*strs[100];
 			}
 			if (i >= n) continue;
 		}
-		if (!success) rpt_manager_success(ses,m);
-		success = 1;
-		astman_append(ses,"Node: %d\r\n",p->nodenum);
+		voter_status_append("Node: %d\r\n",p->nodenum);
 		if (p->lastwon) 
-			astman_append(ses,"Voted: %s\r\n",p->lastwon->name);
+			voter_status_append("Voted: %s\r\n",p->lastwon->name);
 		for(client = clients; client; client = client->next)
 		{
 			if (client->nodenum != p->nodenum) continue;
 			if (!client->heardfrom) continue;
 			if (IS_CLIENT_PROXY(client))
 			{
-				astman_append(ses,"Client: %s",client->name);
-				if (client->dynamic) astman_append(ses," Dynamic");
-				if (client->mix) astman_append(ses," Mix");
-				if (client->ismaster) astman_append(ses," Master");
-				if (client->curmaster) astman_append(ses," ActiveMaster");
-				astman_append(ses,"\r\n");
-				astman_append(ses,"IP: %s:%d (Proxied)\r\n",
+				voter_status_append("Client: %s%s%s%s%s\r\n",client->name,
+					(client->dynamic) ? " Dynamic" : "",(client->mix) ? " Mix" : "",
+					(client->ismaster) ? " Master" : "",(client->curmaster) ? " ActiveMaster" : "");
+				voter_status_append("IP: %s:%d (Proxied)\r\n",
 					ast_inet_ntoa(client->proxy_sin.sin_addr),ntohs(client->proxy_sin.sin_port));
 			}
 			else
 			{
 				if (!client->respdigest) continue;
-				astman_append(ses,"Client: %s",client->name);
-				if (client->dynamic) astman_append(ses," Dynamic");
-				if (client->mix) astman_append(ses," Mix");
-				if (client->ismaster) astman_append(ses," Master");
-				if (client->curmaster) astman_append(ses," ActiveMaster");
-				astman_append(ses,"\r\n");
-				astman_append(ses,"IP: %s:%d\r\n",
+				voter_status_append("Client: %s%s%s%s%s\r\n",client->name,
+					(client->dynamic) ? " Dynamic" : "",(client->mix) ? " Mix" : "",
+					(client->ismaster) ? " Master" : "",(client->curmaster) ? " ActiveMaster" : "");
+				voter_status_append("IP: %s:%d\r\n",
 					ast_inet_ntoa(client->sin.sin_addr),ntohs(client->sin.sin_port));
 			}
-			astman_append(ses,"RSSI: %d\r\n",client->lastrssi);
+			voter_status_append("RSSI: %d\r\n",client->lastrssi);
 		}
 	}
+	if (str) ast_free(str);
+}
+
+static int manager_voter_status(struct mansession *ses, const struct message *m)
+{
+const char *node = astman_get_header(m, "Node");
+char *status;
+
+	ast_mutex_lock(&voter_lock);
+	if ((voter_status_tick != voter_timing_count) || strcmp(voter_status_nodes,S_OR(node,"")))
+	{
+		voter_build_status(node);
+		voter_status_tick = voter_timing_count;
+		ast_copy_string(voter_status_nodes,S_OR(node,""),sizeof(voter_status_nodes));
+	}
+	status = NULL;
+	if (voter_status_len) status = ast_strdup(voter_status_buf);
 	ast_mutex_unlock(&voter_lock);
+	/* send it outside of voter_lock, a slow manager client must not stall the voter */
+	if (status)
+	{
+		rpt_manager_success(ses,m);
+		astman_append(ses,"%s",status);
+		ast_free(status);
+	}
 	astman_append(ses, "\r\n");	/* Properly terminate Manager output */
-	if (str) ast_free(str);
 	return RESULT_SUCCESS;
 }
 
@@ -3878,7 +3931,7 @@ static void *voter_reader(void *data)
 								else if (ntohs(vph->payload_type) == VOTER_PAYLOAD_NULAW)
 								{
 
-									short s,xbuf[FRAME_SIZE * 2];
+									short s,xbuf[FRAME_SIZE * 2],mulin[FRAME_SIZE];
 #ifdef	NULAW_LOOPBACK
 									memset(&audiopacket,0,sizeof(audiopacket));
 									strcpy((char *)audiopacket.vp.challenge,challenge);
@@ -3891,10 +3944,10 @@ static void *voter_reader(void *data)
 									sendto(udp_socket, &audiopacket, sizeof(audiopacket),0,(struct sockaddr *)&client->sin,sizeof(client->sin));
 #endif
 
+									ast_mulaw_buf(mulin,(unsigned char *)buf + sizeof(VOTER_PACKET_HEADER) + 1,FRAME_SIZE);
 									for(i = 0; i < FRAME_SIZE * 2; i += 2)
 									{
- 										s = (AST_MULAW((int)(unsigned char)
-											buf[sizeof(VOTER_PACKET_HEADER) + 1 + (i >> 1)])) / 2;
+ 										s = mulin[i >> 1] / 2;
 										xbuf[i] = lpass4(s,p->rlpx,p->rlpy);
 										xbuf[i + 1] = lpass4(s,p->rlpx,p->rlpy);
 									}
@@ -3932,6 +3985,13 @@ static void *voter_reader(void *data)
 										((f1) ? AST_FRAME_DATAP(f1) : buf + sizeof(VOTER_PACKET_HEADER) + 1) + (flen + i),-i);
 									memset(client->rssi,buf[sizeof(VOTER_PACKET_HEADER)],-i);
 								}
+								if (ast_latency_tracing)
+								{
+									struct timeval now = ast_tvnow();
+
+									for(i = 0; i < flen; i += FRAME_SIZE)
+										client->rxtime[((index + i) % client->buflen) / FRAME_SIZE] = now;
+								}
 								if (f1) ast_frfree(f1);
                                                         } 
 							else if (client->mix)
@@ -4265,15 +4325,14 @@ static void *voter_reader(void *data)
 										}
 										if (p->plfilter || p->hostdeemp) 
 										{
-											short ix;
+											short ix[FRAME_SIZE];
+											ast_mulaw_buf(ix,(unsigned char *)p->buf + AST_FRIENDLY_OFFSET,FRAME_SIZE);
 											for(i = 0; i < FRAME_SIZE; i++)
 											{
-												j = p->buf[AST_FRIENDLY_OFFSET + i] & 0xff;
-												ix = AST_MULAW(j);
-												if (p->plfilter) ix = hpass6(ix,p->hpx,p->hpy);
-												if (p->hostdeemp) ix = deemp1(ix,&p->hdx);
-												p->buf[AST_FRIENDLY_OFFSET + i] = AST_LIN2MU(ix);
+												if (p->plfilter) ix[i] = hpass6(ix[i],p->hpx,p->hpy);
+												if (p->hostdeemp) ix[i] = deemp1(ix[i],&p->hdx);
 											}
+											ast_lin2mu_buf((unsigned char *)p->buf + AST_FRIENDLY_OFFSET,ix,FRAME_SIZE);
 										}
 										stream.curtime = master_time;
 										memcpy(stream.audio,p->buf + AST_FRIENDLY_OFFSET,FRAME_SIZE);
@@ -4933,6 +4992,31 @@ static int reload(void)
 				}
 				memset(client->rssi,0,client->buflen);
 			}
+			if (client->rxtime && client->old_buflen && (client->buflen != client->old_buflen))
+			{
+				client->rxtime = (struct timeval *)ast_realloc(client->rxtime,(client->buflen / FRAME_SIZE) * sizeof(struct timeval));
+				if (!client->rxtime)
+				{
+					ast_log(LOG_ERROR,"Cant realloc()\n");
+			                close(udp_socket);
+					ast_config_destroy(cfg);
+					ast_mutex_unlock(&voter_lock);
+					return -1;
+				}
+				memset(client->rxtime,0,(client->buflen / FRAME_SIZE) * sizeof(struct timeval));
+			}
+			else if (!client->rxtime)
+			{
+				client->rxtime = (struct timeval *)ast_calloc(client->buflen / FRAME_SIZE,sizeof(struct timeval));
+				if (!client->rxtime)
+				{
+					ast_log(LOG_ERROR,"Cant malloc()\n");
+			                close(udp_socket);
+					ast_config_destroy(cfg);
+					ast_mutex_unlock(&voter_lock);
+					return -1;
+				}
+			}
 			/* if a new client, add it into list */
 			if (newclient)
 			{
@@ -4974,6 +5058,7 @@ static int reload(void)
 		if (client->reload) continue;
 		if (client->audio) ast_free(client->audio);
 		if (client->rssi) ast_free(client->rssi);
+		if (client->rxtime) ast_free(client->rxtime);
 		if (client->gpsid) ast_free(client->gpsid);
 		for(client1 = clients; client1; client1 = client1->next)
 		{
@@ -60,9 +60,8 @@ static int alawtolin_framein(struct ast_trans_pvt *pvt, struct ast_frame *f)
 
 	pvt->samples += i;
 	pvt->datalen += i * 2;	/* 2 bytes/sample */
-	
-	while (i--)
-		*dst++ = AST_ALAW(*src++);
+
+	ast_alaw_buf(dst, src, i);
 
 	return 0;
 }
@@ -77,8 +76,7 @@ static int lintoalaw_framein(struct ast_trans_pvt *pvt, struct ast_frame *f)
 	pvt->samples += i;
 	pvt->datalen += i;	/* 1 byte/sample */
 
-	while (i--) 
-		*dst++ = AST_LIN2A(*src++);
+	ast_lin2a_buf((unsigned char *) dst, src, i);
 
 	return 0;
 }
@@ -232,6 +232,7 @@ static struct ast_translator lintogsm = {
 	.sample = lintogsm_sample,
 	.desc_size = sizeof (struct gsm_translator_pvt ),
 	.buf_size = (BUFFER_SAMPLES * GSM_FRAME_LEN + GSM_SAMPLES - 1)/GSM_SAMPLES,
+	.buffer_samples = BUFFER_SAMPLES,
 };
 
 
@@ -220,6 +220,7 @@ static struct ast_translator lintoilbc = {
 	.sample = lintoilbc_sample,
 	.desc_size = sizeof(struct ilbc_coder_pvt),
 	.buf_size = (BUFFER_SAMPLES * ILBC_FRAME_LEN + ILBC_SAMPLES - 1) / ILBC_SAMPLES,
+	.buffer_samples = BUFFER_SAMPLES,
 };
 
 static int unload_module(void)
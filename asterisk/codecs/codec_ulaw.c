@@ -62,8 +62,7 @@ static int ulawtolin_framein(struct ast_trans_pvt *pvt, struct ast_frame *f)
 	pvt->datalen += i * 2;	/* 2 bytes/sample */
 
 	/* convert and copy in outbuf */
-	while (i--)
-		*dst++ = AST_MULAW(*src++);
+	ast_mulaw_buf(dst, src, i);
 
 	return 0;
 }
@@ -78,8 +77,7 @@ static int lintoulaw_framein(struct ast_trans_pvt *pvt, struct ast_frame *f)
 	pvt->samples += i;
 	pvt->datalen += i;	/* 1 byte/sample */
 
-	while (i--)
-		*dst++ = AST_LIN2MU(*src++);
+	ast_lin2mu_buf((unsigned char *) dst, src, i);
 
 	return 0;
 }
@@ -30,11 +30,15 @@ static char const	ident[] = "$Header$";
 #include "gsm.h"
 #include "private.h"
 #include "proto.h"
+#include "x86opt.h"
 
 gsm gsm_create P0()
 {
 	gsm  r;
 
+#ifdef X86OPT
+	gsm_x86opt_init();
+#endif
 	r = (gsm)malloc(sizeof(struct gsm_state));
 	if (!r) return r;
 
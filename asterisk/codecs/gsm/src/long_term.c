@@ -16,6 +16,7 @@
 #ifdef K6OPT
 #include "k6opt.h"
 #endif
+#include "x86opt.h"
 /*
  *  4.2.11 .. 4.2.12 LONG TERM PREDICTOR (LTP) SECTION
  */
@@ -205,6 +206,12 @@ static void Calculation_of_the_LTP_parameters P4((d,dp,bc_out,Nc_out),
 # ifdef K6OPT
 	L_max = k6maxcc(wt,dp,&Nc);
 #	else
+#	ifdef X86OPT
+	if (x86_maxcc)
+		L_max = x86_maxcc(wt,dp,&Nc);
+	else
+#	endif
+	{
 	L_max = 0;
 	Nc    = 40;	/* index for the maximum cross-correlation */
 
@@ -242,6 +249,7 @@ static void Calculation_of_the_LTP_parameters P4((d,dp,bc_out,Nc_out),
 			L_max = L_result;
 		}
 	}
+	}
 #	endif
 	*Nc_out = Nc;
 
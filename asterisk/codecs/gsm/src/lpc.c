@@ -17,6 +17,7 @@
 #ifdef K6OPT
 #include "k6opt.h"
 #endif
+#include "x86opt.h"
 
 #undef	P
 
@@ -110,6 +111,12 @@ static void Autocorrelation P2((s, L_ACF),
 	/*  Compute the L_ACF[..].
 	 */
 #ifndef K6OPT
+# if defined(X86OPT) && !defined(USE_FLOAT_MUL)
+	if (x86_iprod) {
+		for (k = 0; k <= 8; k++)
+			L_ACF[k] = 2 * x86_iprod(s, s + k, 160 - k);
+	} else
+# endif
 	{
 # ifdef	USE_FLOAT_MUL
 		register float * sp = float_s;
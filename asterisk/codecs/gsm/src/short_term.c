@@ -19,6 +19,7 @@
 #define Short_term_analysis_filtering Short_term_analysis_filteringx
 
 #endif
+#include "x86opt.h"
 /*
  *  SHORT TERM ANALYSIS FILTERING SECTION
  */
@@ -207,6 +208,10 @@ static void Short_term_analysis_filtering P4((u0,rp0,k_n,s),
 	register word		* u_top = u0 + 8;
 	register word		* s_top = s + k_n;
 
+#ifdef X86OPT
+	if (x86_short_term_analysis && !x86_short_term_analysis(u0, rp0, k_n, s))
+		return;
+#endif
 	while (s < s_top) {
 		register word		*u, *rp ;
 		register longword		di, u_out;
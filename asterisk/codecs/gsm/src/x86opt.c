@@ -0,0 +1,279 @@
+/* x86opt.c  SSE2/SSSE3/AVX2 versions of the encoder's hot loops
+ *
+ * All the arithmetic here is exact: the products and sums fit the
+ * vector lanes for the inputs the encoder gives them (see x86opt.h),
+ * so the results match the C code bit for bit.
+ */
+
+/* $Header$ */
+
+#include <stdio.h>
+
+#include "private.h"
+
+#include "gsm.h"
+#include "proto.h"
+#include "x86opt.h"
+
+#ifdef	X86OPT
+
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#include <immintrin.h>
+
+#define	SSE2	__attribute__((target("sse2")))
+#define	SSSE3	__attribute__((target("ssse3")))
+#define	AVX2	__attribute__((target("avx2")))
+
+longword (*x86_maxcc) P((const word *wt, const word *dp, word *Nc_out));
+longword (*x86_iprod) P((const word *p, const word *q, int n));
+int (*x86_short_term_analysis) P((word *u0, const word *rp0, int k_n, word *s));
+
+/* the sums of four vectors of four 32 bit integers, as one vector */
+static SSE2 __m128i hsum4(__m128i a, __m128i b, __m128i c, __m128i d)
+{
+	__m128i ab, cd;
+
+	ab = _mm_add_epi32(_mm_unpacklo_epi32(a, b), _mm_unpackhi_epi32(a, b));
+	cd = _mm_add_epi32(_mm_unpacklo_epi32(c, d), _mm_unpackhi_epi32(c, d));
+	return _mm_add_epi32(_mm_unpacklo_epi64(ab, cd), _mm_unpackhi_epi64(ab, cd));
+}
+
+/* pick the lag the way the C loop does: the first strict maximum */
+static longword pick_max(const int *cc, word *Nc_out)
+{
+	longword L_max = 0;
+	word Nc = 40;
+	int lambda;
+
+	for (lambda = 40; lambda <= 120; lambda++) {
+		if (cc[lambda - 40] > L_max) {
+			Nc = lambda;
+			L_max = cc[lambda - 40];
+		}
+	}
+	*Nc_out = Nc;
+	return L_max;
+}
+
+static SSE2 __m128i sse2_cc(const __m128i *w, const word *dp)
+{
+	__m128i acc;
+	int k;
+
+	acc = _mm_madd_epi16(w[0], _mm_loadu_si128((const __m128i *)dp));
+	for (k = 1; k < 5; k++)
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(w[k],
+			_mm_loadu_si128((const __m128i *)(dp + 8 * k))));
+	return acc;
+}
+
+static SSE2 longword sse2_maxcc P3((wt,dp,Nc_out),
+	const word *wt,
+	const word *dp,
+	word *Nc_out)
+{
+	__m128i w[5], a, b, c, d;
+	int cc[84];
+	int k, lambda;
+
+	for (k = 0; k < 5; k++)
+		w[k] = _mm_loadu_si128((const __m128i *)(wt + 8 * k));
+
+	/* four lags at a time up to 119; reading past dp[-120] isn't safe */
+	for (lambda = 40; lambda < 120; lambda += 4) {
+		a = sse2_cc(w, dp - lambda);
+		b = sse2_cc(w, dp - lambda - 1);
+		c = sse2_cc(w, dp - lambda - 2);
+		d = sse2_cc(w, dp - lambda - 3);
+		_mm_storeu_si128((__m128i *)(cc + lambda - 40), hsum4(a, b, c, d));
+	}
+	a = sse2_cc(w, dp - 120);
+	b = _mm_setzero_si128();
+	_mm_storeu_si128((__m128i *)(cc + 80), hsum4(a, b, b, b));
+
+	return pick_max(cc, Nc_out);
+}
+
+static AVX2 __m128i avx2_cc(__m256i w0, __m256i w1, __m128i w2, const word *dp)
+{
+	__m256i acc;
+
+	acc = _mm256_madd_epi16(w0, _mm256_loadu_si256((const __m256i *)dp));
+	acc = _mm256_add_epi32(acc, _mm256_madd_epi16(w1,
+		_mm256_loadu_si256((const __m256i *)(dp + 16))));
+	return _mm_add_epi32(_mm_add_epi32(_mm256_castsi256_si128(acc),
+			_mm256_extracti128_si256(acc, 1)),
+		_mm_madd_epi16(w2, _mm_loadu_si128((const __m128i *)(dp + 32))));
+}
+
+static AVX2 longword avx2_maxcc P3((wt,dp,Nc_out),
+	const word *wt,
+	const word *dp,
+	word *Nc_out)
+{
+	__m256i w0, w1;
+	__m128i w2, a, b, c, d;
+	int cc[84];
+	int lambda;
+
+	w0 = _mm256_loadu_si256((const __m256i *)wt);
+	w1 = _mm256_loadu_si256((const __m256i *)(wt + 16));
+	w2 = _mm_loadu_si128((const __m128i *)(wt + 32));
+
+	for (lambda = 40; lambda < 120; lambda += 4) {
+		a = avx2_cc(w0, w1, w2, dp - lambda);
+		b = avx2_cc(w0, w1, w2, dp - lambda - 1);
+		c = avx2_cc(w0, w1, w2, dp - lambda - 2);
+		d = avx2_cc(w0, w1, w2, dp - lambda - 3);
+		_mm_storeu_si128((__m128i *)(cc + lambda - 40), hsum4(a, b, c, d));
+	}
+	a = avx2_cc(w0, w1, w2, dp - 120);
+	b = _mm_setzero_si128();
+	_mm_storeu_si128((__m128i *)(cc + 80), hsum4(a, b, b, b));
+
+	/* leave the upper halves clean for any SSE code that follows */
+	_mm256_zeroupper();
+
+	return pick_max(cc, Nc_out);
+}
+
+static SSE2 longword sse2_iprod P3((p,q,n),
+	const word *p,
+	const word *q,
+	int n)
+{
+	__m128i acc = _mm_setzero_si128();
+	int sum[4];
+	longword L_sum;
+
+	for (; n >= 8; n -= 8, p += 8, q += 8)
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(
+			_mm_loadu_si128((const __m128i *)p),
+			_mm_loadu_si128((const __m128i *)q)));
+	_mm_storeu_si128((__m128i *)sum, acc);
+	L_sum = (longword)sum[0] + sum[1] + sum[2] + sum[3];
+	while (n--)
+		L_sum += (longword)*p++ * *q++;
+	return L_sum;
+}
+
+static AVX2 longword avx2_iprod P3((p,q,n),
+	const word *p,
+	const word *q,
+	int n)
+{
+	__m256i acc = _mm256_setzero_si256();
+	__m128i acc128;
+	int sum[4];
+	longword L_sum;
+
+	for (; n >= 16; n -= 16, p += 16, q += 16)
+		acc = _mm256_add_epi32(acc, _mm256_madd_epi16(
+			_mm256_loadu_si256((const __m256i *)p),
+			_mm256_loadu_si256((const __m256i *)q)));
+	acc128 = _mm_add_epi32(_mm256_castsi256_si128(acc),
+		_mm256_extracti128_si256(acc, 1));
+	if (n >= 8) {
+		acc128 = _mm_add_epi32(acc128, _mm_madd_epi16(
+			_mm_loadu_si128((const __m128i *)p),
+			_mm_loadu_si128((const __m128i *)q)));
+		n -= 8, p += 8, q += 8;
+	}
+	_mm256_zeroupper();
+	_mm_storeu_si128((__m128i *)sum, acc128);
+	L_sum = (longword)sum[0] + sum[1] + sum[2] + sum[3];
+	while (n--)
+		L_sum += (longword)*p++ * *q++;
+	return L_sum;
+}
+
+/*
+ *  The short term analysis filter is a lattice of 8 stages, each of
+ *  which needs the output of the stage before for the same sample, so
+ *  there is nothing to run side by side within a sample.  Instead lane i
+ *  of the vectors runs stage i on sample t - i at step t: every step the
+ *  outputs move up one lane and the next sample comes in at lane 0.
+ *  Lanes with no sample in them yet (or any more) leave u[] alone.
+ *
+ *  With rp[i] != MIN_WORD, (rp[i] * x + 16384) >> 15 always fits a word,
+ *  so the saturating adds give what the C code gets by clamping.
+ */
+static SSE2 __m128i sse2_mult_r(__m128i a, __m128i b)
+{
+	__m128i hi = _mm_mulhi_epi16(a, b), lo = _mm_mullo_epi16(a, b);
+
+	/* (hi << 16 | lo) + 0x4000 >> 15, with lo taken as unsigned */
+	return _mm_add_epi16(_mm_add_epi16(hi, hi),
+		_mm_srli_epi16(_mm_add_epi16(_mm_srli_epi16(lo, 14), _mm_set1_epi16(1)), 1));
+}
+
+static SSSE3 __m128i ssse3_mult_r(__m128i a, __m128i b)
+{
+	return _mm_mulhrs_epi16(a, b);
+}
+
+#define	SHORT_TERM_ANALYSIS(name, attr, mult_r)				\
+static attr int name P4((u0,rp0,k_n,s),					\
+	word *u0,							\
+	const word *rp0,						\
+	int k_n,							\
+	word *s)							\
+{									\
+	__m128i rp, u, di, uo, ui, valid, lane;				\
+	int t;								\
+									\
+	rp = _mm_loadu_si128((const __m128i *)rp0);			\
+	if (_mm_movemask_epi8(_mm_cmpeq_epi16(rp, _mm_set1_epi16(MIN_WORD))))	\
+		return -1;						\
+	u = _mm_loadu_si128((const __m128i *)u0);			\
+	di = uo = _mm_setzero_si128();					\
+	lane = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);			\
+									\
+	for (t = 0; t < k_n + 7; t++) {					\
+		di = _mm_slli_si128(di, 2);				\
+		uo = _mm_slli_si128(uo, 2);				\
+		if (t < k_n) {						\
+			di = _mm_insert_epi16(di, s[t], 0);		\
+			uo = _mm_insert_epi16(uo, s[t], 0);		\
+		}							\
+		/* lane i holds sample t - i: is that in 0..k_n-1? */	\
+		valid = _mm_and_si128(					\
+			_mm_cmpgt_epi16(_mm_set1_epi16(t + 1), lane),	\
+			_mm_cmpgt_epi16(lane, _mm_set1_epi16(t - k_n)));	\
+		ui = u;							\
+		u = _mm_or_si128(_mm_and_si128(valid, uo), _mm_andnot_si128(valid, u));	\
+		uo = _mm_adds_epi16(ui, mult_r(rp, di));		\
+		di = _mm_adds_epi16(di, mult_r(rp, ui));		\
+		if (t >= 7)						\
+			s[t - 7] = (word)_mm_extract_epi16(di, 7);	\
+	}								\
+	_mm_storeu_si128((__m128i *)u0, u);				\
+	return 0;							\
+}
+
+SHORT_TERM_ANALYSIS(sse2_short_term_analysis, SSE2, sse2_mult_r)
+SHORT_TERM_ANALYSIS(ssse3_short_term_analysis, SSSE3, ssse3_mult_r)
+
+void gsm_x86opt_init P0()
+{
+	static int done;
+
+	if (done)
+		return;
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		x86_maxcc = avx2_maxcc;
+		x86_iprod = avx2_iprod;
+	} else if (__builtin_cpu_supports("sse2")) {
+		x86_maxcc = sse2_maxcc;
+		x86_iprod = sse2_iprod;
+	}
+	if (__builtin_cpu_supports("ssse3"))
+		x86_short_term_analysis = ssse3_short_term_analysis;
+	else if (__builtin_cpu_supports("sse2"))
+		x86_short_term_analysis = sse2_short_term_analysis;
+	done = 1;
+}
+
+#endif	/* X86OPT */
@@ -0,0 +1,46 @@
+/* x86opt.h  SSE2/SSSE3/AVX2 versions of the encoder's hot loops
+ *
+ * These give exactly the same results as the C code they stand in for.
+ * The pointers are set up by gsm_x86opt_init() for the best instruction
+ * set the CPU has, and stay NULL if it has none of them, in which case
+ * the C code is used.
+ */
+
+#ifndef	X86OPT_H
+#define	X86OPT_H
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(K6OPT) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define	X86OPT
+#endif
+
+#ifdef	X86OPT
+
+extern void gsm_x86opt_init P((void));
+
+/*
+ * x86_maxcc(wt,dp,Nc_out)
+ *  the LTP lag search of Calculation_of_the_LTP_parameters(): returns the
+ *  largest positive cross-correlation of wt[0..39] with dp[-lambda..]
+ *  for lambda 40..120 (or 0), and in Nc_out the first lambda giving it
+ *  (or 40).
+ */
+extern longword (*x86_maxcc) P((const word *wt, const word *dp, word *Nc_out));
+
+/*
+ * x86_iprod(p,q,n)
+ *  returns the inner product of p[n] and q[n].  The sum must fit in
+ *  32 bits, as it does for the scaled signal in Autocorrelation().
+ */
+extern longword (*x86_iprod) P((const word *p, const word *q, int n));
+
+/*
+ * x86_short_term_analysis(u0,rp0,k_n,s)
+ *  Short_term_analysis_filtering(); returns -1 without touching anything
+ *  if it can't give the same result (an rp0[] of MIN_WORD).
+ */
+extern int (*x86_short_term_analysis) P((word *u0, const word *rp0, int k_n, word *s));
+
+#endif	/* X86OPT */
+
+#endif	/* X86OPT_H */
@@ -0,0 +1,146 @@
+#!/usr/bin/env python3
+#
+# Put/get throughput test for AstDB.
+#
+# Logs in to the manager and runs "database put" for a number of keys,
+# then "database get" for the same keys a number of times over, through
+# the Command action.  Each connection works on keys of its own.  Prints
+# the operations per second for each, and the syncs, pending writes and
+# cache hits that "database status" counted while it ran.
+#
+# Every operation is a manager round trip, so the figures are a floor;
+# compare runs with dbsyncinterval (asterisk.conf) off and on to see what
+# syncing every write costs.  The keys are deleted at the end.
+#
+# Usage:
+#
+#   astdb_bench.py [--host 127.0.0.1] [--port 5038]
+#                  [--username admin --secret secret]
+#                  [--family astdb_bench] [--keys 200] [--gets 4]
+#                  [--connections 4]
+#
+# This program is free software, distributed under the terms of
+# the GNU General Public License Version 2.
+#
+
+import optparse
+import socket
+import sys
+import threading
+import time
+
+class Manager:
+	def __init__(self, host, port, username, secret):
+		self.sock = socket.create_connection((host, port))
+		self.f = self.sock.makefile("rb")
+		self.f.readline()
+		self.id = 0
+		res = self.action(Action="Login", Username=username, Secret=secret, Events="off")
+		if res.get("Response") != "Success":
+			raise IOError("manager login failed: %s" % res.get("Message"))
+
+	def action(self, **headers):
+		self.id += 1
+		headers["ActionID"] = str(self.id)
+		req = "".join("%s: %s\r\n" % (k, v) for k, v in headers.items())
+		self.sock.sendall((req + "\r\n").encode("latin-1"))
+		while True:
+			res, text = {}, []
+			while True:
+				line = self.readline()
+				if res.get("Response") == "Follows" and "ActionID" in res:
+					# Command output, which can have blank lines of its own
+					if line.endswith("--END COMMAND--"):
+						text.append(line[:-len("--END COMMAND--")])
+						self.readline()
+						break
+					text.append(line)
+					continue
+				if not line:
+					break
+				name, sep, value = line.partition(": ")
+				if sep:
+					res.setdefault(name, value)
+			if res.get("ActionID") == headers["ActionID"] and "Response" in res and "Event" not in res:
+				res["text"] = text
+				return res
+
+	def readline(self):
+		line = self.f.readline()
+		if not line:
+			raise IOError("manager connection closed")
+		return line.decode("latin-1").rstrip("\r\n")
+
+	def command(self, command):
+		return self.action(Action="Command", Command=command)["text"]
+
+	def status(self):
+		"""The counters from 'database status', by name"""
+		stats = {}
+		for line in self.command("database status"):
+			words = line.replace(":", "").split()
+			for x in range(len(words) - 1):
+				if words[x + 1].isdigit():
+					stats[words[x]] = int(words[x + 1])
+		return stats
+
+def worker(opts, num, phase, errors):
+	man = Manager(opts.host, opts.port, opts.username, opts.secret)
+	keys = range(num, opts.keys, opts.connections)
+	phase.wait()
+	for key in keys:
+		man.command("database put %s k%d v%d" % (opts.family, key, key))
+	phase.wait()
+	phase.wait()
+	for x in range(opts.gets):
+		for key in keys:
+			if "v%d" % key not in "".join(man.command("database get %s k%d" % (opts.family, key))):
+				errors.append(key)
+	phase.wait()
+
+def main():
+	parser = optparse.OptionParser()
+	parser.add_option("--host", default="127.0.0.1")
+	parser.add_option("--port", type="int", default=5038, help="the manager port")
+	parser.add_option("--username", default="admin")
+	parser.add_option("--secret", default="")
+	parser.add_option("--family", default="astdb_bench", help="the family the keys go in")
+	parser.add_option("--keys", type="int", default=200, help="fewer than the 256 cache slots, to see hits")
+	parser.add_option("--gets", type="int", default=4, help="how many times each key is read")
+	parser.add_option("--connections", type="int", default=4)
+	opts, args = parser.parse_args()
+
+	man = Manager(opts.host, opts.port, opts.username, opts.secret)
+	man.command("database deltree %s" % opts.family)
+	phase = threading.Barrier(opts.connections + 1)
+	errors = []
+	workers = [threading.Thread(target=worker, args=(opts, x, phase, errors)) for x in range(opts.connections)]
+	for t in workers:
+		t.daemon = True
+		t.start()
+
+	before = man.status()
+	phase.wait()
+	start = time.time()
+	phase.wait()
+	puts = time.time() - start
+	middle = man.status()
+	phase.wait()
+	start = time.time()
+	phase.wait()
+	gets = time.time() - start
+	after = man.status()
+	man.command("database deltree %s" % opts.family)
+
+	def delta(a, b, name):
+		return b.get(name, 0) - a.get(name, 0)
+
+	print("%d puts in %.2f s over %d connections, %.0f puts/s, %d syncs, %d writes pending after" %
+		(opts.keys, puts, opts.connections, opts.keys / puts, delta(before, middle, "Syncs"), middle.get("writes", 0)))
+	reads = opts.keys * opts.gets
+	print("%d gets in %.2f s, %.0f gets/s, %d cache hits, %d wrong values" %
+		(reads, gets, reads / gets, delta(middle, after, "hits"), len(errors)))
+	return 1 if errors else 0
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,177 @@
+#!/usr/bin/env python3
+#
+# Extension lookup test for the dialplan.
+#
+# Fills a context with node numbers and node patterns, the way a big
+# AllStar or gateway dialplan looks: half exact numbers, half patterns
+# like _2741X that each cover a block of ten.  Every extension gets a
+# hint, so the manager's ExtensionState action does a full extension
+# lookup and tells us whether it matched.  Numbers that should match an
+# exact extension, a pattern, or nothing are then looked up over several
+# manager connections, and the time per lookup is printed, along with
+# the same for a context holding a single extension, which is the cost
+# of the manager round trip itself.  The match tree line from
+# "dialplan show" is printed too.  The extensions are removed at the end.
+#
+# Both contexts have to be in extensions.conf, empty, since the CLI can
+# only add extensions to a context that exists:
+#
+#   [dialplan_bench]
+#
+#   [dialplan_bench_small]
+#
+# Usage:
+#
+#   dialplan_bench.py [--host 127.0.0.1] [--port 5038]
+#                     [--username admin --secret secret]
+#                     [--context dialplan_bench] [--extensions 5000]
+#                     [--lookups 4000] [--connections 4]
+#                     [--hint Local/100@default]
+#
+# This program is free software, distributed under the terms of
+# the GNU General Public License Version 2.
+#
+
+import optparse
+import random
+import socket
+import sys
+import threading
+import time
+
+class Manager:
+	def __init__(self, host, port, username, secret):
+		self.sock = socket.create_connection((host, port))
+		self.f = self.sock.makefile("rb")
+		self.f.readline()
+		self.id = 0
+		res = self.action(Action="Login", Username=username, Secret=secret, Events="off")
+		if res.get("Response") != "Success":
+			raise IOError("manager login failed: %s" % res.get("Message"))
+
+	def action(self, **headers):
+		self.id += 1
+		headers["ActionID"] = str(self.id)
+		req = "".join("%s: %s\r\n" % (k, v) for k, v in headers.items())
+		self.sock.sendall((req + "\r\n").encode("latin-1"))
+		while True:
+			res, text = {}, []
+			while True:
+				line = self.readline()
+				if res.get("Response") == "Follows" and "ActionID" in res:
+					# Command output, which can have blank lines of its own
+					if line.endswith("--END COMMAND--"):
+						text.append(line[:-len("--END COMMAND--")])
+						self.readline()
+						break
+					text.append(line)
+					continue
+				if not line:
+					break
+				name, sep, value = line.partition(": ")
+				if sep:
+					res.setdefault(name, value)
+			if res.get("ActionID") == headers["ActionID"] and "Response" in res and "Event" not in res:
+				res["text"] = text
+				return res
+
+	def readline(self):
+		line = self.f.readline()
+		if not line:
+			raise IOError("manager connection closed")
+		return line.decode("latin-1").rstrip("\r\n")
+
+	def command(self, command):
+		return self.action(Action="Command", Command=command)["text"]
+
+	def matches(self, context, exten):
+		return self.action(Action="ExtensionState", Context=context, Exten=exten).get("Status", "-1") != "-1"
+
+def make_dialplan(count):
+	"""Exact node numbers, patterns over blocks of ten, and numbers to look up for each"""
+	rand = random.Random(4)
+	blocks = rand.sample(range(1000, 10000), count)
+	exact, patterns = [], []
+	for x, block in enumerate(blocks):
+		if x % 2:
+			patterns.append("_%dX" % block)
+		else:
+			exact.append("%d%d" % (block, rand.randrange(10)))
+	used = set(blocks)
+	misses = [n for n in range(10000, 100000, 7) if n // 10 not in used]
+	return exact, patterns, {
+		"exact": exact,
+		"pattern": ["%s%d" % (p[1:-1], rand.randrange(10)) for p in patterns],
+		"miss": ["%d" % n for n in misses],
+	}
+
+def lookups(opts, context, numbers, want, results):
+	man = Manager(opts.host, opts.port, opts.username, opts.secret)
+	wrong = 0
+	start = time.time()
+	for exten in numbers:
+		if man.matches(context, exten) != want:
+			wrong += 1
+	results.append((time.time() - start, len(numbers), wrong))
+
+def run(opts, context, numbers, want):
+	"""Microseconds per lookup over all the connections, and how many came out wrong"""
+	results = []
+	share = opts.lookups // opts.connections
+	rand = random.Random(len(numbers))
+	threads = [threading.Thread(target=lookups, args=(opts, context, [rand.choice(numbers) for y in range(share)], want, results))
+		for x in range(opts.connections)]
+	start = time.time()
+	for t in threads:
+		t.start()
+	for t in threads:
+		t.join()
+	elapsed = time.time() - start
+	done = sum(r[1] for r in results)
+	return elapsed * 1000000 / done * opts.connections, sum(r[2] for r in results)
+
+def main():
+	parser = optparse.OptionParser()
+	parser.add_option("--host", default="127.0.0.1")
+	parser.add_option("--port", type="int", default=5038, help="the manager port")
+	parser.add_option("--username", default="admin")
+	parser.add_option("--secret", default="")
+	parser.add_option("--context", default="dialplan_bench", help="an empty context to fill, with one named this and _small")
+	parser.add_option("--extensions", type="int", default=5000)
+	parser.add_option("--lookups", type="int", default=4000, help="lookups of each kind")
+	parser.add_option("--connections", type="int", default=4)
+	parser.add_option("--hint", default="Local/100@default", help="a device whose state is known")
+	opts, args = parser.parse_args()
+
+	man = Manager(opts.host, opts.port, opts.username, opts.secret)
+	small = opts.context + "_small"
+	exact, patterns, numbers = make_dialplan(opts.extensions)
+	start = time.time()
+	for context, extens in ((opts.context, exact + patterns), (small, exact[:1])):
+		for exten in extens:
+			if "added" not in "".join(man.command("dialplan add extension %s,hint,%s into %s" % (exten, opts.hint, context))):
+				print("Unable to add extensions to '%s'; is it in extensions.conf?" % context)
+				return 1
+	print("%d extensions added in %.1f s" % (len(exact) + len(patterns), time.time() - start))
+
+	failed = 0
+	base, wrong = run(opts, small, [exact[0]], True)
+	failed += wrong
+	print("%-8s %7.1f us per lookup, %d wrong (one extension: the manager round trip)" % ("single", base, wrong))
+	for kind in ("exact", "pattern", "miss"):
+		us, wrong = run(opts, opts.context, numbers[kind], kind != "miss")
+		failed += wrong
+		print("%-8s %7.1f us per lookup, %d wrong, %.1f us over the round trip" % (kind, us, wrong, us - base))
+	for line in man.command("dialplan show %s" % opts.context):
+		if "Match trees" in line:
+			print(line.strip())
+
+	start = time.time()
+	for exten in exact + patterns:
+		man.command("dialplan remove extension %s@%s hint" % (exten, opts.context))
+	man.command("dialplan remove extension %s@%s hint" % (exact[0], small))
+	print("%d extensions removed in %.1f s" % (len(exact) + len(patterns), time.time() - start))
+	return 1 if failed else 0
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,283 @@
+#!/usr/bin/env python3
+#
+# Test for FastAGI connection reuse.
+#
+# Runs a stub FastAGI server that takes Asterisk up on agi_network_reuse:
+# each session sends a NOOP and then ends with "SESSION END", and the
+# connection is kept for the next one.  Calls are started through the
+# manager with Originate, and "agi show pool" is read before and after
+# each step.  The steps are:
+#
+#   reuse     sessions one after another all go down one connection
+#   handshake every SESSION END is answered with "200 result=0"
+#   dead      idle connections the server has closed are thrown away,
+#             and the next session connects afresh
+#   oldest    with more sessions at once than the pool keeps, the ones
+#             that went idle first are the ones closed
+#
+# This needs a manager.conf user allowed to originate, and an extension
+# that answers (100 in the sample extensions.conf does).
+#
+# Usage:
+#
+#   fastagi_pooltest.py [--host 127.0.0.1] [--port 5038]
+#                       [--username admin --secret secret]
+#                       [--channel Local/100@default]
+#                       [--agi-port 4573] [--sessions 5] [--pool-max 16]
+#
+# This program is free software, distributed under the terms of
+# the GNU General Public License Version 2.
+#
+
+import optparse
+import socket
+import sys
+import threading
+import time
+
+class Stub:
+	"""A FastAGI server that ends its sessions with SESSION END"""
+
+	def __init__(self, port):
+		self.lock = threading.Condition()
+		self.sessions = 0		# sessions finished
+		self.handshakes = 0		# SESSION ENDs answered with 200
+		self.bad = []			# anything else
+		self.idle = {}			# idle connections, by number
+		self.idle_order = []		# connections in the order they went idle
+		self.closed = []		# idle connections Asterisk closed
+		self.conns = 0
+		self.barrier = None
+		self.arrived = 0
+		self.sock = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+		self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+		self.sock.bind(("127.0.0.1", port))
+		self.sock.listen(64)
+		t = threading.Thread(target=self.accept)
+		t.daemon = True
+		t.start()
+
+	def accept(self):
+		while True:
+			conn, addr = self.sock.accept()
+			with self.lock:
+				self.conns += 1
+				num = self.conns
+			t = threading.Thread(target=self.serve, args=(conn, num))
+			t.daemon = True
+			t.start()
+
+	def read_env(self, f):
+		env = {}
+		while True:
+			line = f.readline()
+			if not line:
+				return None
+			line = line.decode("latin-1").strip()
+			if not line:
+				return env
+			name, _, value = line.partition(":")
+			env[name.strip()] = value.strip()
+
+	def serve(self, conn, num):
+		f = conn.makefile("rb")
+		while True:
+			env = self.read_env(f)
+			with self.lock:
+				self.idle.pop(num, None)
+			if env is None:
+				with self.lock:
+					if num in self.idle_order:
+						self.closed.append(num)
+					self.lock.notify_all()
+				conn.close()
+				return
+			conn.sendall(b"NOOP\n")
+			res = f.readline()
+			if not res.startswith(b"200"):
+				self.fail("connection %d: NOOP got %r" % (num, res))
+			self.hold()
+			if env.get("agi_network_reuse") != "yes":
+				self.fail("connection %d: reuse was not offered" % num)
+				conn.close()
+				return
+			conn.sendall(b"SESSION END\n")
+			res = f.readline()
+			with self.lock:
+				self.sessions += 1
+				if res.strip() == b"200 result=0":
+					self.handshakes += 1
+				else:
+					self.bad.append("connection %d: SESSION END got %r" % (num, res))
+				self.idle[num] = conn
+				self.idle_order.append(num)
+				self.lock.notify_all()
+
+	def hold(self):
+		"""With a barrier set, wait for everyone, then end one at a time in arrival order"""
+		with self.lock:
+			barrier = self.barrier
+			if not barrier:
+				return
+			self.arrived += 1
+			n = self.arrived
+		try:
+			barrier.wait(15)
+		except threading.BrokenBarrierError:
+			self.fail("not all sessions started")
+		time.sleep(n * 0.1)
+
+	def fail(self, why):
+		with self.lock:
+			self.bad.append(why)
+			self.lock.notify_all()
+
+	def wait_sessions(self, n, timeout=30):
+		deadline = time.time() + timeout
+		with self.lock:
+			while self.sessions < n and time.time() < deadline:
+				self.lock.wait(deadline - time.time())
+			return self.sessions >= n
+
+	def close_idle(self):
+		with self.lock:
+			conns = list(self.idle.values())
+			self.idle.clear()
+		for conn in conns:
+			conn.shutdown(socket.SHUT_RDWR)
+			conn.close()
+		return len(conns)
+
+class Manager:
+	def __init__(self, host, port, username, secret):
+		self.sock = socket.create_connection((host, port))
+		self.f = self.sock.makefile("rb")
+		self.f.readline()
+		self.id = 0
+		res = self.action(Action="Login", Username=username, Secret=secret, Events="off")
+		if res.get("Response") != "Success":
+			raise IOError("manager login failed: %s" % res.get("Message"))
+
+	def action(self, **headers):
+		self.id += 1
+		headers["ActionID"] = str(self.id)
+		req = "".join("%s: %s\r\n" % (k, v) for k, v in headers.items())
+		self.sock.sendall((req + "\r\n").encode("latin-1"))
+		while True:
+			res, text = {}, []
+			while True:
+				line = self.readline()
+				if res.get("Response") == "Follows" and "ActionID" in res:
+					# Command output, which can have blank lines of its own
+					if line.endswith("--END COMMAND--"):
+						text.append(line[:-len("--END COMMAND--")])
+						self.readline()
+						break
+					text.append(line)
+					continue
+				if not line:
+					break
+				name, sep, value = line.partition(": ")
+				if sep:
+					res.setdefault(name, value)
+			if res.get("ActionID") == headers["ActionID"] and "Response" in res and "Event" not in res:
+				res["text"] = text
+				return res
+
+	def readline(self):
+		line = self.f.readline()
+		if not line:
+			raise IOError("manager connection closed")
+		return line.decode("latin-1").rstrip("\r\n")
+
+	def pool(self, server):
+		"""The Idle, Connects, Reused and Stale figures for a FastAGI server"""
+		res = self.action(Action="Command", Command="agi show pool")
+		seen = False
+		for line in res["text"]:
+			if line.startswith("FastAGI server"):
+				seen = True
+			elif seen and line.split()[:1] == [server]:
+				return [int(x) for x in line.split()[1:5]]
+		return [0, 0, 0, 0]
+
+	def originate(self, channel, url):
+		return self.action(Action="Originate", Channel=channel, Application="AGI",
+			Data=url, Timeout="10000", Async="true")
+
+def check(results, name, ok, detail):
+	results.append(ok)
+	print("%-10s %s  %s" % (name, "ok  " if ok else "FAIL", detail))
+
+def main():
+	parser = optparse.OptionParser()
+	parser.add_option("--host", default="127.0.0.1")
+	parser.add_option("--port", type="int", default=5038, help="the manager port")
+	parser.add_option("--username", default="admin")
+	parser.add_option("--secret", default="")
+	parser.add_option("--channel", default="Local/100@default", help="a channel that answers")
+	parser.add_option("--agi-port", type="int", default=4573, help="where the stub FastAGI server listens")
+	parser.add_option("--sessions", type="int", default=5, help="sessions to run one after another")
+	parser.add_option("--pool-max", type="int", default=16, help="AGI_POOL_MAX in res_agi.c")
+	opts, args = parser.parse_args()
+
+	stub = Stub(opts.agi_port)
+	man = Manager(opts.host, opts.port, opts.username, opts.secret)
+	server = "127.0.0.1:%d" % opts.agi_port
+	url = "agi://%s/pooltest" % server
+	results = []
+
+	# Sessions one after another should all go down one connection
+	before = man.pool(server)
+	for x in range(opts.sessions):
+		man.originate(opts.channel, url)
+		if not stub.wait_sessions(x + 1):
+			break
+	after = man.pool(server)
+	connects, reused = after[1] - before[1], after[2] - before[2]
+	check(results, "reuse", stub.sessions == opts.sessions and connects + reused == opts.sessions and reused >= opts.sessions - 1,
+		"%d sessions, %d new connections, %d reused" % (stub.sessions, connects, reused))
+	check(results, "handshake", stub.handshakes == stub.sessions and not stub.bad,
+		"%d of %d SESSION ENDs answered with 200" % (stub.handshakes, stub.sessions))
+
+	# Close what Asterisk has idle; the next session must see it and connect again
+	dropped = stub.close_idle()
+	time.sleep(0.5)
+	before = man.pool(server)
+	done = stub.sessions
+	man.originate(opts.channel, url)
+	ok = stub.wait_sessions(done + 1)
+	after = man.pool(server)
+	check(results, "dead", ok and after[1] - before[1] == 1 and after[3] - before[3] >= dropped,
+		"closed %d idle, then %d new connection(s) and %d found stale" % (dropped, after[1] - before[1], after[3] - before[3]))
+
+	# More sessions at once than the pool keeps, going idle one at a time
+	count = opts.pool_max + 4
+	with stub.lock:
+		stub.barrier = threading.Barrier(count)
+		stub.arrived = 0
+		first = len(stub.idle_order)
+		closed = len(stub.closed)
+	done = stub.sessions
+	before = man.pool(server)
+	for x in range(count):
+		man.originate(opts.channel, url)
+	ok = stub.wait_sessions(done + count, 60)
+	time.sleep(0.5)
+	after = man.pool(server)
+	with stub.lock:
+		stub.barrier = None
+		order = stub.idle_order[first:]
+		evicted = stub.closed[closed:]
+	want = order[:count - opts.pool_max]
+	check(results, "oldest", ok and sorted(evicted) == sorted(want) and after[0] == opts.pool_max,
+		"%d idle kept, closed connections %s, the first %d to go idle were %s" %
+		(after[0], evicted, len(want), want))
+
+	for why in stub.bad:
+		print("  " + why)
+	print("%d of %d checks passed" % (sum(results), len(results)))
+	return 0 if all(results) else 1
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+#
+# Load test for Asterisk's built in HTTP server.
+#
+# Opens a number of keep-alive connections and sends requests down each,
+# one after another, for as long as asked.  Prints the requests per second
+# and the median and 99th percentile response times.
+#
+# With --waiters, that many manager sessions are logged in first, and each
+# sits in a WaitEvent long poll while the test runs, the way dashboards do.
+# The requests should be no slower for them.  This needs a manager.conf
+# user with webenabled = yes in [general].
+#
+# Usage:
+#
+#   http_loadtest.py [--host 127.0.0.1] [--port 8088]
+#                    [--uri /asterisk/static/index.html]
+#                    [--connections 8] [--seconds 10] [--close]
+#                    [--waiters 16 --username admin --secret secret]
+#
+# This program is free software, distributed under the terms of
+# the GNU General Public License Version 2.
+#
+
+import optparse
+import socket
+import sys
+import threading
+import time
+
+def read_response(f):
+	"""Read one response, returning the status code and the body"""
+	status = f.readline()
+	if not status:
+		raise IOError("connection closed")
+	headers = {}
+	while True:
+		line = f.readline().strip()
+		if not line:
+			break
+		name, _, value = line.decode("latin-1").partition(":")
+		headers[name.strip().lower()] = value.strip()
+	if "content-length" in headers:
+		body = f.read(int(headers["content-length"]))
+	else:
+		body = f.read()
+	return int(status.split()[1]), headers, body
+
+def request(sock, f, host, uri, close, cookie=None):
+	req = "GET %s HTTP/1.1\r\nHost: %s\r\n" % (uri, host)
+	if close:
+		req += "Connection: close\r\n"
+	if cookie:
+		req += "Cookie: %s\r\n" % cookie
+	sock.sendall((req + "\r\n").encode("latin-1"))
+	return read_response(f)
+
+def waiter(opts, ready, stop):
+	"""Log in to the manager, then long poll for events until told to stop"""
+	sock = socket.create_connection((opts.host, opts.port))
+	f = sock.makefile("rb")
+	status, headers, body = request(sock, f, opts.host,
+		"%s/rawman?action=login&username=%s&secret=%s" % (opts.prefix, opts.username, opts.secret), False)
+	cookie = headers.get("set-cookie", "").split(";")[0]
+	if status != 200 or b"Success" not in body or not cookie:
+		sys.stderr.write("Manager login failed: %s\n" % body.decode("latin-1").strip())
+		ready.release()
+		return
+	ready.release()
+	while not stop.is_set():
+		request(sock, f, opts.host, "%s/rawman?action=waitevent&timeout=30" % opts.prefix, False, cookie)
+	sock.close()
+
+def client(opts, deadline, results):
+	times = []
+	errors = 0
+	sock = None
+	while time.time() < deadline:
+		try:
+			if not sock:
+				sock = socket.create_connection((opts.host, opts.port))
+				f = sock.makefile("rb")
+			start = time.time()
+			status, headers, body = request(sock, f, opts.host, opts.uri, opts.close)
+			times.append(time.time() - start)
+			if status >= 400:
+				errors += 1
+			if opts.close or headers.get("connection", "").lower() == "close":
+				sock.close()
+				sock = None
+		except (IOError, socket.error):
+			errors += 1
+			if sock:
+				sock.close()
+			sock = None
+	if sock:
+		sock.close()
+	results.append((times, errors))
+
+def main():
+	parser = optparse.OptionParser()
+	parser.add_option("--host", default="127.0.0.1")
+	parser.add_option("--port", type="int", default=8088)
+	parser.add_option("--prefix", default="/asterisk", help="the prefix set in http.conf")
+	parser.add_option("--uri", default="/asterisk/static/index.html")
+	parser.add_option("--connections", type="int", default=8)
+	parser.add_option("--seconds", type="float", default=10)
+	parser.add_option("--close", action="store_true", help="a new connection for every request")
+	parser.add_option("--waiters", type="int", default=0, help="manager WaitEvent long polls to hold open")
+	parser.add_option("--username", default="admin")
+	parser.add_option("--secret", default="")
+	opts, args = parser.parse_args()
+
+	stop = threading.Event()
+	ready = threading.Semaphore(0)
+	waiters = [threading.Thread(target=waiter, args=(opts, ready, stop)) for x in range(opts.waiters)]
+	for t in waiters:
+		t.daemon = True
+		t.start()
+	for t in waiters:
+		ready.acquire()
+	# Give the long polls time to get to the server
+	if waiters:
+		time.sleep(1)
+
+	results = []
+	deadline = time.time() + opts.seconds
+	clients = [threading.Thread(target=client, args=(opts, deadline, results)) for x in range(opts.connections)]
+	start = time.time()
+	for t in clients:
+		t.start()
+	for t in clients:
+		t.join()
+	elapsed = time.time() - start
+	stop.set()
+
+	times = sorted(t for r in results for t in r[0])
+	errors = sum(r[1] for r in results)
+	if not times:
+		print("No requests answered (%d errors)" % errors)
+		return 1
+	print("%d requests in %.1f seconds over %d connections, %d long polls, %d errors" %
+		(len(times), elapsed, opts.connections, opts.waiters, errors))
+	print("%.0f requests/s, median %.2f ms, p99 %.2f ms, max %.2f ms" %
+		(len(times) / elapsed, times[len(times) // 2] * 1000,
+		times[min(len(times) - 1, int(len(times) * 0.99))] * 1000, times[-1] * 1000))
+	return 0
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+#
+# Load test for many channels playing the same file.
+#
+# Starts a number of calls through the manager, each running an
+# application on its own channel: Playback of one long prompt by
+# default.  Once they're all up, it measures the CPU time and memory
+# Asterisk uses over a stretch of seconds, then waits for the calls to
+# end.  Prints the channels that were up, CPU as a percentage of one core
+# and per channel, and the change in resident memory.
+#
+# Asterisk has to be on this machine, since the figures come from /proc;
+# --pid-file points at its pid file.  The prompt should play for longer
+# than it takes to start the calls plus --seconds.
+#
+# Other applications work the same way.  For one that doesn't end by
+# itself, such as MusicOnHold, --hangup hangs the calls up once the
+# measuring is done.  Without a timing device, music on hold only sends
+# a frame when its channel reads one, so --channel should lead to an
+# extension that plays something back, not one that just waits:
+#
+#   playback_loadtest.py --channel Local/play@default --channels 300
+#                        --app MusicOnHold --data default --hangup
+#
+# Usage:
+#
+#   playback_loadtest.py [--host 127.0.0.1] [--port 5038]
+#                        [--username admin --secret secret]
+#                        [--channel Local/100@default] [--channels 500]
+#                        [--app Playback] [--data long] [--seconds 10]
+#                        [--hangup] [--pid-file /var/run/asterisk/asterisk.pid]
+#
+# This program is free software, distributed under the terms of
+# the GNU General Public License Version 2.
+#
+
+import optparse
+import os
+import socket
+import sys
+import time
+
+class Manager:
+	def __init__(self, host, port, username, secret):
+		self.sock = socket.create_connection((host, port))
+		self.f = self.sock.makefile("rb")
+		self.f.readline()
+		self.id = 0
+		res = self.action(Action="Login", Username=username, Secret=secret, Events="off")
+		if res.get("Response") != "Success":
+			raise IOError("manager login failed: %s" % res.get("Message"))
+
+	def action(self, **headers):
+		self.id += 1
+		headers["ActionID"] = str(self.id)
+		req = "".join("%s: %s\r\n" % (k, v) for k, v in headers.items())
+		self.sock.sendall((req + "\r\n").encode("latin-1"))
+		while True:
+			res, text = {}, []
+			while True:
+				line = self.readline()
+				if res.get("Response") == "Follows" and "ActionID" in res:
+					# Command output, which can have blank lines of its own
+					if line.endswith("--END COMMAND--"):
+						text.append(line[:-len("--END COMMAND--")])
+						self.readline()
+						break
+					text.append(line)
+					continue
+				if not line:
+					break
+				name, sep, value = line.partition(": ")
+				if sep:
+					res.setdefault(name, value)
+			if res.get("ActionID") == headers["ActionID"] and "Response" in res and "Event" not in res:
+				res["text"] = text
+				return res
+
+	def readline(self):
+		line = self.f.readline()
+		if not line:
+			raise IOError("manager connection closed")
+		return line.decode("latin-1").rstrip("\r\n")
+
+	def channels(self, app):
+		"""The names of the channels running app"""
+		res = self.action(Action="Command", Command="core show channels concise")
+		return [line.split("!")[0] for line in res["text"] if line.split("!")[5:6] == [app]]
+
+def cpu_ticks(pid):
+	with open("/proc/%d/stat" % pid) as f:
+		fields = f.read().rsplit(")", 1)[1].split()
+	return int(fields[11]) + int(fields[12])
+
+def rss_kb(pid):
+	with open("/proc/%d/status" % pid) as f:
+		for line in f:
+			if line.startswith("VmRSS:"):
+				return int(line.split()[1])
+	return 0
+
+def main():
+	parser = optparse.OptionParser()
+	parser.add_option("--host", default="127.0.0.1")
+	parser.add_option("--port", type="int", default=5038, help="the manager port")
+	parser.add_option("--username", default="admin")
+	parser.add_option("--secret", default="")
+	parser.add_option("--channel", default="Local/100@default", help="a channel that answers")
+	parser.add_option("--channels", type="int", default=500)
+	parser.add_option("--app", default="Playback")
+	parser.add_option("--data", default="long", help="the application's argument: the prompt, for Playback")
+	parser.add_option("--seconds", type="float", default=10, help="how long to measure for")
+	parser.add_option("--hangup", action="store_true", help="hang the calls up after measuring")
+	parser.add_option("--pid-file", default="/var/run/asterisk/asterisk.pid")
+	opts, args = parser.parse_args()
+
+	with open(opts.pid_file) as f:
+		pid = int(f.read().split()[0])
+	hz = os.sysconf("SC_CLK_TCK")
+	man = Manager(opts.host, opts.port, opts.username, opts.secret)
+	rss = rss_kb(pid)
+
+	start = time.time()
+	for x in range(opts.channels):
+		man.action(Action="Originate", Channel=opts.channel, Application=opts.app,
+			Data=opts.data, Timeout="30000", Async="true")
+	while len(man.channels(opts.app)) < opts.channels and time.time() < start + 60:
+		time.sleep(0.5)
+	up = len(man.channels(opts.app))
+	print("%d of %d channels running %s after %.1f s" % (up, opts.channels, opts.app, time.time() - start))
+
+	ticks, begin = cpu_ticks(pid), time.time()
+	time.sleep(opts.seconds)
+	ticks, elapsed = cpu_ticks(pid) - ticks, time.time() - begin
+	still = len(man.channels(opts.app))
+	cpu = ticks / float(hz) / elapsed * 100
+	print("%d still running after %.0f s; CPU %.1f%% of a core, %.3f%% per channel; RSS +%d kB" %
+		(still, elapsed, cpu, cpu / max(still, 1), rss_kb(pid) - rss))
+
+	if opts.hangup:
+		for name in man.channels(opts.app):
+			man.action(Action="Hangup", Channel=name)
+	while man.channels(opts.app) and time.time() < begin + 300:
+		time.sleep(1)
+	return 0 if up == still == opts.channels else 1
+
+if __name__ == "__main__":
+	sys.exit(main())
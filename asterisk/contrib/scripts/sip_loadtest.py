@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+#
+# Load test for chan_sip's dialog and peer lookups.
+#
+# Registers a number of peers, each from a UDP port of its own, then has
+# every peer send OPTIONS keepalives, each a new dialog, one outstanding
+# at a time per peer, for as long as asked.  Requests left unanswered are
+# sent again every 500 ms, as a UDP user agent would.  Prints the
+# registrations and the OPTIONS answered per second, the median and 99th
+# percentile response times, the status codes seen, and the hash table
+# lines from "sip show settings" (read through the manager, if a secret
+# is given).  With the tables hashed, the OPTIONS rate should hardly move
+# as --peers grows; the response times grow with the requests in flight.
+#
+# The peers need to be in sip.conf; --print-peers writes sections for them
+# (type=friend, host=dynamic, no secret) to paste in before running.
+#
+# Usage:
+#
+#   sip_loadtest.py --print-peers [--peers 500] >> sip.conf
+#   sip_loadtest.py [--host 127.0.0.1] [--sip-port 5060]
+#                   [--peers 500] [--prefix load] [--seconds 10]
+#                   [--port 5038 --username admin --secret secret]
+#
+# This program is free software, distributed under the terms of
+# the GNU General Public License Version 2.
+#
+
+import optparse
+import selectors
+import socket
+import sys
+import time
+
+class Manager:
+	def __init__(self, host, port, username, secret):
+		self.sock = socket.create_connection((host, port))
+		self.f = self.sock.makefile("rb")
+		self.f.readline()
+		self.id = 0
+		res = self.action(Action="Login", Username=username, Secret=secret, Events="off")
+		if res.get("Response") != "Success":
+			raise IOError("manager login failed: %s" % res.get("Message"))
+
+	def action(self, **headers):
+		self.id += 1
+		headers["ActionID"] = str(self.id)
+		req = "".join("%s: %s\r\n" % (k, v) for k, v in headers.items())
+		self.sock.sendall((req + "\r\n").encode("latin-1"))
+		while True:
+			res, text = {}, []
+			while True:
+				line = self.readline()
+				if res.get("Response") == "Follows" and "ActionID" in res:
+					# Command output, which can have blank lines of its own
+					if line.endswith("--END COMMAND--"):
+						text.append(line[:-len("--END COMMAND--")])
+						self.readline()
+						break
+					text.append(line)
+					continue
+				if not line:
+					break
+				name, sep, value = line.partition(": ")
+				if sep:
+					res.setdefault(name, value)
+			if res.get("ActionID") == headers["ActionID"] and "Response" in res and "Event" not in res:
+				res["text"] = text
+				return res
+
+	def readline(self):
+		line = self.f.readline()
+		if not line:
+			raise IOError("manager connection closed")
+		return line.decode("latin-1").rstrip("\r\n")
+
+class Peer:
+	def __init__(self, opts, num):
+		self.name = "%s%d" % (opts.prefix, num)
+		self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		self.sock.bind(("127.0.0.1", 0))
+		self.sock.connect((opts.host, opts.sip_port))
+		self.port = self.sock.getsockname()[1]
+		self.target = "%s:%d" % (opts.host, opts.sip_port)
+		self.seq = 0
+		self.sent = self.last = None
+		self.req = None
+
+	def send(self, method, extra=""):
+		self.seq += 1
+		req = ("%s sip:%s SIP/2.0\r\n"
+			"Via: SIP/2.0/UDP 127.0.0.1:%d;branch=z9hG4bK%s-%d\r\n"
+			"Max-Forwards: 70\r\n"
+			"From: <sip:%s@127.0.0.1>;tag=%s\r\n"
+			"To: <sip:%s@%s>\r\n"
+			"Call-ID: %s-%d-%d@127.0.0.1\r\n"
+			"CSeq: %d %s\r\n"
+			"Contact: <sip:%s@127.0.0.1:%d>\r\n"
+			"%s"
+			"Content-Length: 0\r\n\r\n") % (method, self.target, self.port, self.name, self.seq,
+			self.name, self.name, self.name, self.target, self.name, self.port, self.seq,
+			self.seq, method, self.name, self.port, extra)
+		self.req = req.encode("latin-1")
+		self.sent = self.last = time.time()
+		self.sock.send(self.req)
+
+	def retransmit(self, now):
+		"""Send the request again if it's gone unanswered for T1 (500 ms)"""
+		if now - self.last >= 0.5:
+			self.last = now
+			self.sock.send(self.req)
+
+	def receive(self):
+		"""The status code of a response to our last request, or None for anything else"""
+		msg = self.sock.recv(65535).decode("latin-1")
+		first, _, rest = msg.partition("\r\n")
+		words = first.split()
+		if len(words) < 2 or words[0] != "SIP/2.0":
+			return None
+		for line in rest.split("\r\n"):
+			name, _, value = line.partition(":")
+			if name.strip().lower() in ("call-id", "i") and not value.strip().endswith("-%d@127.0.0.1" % self.seq):
+				return None
+		return int(words[1])
+
+def run(peers, sel, deadline, method, extra, once):
+	"""Send from every peer, one request outstanding each, until the deadline"""
+	times, codes, waiting = [], {}, set(peers)
+	for peer in peers:
+		peer.send(method, extra)
+	while waiting and time.time() < deadline:
+		for key, events in sel.select(min(0.1, max(0, deadline - time.time()))):
+			peer = key.data
+			code = peer.receive()
+			if code is None or code < 200:
+				continue
+			times.append(time.time() - peer.sent)
+			codes[code] = codes.get(code, 0) + 1
+			if once:
+				waiting.discard(peer)
+			else:
+				peer.send(method, extra)
+		now = time.time()
+		for peer in (waiting if once else peers):
+			peer.retransmit(now)
+	if once and waiting:
+		codes["unanswered"] = len(waiting)
+	return times, codes
+
+def report(what, times, codes, elapsed):
+	times.sort()
+	answers = ", ".join("%s %d" % (code, codes[code]) for code in sorted(codes, key=str))
+	if not times:
+		print("%s: none answered (%s)" % (what, answers))
+		return
+	print("%s: %d answered in %.1f s, %.0f/s, median %.2f ms, p99 %.2f ms (%s)" %
+		(what, len(times), elapsed, len(times) / elapsed, times[len(times) // 2] * 1000,
+		times[min(len(times) - 1, int(len(times) * 0.99))] * 1000, answers))
+
+def main():
+	parser = optparse.OptionParser()
+	parser.add_option("--host", default="127.0.0.1")
+	parser.add_option("--sip-port", type="int", default=5060)
+	parser.add_option("--peers", type="int", default=500)
+	parser.add_option("--prefix", default="load", help="peer names are this and a number")
+	parser.add_option("--seconds", type="float", default=10)
+	parser.add_option("--print-peers", action="store_true", help="print sip.conf sections for the peers and exit")
+	parser.add_option("--port", type="int", default=5038, help="the manager port")
+	parser.add_option("--username", default="admin")
+	parser.add_option("--secret", default="", help="to read 'sip show settings' when done")
+	opts, args = parser.parse_args()
+
+	if opts.print_peers:
+		for x in range(opts.peers):
+			print("[%s%d]\ntype=friend\nhost=dynamic\ncontext=default\n" % (opts.prefix, x))
+		return 0
+
+	peers = [Peer(opts, x) for x in range(opts.peers)]
+	sel = selectors.DefaultSelector()
+	for peer in peers:
+		sel.register(peer.sock, selectors.EVENT_READ, peer)
+
+	start = time.time()
+	times, codes = run(peers, sel, start + 30, "REGISTER", "Expires: 3600\r\n", True)
+	report("REGISTER", times, codes, time.time() - start)
+	registered = codes.get(200, 0)
+	start = time.time()
+	times, codes = run(peers, sel, start + opts.seconds, "OPTIONS", "Accept: application/sdp\r\n", False)
+	report("OPTIONS ", times, codes, time.time() - start)
+	for peer in peers:
+		peer.send("REGISTER", "Expires: 0\r\n")
+
+	if opts.secret:
+		man = Manager(opts.host, opts.port, opts.username, opts.secret)
+		for line in man.action(Action="Command", Command="sip show settings")["text"]:
+			if "chain" in line:
+				print(line.strip())
+	return 0 if registered == opts.peers else 1
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,263 @@
+#!/usr/bin/env python3
+#
+# Parser test for chan_sip.
+#
+# Sends a small corpus of INVITE, REGISTER and OPTIONS requests, written
+# the way real phones and proxies write them: long and compact header
+# names, odd case, folded lines, stacked Vias and SDP bodies.  Each is
+# checked first on its own: the response must have the expected status,
+# and must echo every Via, the Call-ID and the CSeq.  Then the corpus is
+# replayed for as long as asked, each copy a new dialog, with a number of
+# requests in flight, and the responses per second are printed for each
+# kind of message.
+#
+# The INVITEs go to an extension that doesn't exist, so no calls are set
+# up; their final responses are ACKed.  The REGISTERs are for a peer with
+# a secret, and are answered with a challenge.  --user names that peer.
+#
+# Usage:
+#
+#   sip_parsetest.py [--host 127.0.0.1] [--sip-port 5060]
+#                    [--user Bob] [--exten 999]
+#                    [--seconds 10] [--inflight 32]
+#
+# This program is free software, distributed under the terms of
+# the GNU General Public License Version 2.
+#
+
+import optparse
+import selectors
+import socket
+import sys
+import time
+
+SDP = ("v=0\r\n"
+	"o=- 8000 8000 IN IP4 127.0.0.1\r\n"
+	"s=call\r\n"
+	"c=IN IP4 127.0.0.1\r\n"
+	"t=0 0\r\n"
+	"m=audio 40000 RTP/AVP 0 8 3 101\r\n"
+	"a=rtpmap:0 PCMU/8000\r\n"
+	"a=rtpmap:8 PCMA/8000\r\n"
+	"a=rtpmap:3 GSM/8000\r\n"
+	"a=rtpmap:101 telephone-event/8000\r\n"
+	"a=fmtp:101 0-15\r\n"
+	"a=ptime:20\r\n"
+	"a=sendrecv\r\n")
+
+# Name, method, expected final status, and the request.  {via} is the
+# top Via's address, {id} makes the Call-ID, branch and tag unique, and
+# {len} is the body length.
+CORPUS = [
+	("register", "REGISTER", 401,
+		"REGISTER sip:{target} SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP {via};branch=z9hG4bK{id};rport\r\n"
+		"From: \"{user}\" <sip:{user}@{target}>;tag={id}\r\n"
+		"To: \"{user}\" <sip:{user}@{target}>\r\n"
+		"Call-ID: {id}@127.0.0.1\r\n"
+		"CSeq: 1 REGISTER\r\n"
+		"Contact: <sip:{user}@{via};transport=udp>;expires=3600\r\n"
+		"Max-Forwards: 70\r\n"
+		"User-Agent: PolycomSoundPointIP-SPIP_550-UA/3.3.4.0085\r\n"
+		"Accept-Language: en\r\n"
+		"Supported: 100rel,replaces\r\n"
+		"Allow-Events: talk,hold,conference\r\n"
+		"Content-Length: 0\r\n\r\n"),
+	("register-compact", "REGISTER", 401,
+		"REGISTER sip:{target} SIP/2.0\r\n"
+		"v: SIP/2.0/UDP {via};branch=z9hG4bK{id}\r\n"
+		"f: <sip:{user}@{target}>;tag={id}\r\n"
+		"t: <sip:{user}@{target}>\r\n"
+		"i: {id}@127.0.0.1\r\n"
+		"CSeq: 7 REGISTER\r\n"
+		"m: <sip:{user}@{via}>\r\n"
+		"Expires: 120\r\n"
+		"k: path\r\n"
+		"l: 0\r\n\r\n"),
+	("invite", "INVITE", 404,
+		"INVITE sip:{exten}@{target} SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP {via};branch=z9hG4bK{id}\r\n"
+		"Max-Forwards: 70\r\n"
+		"From: \"Caller\" <sip:caller@127.0.0.1>;tag={id}\r\n"
+		"To: <sip:{exten}@{target}>\r\n"
+		"Call-ID: {id}@127.0.0.1\r\n"
+		"CSeq: 102 INVITE\r\n"
+		"Contact: <sip:caller@{via}>\r\n"
+		"Allow: INVITE, ACK, CANCEL, OPTIONS, BYE, REFER, NOTIFY\r\n"
+		"Supported: replaces\r\n"
+		"User-Agent: Grandstream GXP2000 1.1.6.46\r\n"
+		"Content-Type: application/sdp\r\n"
+		"Content-Length: {len}\r\n\r\n" + SDP),
+	("invite-compact", "INVITE", 404,
+		"INVITE sip:{exten}@{target} SIP/2.0\r\n"
+		"v: SIP/2.0/UDP {via};branch=z9hG4bK{id}\r\n"
+		"v: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bKproxy{id};received=10.0.0.1\r\n"
+		"f: <sip:caller@127.0.0.1>;tag={id}\r\n"
+		"t: <sip:{exten}@{target}>\r\n"
+		"i: {id}@127.0.0.1\r\n"
+		"CSeq: 1 INVITE\r\n"
+		"m: <sip:caller@{via}>\r\n"
+		"s: a subject\r\n"
+		"c: application/sdp\r\n"
+		"l: {len}\r\n\r\n" + SDP),
+	("invite-folded", "INVITE", 404,
+		"INVITE sip:{exten}@{target} SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP {via};branch=z9hG4bK{id}\r\n"
+		"VIA: SIP/2.0/UDP 10.0.0.1:5060;branch=z9hG4bKproxy{id}\r\n"
+		"max-forwards: 69\r\n"
+		"FROM: <sip:caller@127.0.0.1>;tag={id}\r\n"
+		"to: <sip:{exten}@{target}>\r\n"
+		"call-id: {id}@127.0.0.1\r\n"
+		"cseq: 3 INVITE\r\n"
+		"Contact: <sip:caller@{via}>\r\n"
+		"Subject: a subject that goes\r\n"
+		"  on to a second line\r\n"
+		"Record-Route: <sip:10.0.0.1;lr>\r\n"
+		"Content-Type: application/sdp\r\n"
+		"Content-Length: {len}\r\n\r\n" + SDP),
+	("options", "OPTIONS", 404,
+		"OPTIONS sip:{exten}@{target} SIP/2.0\r\n"
+		"Via: SIP/2.0/UDP {via};branch=z9hG4bK{id}\r\n"
+		"From: <sip:monitor@127.0.0.1>;tag={id}\r\n"
+		"To: <sip:{exten}@{target}>\r\n"
+		"Call-ID: {id}@127.0.0.1\r\n"
+		"CSeq: 1 OPTIONS\r\n"
+		"Accept: application/sdp\r\n"
+		"Max-Forwards: 70\r\n"
+		"Content-Length: 0\r\n\r\n"),
+]
+
+COMPACT = {"v": "via", "i": "call-id", "f": "from", "t": "to", "m": "contact", "l": "content-length"}
+
+def parse(msg):
+	"""The status code and the headers of a response, by lower case long name"""
+	head = msg.split("\r\n\r\n", 1)[0].split("\r\n")
+	words = head[0].split()
+	if len(words) < 2 or words[0] != "SIP/2.0":
+		return None, {}
+	headers = {}
+	for line in head[1:]:
+		name, _, value = line.partition(":")
+		name = name.strip().lower()
+		headers.setdefault(COMPACT.get(name, name), []).append(value.strip())
+	return int(words[1]), headers
+
+class Client:
+	def __init__(self, opts):
+		self.opts = opts
+		self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		self.sock.bind(("127.0.0.1", 0))
+		self.sock.connect((opts.host, opts.sip_port))
+		self.via = "127.0.0.1:%d" % self.sock.getsockname()[1]
+		self.target = "%s:%d" % (opts.host, opts.sip_port)
+		self.count = 0
+		self.pending = {}
+
+	def send(self, entry):
+		"""Send a fresh copy of a corpus entry, returning its Call-ID"""
+		name, method, status, text = entry
+		self.count += 1
+		id = "%s%dx%d" % (name.replace("-", ""), self.sock.getsockname()[1], self.count)
+		msg = text.replace("{via}", self.via).replace("{target}", self.target).replace("{id}", id)
+		msg = msg.replace("{user}", self.opts.user).replace("{exten}", self.opts.exten)
+		msg = msg.replace("{len}", str(len(SDP)))
+		self.pending[id + "@127.0.0.1"] = (entry, msg, time.time())
+		self.sock.send(msg.encode("latin-1"))
+		return id + "@127.0.0.1"
+
+	def receive(self):
+		"""A final response to one of ours: its entry, the request, the status and the headers"""
+		code, headers = parse(self.sock.recv(65535).decode("latin-1"))
+		callid = headers.get("call-id", [""])[0]
+		if code is None or code < 200 or callid not in self.pending:
+			return None
+		entry, msg, sent = self.pending.pop(callid)
+		if entry[1] == "INVITE":
+			self.ack(msg, headers)
+		return entry, msg, code, headers, time.time() - sent
+
+	def ack(self, msg, headers):
+		uri = msg.split()[1]
+		cseq = headers.get("cseq", ["1 INVITE"])[0].split()[0]
+		ack = ("ACK %s SIP/2.0\r\n"
+			"Via: %s\r\n"
+			"From: %s\r\n"
+			"To: %s\r\n"
+			"Call-ID: %s\r\n"
+			"CSeq: %s ACK\r\n"
+			"Max-Forwards: 70\r\n"
+			"Content-Length: 0\r\n\r\n") % (uri, headers["via"][0], headers["from"][0],
+			headers["to"][0], headers["call-id"][0], cseq)
+		self.sock.send(ack.encode("latin-1"))
+
+def check(entry, msg, code, headers):
+	"""What's wrong with a response, if anything"""
+	name, method, status, text = entry
+	sent = parse("SIP/2.0 0 x\r\n" + msg.split("\r\n", 1)[1])[1]
+	wrong = []
+	if code != status:
+		wrong.append("status %d, wanted %d" % (code, status))
+	if [v.split(";")[0] for v in headers.get("via", [])] != [v.split(";")[0] for v in sent["via"]]:
+		wrong.append("Vias %r, sent %r" % (headers.get("via"), sent["via"]))
+	if headers.get("cseq") != sent["cseq"]:
+		wrong.append("CSeq %r, sent %r" % (headers.get("cseq"), sent["cseq"]))
+	return wrong
+
+def main():
+	parser = optparse.OptionParser()
+	parser.add_option("--host", default="127.0.0.1")
+	parser.add_option("--sip-port", type="int", default=5060)
+	parser.add_option("--user", default="Bob", help="a peer with a secret, for the REGISTERs")
+	parser.add_option("--exten", default="999", help="an extension that doesn't exist")
+	parser.add_option("--seconds", type="float", default=10)
+	parser.add_option("--inflight", type="int", default=32, help="requests in flight while replaying")
+	opts, args = parser.parse_args()
+
+	client = Client(opts)
+	sel = selectors.DefaultSelector()
+	sel.register(client.sock, selectors.EVENT_READ)
+	failed = 0
+
+	for entry in CORPUS:
+		client.send(entry)
+		res = None
+		deadline = time.time() + 2
+		while not res and sel.select(max(0, deadline - time.time())):
+			res = client.receive()
+		wrong = check(*res[:4]) if res else ["no answer"]
+		failed += bool(wrong)
+		print("%-16s %s  %s" % (entry[0], "FAIL" if wrong else "ok  ", "; ".join(wrong) or "%d, Vias, Call-ID and CSeq echoed" % res[2]))
+
+	counts = dict((entry[0], []) for entry in CORPUS)
+	start = time.time()
+	deadline = start + opts.seconds
+	x = 0
+	for x in range(opts.inflight):
+		client.send(CORPUS[x % len(CORPUS)])
+	while time.time() < deadline:
+		if not sel.select(0.5):
+			# Lost to a full socket buffer; the run is measuring throughput, so move on
+			client.pending.clear()
+			for y in range(opts.inflight):
+				client.send(CORPUS[y % len(CORPUS)])
+			continue
+		res = client.receive()
+		if not res:
+			continue
+		counts[res[0][0]].append(res[4])
+		if check(*res[:4]):
+			failed += 1
+		x += 1
+		client.send(CORPUS[x % len(CORPUS)])
+	elapsed = time.time() - start
+
+	total = sum(len(times) for times in counts.values())
+	print("%d responses in %.1f s, %.0f/s with %d in flight, %d wrong" % (total, elapsed, total / elapsed, opts.inflight, failed))
+	for entry in CORPUS:
+		times = sorted(counts[entry[0]])
+		if times:
+			print("  %-16s %6d  median %.2f ms" % (entry[0], len(times), times[len(times) // 2] * 1000))
+	return 1 if failed else 0
+
+if __name__ == "__main__":
+	sys.exit(main())
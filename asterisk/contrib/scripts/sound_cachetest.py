@@ -0,0 +1,152 @@
+#!/usr/bin/env python3
+#
+# Sound file setup time test.
+#
+# Runs a stub FastAGI server and starts one call to it through the
+# manager.  The call sets its language, then runs STREAM FILE over and
+# over on a set of prompts, with an offset past the end of each file, so
+# what's timed is finding and opening the file, not playing it.  Prompts
+# that exist only in the default language and names that don't exist at
+# all are timed separately, since both have to fall back through the
+# language first.  Prints the median and 99th percentile time for each,
+# and the sound file cache lines from "core show file formats".
+#
+# This needs a manager.conf user allowed to originate, an extension
+# that answers (100 in the sample extensions.conf does), and the prompts
+# asked for, which default to the digits.
+#
+# Usage:
+#
+#   sound_cachetest.py [--host 127.0.0.1] [--port 5038]
+#                      [--username admin --secret secret]
+#                      [--channel Local/100@default] [--agi-port 4573]
+#                      [--language fr] [--prompts digits/0,digits/1,...]
+#                      [--rounds 200]
+#
+# This program is free software, distributed under the terms of
+# the GNU General Public License Version 2.
+#
+
+import optparse
+import socket
+import sys
+import threading
+import time
+
+class Manager:
+	def __init__(self, host, port, username, secret):
+		self.sock = socket.create_connection((host, port))
+		self.f = self.sock.makefile("rb")
+		self.f.readline()
+		self.id = 0
+		res = self.action(Action="Login", Username=username, Secret=secret, Events="off")
+		if res.get("Response") != "Success":
+			raise IOError("manager login failed: %s" % res.get("Message"))
+
+	def action(self, **headers):
+		self.id += 1
+		headers["ActionID"] = str(self.id)
+		req = "".join("%s: %s\r\n" % (k, v) for k, v in headers.items())
+		self.sock.sendall((req + "\r\n").encode("latin-1"))
+		while True:
+			res, text = {}, []
+			while True:
+				line = self.readline()
+				if res.get("Response") == "Follows" and "ActionID" in res:
+					# Command output, which can have blank lines of its own
+					if line.endswith("--END COMMAND--"):
+						text.append(line[:-len("--END COMMAND--")])
+						self.readline()
+						break
+					text.append(line)
+					continue
+				if not line:
+					break
+				name, sep, value = line.partition(": ")
+				if sep:
+					res.setdefault(name, value)
+			if res.get("ActionID") == headers["ActionID"] and "Response" in res and "Event" not in res:
+				res["text"] = text
+				return res
+
+	def readline(self):
+		line = self.f.readline()
+		if not line:
+			raise IOError("manager connection closed")
+		return line.decode("latin-1").rstrip("\r\n")
+
+def agi_session(sock, opts, results):
+	"""Time STREAM FILE for every prompt, and for a missing name next to each"""
+	f = sock.makefile("rb")
+	while f.readline().strip():
+		pass
+
+	def command(cmd):
+		sock.sendall((cmd + "\n").encode("latin-1"))
+		return f.readline().decode("latin-1").strip()
+
+	command("EXEC Set LANGUAGE()=%s" % opts.language)
+	prompts = opts.prompts.split(",")
+	for x in range(opts.rounds):
+		for prompt in prompts:
+			for kind, name in (("found", prompt), ("missing", prompt + "_nosuch")):
+				start = time.time()
+				res = command("STREAM FILE %s \"\" 100000000" % name)
+				results[kind].append(time.time() - start)
+				if not res.startswith("200"):
+					results["bad"].append("%s: %s" % (name, res))
+	command("HANGUP")
+	sock.close()
+
+def show(kind, times):
+	times.sort()
+	if times:
+		print("%-8s %6d  median %.1f us, p99 %.1f us" % (kind, len(times), times[len(times) // 2] * 1000000,
+			times[min(len(times) - 1, int(len(times) * 0.99))] * 1000000))
+
+def cache_lines(man):
+	return [line.strip() for line in man.action(Action="Command", Command="core show file formats")["text"]
+		if "cache" in line.lower()]
+
+def main():
+	parser = optparse.OptionParser()
+	parser.add_option("--host", default="127.0.0.1")
+	parser.add_option("--port", type="int", default=5038, help="the manager port")
+	parser.add_option("--username", default="admin")
+	parser.add_option("--secret", default="")
+	parser.add_option("--channel", default="Local/100@default", help="a channel that answers")
+	parser.add_option("--agi-port", type="int", default=4573, help="where the stub FastAGI server listens")
+	parser.add_option("--language", default="fr", help="a language the prompts mostly aren't in")
+	parser.add_option("--prompts", default=",".join("digits/%d" % x for x in range(10)))
+	parser.add_option("--rounds", type="int", default=200)
+	opts, args = parser.parse_args()
+
+	server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+	server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+	server.bind(("127.0.0.1", opts.agi_port))
+	server.listen(1)
+	man = Manager(opts.host, opts.port, opts.username, opts.secret)
+	before = cache_lines(man)
+
+	man.action(Action="Originate", Channel=opts.channel, Application="AGI",
+		Data="agi://127.0.0.1:%d/sound_cachetest" % opts.agi_port, Timeout="10000", Async="true")
+	server.settimeout(15)
+	sock, addr = server.accept()
+	sock.settimeout(None)
+	results = {"found": [], "missing": [], "bad": []}
+	t = threading.Thread(target=agi_session, args=(sock, opts, results))
+	t.start()
+	t.join()
+
+	show("found", results["found"])
+	show("missing", results["missing"])
+	for line in results["bad"][:5]:
+		print("  " + line)
+	for line in before:
+		print("before: " + line)
+	for line in cache_lines(man):
+		print("after:  " + line)
+	return 1 if results["bad"] else 0
+
+if __name__ == "__main__":
+	sys.exit(main())
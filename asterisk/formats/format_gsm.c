@@ -69,7 +69,7 @@ static struct ast_frame *gsm_read(struct ast_filestream *s, int *whennext)
 	s->fr.subclass = AST_FORMAT_GSM;
 	AST_FRAME_SET_BUFFER(&(s->fr), s->buf, AST_FRIENDLY_OFFSET, GSM_FRAME_SIZE)
 	s->fr.mallocd = 0;
-	if ((res = fread(s->fr.data, 1, GSM_FRAME_SIZE, s->f)) != GSM_FRAME_SIZE) {
+	if ((res = ast_filestream_read(s, GSM_FRAME_SIZE)) != GSM_FRAME_SIZE) {
 		if (res)
 			ast_log(LOG_WARNING, "Short read (%d) (%s)!\n", res, strerror(errno));
 		return NULL;
@@ -166,6 +166,7 @@ static const struct ast_format gsm_f = {
 	.tell =	gsm_tell,
 	.read =	gsm_read,
 	.buf_size = 2*GSM_FRAME_SIZE + AST_FRIENDLY_OFFSET,	/* 2 gsm frames */
+	.flags = AST_FORMAT_FLAG_PREAD,
 };
 
 static int load_module(void)
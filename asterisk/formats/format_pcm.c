@@ -96,7 +96,7 @@ static struct ast_frame *pcm_read(struct ast_filestream *s, int *whennext)
 	s->fr.subclass = s->fmt->format;
 	s->fr.mallocd = 0;
 	AST_FRAME_SET_BUFFER(&s->fr, s->buf, AST_FRIENDLY_OFFSET, BUF_SIZE);
-	if ((res = fread(s->fr.data, 1, s->fr.datalen, s->f)) < 1) {
+	if ((res = ast_filestream_read(s, s->fr.datalen)) < 1) {
 		if (res)
 			ast_log(LOG_WARNING, "Short read (%d) (%s)!\n", res, strerror(errno));
 		return NULL;
@@ -435,6 +435,7 @@ static const struct ast_format alaw_f = {
 	.tell = pcm_tell,
 	.read = pcm_read,
 	.buf_size = BUF_SIZE + AST_FRIENDLY_OFFSET,
+	.flags = AST_FORMAT_FLAG_PREAD,
 #ifdef REALTIME_WRITE
 	.open = pcma_open,
 	.rewrite = pcma_rewrite,
@@ -452,6 +453,7 @@ static const struct ast_format pcm_f = {
 	.tell = pcm_tell,
 	.read = pcm_read,
 	.buf_size = BUF_SIZE + AST_FRIENDLY_OFFSET,
+	.flags = AST_FORMAT_FLAG_PREAD,
 };
 
 static const struct ast_format g722_f = {
@@ -464,6 +466,7 @@ static const struct ast_format g722_f = {
 	.tell = pcm_tell,
 	.read = pcm_read,
 	.buf_size = (BUF_SIZE * 2) + AST_FRIENDLY_OFFSET,
+	.flags = AST_FORMAT_FLAG_PREAD,
 };
 
 static const struct ast_format au_f = {
@@ -478,6 +481,7 @@ static const struct ast_format au_f = {
 	.tell = au_tell,
 	.read = pcm_read,
 	.buf_size = BUF_SIZE + AST_FRIENDLY_OFFSET,	/* this many shorts */
+	.flags = AST_FORMAT_FLAG_PREAD,
 };
 
 static int load_module(void)
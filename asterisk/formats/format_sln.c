@@ -55,7 +55,7 @@ static struct ast_frame *slinear_read(struct ast_filestream *s, int *whennext)
 	s->fr.subclass = AST_FORMAT_SLINEAR;
 	s->fr.mallocd = 0;
 	AST_FRAME_SET_BUFFER(&s->fr, s->buf, AST_FRIENDLY_OFFSET, BUF_SIZE);
-	if ((res = fread(s->fr.data, 1, s->fr.datalen, s->f)) < 1) {
+	if ((res = ast_filestream_read(s, s->fr.datalen)) < 1) {
 		if (res)
 			ast_log(LOG_WARNING, "Short read (%d) (%s)!\n", res, strerror(errno));
 		return NULL;
@@ -126,6 +126,7 @@ static const struct ast_format slin_f = {
 	.tell = slinear_tell,
 	.read = slinear_read,
 	.buf_size = BUF_SIZE + AST_FRIENDLY_OFFSET,
+	.flags = AST_FORMAT_FLAG_PREAD,
 };
 
 static int load_module(void)
@@ -73,6 +73,7 @@ int dnsmgr_reload(void);			/*!< Provided by dnsmgr.c */
 void threadstorage_init(void);			/*!< Provided by threadstorage.c */
 int astobj2_init(void);				/*! Provided by astobj2.c */
 void ast_autoservice_init(void);    /*!< Provided by autoservice.c */
+int ast_heapprof_init(void);			/*!< Provided by heapprof.c */
 
 /* Many headers need 'ast_channel' to be defined */
 struct ast_channel;
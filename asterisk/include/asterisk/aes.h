@@ -163,6 +163,21 @@ aes_rval aes_decrypt_key(const void *in_key, int key_len, aes_decrypt_ctx cx[1])
 aes_rval aes_decrypt(const void *in_blk, void *out_blk, const aes_decrypt_ctx cx[1]);
 #endif
 
+#if defined(AES_ENCRYPT) && defined(AES_DECRYPT)
+
+/* CBC over len bytes, using AES-NI or the ARMv8 crypto extensions     */
+/* when the CPU has them (see main/aescbc.c). iv is updated to chain    */
+/* further calls; in and out may be the same buffer. Encryption zero    */
+/* pads a partial last block, so out needs len rounded up to 16 bytes;  */
+/* decryption only handles whole blocks.                                */
+
+void aes_cbc_encrypt(const unsigned char *in, unsigned char *out, int len, unsigned char *iv, const aes_encrypt_ctx cx[1]);
+void aes_cbc_decrypt(const unsigned char *in, unsigned char *out, int len, unsigned char *iv, const aes_decrypt_ctx cx[1]);
+
+/* Name of the backend in use                                           */
+const char *aes_cbc_backend(void);
+#endif
+
 #if defined(__cplusplus)
 }
 #endif
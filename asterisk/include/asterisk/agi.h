@@ -32,6 +32,7 @@ typedef struct agi_state {
 	int audio;	/* FD for audio output */
 	int ctrl;	/* FD for input control */
 	unsigned int fast:1; /* flag for fast agi or not */
+	unsigned int reusable:1; /* fast agi session ended cleanly, so the connection may be reused */
 } AGI;
 
 typedef struct agi_command {
@@ -40,4 +40,11 @@ extern short __ast_alaw[256];
 #define AST_LIN2A(a) (__ast_lin2a[((unsigned short)(a)) >> 3])
 #define AST_ALAW(a) (__ast_alaw[(int)(a)])
 
+/*! \brief Convert a block of signed linear samples to A-law.
+ * Gives the same result as AST_LIN2A() on each sample, using SIMD where the CPU has it. */
+void ast_lin2a_buf(unsigned char *dst, const short *src, int samples);
+
+/*! \brief Convert a block of A-law samples to signed linear, like AST_ALAW() on each sample */
+void ast_alaw_buf(short *dst, const unsigned char *src, int samples);
+
 #endif /* _ASTERISK_ALAW_H */
@@ -45,6 +45,14 @@ struct ast_db_entry *ast_db_gettree(const char *family, const char *keytree);
 
 void ast_db_freetree(struct ast_db_entry *entry);
 
+/*! \brief Write any pending database changes to disk
+ *
+ * When dbsyncinterval is set in asterisk.conf, writes are batched in memory
+ * and flushed periodically; this forces the flush immediately.  It is also
+ * run automatically when Asterisk exits.
+ */
+void ast_db_sync(void);
+
 #if defined(__cplusplus) || defined(c_plusplus)
 }
 #endif
@@ -69,6 +69,13 @@ struct ast_audiohook;
  */
 typedef int (*ast_audiohook_manipulate_callback)(struct ast_audiohook *audiohook, struct ast_channel *chan, struct ast_frame *frame, enum ast_audiohook_direction direction);
 
+/*! \brief Callback function for triggering an audiohook
+ * \param audiohook Audiohook structure
+ * \note Called with the audiohook locked, in place of signalling the trigger condition. It is meant for
+ *       whoever services many audiohooks from one thread, and must not block.
+ */
+typedef void (*ast_audiohook_trigger_callback)(struct ast_audiohook *audiohook);
+
 struct ast_audiohook_options {
 	int read_volume;  /*!< Volume adjustment on frames read from the channel the hook is on */
 	int write_volume; /*!< Volume adjustment on frames written to the channel the hook is on */
@@ -88,6 +95,7 @@ struct ast_audiohook {
 	int format;                                            /*!< Format translation path is setup as */
 	struct ast_trans_pvt *trans_pvt;                       /*!< Translation path for reading frames */
 	ast_audiohook_manipulate_callback manipulate_callback; /*!< Manipulation callback */
+	ast_audiohook_trigger_callback trigger_callback;       /*!< Trigger callback (if set, the trigger condition is not used) */
 	struct ast_audiohook_options options;                  /*!< Applicable options */
 	AST_LIST_ENTRY(ast_audiohook) list;                    /*!< Linked list information */
 };
@@ -121,4 +121,34 @@ int ast_dsp_get_tcount(struct ast_dsp *dsp);
  */
 void ast_dsp_frame_freed(struct ast_frame *fr);
 
+/*! \brief A Goertzel filter, measuring the energy at one frequency of 8kHz audio */
+struct ast_goertzel {
+	float v2;
+	float v3;
+	float fac;
+};
+
+/*! \brief Tune a Goertzel filter to freq Hz and clear it */
+void ast_goertzel_init(struct ast_goertzel *g, float freq);
+
+/*! \brief Clear a Goertzel filter for the next block */
+void ast_goertzel_reset(struct ast_goertzel *g);
+
+/*! \brief Energy at the filter's frequency in the samples fed to it since it was cleared */
+float ast_goertzel_result(const struct ast_goertzel *g);
+
+/*!
+ * \brief Feed a block of samples to a bank of Goertzel filters
+ *
+ * \param bank the filters, which needn't be next to each other
+ * \param n how many filters there are (at most 16)
+ * \param samps the samples
+ * \param count how many samples there are
+ * \param energy if not NULL, the sum of the squares of the samples is added to it
+ *
+ * The filters are run side by side (with SSE where the CPU has it), and come
+ * out exactly as if each had been fed the samples one at a time.
+ */
+void ast_goertzel_update(struct ast_goertzel *const *bank, int n, const short *samps, int count, float *energy);
+
 #endif /* _ASTERISK_DSP_H */
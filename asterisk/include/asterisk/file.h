@@ -105,10 +105,17 @@ struct ast_format {
 	 */
 	int buf_size;			/*! size of frame buffer, if any, aligned to 8 bytes. */
 	int desc_size;			/*! size of private descriptor, if any */
+	unsigned int flags;		/*! AST_FORMAT_FLAG_* */
 
 	struct ast_module *module;
 };
 
+/*!
+ * The read function gets its data with ast_filestream_read(), so a stream
+ * opened for reading is read with pread() rather than through stdio.
+ */
+#define AST_FORMAT_FLAG_PREAD	(1 << 0)
+
 /*
  * This structure is allocated by file.c in one chunk,
  * together with buf_size and desc_size bytes of memory
@@ -140,9 +147,23 @@ struct ast_filestream {
 #endif
 	};
 	const char *orig_chan_name;
+	/*! Where the next ast_filestream_read() starts, for AST_FORMAT_FLAG_PREAD
+	    formats opened for reading.  -1 when reading through the FILE. */
+	off_t readpos;
 };
 
 #define SEEK_FORCECUR	10
+
+/*!
+ * \brief Get the data for the next frame of a stream being read
+ * \param s the stream, whose frame has been set up with AST_FRAME_SET_BUFFER()
+ * \param len the most bytes wanted
+ *
+ * The bytes are read into the frame's buffer with a single pread(), or
+ * with fread() for a stream that isn't read that way.
+ * \return the number of bytes, or -1 on error
+ */
+int ast_filestream_read(struct ast_filestream *s, int len);
 	
 /*! Register a new file format capability
  * Adds a format to Asterisk's format abilities.
@@ -160,6 +160,8 @@ struct ast_frame {
 	void *data;		
 	/*! Global delivery time */		
 	struct timeval delivery;
+	/*! When the audio in it came into Asterisk, while latency tracing is on */
+	struct timeval ingress;
 	/*! For placing in a linked list */
 	AST_LIST_ENTRY(ast_frame) frame_list;
 	/*! Misc. frame flags */
@@ -202,6 +204,8 @@ extern struct ast_frame ast_null_frame;
 #define AST_MALLOCD_DATA	(1 << 1)
 /*! Need the source be free'd? (haha!) */
 #define AST_MALLOCD_SRC		(1 << 2)
+/*! The header came from a frame slab, set by the framer only */
+#define AST_MALLOCD_SLAB	(1 << 3)
 
 /* MODEM subclasses */
 /*! T.38 Fax-over-IP */
@@ -406,8 +410,9 @@ void ast_frame_free(struct ast_frame *fr, int cache);
  * \param fr frame to act upon
  * Take a frame, and if it's not been malloc'd, make a malloc'd copy
  * and if the data hasn't been malloced then make the
- * data malloc'd.  If you need to store frames, say for queueing, then
- * you should call this function.
+ * data malloc'd.  A frame with nothing malloc'd is copied whole, header,
+ * src and data in one allocation.  If you need to store frames, say for
+ * queueing, then you should call this function.
  * \return Returns a frame on success, NULL on error
  */
 struct ast_frame *ast_frisolate(struct ast_frame *fr);
@@ -419,6 +424,35 @@ struct ast_frame *ast_frisolate(struct ast_frame *fr);
  */
 struct ast_frame *ast_frdup(const struct ast_frame *fr);
 
+/*! \brief Points along the voice path where the age of a frame is measured */
+enum ast_latency_stage {
+	AST_LATENCY_READ,		/*!< Returned by ast_read() */
+	AST_LATENCY_TRANSLATE,		/*!< Out of a translation path */
+	AST_LATENCY_CONFERENCE,		/*!< Out of a conference (app_rpt) */
+	AST_LATENCY_WRITE,		/*!< Handed to the channel driver by ast_write() */
+	AST_LATENCY_STAGES,
+};
+
+/*! \brief Non-zero while "core set latency on" is in effect */
+extern int ast_latency_tracing;
+
+void __ast_frame_stamp(struct ast_frame *fr);
+void __ast_latency_mark(const struct ast_frame *fr, enum ast_latency_stage stage, const char *where);
+
+/*! \brief Note that the audio in a frame has just come in
+ * Channel drivers call this where the audio arrives (off the network or the sound card),
+ * so the time it then spends in jitter buffers and queues is seen.  A voice frame not
+ * stamped by its driver is stamped when it is queued on the channel.
+ */
+#define ast_frame_stamp(fr) do { if (ast_latency_tracing) __ast_frame_stamp(fr); } while (0)
+
+/*! \brief Count how long ago the audio in a frame came in, against a stage of the voice path
+ * \param fr the frame
+ * \param stage how far along it has got
+ * \param where what it is going through (a channel type, say), or NULL
+ */
+#define ast_latency_mark(fr, stage, where) do { if (ast_latency_tracing) __ast_latency_mark(fr, stage, where); } while (0)
+
 void ast_swapcopy_samples(void *dst, const void *src, int samples);
 
 /* Helpers for byteswapping native samples to/from 
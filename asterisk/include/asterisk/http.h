@@ -57,6 +57,16 @@ char *ast_http_error(int status, const char *title, const char *extra_header, co
 /*! \brief Destroy an HTTP server */
 void ast_http_uri_unlink(struct ast_http_uri *urihandler);
 
+/*!
+ * \brief Mark the request being served as about to wait, or done waiting
+ * \param start 1 before the wait, 0 after it
+ *
+ * For a callback that can sit for a long time, such as a manager WaitEvent.
+ * Another server thread is started for as long as it waits, so the others
+ * keep answering requests.  Does nothing outside the HTTP server threads.
+ */
+void ast_http_blocking(int start);
+
 char *ast_http_setcookie(const char *var, const char *val, int expires, char *buf, size_t buflen);
 
 int ast_http_init(void);
@@ -71,6 +71,23 @@
 	} while (0)
 #endif	/* HAVE_MTX_PROFILE */
 
+/*! \brief Non-zero while the lock contention profiler is running
+ *
+ * The profiler is started and stopped with "core set locks profile", and its
+ * findings are shown by "core show locks profile".  While it is stopped, the
+ * only cost to locking a mutex is testing this flag.
+ */
+extern int ast_lock_profiling;
+
+/*! \brief Lock (or try to lock) a mutex, noting how long it took and where it was done */
+int __ast_lock_prof_lock(pthread_mutex_t *mutex, const char *filename, int lineno, const char *lock_name, int try);
+
+/*! \brief Note that a mutex is about to be unlocked, ending the time it was held */
+void __ast_lock_prof_unlock(pthread_mutex_t *mutex);
+
+/*! \brief Note that a condition wait is about to let go of a mutex (waiting != 0), or has got it back */
+void __ast_lock_prof_cond(pthread_mutex_t *mutex, int waiting);
+
 #define AST_PTHREADT_NULL (pthread_t) -1
 #define AST_PTHREADT_STOP (pthread_t) -2
 
@@ -397,13 +414,17 @@ static inline int __ast_pthread_mutex_lock(const char *filename, int lineno, con
 		} while (res == EBUSY);
 	}
 #else
+	if (ast_lock_profiling)
+		res = __ast_lock_prof_lock(&t->mutex, filename, lineno, mutex_name, 0);
+	else {
 #ifdef	HAVE_MTX_PROFILE
-	ast_mark(mtx_prof, 1);
-	res = pthread_mutex_trylock(&t->mutex);
-	ast_mark(mtx_prof, 0);
-	if (res)
+		ast_mark(mtx_prof, 1);
+		res = pthread_mutex_trylock(&t->mutex);
+		ast_mark(mtx_prof, 0);
+		if (res)
 #endif
-	res = pthread_mutex_lock(&t->mutex);
+		res = pthread_mutex_lock(&t->mutex);
+	}
 #endif /* DETECT_DEADLOCKS */
 
 	if (!res) {
@@ -456,7 +477,12 @@ static inline int __ast_pthread_mutex_trylock(const char *filename, int lineno,
 	if (t->track)
 		ast_store_lock_info(AST_MUTEX, filename, lineno, func, mutex_name, &t->mutex);
 
-	if (!(res = pthread_mutex_trylock(&t->mutex))) {
+	if (ast_lock_profiling)
+		res = __ast_lock_prof_lock(&t->mutex, filename, lineno, mutex_name, 1);
+	else
+		res = pthread_mutex_trylock(&t->mutex);
+
+	if (!res) {
 		ast_reentrancy_lock(t);
 		if (t->reentrancy < AST_MAX_REENTRANCY) {
 			t->file[t->reentrancy] = filename;
@@ -523,6 +549,9 @@ static inline int __ast_pthread_mutex_unlock(const char *filename, int lineno, c
 	if (t->track)
 		ast_remove_lock_info(&t->mutex);
 
+	if (ast_lock_profiling)
+		__ast_lock_prof_unlock(&t->mutex);
+
 	if ((res = pthread_mutex_unlock(&t->mutex))) {
 		__ast_mutex_logger("%s line %d (%s): Error releasing mutex: %s\n", 
 				   filename, lineno, func, strerror(res));
@@ -602,7 +631,13 @@ static inline int __ast_cond_wait(const char *filename, int lineno, const char *
 	if (t->track)
 		ast_remove_lock_info(&t->mutex);
 
-	if ((res = pthread_cond_wait(cond, &t->mutex))) {
+	if (ast_lock_profiling)
+		__ast_lock_prof_cond(&t->mutex, 1);
+	res = pthread_cond_wait(cond, &t->mutex);
+	if (ast_lock_profiling)
+		__ast_lock_prof_cond(&t->mutex, 0);
+
+	if (res) {
 		__ast_mutex_logger("%s line %d (%s): Error waiting on condition mutex '%s'\n", 
 				   filename, lineno, func, strerror(res));
 		DO_THREAD_CRASH;
@@ -673,7 +708,13 @@ static inline int __ast_cond_timedwait(const char *filename, int lineno, const c
 	if (t->track)
 		ast_remove_lock_info(&t->mutex);
 
-	if ((res = pthread_cond_timedwait(cond, &t->mutex, abstime)) && (res != ETIMEDOUT)) {
+	if (ast_lock_profiling)
+		__ast_lock_prof_cond(&t->mutex, 1);
+	res = pthread_cond_timedwait(cond, &t->mutex, abstime);
+	if (ast_lock_profiling)
+		__ast_lock_prof_cond(&t->mutex, 0);
+
+	if (res && (res != ETIMEDOUT)) {
 		__ast_mutex_logger("%s line %d (%s): Error waiting on condition mutex '%s'\n", 
 				   filename, lineno, func, strerror(res));
 		DO_THREAD_CRASH;
@@ -742,6 +783,8 @@ static inline int ast_mutex_init(ast_mutex_t *pmutex)
 
 static inline int ast_mutex_unlock(ast_mutex_t *pmutex)
 {
+	if (__builtin_expect(ast_lock_profiling, 0))
+		__ast_lock_prof_unlock(pmutex);
 	return pthread_mutex_unlock(pmutex);
 }
 
@@ -750,16 +793,24 @@ static inline int ast_mutex_destroy(ast_mutex_t *pmutex)
 	return pthread_mutex_destroy(pmutex);
 }
 
-static inline int ast_mutex_lock(ast_mutex_t *pmutex)
+static inline int __ast_mutex_lock(ast_mutex_t *pmutex, const char *filename, int lineno, const char *lock_name)
 {
+	if (__builtin_expect(ast_lock_profiling, 0))
+		return __ast_lock_prof_lock(pmutex, filename, lineno, lock_name, 0);
 	__MTX_PROF(pmutex);
 }
 
-static inline int ast_mutex_trylock(ast_mutex_t *pmutex)
+#define ast_mutex_lock(a) __ast_mutex_lock(a, __FILE__, __LINE__, #a)
+
+static inline int __ast_mutex_trylock(ast_mutex_t *pmutex, const char *filename, int lineno, const char *lock_name)
 {
+	if (__builtin_expect(ast_lock_profiling, 0))
+		return __ast_lock_prof_lock(pmutex, filename, lineno, lock_name, 1);
 	return pthread_mutex_trylock(pmutex);
 }
 
+#define ast_mutex_trylock(a) __ast_mutex_trylock(a, __FILE__, __LINE__, #a)
+
 typedef pthread_cond_t ast_cond_t;
 
 static inline int ast_cond_init(ast_cond_t *cond, pthread_condattr_t *cond_attr)
@@ -784,12 +835,26 @@ static inline int ast_cond_destroy(ast_cond_t *cond)
 
 static inline int ast_cond_wait(ast_cond_t *cond, ast_mutex_t *t)
 {
-	return pthread_cond_wait(cond, t);
+	int res;
+
+	if (__builtin_expect(!ast_lock_profiling, 1))
+		return pthread_cond_wait(cond, t);
+	__ast_lock_prof_cond(t, 1);
+	res = pthread_cond_wait(cond, t);
+	__ast_lock_prof_cond(t, 0);
+	return res;
 }
 
 static inline int ast_cond_timedwait(ast_cond_t *cond, ast_mutex_t *t, const struct timespec *abstime)
 {
-	return pthread_cond_timedwait(cond, t, abstime);
+	int res;
+
+	if (__builtin_expect(!ast_lock_profiling, 1))
+		return pthread_cond_timedwait(cond, t, abstime);
+	__ast_lock_prof_cond(t, 1);
+	res = pthread_cond_timedwait(cond, t, abstime);
+	__ast_lock_prof_cond(t, 0);
+	return res;
 }
 
 #endif /* !DEBUG_THREADS */
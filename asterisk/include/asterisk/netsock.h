@@ -40,6 +40,9 @@ struct ast_netsock_list *ast_netsock_list_alloc(void);
 
 int ast_netsock_init(struct ast_netsock_list *list);
 
+/*! \brief Bind later sockets in this list with SO_REUSEPORT (returns -1 where unsupported) */
+int ast_netsock_set_reuseport(struct ast_netsock_list *list, int reuseport);
+
 struct ast_netsock *ast_netsock_bind(struct ast_netsock_list *list, struct io_context *ioc,
 				     const char *bindinfo, int defaultport, int tos, ast_io_cb callback, void *data);
 
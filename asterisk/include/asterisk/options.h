@@ -114,6 +114,9 @@ extern int option_verbose;
 extern int option_debug;		/*!< Debugging */
 extern int option_maxcalls;		/*!< Maximum number of simultaneous channels */
 extern double option_maxload;
+extern int option_dbsyncinterval;	/*!< Milliseconds between AstDB flushes (0 = flush every write) */
+extern int option_dbsyncwrites;		/*!< Pending AstDB writes that force an early flush */
+extern int option_heapsample;		/*!< Bytes between heap profiler samples from startup (0 = off) */
 extern char defaultlanguage[];
 
 extern time_t ast_startuptime;
@@ -230,6 +230,22 @@ void ast_translator_free_path(struct ast_trans_pvt *tr);
  */
 struct ast_frame *ast_translate(struct ast_trans_pvt *tr, struct ast_frame *f, int consume);
 
+/*!
+ * \brief translates several frames of one stream in one pass
+ * Each step of the path is fed all the frames, and only gives up what it
+ * has buffered when the next frame would not fit, so codecs get to work on
+ * as much audio at once as their buffers hold, and the buffers never overflow.
+ * A step that does not set buffer_samples is emptied before every frame.
+ * \param tr translator structure to use for translation
+ * \param frames frames to translate, in order
+ * \param count number of frames
+ * \param consume Whether or not to free the original frames
+ * \return the first resulting frame, NULL if there was none. The results are
+ * linked through their frame_list entries and each one must be freed by the
+ * caller with ast_frfree().
+ */
+struct ast_frame *ast_translate_frames(struct ast_trans_pvt *tr, struct ast_frame **frames, int count, int consume);
+
 /*!
  * \brief Returns the number of steps required to convert from 'src' to 'dest'.
  * \param dest destination format
@@ -40,4 +40,11 @@ extern short __ast_mulaw[256];
 #define AST_LIN2MU(a) (__ast_lin2mu[((unsigned short)(a)) >> 2])
 #define AST_MULAW(a) (__ast_mulaw[(a)])
 
+/*! \brief Convert a block of signed linear samples to mu-law.
+ * Gives the same result as AST_LIN2MU() on each sample, using SIMD where the CPU has it. */
+void ast_lin2mu_buf(unsigned char *dst, const short *src, int samples);
+
+/*! \brief Convert a block of mu-law samples to signed linear, like AST_MULAW() on each sample */
+void ast_mulaw_buf(short *dst, const unsigned char *src, int samples);
+
 #endif /* _ASTERISK_ULAW_H */
@@ -273,6 +273,8 @@ static force_inline int inaddrcmp(const struct sockaddr_in *sin1, const struct s
 #endif
 
 void ast_register_thread(char *name);
+/*! \brief Register the calling thread, charging the CPU it uses to subsystem (a module's name, say) */
+void ast_register_thread_subsystem(char *name, const char *subsystem);
 void ast_unregister_thread(void *id);
 
 int ast_pthread_create_stack(pthread_t *thread, pthread_attr_t *attr, void *(*start_routine)(void *),
@@ -323,6 +325,21 @@ static void ast_free(void *ptr)
 
 #define MALLOC_FAILURE_MSG \
 	ast_log(LOG_ERROR, "Memory Allocation Failure in function %s at line %d of %s\n", func, lineno, file);
+
+/*! \brief Bytes between the allocations the heap profiler samples, or 0 while it is off */
+extern int ast_heap_sample_rate;
+
+void __ast_heap_alloc(void *p, size_t len, const char *file, int lineno, const char *func);
+
+/*!
+ * \brief Tell the heap profiler about an allocation
+ *
+ * The wrappers below call this for everything they allocate.  While the
+ * profiler is off, that is a single test of a global.
+ */
+#define ast_heap_alloc(p, len, file, lineno, func) \
+	do { if (ast_heap_sample_rate) __ast_heap_alloc(p, len, file, lineno, func); } while (0)
+
 /*!
  * \brief A wrapper for malloc()
  *
@@ -339,8 +356,10 @@ void * attribute_malloc _ast_malloc(size_t len, const char *file, int lineno, co
 {
 	void *p;
 
-	if (!(p = malloc(len)))
+	if (!(p = malloc(len))) {
 		MALLOC_FAILURE_MSG;
+	} else
+		ast_heap_alloc(p, len, file, lineno, func);
 
 	return p;
 }
@@ -362,8 +381,10 @@ void * attribute_malloc _ast_calloc(size_t num, size_t len, const char *file, in
 {
 	void *p;
 
-	if (!(p = calloc(num, len)))
+	if (!(p = calloc(num, len))) {
 		MALLOC_FAILURE_MSG;
+	} else
+		ast_heap_alloc(p, num * len, file, lineno, func);
 
 	return p;
 }
@@ -398,8 +419,10 @@ void * attribute_malloc _ast_realloc(void *p, size_t len, const char *file, int
 {
 	void *newp;
 
-	if (!(newp = realloc(p, len)))
+	if (!(newp = realloc(p, len))) {
 		MALLOC_FAILURE_MSG;
+	} else
+		ast_heap_alloc(newp, len, file, lineno, func);
 
 	return newp;
 }
@@ -426,8 +449,10 @@ char * attribute_malloc _ast_strdup(const char *str, const char *file, int linen
 	char *newstr = NULL;
 
 	if (str) {
-		if (!(newstr = strdup(str)))
+		if (!(newstr = strdup(str))) {
 			MALLOC_FAILURE_MSG;
+		} else
+			ast_heap_alloc(newstr, strlen(newstr) + 1, file, lineno, func);
 	}
 
 	return newstr;
@@ -455,8 +480,10 @@ char * attribute_malloc _ast_strndup(const char *str, size_t len, const char *fi
 	char *newstr = NULL;
 
 	if (str) {
-		if (!(newstr = strndup(str, len)))
+		if (!(newstr = strndup(str, len))) {
 			MALLOC_FAILURE_MSG;
+		} else
+			ast_heap_alloc(newstr, strlen(newstr) + 1, file, lineno, func);
 	}
 
 	return newstr;
@@ -492,8 +519,10 @@ int _ast_vasprintf(char **ret, const char *file, int lineno, const char *func, c
 {
 	int res;
 
-	if ((res = vasprintf(ret, fmt, ap)) == -1)
+	if ((res = vasprintf(ret, fmt, ap)) == -1) {
 		MALLOC_FAILURE_MSG;
+	} else
+		ast_heap_alloc(*ret, res + 1, file, lineno, func);
 
 	return res;
 }
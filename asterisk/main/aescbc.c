@@ -0,0 +1,410 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief AES-128 CBC with hardware backends
+ *
+ * The key schedules built by aeskey.c are laid out the way the AES-NI and
+ * ARMv8 crypto instructions expect them (the decryption schedule is the
+ * equivalent inverse cipher), so the same aes_encrypt_ctx/aes_decrypt_ctx
+ * drive every backend.  The backend is picked on first use from what the
+ * CPU supports, and is only used once it has reproduced the FIPS-197 known
+ * answer and the table driven code on a multi-block buffer.
+ */
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define AES_CBC_AESNI
+#include <cpuid.h>
+#include <wmmintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRYPTO)
+#define AES_CBC_ARMV8
+#include <arm_neon.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "asterisk/aes.h"
+#include "asterisk/logger.h"
+#include "asterisk/options.h"
+#include "asterisk/utils.h"
+
+/*! Rounds for AES-128, the only key size the hardware paths handle */
+#define AES_CBC_ROUNDS	10
+
+struct aes_cbc_backend {
+	const char *name;
+	int (*available)(void);
+	void (*encrypt)(const unsigned char *in, unsigned char *out, int blocks, unsigned char *iv, const aes_encrypt_ctx *cx);
+	void (*decrypt)(const unsigned char *in, unsigned char *out, int blocks, unsigned char *iv, const aes_decrypt_ctx *cx);
+};
+
+static void generic_cbc_encrypt(const unsigned char *in, unsigned char *out, int blocks, unsigned char *iv, const aes_encrypt_ctx *cx)
+{
+	unsigned char curblock[AES_BLOCK_SIZE];
+	int x;
+
+	memcpy(curblock, iv, sizeof(curblock));
+	while (blocks--) {
+		for (x = 0; x < AES_BLOCK_SIZE; x++)
+			curblock[x] ^= in[x];
+		aes_encrypt(curblock, out, cx);
+		memcpy(curblock, out, sizeof(curblock));
+		in += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+	}
+	memcpy(iv, curblock, sizeof(curblock));
+}
+
+static void generic_cbc_decrypt(const unsigned char *in, unsigned char *out, int blocks, unsigned char *iv, const aes_decrypt_ctx *cx)
+{
+	unsigned char lastblock[AES_BLOCK_SIZE], thisblock[AES_BLOCK_SIZE];
+	int x;
+
+	memcpy(lastblock, iv, sizeof(lastblock));
+	while (blocks--) {
+		memcpy(thisblock, in, sizeof(thisblock));
+		aes_decrypt(thisblock, out, cx);
+		for (x = 0; x < AES_BLOCK_SIZE; x++)
+			out[x] ^= lastblock[x];
+		memcpy(lastblock, thisblock, sizeof(lastblock));
+		in += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+	}
+	memcpy(iv, lastblock, sizeof(lastblock));
+}
+
+static int generic_available(void)
+{
+	return 1;
+}
+
+#ifdef AES_CBC_AESNI
+#define AESNI_TARGET __attribute__((target("aes,sse2")))
+
+static int aesni_available(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+	return (ecx & bit_AES) ? 1 : 0;
+}
+
+static AESNI_TARGET void aesni_cbc_encrypt(const unsigned char *in, unsigned char *out, int blocks, unsigned char *iv, const aes_encrypt_ctx *cx)
+{
+	const __m128i *ks = (const __m128i *) cx->ks;
+	__m128i rk[AES_CBC_ROUNDS + 1], state;
+	int r;
+
+	for (r = 0; r <= AES_CBC_ROUNDS; r++)
+		rk[r] = _mm_loadu_si128(ks + r);
+
+	state = _mm_loadu_si128((const __m128i *) iv);
+	while (blocks--) {
+		state = _mm_xor_si128(state, _mm_loadu_si128((const __m128i *) in));
+		state = _mm_xor_si128(state, rk[0]);
+		for (r = 1; r < AES_CBC_ROUNDS; r++)
+			state = _mm_aesenc_si128(state, rk[r]);
+		state = _mm_aesenclast_si128(state, rk[AES_CBC_ROUNDS]);
+		_mm_storeu_si128((__m128i *) out, state);
+		in += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+	}
+	_mm_storeu_si128((__m128i *) iv, state);
+}
+
+/*! \brief CBC decryption has no chaining between blocks, so run four at once */
+static AESNI_TARGET void aesni_cbc_decrypt(const unsigned char *in, unsigned char *out, int blocks, unsigned char *iv, const aes_decrypt_ctx *cx)
+{
+	const __m128i *ks = (const __m128i *) cx->ks;
+	__m128i rk[AES_CBC_ROUNDS + 1], last, c0, c1, c2, c3, s0, s1, s2, s3;
+	int r;
+
+	for (r = 0; r <= AES_CBC_ROUNDS; r++)
+		rk[r] = _mm_loadu_si128(ks + r);
+
+	last = _mm_loadu_si128((const __m128i *) iv);
+	for (; blocks >= 4; blocks -= 4) {
+		c0 = _mm_loadu_si128((const __m128i *) in);
+		c1 = _mm_loadu_si128((const __m128i *) in + 1);
+		c2 = _mm_loadu_si128((const __m128i *) in + 2);
+		c3 = _mm_loadu_si128((const __m128i *) in + 3);
+		s0 = _mm_xor_si128(c0, rk[AES_CBC_ROUNDS]);
+		s1 = _mm_xor_si128(c1, rk[AES_CBC_ROUNDS]);
+		s2 = _mm_xor_si128(c2, rk[AES_CBC_ROUNDS]);
+		s3 = _mm_xor_si128(c3, rk[AES_CBC_ROUNDS]);
+		for (r = AES_CBC_ROUNDS - 1; r > 0; r--) {
+			s0 = _mm_aesdec_si128(s0, rk[r]);
+			s1 = _mm_aesdec_si128(s1, rk[r]);
+			s2 = _mm_aesdec_si128(s2, rk[r]);
+			s3 = _mm_aesdec_si128(s3, rk[r]);
+		}
+		s0 = _mm_xor_si128(_mm_aesdeclast_si128(s0, rk[0]), last);
+		s1 = _mm_xor_si128(_mm_aesdeclast_si128(s1, rk[0]), c0);
+		s2 = _mm_xor_si128(_mm_aesdeclast_si128(s2, rk[0]), c1);
+		s3 = _mm_xor_si128(_mm_aesdeclast_si128(s3, rk[0]), c2);
+		_mm_storeu_si128((__m128i *) out, s0);
+		_mm_storeu_si128((__m128i *) out + 1, s1);
+		_mm_storeu_si128((__m128i *) out + 2, s2);
+		_mm_storeu_si128((__m128i *) out + 3, s3);
+		last = c3;
+		in += 4 * AES_BLOCK_SIZE;
+		out += 4 * AES_BLOCK_SIZE;
+	}
+	while (blocks--) {
+		c0 = _mm_loadu_si128((const __m128i *) in);
+		s0 = _mm_xor_si128(c0, rk[AES_CBC_ROUNDS]);
+		for (r = AES_CBC_ROUNDS - 1; r > 0; r--)
+			s0 = _mm_aesdec_si128(s0, rk[r]);
+		s0 = _mm_xor_si128(_mm_aesdeclast_si128(s0, rk[0]), last);
+		_mm_storeu_si128((__m128i *) out, s0);
+		last = c0;
+		in += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+	}
+	_mm_storeu_si128((__m128i *) iv, last);
+}
+#endif /* AES_CBC_AESNI */
+
+#ifdef AES_CBC_ARMV8
+static int armv8_available(void)
+{
+	return (getauxval(AT_HWCAP) & HWCAP_AES) ? 1 : 0;
+}
+
+static void armv8_cbc_encrypt(const unsigned char *in, unsigned char *out, int blocks, unsigned char *iv, const aes_encrypt_ctx *cx)
+{
+	const unsigned char *ks = (const unsigned char *) cx->ks;
+	uint8x16_t rk[AES_CBC_ROUNDS + 1], state;
+	int r;
+
+	for (r = 0; r <= AES_CBC_ROUNDS; r++)
+		rk[r] = vld1q_u8(ks + r * AES_BLOCK_SIZE);
+
+	state = vld1q_u8(iv);
+	while (blocks--) {
+		state = veorq_u8(state, vld1q_u8(in));
+		for (r = 0; r < AES_CBC_ROUNDS - 1; r++)
+			state = vaesmcq_u8(vaeseq_u8(state, rk[r]));
+		state = veorq_u8(vaeseq_u8(state, rk[AES_CBC_ROUNDS - 1]), rk[AES_CBC_ROUNDS]);
+		vst1q_u8(out, state);
+		in += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+	}
+	vst1q_u8(iv, state);
+}
+
+static void armv8_cbc_decrypt(const unsigned char *in, unsigned char *out, int blocks, unsigned char *iv, const aes_decrypt_ctx *cx)
+{
+	const unsigned char *ks = (const unsigned char *) cx->ks;
+	uint8x16_t rk[AES_CBC_ROUNDS + 1], last, c0, c1, c2, c3, s0, s1, s2, s3;
+	int r;
+
+	for (r = 0; r <= AES_CBC_ROUNDS; r++)
+		rk[r] = vld1q_u8(ks + r * AES_BLOCK_SIZE);
+
+	last = vld1q_u8(iv);
+	for (; blocks >= 4; blocks -= 4) {
+		s0 = c0 = vld1q_u8(in);
+		s1 = c1 = vld1q_u8(in + AES_BLOCK_SIZE);
+		s2 = c2 = vld1q_u8(in + 2 * AES_BLOCK_SIZE);
+		s3 = c3 = vld1q_u8(in + 3 * AES_BLOCK_SIZE);
+		for (r = AES_CBC_ROUNDS; r > 1; r--) {
+			s0 = vaesimcq_u8(vaesdq_u8(s0, rk[r]));
+			s1 = vaesimcq_u8(vaesdq_u8(s1, rk[r]));
+			s2 = vaesimcq_u8(vaesdq_u8(s2, rk[r]));
+			s3 = vaesimcq_u8(vaesdq_u8(s3, rk[r]));
+		}
+		s0 = veorq_u8(veorq_u8(vaesdq_u8(s0, rk[1]), rk[0]), last);
+		s1 = veorq_u8(veorq_u8(vaesdq_u8(s1, rk[1]), rk[0]), c0);
+		s2 = veorq_u8(veorq_u8(vaesdq_u8(s2, rk[1]), rk[0]), c1);
+		s3 = veorq_u8(veorq_u8(vaesdq_u8(s3, rk[1]), rk[0]), c2);
+		vst1q_u8(out, s0);
+		vst1q_u8(out + AES_BLOCK_SIZE, s1);
+		vst1q_u8(out + 2 * AES_BLOCK_SIZE, s2);
+		vst1q_u8(out + 3 * AES_BLOCK_SIZE, s3);
+		last = c3;
+		in += 4 * AES_BLOCK_SIZE;
+		out += 4 * AES_BLOCK_SIZE;
+	}
+	while (blocks--) {
+		s0 = c0 = vld1q_u8(in);
+		for (r = AES_CBC_ROUNDS; r > 1; r--)
+			s0 = vaesimcq_u8(vaesdq_u8(s0, rk[r]));
+		s0 = veorq_u8(veorq_u8(vaesdq_u8(s0, rk[1]), rk[0]), last);
+		vst1q_u8(out, s0);
+		last = c0;
+		in += AES_BLOCK_SIZE;
+		out += AES_BLOCK_SIZE;
+	}
+	vst1q_u8(iv, last);
+}
+#endif /* AES_CBC_ARMV8 */
+
+/*! Backends in order of preference; the generic one must stay last */
+static const struct aes_cbc_backend backends[] = {
+#ifdef AES_CBC_AESNI
+	{ "AES-NI", aesni_available, aesni_cbc_encrypt, aesni_cbc_decrypt },
+#endif
+#ifdef AES_CBC_ARMV8
+	{ "ARMv8 crypto", armv8_available, armv8_cbc_encrypt, armv8_cbc_decrypt },
+#endif
+	{ "generic", generic_available, generic_cbc_encrypt, generic_cbc_decrypt },
+};
+
+static const struct aes_cbc_backend *backend = &backends[ARRAY_LEN(backends) - 1];
+static pthread_once_t backend_once = PTHREAD_ONCE_INIT;
+
+/*! \brief Encrypt len bytes, zero padding a partial last block out to a whole one */
+static void cbc_encrypt(const struct aes_cbc_backend *be, const unsigned char *in, unsigned char *out, int len, unsigned char *iv, const aes_encrypt_ctx *cx)
+{
+	unsigned char last[AES_BLOCK_SIZE];
+	int blocks = len / AES_BLOCK_SIZE, tail = len % AES_BLOCK_SIZE;
+
+	/* Take the tail first, as in may be out */
+	if (tail) {
+		memset(last, 0, sizeof(last));
+		memcpy(last, in + blocks * AES_BLOCK_SIZE, tail);
+	}
+	be->encrypt(in, out, blocks, iv, cx);
+	if (tail)
+		be->encrypt(last, out + blocks * AES_BLOCK_SIZE, 1, iv, cx);
+}
+
+/*! \brief Check a backend against FIPS-197 C.1 and against the generic code */
+static int aes_cbc_selftest(const struct aes_cbc_backend *be)
+{
+	static const unsigned char fips_ct[AES_BLOCK_SIZE] = {
+		0x69, 0xc4, 0xe0, 0xd8, 0x6a, 0x7b, 0x04, 0x30,
+		0xd8, 0xcd, 0xb7, 0x80, 0x70, 0xb4, 0xc5, 0x5a,
+	};
+	const struct aes_cbc_backend *generic = &backends[ARRAY_LEN(backends) - 1];
+	unsigned char key[16], pt[7 * AES_BLOCK_SIZE], ct[sizeof(pt)], ref[sizeof(pt)], out[sizeof(pt)];
+	unsigned char iv[AES_BLOCK_SIZE], refiv[AES_BLOCK_SIZE];
+	aes_encrypt_ctx ecx;
+	aes_decrypt_ctx dcx;
+	int x;
+
+	/* FIPS-197 appendix C.1: a single block with a zero IV is plain AES */
+	for (x = 0; x < sizeof(key); x++)
+		key[x] = x;
+	for (x = 0; x < AES_BLOCK_SIZE; x++)
+		pt[x] = (x << 4) | x;
+	aes_encrypt_key128(key, &ecx);
+	aes_decrypt_key128(key, &dcx);
+	memset(iv, 0, sizeof(iv));
+	be->encrypt(pt, ct, 1, iv, &ecx);
+	if (memcmp(ct, fips_ct, sizeof(fips_ct)))
+		return -1;
+	memset(iv, 0, sizeof(iv));
+	be->decrypt(ct, out, 1, iv, &dcx);
+	if (memcmp(out, pt, AES_BLOCK_SIZE))
+		return -1;
+
+	/* Seven blocks cover both the pipelined and the single block decrypt */
+	for (x = 0; x < sizeof(key); x++)
+		key[x] = 0xa5 ^ (x * 29);
+	for (x = 0; x < sizeof(pt); x++)
+		pt[x] = x * 7 + 3;
+	aes_encrypt_key128(key, &ecx);
+	aes_decrypt_key128(key, &dcx);
+	for (x = 0; x < sizeof(iv); x++)
+		refiv[x] = iv[x] = x * 13;
+	generic->encrypt(pt, ref, ARRAY_LEN(pt) / AES_BLOCK_SIZE, refiv, &ecx);
+	be->encrypt(pt, ct, ARRAY_LEN(pt) / AES_BLOCK_SIZE, iv, &ecx);
+	if (memcmp(ct, ref, sizeof(ct)) || memcmp(iv, refiv, sizeof(iv)))
+		return -1;
+	for (x = 0; x < sizeof(iv); x++)
+		iv[x] = x * 13;
+	/* Decrypt in place, as callers are allowed to */
+	be->decrypt(ct, ct, ARRAY_LEN(ct) / AES_BLOCK_SIZE, iv, &dcx);
+	if (memcmp(ct, pt, sizeof(ct)) || memcmp(iv, ref + sizeof(ref) - AES_BLOCK_SIZE, sizeof(iv)))
+		return -1;
+
+	/* A length that isn't a whole number of blocks must come back with the
+	   tail intact and zero padding after it, and never go out in the clear */
+	for (x = 0; x < sizeof(iv); x++)
+		iv[x] = x * 13;
+	cbc_encrypt(be, pt, ct, sizeof(pt) - 9, iv, &ecx);
+	if (!memcmp(ct + sizeof(ct) - AES_BLOCK_SIZE, pt + sizeof(pt) - AES_BLOCK_SIZE, AES_BLOCK_SIZE - 9))
+		return -1;
+	for (x = 0; x < sizeof(iv); x++)
+		iv[x] = x * 13;
+	be->decrypt(ct, out, ARRAY_LEN(ct) / AES_BLOCK_SIZE, iv, &dcx);
+	if (memcmp(out, pt, sizeof(pt) - 9))
+		return -1;
+	for (x = sizeof(out) - 9; x < sizeof(out); x++) {
+		if (out[x])
+			return -1;
+	}
+
+	return 0;
+}
+
+static void aes_cbc_select(void)
+{
+	int x;
+
+	for (x = 0; x < ARRAY_LEN(backends) - 1; x++) {
+		if (!backends[x].available())
+			continue;
+		if (aes_cbc_selftest(&backends[x])) {
+			ast_log(LOG_WARNING, "AES %s backend failed its self test, not using it\n", backends[x].name);
+			continue;
+		}
+		backend = &backends[x];
+		break;
+	}
+	/* There is nothing to fall back to from the generic code, but say so if it's broken */
+	if (backend == &backends[ARRAY_LEN(backends) - 1] && aes_cbc_selftest(backend))
+		ast_log(LOG_ERROR, "AES %s backend failed its self test\n", backend->name);
+	if (option_verbose > 1)
+		ast_verbose(VERBOSE_PREFIX_2 "Using %s AES backend\n", backend->name);
+}
+
+void aes_cbc_encrypt(const unsigned char *in, unsigned char *out, int len, unsigned char *iv, const aes_encrypt_ctx cx[1])
+{
+	pthread_once(&backend_once, aes_cbc_select);
+	if (cx->ks[52] == AES_CBC_ROUNDS)
+		cbc_encrypt(backend, in, out, len, iv, cx);
+	else
+		cbc_encrypt(&backends[ARRAY_LEN(backends) - 1], in, out, len, iv, cx);
+}
+
+void aes_cbc_decrypt(const unsigned char *in, unsigned char *out, int len, unsigned char *iv, const aes_decrypt_ctx cx[1])
+{
+	pthread_once(&backend_once, aes_cbc_select);
+	if (cx->ks[52] == AES_CBC_ROUNDS)
+		backend->decrypt(in, out, len / AES_BLOCK_SIZE, iv, cx);
+	else
+		generic_cbc_decrypt(in, out, len / AES_BLOCK_SIZE, iv, cx);
+}
+
+const char *aes_cbc_backend(void)
+{
+	pthread_once(&backend_once, aes_cbc_select);
+	return backend->name;
+}
@@ -27,7 +27,15 @@
 
 ASTERISK_FILE_VERSION(__FILE__, "$Revision: 80166 $")
 
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define ALAW_SSE2
+#include <cpuid.h>
+#include <emmintrin.h>
+#endif
+
 #include "asterisk/alaw.h"
+#include "asterisk/logger.h"
 
 #define AMI_MASK 0x55
 
@@ -81,6 +89,146 @@ static inline short int alaw2linear (unsigned char alaw)
 unsigned char __ast_lin2a[8192];
 short __ast_alaw[256];
 
+static void generic_lin2a_buf(unsigned char *dst, const short *src, int samples)
+{
+	while (samples--)
+		*dst++ = AST_LIN2A(*src++);
+}
+
+static void generic_alaw_buf(short *dst, const unsigned char *src, int samples)
+{
+	while (samples--)
+		*dst++ = AST_ALAW(*src++);
+}
+
+#ifdef ALAW_SSE2
+#define SSE2_TARGET __attribute__((target("sse2")))
+
+static int sse2_available(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+	return (edx & bit_SSE2) ? 1 : 0;
+}
+
+/*! \brief Segment and quantization bits of four 32 bit integers of at
+ * least 0x100, as ((floor(log2(x)) - 7) << 4) | the four bits after the
+ * leading one.  Converting to float does the normalizing for us. */
+static SSE2_TARGET __m128i sse2_segmant(__m128i x)
+{
+	__m128i bits = _mm_castps_si128(_mm_cvtepi32_ps(x));
+
+	return _mm_sub_epi32(_mm_srli_epi32(bits, 19), _mm_set1_epi32((127 + 7) << 4));
+}
+
+/*! \brief linear2alaw() on eight samples, computed rather than looked up.
+ * The table entry for a sample is linear2alaw() of the last of the eight
+ * samples sharing it, so the three low bits are set first. */
+static SSE2_TARGET __m128i sse2_lin2a(__m128i s)
+{
+	__m128i neg, pcm, res, seg0, zero = _mm_setzero_si128();
+
+	s = _mm_or_si128(s, _mm_set1_epi16(7));
+	neg = _mm_srai_epi16(s, 15);
+	pcm = _mm_sub_epi16(_mm_xor_si128(s, neg), neg);
+	res = _mm_packs_epi32(sse2_segmant(_mm_unpacklo_epi16(pcm, zero)),
+		sse2_segmant(_mm_unpackhi_epi16(pcm, zero)));
+	/* segment 0 is linear */
+	seg0 = _mm_cmpgt_epi16(_mm_set1_epi16(0x100), pcm);
+	res = _mm_or_si128(_mm_andnot_si128(seg0, res), _mm_and_si128(seg0, _mm_srli_epi16(pcm, 4)));
+	/* the sign bit is set for positive samples */
+	return _mm_xor_si128(res, _mm_xor_si128(_mm_set1_epi16(AMI_MASK | 0x80), _mm_and_si128(neg, _mm_set1_epi16(0x80))));
+}
+
+static SSE2_TARGET void sse2_lin2a_buf(unsigned char *dst, const short *src, int samples)
+{
+	__m128i lo, hi;
+
+	for (; samples >= 16; samples -= 16, src += 16, dst += 16) {
+		lo = sse2_lin2a(_mm_loadu_si128((const __m128i *) src));
+		hi = sse2_lin2a(_mm_loadu_si128((const __m128i *) (src + 8)));
+		_mm_storeu_si128((__m128i *) dst, _mm_packus_epi16(lo, hi));
+	}
+	generic_lin2a_buf(dst, src, samples);
+}
+
+/*! \brief 1 << shift for eight samples, built as floats */
+static SSE2_TARGET __m128i sse2_pow2(__m128i shift)
+{
+	__m128i zero = _mm_setzero_si128(), bias = _mm_set1_epi32(127);
+	__m128 lo, hi;
+
+	lo = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_unpacklo_epi16(shift, zero), bias), 23));
+	hi = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_unpackhi_epi16(shift, zero), bias), 23));
+	return _mm_packs_epi32(_mm_cvttps_epi32(lo), _mm_cvttps_epi32(hi));
+}
+
+/*! \brief alaw2linear() on eight samples */
+static SSE2_TARGET void sse2_alaw_buf(short *dst, const unsigned char *src, int samples)
+{
+	__m128i a, i, seg, mask, neg;
+
+	for (; samples >= 8; samples -= 8, src += 8, dst += 8) {
+		a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) src), _mm_setzero_si128());
+		a = _mm_xor_si128(a, _mm_set1_epi16(AMI_MASK));
+		i = _mm_add_epi16(_mm_slli_epi16(_mm_and_si128(a, _mm_set1_epi16(0x0f)), 4), _mm_set1_epi16(8));
+		seg = _mm_and_si128(_mm_srli_epi16(a, 4), _mm_set1_epi16(7));
+		mask = _mm_cmpgt_epi16(seg, _mm_setzero_si128());
+		i = _mm_add_epi16(i, _mm_and_si128(mask, _mm_set1_epi16(0x100)));
+		i = _mm_mullo_epi16(i, sse2_pow2(_mm_subs_epu16(seg, _mm_set1_epi16(1))));
+		neg = _mm_cmpeq_epi16(_mm_and_si128(a, _mm_set1_epi16(0x80)), _mm_setzero_si128());
+		i = _mm_sub_epi16(_mm_xor_si128(i, neg), neg);
+		_mm_storeu_si128((__m128i *) dst, i);
+	}
+	generic_alaw_buf(dst, src, samples);
+}
+#endif /* ALAW_SSE2 */
+
+static void (*lin2a_buf)(unsigned char *dst, const short *src, int samples) = generic_lin2a_buf;
+static void (*alaw_buf)(short *dst, const unsigned char *src, int samples) = generic_alaw_buf;
+
+void ast_lin2a_buf(unsigned char *dst, const short *src, int samples)
+{
+	lin2a_buf(dst, src, samples);
+}
+
+void ast_alaw_buf(short *dst, const unsigned char *src, int samples)
+{
+	alaw_buf(dst, src, samples);
+}
+
+/*! \brief Check a pair of block converters against the tables, for every input value */
+static int alaw_selftest(void (*enc)(unsigned char *dst, const short *src, int samples),
+	void (*dec)(short *dst, const unsigned char *src, int samples))
+{
+	short lin[256], back[256];
+	unsigned char a[256];
+	int i, j;
+
+	for (i = -32768; i < 32768; i += 256) {
+		for (j = 0; j < 256; j++)
+			lin[j] = i + j;
+		/* odd lengths, so the scalar tail gets some of the work too */
+		enc(a, lin, 250);
+		enc(a + 250, lin + 250, 6);
+		for (j = 0; j < 256; j++) {
+			if (a[j] != AST_LIN2A(lin[j]))
+				return -1;
+		}
+	}
+	for (i = 0; i < 256; i++)
+		a[i] = i;
+	dec(back, a, 250);
+	dec(back + 250, a + 250, 6);
+	for (i = 0; i < 256; i++) {
+		if (back[i] != AST_ALAW(i))
+			return -1;
+	}
+	return 0;
+}
+
 void ast_alaw_init(void)
 {
 	int i;
@@ -96,6 +244,15 @@ void ast_alaw_init(void)
 	   {
 		__ast_lin2a[((unsigned short)i) >> 3] = linear2alaw(i);
 	   }
+#ifdef ALAW_SSE2
+	if (sse2_available()) {
+		if (!alaw_selftest(sse2_lin2a_buf, sse2_alaw_buf)) {
+			lin2a_buf = sse2_lin2a_buf;
+			alaw_buf = sse2_alaw_buf;
+		} else
+			ast_log(LOG_WARNING, "SSE2 A-law conversion does not match the tables, not using it\n");
+	}
+#endif
 
 }
 
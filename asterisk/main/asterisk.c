@@ -160,6 +160,9 @@ int option_debug;				/*!< Debug level */
 
 double option_maxload;				/*!< Max load avg on system */
 int option_maxcalls;				/*!< Max number of active calls */
+int option_dbsyncinterval;			/*!< Milliseconds between AstDB flushes */
+int option_dbsyncwrites;			/*!< Pending AstDB writes before an early flush */
+int option_heapsample;				/*!< Bytes between heap profiler samples from startup */
 
 /*! @} */
 
@@ -299,19 +302,89 @@ void ast_unregister_file_version(const char *file)
 		free(find);
 }
 
+/*! \brief Seconds between samples of the CPU time each thread has used */
+#define THREAD_CPU_INTERVAL	5
+/*! \brief Samples kept, enough for the longest window shown */
+#define THREAD_CPU_SLOTS	(300 / THREAD_CPU_INTERVAL + 1)
+/*! \brief Subsystems told apart; any more are lumped in with the last */
+#define THREAD_CPU_SUBSYSTEMS	64
+#define THREAD_CPU_WINDOWS	3
+
+/*! \brief The windows CPU use is shown over, in samples: 10 seconds, a minute and 5 minutes */
+static const unsigned int thread_cpu_windows[THREAD_CPU_WINDOWS] = {
+	10 / THREAD_CPU_INTERVAL, 60 / THREAD_CPU_INTERVAL, 300 / THREAD_CPU_INTERVAL
+};
+
+/*! \brief The threads started from one source file (a module, mostly), taken together */
+struct thread_cpu_subsystem {
+	char name[32];
+	int threads;				/*!< How many are running now */
+	uint64_t gone;				/*!< CPU time (ns) used by those that have exited */
+	unsigned int first;			/*!< The first sample it is in */
+	uint64_t cpu[THREAD_CPU_SLOTS];		/*!< CPU time (ns) used by all of them, as of each sample */
+};
+
 struct thread_list_t {
 	AST_LIST_ENTRY(thread_list_t) list;
 	char *name;
 	pthread_t id;
+	struct thread_cpu_subsystem *sub;
+	int has_clock;
+	clockid_t clock;
+	unsigned int first;			/*!< The first sample it is in */
+	uint64_t cpu[THREAD_CPU_SLOTS];		/*!< CPU time (ns) it had used, as of each sample */
 };
 
+/* The list's lock guards the CPU figures too */
 static AST_LIST_HEAD_STATIC(thread_list, thread_list_t);
+static struct thread_cpu_subsystem thread_cpu_subs[THREAD_CPU_SUBSYSTEMS];
+static int thread_cpu_num_subs;
+static unsigned int thread_cpu_samples;			/*!< How many samples have been taken */
+static uint64_t thread_cpu_when[THREAD_CPU_SLOTS];	/*!< When (ns, monotonic) each sample was taken */
+static uint64_t thread_cpu_process[THREAD_CPU_SLOTS];	/*!< CPU time (ns) used by the whole process, as of each sample */
 
 static char show_threads_help[] =
 "Usage: core show threads\n"
 "       List threads currently active in the system.\n";
 
-void ast_register_thread(char *name)
+static char show_threads_cpu_help[] =
+"Usage: core show threads cpu [threads]\n"
+"       Shows how much CPU the threads started from each module (or other\n"
+"       part of Asterisk) have used over the last 10 seconds, minute and\n"
+"       5 minutes, in percent of one CPU.  With 'threads', each thread is\n"
+"       shown by itself.  Samples are taken every 5 seconds, so until\n"
+"       Asterisk has been up for a window's length, it covers as long as\n"
+"       there is.\n";
+
+static uint64_t thread_cpu_read(clockid_t clock)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts))
+		return 0;
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*! \brief Find (or add) a subsystem by name; called with the thread list locked */
+static struct thread_cpu_subsystem *thread_cpu_subsystem(const char *name)
+{
+	struct thread_cpu_subsystem *sub;
+	int x;
+
+	for (x = 0; x < thread_cpu_num_subs; x++) {
+		if (!strcmp(thread_cpu_subs[x].name, name))
+			return &thread_cpu_subs[x];
+	}
+	if (thread_cpu_num_subs == THREAD_CPU_SUBSYSTEMS)
+		return &thread_cpu_subs[THREAD_CPU_SUBSYSTEMS - 1];
+
+	sub = &thread_cpu_subs[thread_cpu_num_subs++];
+	ast_copy_string(sub->name, name, sizeof(sub->name));
+	sub->first = thread_cpu_samples;
+	return sub;
+}
+
+void ast_register_thread_subsystem(char *name, const char *subsystem)
 { 
 	struct thread_list_t *new = ast_calloc(1, sizeof(*new));
 
@@ -319,11 +392,22 @@ void ast_register_thread(char *name)
 		return;
 	new->id = pthread_self();
 	new->name = name; /* steal the allocated memory for the thread name */
+#ifdef _POSIX_THREAD_CPUTIME
+	new->has_clock = !pthread_getcpuclockid(new->id, &new->clock);
+#endif
 	AST_LIST_LOCK(&thread_list);
+	new->sub = thread_cpu_subsystem(S_OR(subsystem, "other"));
+	new->sub->threads++;
+	new->first = thread_cpu_samples;
 	AST_LIST_INSERT_HEAD(&thread_list, new, list);
 	AST_LIST_UNLOCK(&thread_list);
 }
 
+void ast_register_thread(char *name)
+{
+	ast_register_thread_subsystem(name, NULL);
+}
+
 void ast_unregister_thread(void *id)
 {
 	struct thread_list_t *x;
@@ -336,6 +420,12 @@ void ast_unregister_thread(void *id)
 		}
 	}
 	AST_LIST_TRAVERSE_SAFE_END;
+	/* The thread itself calls this on its way out, so its clock can still be read */
+	if (x) {
+		x->sub->threads--;
+		if (x->has_clock)
+			x->sub->gone += thread_cpu_read(x->clock);
+	}
 	AST_LIST_UNLOCK(&thread_list);
 	if (x) {
 		free(x->name);
@@ -358,6 +448,218 @@ static int handle_show_threads(int fd, int argc, char *argv[])
 	return 0;
 }
 
+/*! \brief Note how much CPU time every thread, and so every subsystem, has used so far */
+static void thread_cpu_sample(void)
+{
+	struct thread_list_t *cur;
+	unsigned int slot;
+	int x;
+
+	AST_LIST_LOCK(&thread_list);
+	slot = thread_cpu_samples % THREAD_CPU_SLOTS;
+	thread_cpu_when[slot] = thread_cpu_read(CLOCK_MONOTONIC);
+	thread_cpu_process[slot] = thread_cpu_read(CLOCK_PROCESS_CPUTIME_ID);
+	for (x = 0; x < thread_cpu_num_subs; x++)
+		thread_cpu_subs[x].cpu[slot] = thread_cpu_subs[x].gone;
+	AST_LIST_TRAVERSE(&thread_list, cur, list) {
+		cur->cpu[slot] = cur->has_clock ? thread_cpu_read(cur->clock) : 0;
+		cur->sub->cpu[slot] += cur->cpu[slot];
+	}
+	thread_cpu_samples++;
+	AST_LIST_UNLOCK(&thread_list);
+}
+
+/*!
+ * \brief CPU used over the last so many samples, in percent of one CPU
+ * \param cpu CPU time used as of each sample, from the sample numbered first on (none before)
+ * \return -1 if there aren't two samples to go by yet
+ */
+static double thread_cpu_percent(const uint64_t *cpu, unsigned int first, unsigned int window)
+{
+	unsigned int now, then;
+	uint64_t start = 0, elapsed;
+
+	if (thread_cpu_samples < 2)
+		return -1.0;
+	now = thread_cpu_samples - 1;
+	then = now > window ? now - window : 0;
+	if (!(elapsed = thread_cpu_when[now % THREAD_CPU_SLOTS] - thread_cpu_when[then % THREAD_CPU_SLOTS]))
+		return -1.0;
+	if (now < first)
+		return 0.0;
+	if (then >= first)
+		start = cpu[then % THREAD_CPU_SLOTS];
+	return (cpu[now % THREAD_CPU_SLOTS] - start) * 100.0 / elapsed;
+}
+
+struct thread_cpu_row {
+	char name[32];
+	const char *sub;
+	int threads;
+	double percent[THREAD_CPU_WINDOWS];
+};
+
+static int thread_cpu_cmp(const void *a, const void *b)
+{
+	const struct thread_cpu_row *ra = a, *rb = b;
+
+	if (ra->percent[1] != rb->percent[1])
+		return ra->percent[1] < rb->percent[1] ? 1 : -1;
+	return strcmp(ra->name, rb->name);
+}
+
+/*!
+ * \brief What each subsystem (or thread) has used, busiest first
+ *
+ * For subsystems, the last two rows are what threads Asterisk didn't start
+ * (the main thread, for one) have used, and the total for the process.
+ */
+static struct thread_cpu_row *thread_cpu_report(int by_thread, int *num)
+{
+	struct thread_cpu_row *rows, *row, *untracked, *total;
+	struct thread_cpu_subsystem *sub;
+	struct thread_list_t *cur;
+	int x, w, count = 0;
+
+	*num = 0;
+	AST_LIST_LOCK(&thread_list);
+	if (by_thread) {
+		AST_LIST_TRAVERSE(&thread_list, cur, list)
+			count++;
+	} else
+		count = thread_cpu_num_subs + 2;
+	if (!(rows = ast_calloc(count, sizeof(*rows)))) {
+		AST_LIST_UNLOCK(&thread_list);
+		return NULL;
+	}
+
+	if (by_thread) {
+		AST_LIST_TRAVERSE(&thread_list, cur, list) {
+			row = &rows[(*num)++];
+			/* The name starts with the function the thread runs */
+			sscanf(cur->name, "%31s", row->name);
+			row->sub = cur->sub->name;
+			row->threads = 1;
+			for (w = 0; w < THREAD_CPU_WINDOWS; w++)
+				row->percent[w] = thread_cpu_percent(cur->cpu, cur->first, thread_cpu_windows[w]);
+		}
+		/* Thread rows point at subsystem names, which are never removed */
+		AST_LIST_UNLOCK(&thread_list);
+		qsort(rows, *num, sizeof(*rows), thread_cpu_cmp);
+		return rows;
+	}
+
+	untracked = &rows[count - 2];
+	total = &rows[count - 1];
+	ast_copy_string(untracked->name, "(other threads)", sizeof(untracked->name));
+	ast_copy_string(total->name, "Total", sizeof(total->name));
+	for (w = 0; w < THREAD_CPU_WINDOWS; w++)
+		untracked->percent[w] = total->percent[w] = thread_cpu_percent(thread_cpu_process, 0, thread_cpu_windows[w]);
+	for (x = 0; x < thread_cpu_num_subs; x++) {
+		sub = &thread_cpu_subs[x];
+		row = &rows[(*num)++];
+		ast_copy_string(row->name, sub->name, sizeof(row->name));
+		row->threads = sub->threads;
+		total->threads += sub->threads;
+		for (w = 0; w < THREAD_CPU_WINDOWS; w++) {
+			row->percent[w] = thread_cpu_percent(sub->cpu, sub->first, thread_cpu_windows[w]);
+			if (row->percent[w] > 0.0)
+				untracked->percent[w] -= row->percent[w];
+		}
+	}
+	AST_LIST_UNLOCK(&thread_list);
+
+	/* Rounding aside, the threads can't have used more than the process */
+	for (w = 0; w < THREAD_CPU_WINDOWS; w++) {
+		if (untracked->percent[w] < 0.0 && total->percent[w] >= 0.0)
+			untracked->percent[w] = 0.0;
+	}
+	qsort(rows, *num, sizeof(*rows), thread_cpu_cmp);
+	*num += 2;
+
+	return rows;
+}
+
+static void thread_cpu_format(char *buf, size_t len, double percent)
+{
+	if (percent < 0.0)
+		ast_copy_string(buf, "-", len);
+	else
+		snprintf(buf, len, "%.2f%%", percent);
+}
+
+static int handle_show_threads_cpu(int fd, int argc, char *argv[])
+{
+	struct thread_cpu_row *rows, *row;
+	char pct[THREAD_CPU_WINDOWS][16];
+	int by_thread = 0, num, x, w;
+
+	if (argc == 5 && !strcasecmp(argv[4], "threads"))
+		by_thread = 1;
+	else if (argc != 4)
+		return RESULT_SHOWUSAGE;
+
+	if (!(rows = thread_cpu_report(by_thread, &num)))
+		return RESULT_FAILURE;
+
+	if (by_thread)
+		ast_cli(fd, "%-31s %-20s %9s %9s %9s\n", "Thread", "Subsystem", "10 sec", "1 min", "5 min");
+	else
+		ast_cli(fd, "%-31s %7s %9s %9s %9s\n", "Subsystem", "Threads", "10 sec", "1 min", "5 min");
+	for (x = 0; x < num; x++) {
+		row = &rows[x];
+		/* Leave out what has neither threads now nor any CPU used lately */
+		if (!by_thread && x < num - 2 && !row->threads && row->percent[THREAD_CPU_WINDOWS - 1] <= 0.0)
+			continue;
+		for (w = 0; w < THREAD_CPU_WINDOWS; w++)
+			thread_cpu_format(pct[w], sizeof(pct[w]), row->percent[w]);
+		if (by_thread)
+			ast_cli(fd, "%-31s %-20s %9s %9s %9s\n", row->name, row->sub, pct[0], pct[1], pct[2]);
+		else if (x == num - 2)
+			ast_cli(fd, "%-31s %7s %9s %9s %9s\n", row->name, "", pct[0], pct[1], pct[2]);
+		else
+			ast_cli(fd, "%-31s %7d %9s %9s %9s\n", row->name, row->threads, pct[0], pct[1], pct[2]);
+	}
+	free(rows);
+
+	return RESULT_SUCCESS;
+}
+
+/*! \brief Tell the managers what each subsystem has used, as 'core show threads cpu' does */
+static void thread_cpu_events(void)
+{
+	struct thread_cpu_row *rows, *row;
+	int num, x;
+
+	if (!(rows = thread_cpu_report(0, &num)))
+		return;
+	for (x = 0; x < num; x++) {
+		row = &rows[x];
+		if (x < num - 2 && !row->threads && row->percent[THREAD_CPU_WINDOWS - 1] <= 0.0)
+			continue;
+		manager_event(EVENT_FLAG_SYSTEM, "ThreadCPU",
+			"Subsystem: %s\r\n"
+			"Threads: %d\r\n"
+			"CPU10s: %.2f\r\n"
+			"CPU1m: %.2f\r\n"
+			"CPU5m: %.2f\r\n",
+			row->name, row->threads, row->percent[0], row->percent[1], row->percent[2]);
+	}
+	free(rows);
+}
+
+static void *thread_cpu_monitor(void *unused)
+{
+	for (;;) {
+		thread_cpu_sample();
+		if (!(thread_cpu_samples % (60 / THREAD_CPU_INTERVAL)))
+			thread_cpu_events();
+		sleep(THREAD_CPU_INTERVAL);
+	}
+
+	return NULL;
+}
+
 struct profile_entry {
 	const char *name;
 	uint64_t	scale;	/* if non-zero, values are scaled by this */
@@ -1735,6 +2037,10 @@ static struct ast_cli_entry cli_asterisk[] = {
 	handle_show_threads, "Show running threads",
 	show_threads_help },
 
+	{ { "core", "show", "threads", "cpu", NULL },
+	handle_show_threads_cpu, "Show CPU used by each part of Asterisk",
+	show_threads_cpu_help },
+
 	{ { "core", "show", "profile", NULL },
 	handle_show_profile, "Display profiling info",
 	NULL, NULL, &cli_show_profile_deprecated },
@@ -2576,6 +2882,21 @@ static void ast_readconfig(void)
 			} else if ((sscanf(v->value, "%lf", &option_maxload) != 1) || (option_maxload < 0.0)) {
 				option_maxload = 0.0;
 			}
+		/* How long AstDB writes may stay unflushed, in milliseconds */
+		} else if (!strcasecmp(v->name, "dbsyncinterval")) {
+			if ((sscanf(v->value, "%d", &option_dbsyncinterval) != 1) || (option_dbsyncinterval < 0)) {
+				option_dbsyncinterval = 0;
+			}
+		/* How many AstDB writes may be pending before flushing early */
+		} else if (!strcasecmp(v->name, "dbsyncwrites")) {
+			if ((sscanf(v->value, "%d", &option_dbsyncwrites) != 1) || (option_dbsyncwrites < 0)) {
+				option_dbsyncwrites = 0;
+			}
+		/* Sample the heap from startup, one allocation in every this many bytes */
+		} else if (!strcasecmp(v->name, "heapsample")) {
+			if ((sscanf(v->value, "%d", &option_heapsample) != 1) || (option_heapsample < 0)) {
+				option_heapsample = 0;
+			}
 		/* What user to run as */
 		} else if (!strcasecmp(v->name, "runuser")) {
 			ast_copy_string(ast_config_AST_RUN_USER, v->value, sizeof(ast_config_AST_RUN_USER));
@@ -3043,10 +3364,20 @@ int main(int argc, char *argv[])
 #endif
 	threadstorage_init();
 
+	ast_heapprof_init();
+
 	astobj2_init();
 
 	ast_autoservice_init();
 
+#if !defined(LOW_MEMORY)
+	{
+		pthread_t t;
+
+		ast_pthread_create_background(&t, NULL, thread_cpu_monitor, NULL);
+	}
+#endif
+
 	if (load_modules(1)) {
 		printf(term_quit());
 		exit(1);
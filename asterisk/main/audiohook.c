@@ -73,6 +73,7 @@ int ast_audiohook_init(struct ast_audiohook *audiohook, enum ast_audiohook_type
 	/* Initialize lock that protects our audiohook */
 	ast_mutex_init(&audiohook->lock);
 	ast_cond_init(&audiohook->trigger, NULL);
+	audiohook->trigger_callback = NULL;
 
 	/* Setup the factories that are needed for this audiohook type */
 	switch (type) {
@@ -119,6 +120,17 @@ int ast_audiohook_destroy(struct ast_audiohook *audiohook)
 	return 0;
 }
 
+/*! \brief Wake whoever is waiting on an audiohook
+ * \note Don't call without audiohook locked
+ */
+static void audiohook_trigger(struct ast_audiohook *audiohook)
+{
+	if (audiohook->trigger_callback)
+		audiohook->trigger_callback(audiohook);
+	else
+		ast_cond_signal(&audiohook->trigger);
+}
+
 /*! \brief Writes a frame into the audiohook structure
  * \param audiohook Audiohook structure
  * \param direction Direction the audio frame came from
@@ -147,11 +159,11 @@ int ast_audiohook_write_frame(struct ast_audiohook *audiohook, enum ast_audiohoo
 
 	/* If we need to notify the respective handler of this audiohook, do so */
 	if ((ast_test_flag(audiohook, AST_AUDIOHOOK_TRIGGER_MODE) == AST_AUDIOHOOK_TRIGGER_READ) && (direction == AST_AUDIOHOOK_DIRECTION_READ)) {
-		ast_cond_signal(&audiohook->trigger);
+		audiohook_trigger(audiohook);
 	} else if ((ast_test_flag(audiohook, AST_AUDIOHOOK_TRIGGER_MODE) == AST_AUDIOHOOK_TRIGGER_WRITE) && (direction == AST_AUDIOHOOK_DIRECTION_WRITE)) {
-		ast_cond_signal(&audiohook->trigger);
+		audiohook_trigger(audiohook);
 	} else if (ast_test_flag(audiohook, AST_AUDIOHOOK_TRIGGER_SYNC)) {
-		ast_cond_signal(&audiohook->trigger);
+		audiohook_trigger(audiohook);
 	}
 
 	return 0;
@@ -383,7 +395,7 @@ int ast_audiohook_detach_list(struct ast_audiohook_list *audiohook_list)
 		ast_audiohook_lock(audiohook);
 		AST_LIST_REMOVE_CURRENT(&audiohook_list->spy_list, list);
 		audiohook->status = AST_AUDIOHOOK_STATUS_DONE;
-		ast_cond_signal(&audiohook->trigger);
+		audiohook_trigger(audiohook);
 		ast_audiohook_unlock(audiohook);
 	}
 	AST_LIST_TRAVERSE_SAFE_END
@@ -393,7 +405,7 @@ int ast_audiohook_detach_list(struct ast_audiohook_list *audiohook_list)
 		ast_audiohook_lock(audiohook);
 		AST_LIST_REMOVE_CURRENT(&audiohook_list->whisper_list, list);
 		audiohook->status = AST_AUDIOHOOK_STATUS_DONE;
-		ast_cond_signal(&audiohook->trigger);
+		audiohook_trigger(audiohook);
 		ast_audiohook_unlock(audiohook);
 	}
 	AST_LIST_TRAVERSE_SAFE_END
@@ -534,7 +546,7 @@ static struct ast_frame *audio_audiohook_write_list(struct ast_channel *chan, st
 		if (audiohook->status != AST_AUDIOHOOK_STATUS_RUNNING) {
 			AST_LIST_REMOVE_CURRENT(&audiohook_list->spy_list, list);
 			audiohook->status = AST_AUDIOHOOK_STATUS_DONE;
-			ast_cond_signal(&audiohook->trigger);
+			audiohook_trigger(audiohook);
 			ast_audiohook_unlock(audiohook);
 			continue;
 		}
@@ -553,7 +565,7 @@ static struct ast_frame *audio_audiohook_write_list(struct ast_channel *chan, st
 			if (audiohook->status != AST_AUDIOHOOK_STATUS_RUNNING) {
 				AST_LIST_REMOVE_CURRENT(&audiohook_list->whisper_list, list);
 				audiohook->status = AST_AUDIOHOOK_STATUS_DONE;
-				ast_cond_signal(&audiohook->trigger);
+				audiohook_trigger(audiohook);
 				ast_audiohook_unlock(audiohook);
 				continue;
 			}
@@ -911,6 +911,8 @@ int ast_queue_frame(struct ast_channel *chan, struct ast_frame *fin)
 		ast_log(LOG_WARNING, "Unable to duplicate frame\n");
 		return -1;
 	}
+	if (f->frametype == AST_FRAME_VOICE && ast_tvzero(f->ingress))
+		ast_frame_stamp(f);
 	ast_channel_lock(chan);
 
 	/* See if the last frame on the queue is a hangup, if so don't queue anything */
@@ -2307,6 +2309,7 @@ static struct ast_frame *__ast_read(struct ast_channel *chan, int dropaudio)
 				ast_frfree(f);
 				f = &ast_null_frame;
 			} else if ((f->frametype == AST_FRAME_VOICE)) {
+				ast_latency_mark(f, AST_LATENCY_READ, chan->tech->type);
 				if (chan->audiohooks) {
 					struct ast_frame *old_frame = f;
 					f = ast_audiohook_write_list(chan, chan->audiohooks, AST_AUDIOHOOK_DIRECTION_READ, f);
@@ -2713,8 +2716,10 @@ int ast_write(struct ast_channel *chan, struct ast_frame *fr)
 		if (chan->audiohooks) {
 			struct ast_frame *old_frame = fr;
 			fr = ast_audiohook_write_list(chan, chan->audiohooks, AST_AUDIOHOOK_DIRECTION_WRITE, fr);
-			if (old_frame != fr)
+			if (old_frame != fr) {
+				fr->ingress = old_frame->ingress;
 				f2 = fr;
+			}
 		}
 		
 		/* If the frame is in the raw write format, then it's easy... just use the frame - otherwise we will have to translate */
@@ -2756,9 +2761,10 @@ int ast_write(struct ast_channel *chan, struct ast_frame *fr)
 			}
 		}
 
-		if (f) 
+		if (f) {
+			ast_latency_mark(f, AST_LATENCY_WRITE, chan->tech->type);
 			res = chan->tech->write(chan,f);
-		else
+		} else
 			res = 0;
 		break;
 	case AST_FRAME_NULL:
@@ -60,6 +60,30 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 85574 $")
 static DB *astdb;
 AST_MUTEX_DEFINE_STATIC(dblock);
 
+/*! \brief Number of slots in the read-through cache used by ast_db_get() */
+#define DB_CACHE_SIZE 256
+
+/*! \brief A cached key/value pair, both strings live in the same allocation */
+struct db_cache_entry {
+	char *key;
+	char *value;
+};
+
+static struct db_cache_entry db_cache[DB_CACHE_SIZE];
+
+/*! \brief Writes made to the btree since it was last synced to disk */
+static int db_pending;
+static pthread_t db_sync_thread = AST_PTHREADT_NULL;
+static ast_cond_t db_sync_cond;
+
+static struct {
+	unsigned int puts;
+	unsigned int dels;
+	unsigned int gets;
+	unsigned int hits;
+	unsigned int syncs;
+} db_stats;
+
 static int dbinit(void) 
 {
 	if (!astdb && !(astdb = dbopen((char *)ast_config_AST_DB, O_CREAT | O_RDWR, 0664, DB_BTREE, NULL))) {
@@ -70,6 +94,70 @@ static int dbinit(void)
 }
 
 
+/*! \note Don't call without dblock */
+static void db_sync_locked(void)
+{
+	if (!db_pending)
+		return;
+	astdb->sync(astdb, 0);
+	db_pending = 0;
+	db_stats.syncs++;
+}
+
+/*! \brief Account for a write and flush now unless it can be batched
+ * \note Don't call without dblock */
+static void db_written(void)
+{
+	db_pending++;
+	if (!option_dbsyncinterval || db_sync_thread == AST_PTHREADT_NULL)
+		db_sync_locked();
+	else if (option_dbsyncwrites && db_pending >= option_dbsyncwrites)
+		ast_cond_signal(&db_sync_cond);
+}
+
+static unsigned int db_cache_hash(const char *key)
+{
+	unsigned int hash = 0;
+
+	while (*key)
+		hash = hash * 31 + (unsigned char) *key++;
+	return hash % DB_CACHE_SIZE;
+}
+
+/*! \note Don't call without dblock */
+static void db_cache_clear(struct db_cache_entry *entry)
+{
+	if (entry->key) {
+		free(entry->key);
+		entry->key = NULL;
+		entry->value = NULL;
+	}
+}
+
+/*! \note Don't call without dblock */
+static void db_cache_store(const char *key, const char *value)
+{
+	struct db_cache_entry *entry = &db_cache[db_cache_hash(key)];
+	size_t keylen = strlen(key) + 1;
+
+	db_cache_clear(entry);
+	if (!(entry->key = ast_malloc(keylen + strlen(value) + 1)))
+		return;
+	strcpy(entry->key, key);
+	entry->value = entry->key + keylen;
+	strcpy(entry->value, value);
+}
+
+/*! \note Don't call without dblock */
+static struct db_cache_entry *db_cache_find(const char *key)
+{
+	struct db_cache_entry *entry = &db_cache[db_cache_hash(key)];
+
+	if (entry->key && !strcmp(entry->key, key))
+		return entry;
+	return NULL;
+}
+
 static inline int keymatch(const char *key, const char *prefix)
 {
 	int preflen = strlen(prefix);
@@ -137,7 +225,12 @@ int ast_db_deltree(const char *family, const char *keytree)
 			astdb->del(astdb, &key, 0);
 		}
 	}
-	astdb->sync(astdb, 0);
+	for (pass = 0; pass < DB_CACHE_SIZE; pass++) {
+		if (db_cache[pass].key && keymatch(db_cache[pass].key, prefix))
+			db_cache_clear(&db_cache[pass]);
+	}
+	db_stats.dels++;
+	db_written();
 	ast_mutex_unlock(&dblock);
 	return 0;
 }
@@ -162,7 +255,11 @@ int ast_db_put(const char *family, const char *keys, char *value)
 	data.data = value;
 	data.size = strlen(value) + 1;
 	res = astdb->put(astdb, &key, &data, 0);
-	astdb->sync(astdb, 0);
+	if (!res) {
+		db_cache_store(fullkey, value);
+		db_stats.puts++;
+		db_written();
+	}
 	ast_mutex_unlock(&dblock);
 	if (res)
 		ast_log(LOG_WARNING, "Unable to put value '%s' for key '%s' in family '%s'\n", value, keys, family);
@@ -173,6 +270,7 @@ int ast_db_get(const char *family, const char *keys, char *value, int valuelen)
 {
 	char fullkey[256] = "";
 	DBT key, data;
+	struct db_cache_entry *cached;
 	int res, fullkeylen;
 
 	ast_mutex_lock(&dblock);
@@ -187,9 +285,21 @@ int ast_db_get(const char *family, const char *keys, char *value, int valuelen)
 	memset(value, 0, valuelen);
 	key.data = fullkey;
 	key.size = fullkeylen + 1;
-	
+
+	db_stats.gets++;
+	if ((cached = db_cache_find(fullkey))) {
+		db_stats.hits++;
+		ast_copy_string(value, cached->value, valuelen);
+		ast_mutex_unlock(&dblock);
+		return 0;
+	}
+
 	res = astdb->get(astdb, &key, &data, 0);
-	
+	if (!res && data.size) {
+		((char *)data.data)[data.size - 1] = '\0';
+		db_cache_store(fullkey, data.data);
+	}
+
 	ast_mutex_unlock(&dblock);
 
 	/* Be sure to NULL terminate our data either way */
@@ -215,6 +325,7 @@ int ast_db_del(const char *family, const char *keys)
 {
 	char fullkey[256];
 	DBT key;
+	struct db_cache_entry *cached;
 	int res, fullkeylen;
 
 	ast_mutex_lock(&dblock);
@@ -229,7 +340,12 @@ int ast_db_del(const char *family, const char *keys)
 	key.size = fullkeylen + 1;
 	
 	res = astdb->del(astdb, &key, 0);
-	astdb->sync(astdb, 0);
+	if ((cached = db_cache_find(fullkey)))
+		db_cache_clear(cached);
+	if (!res) {
+		db_stats.dels++;
+		db_written();
+	}
 	
 	ast_mutex_unlock(&dblock);
 
@@ -238,6 +354,34 @@ int ast_db_del(const char *family, const char *keys)
 	return res;
 }
 
+void ast_db_sync(void)
+{
+	ast_mutex_lock(&dblock);
+	if (astdb)
+		db_sync_locked();
+	ast_mutex_unlock(&dblock);
+}
+
+static void *db_sync_thread_main(void *data)
+{
+	struct timespec ts;
+	struct timeval tv;
+
+	ast_mutex_lock(&dblock);
+	for (;;) {
+		tv = ast_tvadd(ast_tvnow(), ast_samp2tv(option_dbsyncinterval, 1000));
+		ts.tv_sec = tv.tv_sec;
+		ts.tv_nsec = tv.tv_usec * 1000;
+		/* Sleep until the flush interval expires or a writer reports a full batch */
+		ast_cond_timedwait(&db_sync_cond, &dblock, &ts);
+		if (astdb)
+			db_sync_locked();
+	}
+	ast_mutex_unlock(&dblock);
+
+	return NULL;
+}
+
 static int database_put(int fd, int argc, char *argv[])
 {
 	int res;
@@ -299,6 +443,35 @@ static int database_deltree(int fd, int argc, char *argv[])
 	return RESULT_SUCCESS;
 }
 
+static int database_sync(int fd, int argc, char *argv[])
+{
+	if (argc != 2)
+		return RESULT_SHOWUSAGE;
+	ast_db_sync();
+	ast_cli(fd, "Database synced to disk.\n");
+	return RESULT_SUCCESS;
+}
+
+static int database_status(int fd, int argc, char *argv[])
+{
+	if (argc != 2)
+		return RESULT_SHOWUSAGE;
+	ast_mutex_lock(&dblock);
+	if (option_dbsyncinterval)
+		ast_cli(fd, "Sync mode: every %d ms%s\n", option_dbsyncinterval,
+			db_sync_thread == AST_PTHREADT_NULL ? " (thread not running, syncing every write)" : "");
+	else
+		ast_cli(fd, "Sync mode: every write\n");
+	if (option_dbsyncwrites)
+		ast_cli(fd, "Early sync after: %d writes\n", option_dbsyncwrites);
+	ast_cli(fd, "Pending writes: %d\n", db_pending);
+	ast_cli(fd, "Puts: %u  Deletes: %u  Syncs: %u\n", db_stats.puts, db_stats.dels, db_stats.syncs);
+	ast_cli(fd, "Gets: %u  Cache hits: %u (%u%%)\n", db_stats.gets, db_stats.hits,
+		db_stats.gets ? (unsigned int) ((unsigned long long) db_stats.hits * 100 / db_stats.gets) : 0);
+	ast_mutex_unlock(&dblock);
+	return RESULT_SUCCESS;
+}
+
 static int database_show(int fd, int argc, char *argv[])
 {
 	char prefix[256];
@@ -489,6 +662,14 @@ static char database_del_usage[] =
 "       Deletes an entry in the Asterisk database for a given\n"
 "family and key.\n";
 
+static char database_sync_usage[] =
+"Usage: database sync\n"
+"       Writes any pending changes in the Asterisk database to disk.\n";
+
+static char database_status_usage[] =
+"Usage: database status\n"
+"       Shows Asterisk database write batching and cache statistics.\n";
+
 static char database_deltree_usage[] =
 "Usage: database deltree <family> [keytree]\n"
 "       Deletes a family or specific keytree within a family\n"
@@ -518,6 +699,14 @@ struct ast_cli_entry cli_database[] = {
 	{ { "database", "deltree", NULL },
 	database_deltree, "Removes database keytree/values",
 	database_deltree_usage },
+
+	{ { "database", "sync", NULL },
+	database_sync, "Writes pending database changes to disk",
+	database_sync_usage },
+
+	{ { "database", "status", NULL },
+	database_status, "Shows database sync and cache statistics",
+	database_status_usage },
 };
 
 static int manager_dbput(struct mansession *s, const struct message *m)
@@ -585,6 +774,14 @@ static int manager_dbget(struct mansession *s, const struct message *m)
 int astdb_init(void)
 {
 	dbinit();
+	if (option_dbsyncinterval) {
+		ast_cond_init(&db_sync_cond, NULL);
+		if (ast_pthread_create_background(&db_sync_thread, NULL, db_sync_thread_main, NULL)) {
+			ast_log(LOG_WARNING, "Unable to start database sync thread, syncing every write\n");
+			db_sync_thread = AST_PTHREADT_NULL;
+		}
+	}
+	ast_register_atexit(ast_db_sync);
 	ast_cli_register_multiple(cli_database, sizeof(cli_database) / sizeof(struct ast_cli_entry));
 	ast_manager_register("DBGet", EVENT_FLAG_SYSTEM, manager_dbget, "Get DB Entry");
 	ast_manager_register("DBPut", EVENT_FLAG_SYSTEM, manager_dbput, "Put DB Entry");
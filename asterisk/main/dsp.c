@@ -44,6 +44,13 @@
 
 ASTERISK_FILE_VERSION(__FILE__, "$Revision: 114611 $")
 
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define GOERTZEL_SSE
+#include <cpuid.h>
+#include <xmmintrin.h>
+#endif
+
 #include <sys/types.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -190,14 +197,7 @@ enum gsamp_thresh {
 #define BUSYDETECT_MARTIN
 #endif
 
-typedef struct {
-	float v2;
-	float v3;
-	float fac;
-#ifndef OLD_DSP_ROUTINES
-	int samples;
-#endif	
-} goertzel_state_t;
+typedef struct ast_goertzel goertzel_state_t;
 
 typedef struct
 {
@@ -293,42 +293,141 @@ static char mf_hit[6][6] = {
 static char bell_mf_positions[] = "1247C-358A--69*---0B----#";
 #endif
 
-static inline void goertzel_sample(goertzel_state_t *s, short sample)
+static inline float goertzel_result(const goertzel_state_t *s)
 {
-	float v1;
-	float fsamp  = sample;
-	
-	v1 = s->v2;
-	s->v2 = s->v3;
-	s->v3 = s->fac * s->v2 - v1 + fsamp;
+	return s->v3 * s->v3 + s->v2 * s->v2 - s->v2 * s->v3 * s->fac;
 }
 
-static inline void goertzel_update(goertzel_state_t *s, short *samps, int count)
+static inline void goertzel_init(goertzel_state_t *s, float freq)
 {
-	int i;
-	
-	for (i=0;i<count;i++) 
-		goertzel_sample(s, samps[i]);
+	s->v2 = s->v3 = 0.0;
+	s->fac = 2.0 * cos(2.0 * M_PI * (freq / 8000.0));
 }
 
+static inline void goertzel_reset(goertzel_state_t *s)
+{
+	s->v2 = s->v3 = 0.0;
+}
+
+/*! Most filters goertzel_update() runs at once */
+#define GOERTZEL_MAX_BANK	16
 
-static inline float goertzel_result(goertzel_state_t *s)
+static void goertzel_update_c(goertzel_state_t *const *bank, int n, const short *samps, int count)
 {
-	return s->v3 * s->v3 + s->v2 * s->v2 - s->v2 * s->v3 * s->fac;
+	goertzel_state_t *s;
+	float famp, v1;
+	int i, j;
+
+	for (j = 0; j < count; j++) {
+		famp = samps[j];
+		for (i = 0; i < n; i++) {
+			s = bank[i];
+			v1 = s->v2;
+			s->v2 = s->v3;
+			s->v3 = s->fac * s->v2 - v1 + famp;
+		}
+	}
 }
 
-static inline void goertzel_init(goertzel_state_t *s, float freq, int samples)
+#ifdef GOERTZEL_SSE
+#define SSE_TARGET __attribute__((target("sse")))
+
+static int goertzel_sse = -1;
+
+static int sse_available(void)
 {
-	s->v2 = s->v3 = 0.0;
-	s->fac = 2.0 * cos(2.0 * M_PI * (freq / 8000.0));
-#ifndef OLD_DSP_ROUTINES
-	s->samples = samples;
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+	return (edx & bit_SSE) ? 1 : 0;
+}
+
+/*! \brief The filters four at a time, one to a lane.  Each lane does the same
+ * multiply, subtract and add as goertzel_update_c(), in single precision, so
+ * the results are the same. */
+static SSE_TARGET void goertzel_update_sse(goertzel_state_t *const *bank, int n, const short *samps, int count)
+{
+	__m128 v1, v2[GOERTZEL_MAX_BANK / 4], v3[GOERTZEL_MAX_BANK / 4], fac[GOERTZEL_MAX_BANK / 4], famp;
+	float lanes[3][GOERTZEL_MAX_BANK];
+	int groups = (n + 3) / 4;
+	int i, j;
+
+	for (i = 0; i < groups * 4; i++) {
+		lanes[0][i] = i < n ? bank[i]->v2 : 0.0;
+		lanes[1][i] = i < n ? bank[i]->v3 : 0.0;
+		lanes[2][i] = i < n ? bank[i]->fac : 0.0;
+	}
+	for (i = 0; i < groups; i++) {
+		v2[i] = _mm_loadu_ps(lanes[0] + 4 * i);
+		v3[i] = _mm_loadu_ps(lanes[1] + 4 * i);
+		fac[i] = _mm_loadu_ps(lanes[2] + 4 * i);
+	}
+	for (j = 0; j < count; j++) {
+		famp = _mm_set1_ps(samps[j]);
+		for (i = 0; i < groups; i++) {
+			v1 = v2[i];
+			v2[i] = v3[i];
+			v3[i] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(fac[i], v2[i]), v1), famp);
+		}
+	}
+	for (i = 0; i < groups; i++) {
+		_mm_storeu_ps(lanes[0] + 4 * i, v2[i]);
+		_mm_storeu_ps(lanes[1] + 4 * i, v3[i]);
+	}
+	for (i = 0; i < n; i++) {
+		bank[i]->v2 = lanes[0][i];
+		bank[i]->v3 = lanes[1][i];
+	}
+}
+#endif /* GOERTZEL_SSE */
+
+/*! \brief Run a bank of filters over a block, adding the block's energy to
+ * *energy if energy isn't NULL */
+static void goertzel_update(goertzel_state_t *const *bank, int n, const short *samps, int count, float *energy)
+{
+	float famp;
+	int j;
+
+	if (energy) {
+		for (j = 0; j < count; j++) {
+			famp = samps[j];
+			*energy += famp * famp;
+		}
+	}
+#ifdef GOERTZEL_SSE
+	if (goertzel_sse < 0)
+		goertzel_sse = sse_available();
+	if (goertzel_sse) {
+		goertzel_update_sse(bank, n, samps, count);
+		return;
+	}
 #endif
+	goertzel_update_c(bank, n, samps, count);
 }
 
-static inline void goertzel_reset(goertzel_state_t *s)
+void ast_goertzel_init(struct ast_goertzel *g, float freq)
 {
-	s->v2 = s->v3 = 0.0;
+	goertzel_init(g, freq);
+}
+
+void ast_goertzel_reset(struct ast_goertzel *g)
+{
+	goertzel_reset(g);
+}
+
+float ast_goertzel_result(const struct ast_goertzel *g)
+{
+	return goertzel_result(g);
+}
+
+void ast_goertzel_update(struct ast_goertzel *const *bank, int n, const short *samps, int count, float *energy)
+{
+	if (n > GOERTZEL_MAX_BANK) {
+		ast_log(LOG_WARNING, "Can't run %d Goertzel filters at once, only %d\n", n, GOERTZEL_MAX_BANK);
+		return;
+	}
+	goertzel_update(bank, n, samps, count, energy);
 }
 
 struct ast_dsp {
@@ -375,21 +474,21 @@ static void ast_dtmf_detect_init (dtmf_detect_state_t *s)
 	s->lasthit = 0;
 #endif
 	for (i = 0;  i < 4;  i++) {
-		goertzel_init (&s->row_out[i], dtmf_row[i], 102);
-		goertzel_init (&s->col_out[i], dtmf_col[i], 102);
+		goertzel_init(&s->row_out[i], dtmf_row[i]);
+		goertzel_init(&s->col_out[i], dtmf_col[i]);
 #ifdef OLD_DSP_ROUTINES
-		goertzel_init (&s->row_out2nd[i], dtmf_row[i] * 2.0, 102);
-		goertzel_init (&s->col_out2nd[i], dtmf_col[i] * 2.0, 102);
+		goertzel_init(&s->row_out2nd[i], dtmf_row[i] * 2.0);
+		goertzel_init(&s->col_out2nd[i], dtmf_col[i] * 2.0);
 #endif	
 		s->energy = 0.0;
 	}
 #ifdef FAX_DETECT
 	/* Same for the fax dector */
-	goertzel_init (&s->fax_tone, fax_freq, 102);
+	goertzel_init(&s->fax_tone, fax_freq);
 
 #ifdef OLD_DSP_ROUTINES
 	/* Same for the fax dector 2nd harmonic */
-	goertzel_init (&s->fax_tone2nd, fax_freq * 2.0, 102);
+	goertzel_init(&s->fax_tone2nd, fax_freq * 2.0);
 #endif	
 #endif /* FAX_DETECT */
 	s->current_sample = 0;
@@ -410,9 +509,9 @@ static void ast_mf_detect_init (mf_detect_state_t *s)
 	s->hits[0] = s->hits[1] = s->hits[2] = s->hits[3] = s->hits[4] = 0;
 #endif
 	for (i = 0;  i < 6;  i++) {
-		goertzel_init (&s->tone_out[i], mf_tones[i], 160);
+		goertzel_init(&s->tone_out[i], mf_tones[i]);
 #ifdef OLD_DSP_ROUTINES
-		goertzel_init (&s->tone_out2nd[i], mf_tones[i] * 2.0, 160);
+		goertzel_init(&s->tone_out2nd[i], mf_tones[i] * 2.0);
 		s->energy = 0.0;
 #endif
 	}
@@ -428,6 +527,8 @@ static void ast_mf_detect_init (mf_detect_state_t *s)
 static int dtmf_detect (dtmf_detect_state_t *s, int16_t amp[], int samples, 
 		 int digitmode, int *writeback, int faxdetect)
 {
+	goertzel_state_t *bank[GOERTZEL_MAX_BANK];
+	int nbank = 0;
 	float row_energy[4];
 	float col_energy[4];
 #ifdef FAX_DETECT
@@ -436,16 +537,30 @@ static int dtmf_detect (dtmf_detect_state_t *s, int16_t amp[], int samples,
 	float fax_energy_2nd;
 #endif	
 #endif /* FAX_DETECT */
-	float famp;
-	float v1;
 	int i;
-	int j;
 	int sample;
 	int best_row;
 	int best_col;
 	int hit;
 	int limit;
 
+	for (i = 0; i < 4; i++)
+		bank[nbank++] = &s->row_out[i];
+	for (i = 0; i < 4; i++)
+		bank[nbank++] = &s->col_out[i];
+#ifdef FAX_DETECT
+	bank[nbank++] = &s->fax_tone;
+#endif
+#ifdef OLD_DSP_ROUTINES
+	for (i = 0; i < 4; i++)
+		bank[nbank++] = &s->row_out2nd[i];
+	for (i = 0; i < 4; i++)
+		bank[nbank++] = &s->col_out2nd[i];
+#ifdef FAX_DETECT
+	bank[nbank++] = &s->fax_tone2nd;
+#endif
+#endif
+
 	hit = 0;
 	for (sample = 0;  sample < samples;  sample = limit) {
 		/* 102 is optimised to meet the DTMF specs. */
@@ -453,87 +568,7 @@ static int dtmf_detect (dtmf_detect_state_t *s, int16_t amp[], int samples,
 			limit = sample + (102 - s->current_sample);
 		else
 			limit = samples;
-#if defined(USE_3DNOW)
-		_dtmf_goertzel_update (s->row_out, amp + sample, limit - sample);
-		_dtmf_goertzel_update (s->col_out, amp + sample, limit - sample);
-#ifdef OLD_DSP_ROUTINES
-		_dtmf_goertzel_update (s->row_out2nd, amp + sample, limit2 - sample);
-		_dtmf_goertzel_update (s->col_out2nd, amp + sample, limit2 - sample);
-#endif		
-		/* XXX Need to fax detect for 3dnow too XXX */
-		#warning "Fax Support Broken"
-#else
-		/* The following unrolled loop takes only 35% (rough estimate) of the 
-		   time of a rolled loop on the machine on which it was developed */
-		for (j=sample;j<limit;j++) {
-			famp = amp[j];
-			s->energy += famp*famp;
-			/* With GCC 2.95, the following unrolled code seems to take about 35%
-			   (rough estimate) as long as a neat little 0-3 loop */
-			v1 = s->row_out[0].v2;
-			s->row_out[0].v2 = s->row_out[0].v3;
-			s->row_out[0].v3 = s->row_out[0].fac*s->row_out[0].v2 - v1 + famp;
-			v1 = s->col_out[0].v2;
-			s->col_out[0].v2 = s->col_out[0].v3;
-			s->col_out[0].v3 = s->col_out[0].fac*s->col_out[0].v2 - v1 + famp;
-			v1 = s->row_out[1].v2;
-			s->row_out[1].v2 = s->row_out[1].v3;
-			s->row_out[1].v3 = s->row_out[1].fac*s->row_out[1].v2 - v1 + famp;
-			v1 = s->col_out[1].v2;
-			s->col_out[1].v2 = s->col_out[1].v3;
-			s->col_out[1].v3 = s->col_out[1].fac*s->col_out[1].v2 - v1 + famp;
-			v1 = s->row_out[2].v2;
-			s->row_out[2].v2 = s->row_out[2].v3;
-			s->row_out[2].v3 = s->row_out[2].fac*s->row_out[2].v2 - v1 + famp;
-			v1 = s->col_out[2].v2;
-			s->col_out[2].v2 = s->col_out[2].v3;
-			s->col_out[2].v3 = s->col_out[2].fac*s->col_out[2].v2 - v1 + famp;
-			v1 = s->row_out[3].v2;
-			s->row_out[3].v2 = s->row_out[3].v3;
-			s->row_out[3].v3 = s->row_out[3].fac*s->row_out[3].v2 - v1 + famp;
-			v1 = s->col_out[3].v2;
-			s->col_out[3].v2 = s->col_out[3].v3;
-			s->col_out[3].v3 = s->col_out[3].fac*s->col_out[3].v2 - v1 + famp;
-#ifdef FAX_DETECT
-			/* Update fax tone */
-			v1 = s->fax_tone.v2;
-			s->fax_tone.v2 = s->fax_tone.v3;
-			s->fax_tone.v3 = s->fax_tone.fac*s->fax_tone.v2 - v1 + famp;
-#endif /* FAX_DETECT */
-#ifdef OLD_DSP_ROUTINES
-			v1 = s->col_out2nd[0].v2;
-			s->col_out2nd[0].v2 = s->col_out2nd[0].v3;
-			s->col_out2nd[0].v3 = s->col_out2nd[0].fac*s->col_out2nd[0].v2 - v1 + famp;
-			v1 = s->row_out2nd[0].v2;
-			s->row_out2nd[0].v2 = s->row_out2nd[0].v3;
-			s->row_out2nd[0].v3 = s->row_out2nd[0].fac*s->row_out2nd[0].v2 - v1 + famp;
-			v1 = s->col_out2nd[1].v2;
-			s->col_out2nd[1].v2 = s->col_out2nd[1].v3;
-			s->col_out2nd[1].v3 = s->col_out2nd[1].fac*s->col_out2nd[1].v2 - v1 + famp;
-			v1 = s->row_out2nd[1].v2;
-			s->row_out2nd[1].v2 = s->row_out2nd[1].v3;
-			s->row_out2nd[1].v3 = s->row_out2nd[1].fac*s->row_out2nd[1].v2 - v1 + famp;
-			v1 = s->col_out2nd[2].v2;
-			s->col_out2nd[2].v2 = s->col_out2nd[2].v3;
-			s->col_out2nd[2].v3 = s->col_out2nd[2].fac*s->col_out2nd[2].v2 - v1 + famp;
-			v1 = s->row_out2nd[2].v2;
-			s->row_out2nd[2].v2 = s->row_out2nd[2].v3;
-			s->row_out2nd[2].v3 = s->row_out2nd[2].fac*s->row_out2nd[2].v2 - v1 + famp;
-			v1 = s->col_out2nd[3].v2;
-			s->col_out2nd[3].v2 = s->col_out2nd[3].v3;
-			s->col_out2nd[3].v3 = s->col_out2nd[3].fac*s->col_out2nd[3].v2 - v1 + famp;
-			v1 = s->row_out2nd[3].v2;
-			s->row_out2nd[3].v2 = s->row_out2nd[3].v3;
-			s->row_out2nd[3].v3 = s->row_out2nd[3].fac*s->row_out2nd[3].v2 - v1 + famp;
-#ifdef FAX_DETECT
-			/* Update fax tone */            
-			v1 = s->fax_tone.v2;
-			s->fax_tone2nd.v2 = s->fax_tone2nd.v3;
-			s->fax_tone2nd.v3 = s->fax_tone2nd.fac*s->fax_tone2nd.v2 - v1 + famp;
-#endif /* FAX_DETECT */
-#endif
-		}
-#endif
+		goertzel_update(bank, nbank, amp + sample, limit - sample, &s->energy);
 		s->current_sample += (limit - sample);
 		if (s->current_sample < 102) {
 			if (hit && !((digitmode & DSP_DIGITMODE_NOQUELCH))) {
@@ -713,6 +748,8 @@ static int dtmf_detect (dtmf_detect_state_t *s, int16_t amp[], int samples,
 static int mf_detect (mf_detect_state_t *s, int16_t amp[],
                  int samples, int digitmode, int *writeback)
 {
+	goertzel_state_t *bank[GOERTZEL_MAX_BANK];
+	int nbank = 0;
 #ifdef OLD_DSP_ROUTINES
 	float tone_energy[6];
 	int best1;
@@ -724,14 +761,18 @@ static int mf_detect (mf_detect_state_t *s, int16_t amp[],
 	int best;
 	int second_best;
 #endif
-	float famp;
-	float v1;
 	int i;
-	int j;
 	int sample;
 	int hit;
 	int limit;
 
+	for (i = 0; i < 6; i++)
+		bank[nbank++] = &s->tone_out[i];
+#ifdef OLD_DSP_ROUTINES
+	for (i = 0; i < 6; i++)
+		bank[nbank++] = &s->tone_out2nd[i];
+#endif
+
 	hit = 0;
 	for (sample = 0;  sample < samples;  sample = limit) {
 		/* 80 is optimised to meet the MF specs. */
@@ -739,64 +780,10 @@ static int mf_detect (mf_detect_state_t *s, int16_t amp[],
 			limit = sample + (MF_GSIZE - s->current_sample);
 		else
 			limit = samples;
-#if defined(USE_3DNOW)
-		_dtmf_goertzel_update (s->row_out, amp + sample, limit - sample);
-		_dtmf_goertzel_update (s->col_out, amp + sample, limit - sample);
 #ifdef OLD_DSP_ROUTINES
-		_dtmf_goertzel_update (s->row_out2nd, amp + sample, limit2 - sample);
-		_dtmf_goertzel_update (s->col_out2nd, amp + sample, limit2 - sample);
-#endif
-		/* XXX Need to fax detect for 3dnow too XXX */
-		#warning "Fax Support Broken"
+		goertzel_update(bank, nbank, amp + sample, limit - sample, &s->energy);
 #else
-		/* The following unrolled loop takes only 35% (rough estimate) of the 
-		   time of a rolled loop on the machine on which it was developed */
-		for (j = sample;  j < limit;  j++) {
-			famp = amp[j];
-#ifdef OLD_DSP_ROUTINES
-			s->energy += famp*famp;
-#endif
-			/* With GCC 2.95, the following unrolled code seems to take about 35%
-			   (rough estimate) as long as a neat little 0-3 loop */
-			v1 = s->tone_out[0].v2;
-			s->tone_out[0].v2 = s->tone_out[0].v3;
-			s->tone_out[0].v3 = s->tone_out[0].fac*s->tone_out[0].v2 - v1 + famp;
-			v1 = s->tone_out[1].v2;
-			s->tone_out[1].v2 = s->tone_out[1].v3;
-			s->tone_out[1].v3 = s->tone_out[1].fac*s->tone_out[1].v2 - v1 + famp;
-			v1 = s->tone_out[2].v2;
-			s->tone_out[2].v2 = s->tone_out[2].v3;
-			s->tone_out[2].v3 = s->tone_out[2].fac*s->tone_out[2].v2 - v1 + famp;
-			v1 = s->tone_out[3].v2;
-			s->tone_out[3].v2 = s->tone_out[3].v3;
-			s->tone_out[3].v3 = s->tone_out[3].fac*s->tone_out[3].v2 - v1 + famp;
-			v1 = s->tone_out[4].v2;
-			s->tone_out[4].v2 = s->tone_out[4].v3;
-			s->tone_out[4].v3 = s->tone_out[4].fac*s->tone_out[4].v2 - v1 + famp;
-			v1 = s->tone_out[5].v2;
-			s->tone_out[5].v2 = s->tone_out[5].v3;
-			s->tone_out[5].v3 = s->tone_out[5].fac*s->tone_out[5].v2 - v1 + famp;
-#ifdef OLD_DSP_ROUTINES
-			v1 = s->tone_out2nd[0].v2;
-			s->tone_out2nd[0].v2 = s->tone_out2nd[0].v3;
-			s->tone_out2nd[0].v3 = s->tone_out2nd[0].fac*s->tone_out2nd[0].v2 - v1 + famp;
-			v1 = s->tone_out2nd[1].v2;
-			s->tone_out2nd[1].v2 = s->tone_out2nd[1].v3;
-			s->tone_out2nd[1].v3 = s->tone_out2nd[1].fac*s->tone_out2nd[1].v2 - v1 + famp;
-			v1 = s->tone_out2nd[2].v2;
-			s->tone_out2nd[2].v2 = s->tone_out2nd[2].v3;
-			s->tone_out2nd[2].v3 = s->tone_out2nd[2].fac*s->tone_out2nd[2].v2 - v1 + famp;
-			v1 = s->tone_out2nd[3].v2;
-			s->tone_out2nd[3].v2 = s->tone_out2nd[3].v3;
-			s->tone_out2nd[3].v3 = s->tone_out2nd[3].fac*s->tone_out2nd[3].v2 - v1 + famp;
-			v1 = s->tone_out2nd[4].v2;
-			s->tone_out2nd[4].v2 = s->tone_out2nd[4].v3;
-			s->tone_out2nd[4].v3 = s->tone_out2nd[4].fac*s->tone_out2nd[2].v2 - v1 + famp;
-			v1 = s->tone_out2nd[3].v2;
-			s->tone_out2nd[5].v2 = s->tone_out2nd[6].v3;
-			s->tone_out2nd[5].v3 = s->tone_out2nd[6].fac*s->tone_out2nd[3].v2 - v1 + famp;
-#endif
-		}
+		goertzel_update(bank, nbank, amp + sample, limit - sample, NULL);
 #endif
 		s->current_sample += (limit - sample);
 		if (s->current_sample < MF_GSIZE) {
@@ -1070,21 +1057,21 @@ int ast_dsp_getdigits (struct ast_dsp *dsp, char *buf, int max)
 
 static int __ast_dsp_call_progress(struct ast_dsp *dsp, short *s, int len)
 {
+	goertzel_state_t *bank[7];
 	int x;
 	int y;
 	int pass;
 	int newstate = DSP_TONE_STATE_SILENCE;
 	int res = 0;
+
+	for (y = 0; y < dsp->freqcount; y++)
+		bank[y] = &dsp->freqs[y];
 	while(len) {
 		/* Take the lesser of the number of samples we need and what we have */
 		pass = len;
 		if (pass > dsp->gsamp_size - dsp->gsamps) 
 			pass = dsp->gsamp_size - dsp->gsamps;
-		for (x=0;x<pass;x++) {
-			for (y=0;y<dsp->freqcount;y++) 
-				goertzel_sample(&dsp->freqs[y], s[x]);
-			dsp->genergy += s[x] * s[x];
-		}
+		goertzel_update(bank, dsp->freqcount, s, pass, &dsp->genergy);
 		s += pass;
 		dsp->gsamps += pass;
 		len -= pass;
@@ -1433,7 +1420,6 @@ struct ast_frame *ast_dsp_process(struct ast_channel *chan, struct ast_dsp *dsp,
 	int silence;
 	int res;
 	int digit;
-	int x;
 	short *shortdata;
 	unsigned char *odata;
 	int len;
@@ -1445,12 +1431,10 @@ struct ast_frame *ast_dsp_process(struct ast_channel *chan, struct ast_dsp *dsp,
 			case AST_FORMAT_SLINEAR: \
 				break; \
 			case AST_FORMAT_ULAW: \
-				for (x=0;x<len;x++) \
-					odata[x] = AST_LIN2MU((unsigned short)shortdata[x]); \
+				ast_lin2mu_buf(odata, shortdata, len); \
 				break; \
 			case AST_FORMAT_ALAW: \
-				for (x=0;x<len;x++) \
-					odata[x] = AST_LIN2A((unsigned short)shortdata[x]); \
+				ast_lin2a_buf(odata, shortdata, len); \
 				break; \
 			} \
 		} \
@@ -1470,13 +1454,11 @@ struct ast_frame *ast_dsp_process(struct ast_channel *chan, struct ast_dsp *dsp,
 		break;
 	case AST_FORMAT_ULAW:
 		shortdata = alloca(af->datalen * 2);
-		for (x = 0;x < len; x++) 
-			shortdata[x] = AST_MULAW(odata[x]);
+		ast_mulaw_buf(shortdata, odata, len);
 		break;
 	case AST_FORMAT_ALAW:
 		shortdata = alloca(af->datalen * 2);
-		for (x = 0; x < len; x++) 
-			shortdata[x] = AST_ALAW(odata[x]);
+		ast_alaw_buf(shortdata, odata, len);
 		break;
 	default:
 		ast_log(LOG_WARNING, "Inband DTMF is not supported on codec %s. Use RFC2833\n", ast_getformatname(af->subclass));
@@ -1644,7 +1626,7 @@ static void ast_dsp_prog_reset(struct ast_dsp *dsp)
 	dsp->gsamps = 0;
 	for (x=0;x<sizeof(modes[dsp->progmode].freqs) / sizeof(modes[dsp->progmode].freqs[0]);x++) {
 		if (modes[dsp->progmode].freqs[x]) {
-			goertzel_init(&dsp->freqs[x], (float)modes[dsp->progmode].freqs[x], dsp->gsamp_size);
+			goertzel_init(&dsp->freqs[x], (float)modes[dsp->progmode].freqs[x]);
 			max = x + 1;
 		}
 	}
@@ -37,6 +37,10 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 147386 $")
 #include <dirent.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#define FILE_CACHE
+#endif
 
 #include "asterisk/frame.h"
 #include "asterisk/file.h"
@@ -65,6 +69,8 @@ int ast_language_is_prefix;
 
 static AST_LIST_HEAD_STATIC(formats, ast_format);
 
+static void file_cache_flush(void);
+
 int __ast_format_register(const struct ast_format *f, struct ast_module *mod)
 {
 	struct ast_format *tmp;
@@ -100,6 +106,7 @@ int __ast_format_register(const struct ast_format *f, struct ast_module *mod)
 
 	AST_LIST_INSERT_HEAD(&formats, tmp, list);
 	AST_LIST_UNLOCK(&formats);
+	file_cache_flush();
 	if (option_verbose > 1)
 		ast_verbose( VERBOSE_PREFIX_2 "Registered file format %s, extension(s) %s\n", f->name, f->exts);
 
@@ -126,6 +133,7 @@ int ast_format_unregister(const char *name)
 	AST_LIST_UNLOCK(&formats);
 
 	if (!res) {
+		file_cache_flush();
 		if (option_verbose > 1)
 			ast_verbose( VERBOSE_PREFIX_2 "Unregistered format %s\n", name);
 	} else
@@ -304,9 +312,34 @@ static struct ast_filestream *get_filestream(struct ast_format *fmt, FILE *bfile
 	if (fmt->buf_size)
 		s->buf = (char *)(s+1);
 	s->fr.src = fmt->name;
+	s->readpos = -1;
 	return s;
 }
 
+/*!
+ * \brief Read a stream opened for reading with pread(), if its format reads through ast_filestream_read()
+ *
+ * Each frame is then one system call straight into the frame's buffer,
+ * and the stream never needs a stdio buffer of its own.  A file that is
+ * cut short or grows while it plays just gives a short read, or more data.
+ */
+static void filestream_pread(struct ast_filestream *s)
+{
+	if (s->fmt->flags & AST_FORMAT_FLAG_PREAD)
+		s->readpos = ftello(s->f);
+}
+
+int ast_filestream_read(struct ast_filestream *s, int len)
+{
+	ssize_t res;
+
+	if (s->readpos < 0)
+		return fread(s->fr.data, 1, len, s->f);
+	if ((res = pread(fileno(s->f), s->fr.data, len, s->readpos)) > 0)
+		s->readpos += res;
+	return res;
+}
+
 /*
  * Default implementations of open and rewrite.
  * Only use them if you don't have expensive stuff to do.
@@ -419,6 +452,7 @@ static int ast_filehelper(const char *filename, const void *arg2, const char *fm
 					continue;	/* cannot run open on file */
 				}
 				/* ok this is good for OPEN */
+				filestream_pread(s);
 				res = 1;	/* found */
 				s->lasttimeout = -1;
 				s->fmt = f;
@@ -475,6 +509,173 @@ static int ast_filehelper(const char *filename, const void *arg2, const char *fm
 	return res;
 }
 
+#ifdef FILE_CACHE
+/*
+ * Cache of ACTION_EXISTS answers for names relative to the sounds
+ * directory, so playing a prompt doesn't stat() every extension of every
+ * format in every language it might be in.  It is kept right by inotify:
+ * a file or directory appearing or going away anywhere we have looked
+ * throws the whole cache away, as does a format coming or going.
+ */
+struct file_cache_entry {
+	struct file_cache_entry *next;
+	int res;		/*!< What ast_filehelper() said: the formats found, or 0 */
+	char key[0];		/*!< The name, '\0', then the format asked for or "" */
+};
+
+#define FILE_CACHE_BUCKETS	512
+#define FILE_CACHE_MAX		8192	/*!< Start again past this many entries */
+
+#define FILE_CACHE_EVENTS	(IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+				 IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+AST_MUTEX_DEFINE_STATIC(file_cache_lock);
+static struct file_cache_entry *file_cache[FILE_CACHE_BUCKETS];
+static int file_cache_entries;
+static unsigned int file_cache_gen;	/*!< Bumped on every flush */
+static int file_cache_fd = -1;
+static pthread_t file_cache_thread = AST_PTHREADT_NULL;
+static int file_cache_hits;
+static int file_cache_misses;
+
+/*! \note Don't call without file_cache_lock locked */
+static void file_cache_clear(void)
+{
+	struct file_cache_entry *e;
+	int x;
+
+	for (x = 0; x < FILE_CACHE_BUCKETS; x++) {
+		while ((e = file_cache[x])) {
+			file_cache[x] = e->next;
+			free(e);
+		}
+	}
+	file_cache_entries = 0;
+	file_cache_gen++;
+}
+
+static void file_cache_flush(void)
+{
+	ast_mutex_lock(&file_cache_lock);
+	file_cache_clear();
+	ast_mutex_unlock(&file_cache_lock);
+}
+
+/*! \brief Throw the cache away whenever anything we watch changes */
+static void *file_cache_monitor(void *data)
+{
+	char buf[4096];
+	ssize_t len;
+
+	for (;;) {
+		len = read(file_cache_fd, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			break;
+		file_cache_flush();
+	}
+	ast_log(LOG_WARNING, "Lost track of the sounds directory, no longer caching file lookups: %s\n",
+		len < 0 ? strerror(errno) : "end of file");
+	/* leave the descriptor open, a lookup may be adding a watch to it */
+	ast_mutex_lock(&file_cache_lock);
+	file_cache_clear();
+	file_cache_fd = -1;
+	ast_mutex_unlock(&file_cache_lock);
+	return NULL;
+}
+
+/*!
+ * \brief Watch every directory from the sounds directory down to the one
+ * that would hold name, stopping at the first that doesn't exist (its
+ * parent will tell us if it turns up).
+ * \return 0 if any change to name's existence will flush the cache
+ */
+static int file_cache_watch(int fd, const char *name)
+{
+	char path[PATH_MAX];
+	char *c, *root;
+	int len;
+
+	len = snprintf(path, sizeof(path), "%s/sounds/%s", ast_config_AST_DATA_DIR, name);
+	if (len >= sizeof(path))
+		return -1;
+	root = path + len - strlen(name) - 1;	/* the '/' after sounds */
+	*root = '\0';
+	if (inotify_add_watch(fd, path, FILE_CACHE_EVENTS) < 0)
+		return -1;
+	*root = '/';
+	for (c = strchr(root + 1, '/'); c; c = strchr(c + 1, '/')) {
+		*c = '\0';
+		if (inotify_add_watch(fd, path, FILE_CACHE_EVENTS) < 0)
+			return (errno == ENOENT || errno == ENOTDIR) ? 0 : -1;
+		*c = '/';
+	}
+	return 0;
+}
+#else
+static void file_cache_flush(void)
+{
+}
+#endif /* FILE_CACHE */
+
+/*!
+ * \brief ast_filehelper(filename, NULL, fmt, ACTION_EXISTS), remembering the
+ * answer for names in the sounds directory.
+ */
+static int file_exists_cached(const char *filename, const char *fmt)
+{
+#ifdef FILE_CACHE
+	struct file_cache_entry *e;
+	unsigned int gen;
+	int namelen, fmtlen, hash, fd, res;
+
+	if (!fmt)
+		fmt = "";
+	namelen = strlen(filename);
+	fmtlen = strlen(fmt);
+	hash = (ast_str_hash(filename) ^ ast_str_hash(fmt)) % FILE_CACHE_BUCKETS;
+
+	ast_mutex_lock(&file_cache_lock);
+	if ((fd = file_cache_fd) < 0 || filename[0] == '/') {
+		ast_mutex_unlock(&file_cache_lock);
+		return ast_filehelper(filename, NULL, *fmt ? fmt : NULL, ACTION_EXISTS);
+	}
+	for (e = file_cache[hash]; e; e = e->next) {
+		if (!strcmp(e->key, filename) && !strcmp(e->key + namelen + 1, fmt)) {
+			res = e->res;
+			ast_mutex_unlock(&file_cache_lock);
+			ast_atomic_fetchadd_int(&file_cache_hits, 1);
+			return res;
+		}
+	}
+	gen = file_cache_gen;
+	ast_mutex_unlock(&file_cache_lock);
+	ast_atomic_fetchadd_int(&file_cache_misses, 1);
+
+	/* watch first, so a change while we look flushes what we find */
+	if (file_cache_watch(fd, filename))
+		return ast_filehelper(filename, NULL, *fmt ? fmt : NULL, ACTION_EXISTS);
+	res = ast_filehelper(filename, NULL, *fmt ? fmt : NULL, ACTION_EXISTS);
+
+	ast_mutex_lock(&file_cache_lock);
+	if (gen == file_cache_gen && (e = ast_malloc(sizeof(*e) + namelen + fmtlen + 2))) {
+		if (file_cache_entries >= FILE_CACHE_MAX)
+			file_cache_clear();
+		e->res = res;
+		strcpy(e->key, filename);
+		strcpy(e->key + namelen + 1, fmt);
+		e->next = file_cache[hash];
+		file_cache[hash] = e;
+		file_cache_entries++;
+	}
+	ast_mutex_unlock(&file_cache_lock);
+	return res;
+#else
+	return ast_filehelper(filename, NULL, fmt, ACTION_EXISTS);
+#endif
+}
+
 static int is_absolute_path(const char *filename)
 {
 	return filename[0] == '/';
@@ -503,7 +704,7 @@ static int fileexists_test(const char *filename, const char *fmt, const char *la
 		}
 	}
 
-	return ast_filehelper(buf, NULL, fmt, ACTION_EXISTS);
+	return file_exists_cached(buf, fmt);
 }
 
 /*!
@@ -779,18 +980,43 @@ int ast_playstream(struct ast_filestream *s)
 	return (res == FSREAD_FAILURE) ? -1 : 0;
 }
 
+/*
+ * The formats seek and tell on the FILE, so for a stream read with pread() move
+ * that to where we have read to first, and take it back afterwards.
+ */
+static void readpos_to_file(struct ast_filestream *fs)
+{
+	if (fs->readpos >= 0)
+		fseeko(fs->f, fs->readpos, SEEK_SET);
+}
+
+static void file_to_readpos(struct ast_filestream *fs)
+{
+	off_t pos;
+
+	if (fs->readpos >= 0 && (pos = ftello(fs->f)) >= 0)
+		fs->readpos = pos;
+}
+
 int ast_seekstream(struct ast_filestream *fs, off_t sample_offset, int whence)
 {
-	return fs->fmt->seek(fs, sample_offset, whence);
+	int res;
+
+	readpos_to_file(fs);
+	res = fs->fmt->seek(fs, sample_offset, whence);
+	file_to_readpos(fs);
+	return res;
 }
 
 int ast_truncstream(struct ast_filestream *fs)
 {
+	readpos_to_file(fs);
 	return fs->fmt->trunc(fs);
 }
 
 off_t ast_tellstream(struct ast_filestream *fs)
 {
+	readpos_to_file(fs);
 	return fs->fmt->tell(fs);
 }
 
@@ -945,6 +1171,7 @@ struct ast_filestream *ast_readfile(const char *filename, const char *type, cons
 			continue;
 		}
 		/* found it */
+		filestream_pread(fs);
 		fs->trans = NULL;
 		fs->fmt = f;
 		fs->flags = flags;
@@ -1270,6 +1497,22 @@ int ast_stream_and_wait(struct ast_channel *chan, const char *file,
         return res;
 } 
 
+static void show_file_cache(int fd)
+{
+#ifdef FILE_CACHE
+	int hits = file_cache_hits, misses = file_cache_misses, entries;
+
+	ast_mutex_lock(&file_cache_lock);
+	entries = file_cache_fd < 0 ? -1 : file_cache_entries;
+	ast_mutex_unlock(&file_cache_lock);
+	if (entries < 0)
+		ast_cli(fd, "Sound file lookups are not cached.\n");
+	else
+		ast_cli(fd, "Sound file cache: %d entries, %d hits, %d misses (%d%% hit rate)\n",
+			entries, hits, misses, hits + misses ? (int)(100LL * hits / (hits + misses)) : 0);
+#endif
+}
+
 static int show_file_formats(int fd, int argc, char *argv[])
 {
 #define FORMAT "%-10s %-10s %-20s\n"
@@ -1292,6 +1535,7 @@ static int show_file_formats(int fd, int argc, char *argv[])
 	}
 	AST_LIST_UNLOCK(&formats);
 	ast_cli(fd, "%d file formats registered.\n", count_fmt);
+	show_file_cache(fd);
 	return RESULT_SUCCESS;
 #undef FORMAT
 #undef FORMAT2
@@ -1319,6 +1563,7 @@ static int show_file_formats_deprecated(int fd, int argc, char *argv[])
 	}
 	AST_LIST_UNLOCK(&formats);
 	ast_cli(fd, "%d file formats registered.\n", count_fmt);
+	show_file_cache(fd);
 	return RESULT_SUCCESS;
 #undef FORMAT
 #undef FORMAT2
@@ -1326,7 +1571,8 @@ static int show_file_formats_deprecated(int fd, int argc, char *argv[])
 
 char show_file_formats_usage[] = 
 "Usage: core show file formats\n"
-"       Displays currently registered file formats (if any)\n";
+"       Displays currently registered file formats (if any), and how well\n"
+"       lookups of sound files are being cached\n";
 
 struct ast_cli_entry cli_show_file_formats_deprecated = {
 	{ "show", "file", "formats" },
@@ -1341,6 +1587,18 @@ struct ast_cli_entry cli_file[] = {
 
 int ast_file_init(void)
 {
+#ifdef FILE_CACHE
+	if ((file_cache_fd = inotify_init()) < 0)
+		ast_log(LOG_WARNING, "Unable to watch the sounds directory, not caching file lookups: %s\n", strerror(errno));
+	else {
+		fcntl(file_cache_fd, F_SETFD, FD_CLOEXEC);
+		if (ast_pthread_create_background(&file_cache_thread, NULL, file_cache_monitor, NULL)) {
+			ast_log(LOG_WARNING, "Unable to start the sound file cache thread, not caching file lookups\n");
+			close(file_cache_fd);
+			file_cache_fd = -1;
+		}
+	}
+#endif
 	ast_cli_register_multiple(cli_file, sizeof(cli_file) / sizeof(struct ast_cli_entry));
 	return 0;
 }
@@ -45,6 +45,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 147386 $")
 #include "asterisk/linkedlists.h"
 #include "asterisk/translate.h"
 #include "asterisk/dsp.h"
+#include "asterisk/manager.h"
 
 #ifdef TRACE_FRAMES
 static int headers;
@@ -52,30 +53,70 @@ static AST_LIST_HEAD_STATIC(headerlist, ast_frame);
 #endif
 
 #if !defined(LOW_MEMORY)
-static void frame_cache_cleanup(void *data);
+static void frame_slab_cleanup(void *data);
 
-/*! \brief A per-thread cache of frame headers */
-AST_THREADSTORAGE_CUSTOM(frame_cache, frame_cache_init, frame_cache_cleanup);
+/*! \brief A per-thread pool of frame slab blocks */
+AST_THREADSTORAGE_CUSTOM(frame_slabs, frame_slabs_init, frame_slab_cleanup);
 
-/*! 
- * \brief Maximum ast_frame cache size
+/*!
+ * \brief Frame slab size classes
  *
- * In most cases where the frame header cache will be useful, the size
- * of the cache will stay very small.  However, it is not always the case that
- * the same thread that allocates the frame will be the one freeing them, so
- * sometimes a thread will never have any frames in its cache, or the cache
- * will never be pulled from.  For the latter case, we limit the maximum size. 
- */ 
-#define FRAME_CACHE_MAX_SIZE	10
-
-/*! \brief This is just so ast_frames, a list head struct for holding a list of
- *  ast_frame structures, is defined. */
-AST_LIST_HEAD_NOLOCK(ast_frames, ast_frame);
-
-struct ast_frame_cache {
-	struct ast_frames list;
-	size_t size;
+ * Frame headers and ast_frdup() copies (header, friendly offset, payload and
+ * src in one piece) are carved from fixed size blocks kept in per-thread
+ * pools. A block freed by a thread other than the one that allocated it is
+ * handed back to its owner through the owner's remote free list, so the
+ * usual producer/consumer pairs (channel reader and bridge, translator and
+ * mixer) keep recycling the same blocks instead of going to malloc for
+ * every frame. Anything larger than the biggest class is malloc'd as before.
+ */
+static const size_t frame_slab_sizes[] = { 256, 512, 1024, 2048, 4096 };
+
+#define FRAME_SLAB_CLASSES	(sizeof(frame_slab_sizes) / sizeof(frame_slab_sizes[0]))
+
+/*! \brief Most free blocks a thread keeps around per size class */
+#define FRAME_SLAB_MAX_FREE	32
+
+/*! \brief Most blocks other threads may queue up for a thread to reuse */
+#define FRAME_SLAB_MAX_REMOTE	(FRAME_SLAB_MAX_FREE * FRAME_SLAB_CLASSES)
+
+struct frame_slab;
+
+/*! \brief Bookkeeping in front of every slab block, the frame follows it */
+struct frame_slab_block {
+	struct frame_slab *owner;
+	struct frame_slab_block *next;
+	unsigned int class;
 };
+
+#define FRAME_SLAB_BLOCK_HDR	((sizeof(struct frame_slab_block) + 15) & ~15)
+
+struct frame_slab_stats {
+	unsigned int allocs;		/*!< Blocks handed out */
+	unsigned int hits;		/*!< Blocks handed out from a free list */
+	unsigned int remote;		/*!< Blocks freed by another thread */
+	unsigned int released;		/*!< Blocks given back to malloc */
+};
+
+struct frame_slab {
+	/*! Free blocks per class, only touched by the owning thread */
+	struct frame_slab_block *free[FRAME_SLAB_CLASSES];
+	unsigned int nfree[FRAME_SLAB_CLASSES];
+	struct frame_slab_stats stats[FRAME_SLAB_CLASSES];
+	/*! Blocks of this pool currently handed out */
+	int inuse;
+	int registered;
+	ast_mutex_t lock;
+	/*! Blocks freed by other threads, protected by lock */
+	struct frame_slab_block *remote;
+	unsigned int nremote;
+	/*! The owning thread has exited, protected by lock */
+	int dead;
+	AST_LIST_ENTRY(frame_slab) list;
+};
+
+/*! \brief All live pools, plus the counters of the ones already gone */
+static AST_LIST_HEAD_STATIC(frame_slab_list, frame_slab);
+static struct frame_slab_stats frame_slab_retired[FRAME_SLAB_CLASSES];
 #endif
 
 #define SMOOTHER_SIZE 8000
@@ -98,6 +139,7 @@ struct ast_smoother {
 	float samplesperbyte;
 	struct ast_frame f;
 	struct timeval delivery;
+	struct timeval ingress;
 	char data[SMOOTHER_SIZE];
 	char framedata[SMOOTHER_SIZE + AST_FRIENDLY_OFFSET];
 	struct ast_frame *opt;
@@ -211,6 +253,9 @@ int __ast_smoother_feed(struct ast_smoother *s, struct ast_frame *f, int swap)
 	/* If either side is empty, reset the delivery time */
 	if (!s->len || ast_tvzero(f->delivery) || ast_tvzero(s->delivery))	/* XXX really ? */
 		s->delivery = f->delivery;
+	/* What comes out is as old as the oldest audio in it */
+	if (!s->len || ast_tvzero(s->ingress))
+		s->ingress = f->ingress;
 	s->len += f->datalen;
 	return 0;
 }
@@ -248,6 +293,7 @@ struct ast_frame *ast_smoother_read(struct ast_smoother *s)
 	/* Samples will be improper given VAD, but with VAD the concept really doesn't even exist */
 	s->f.samples = len * s->samplesperbyte;	/* XXX rounding */
 	s->f.delivery = s->delivery;
+	s->f.ingress = s->ingress;
 	/* Fill Data */
 	memcpy(s->f.data, s->data, len);
 	s->len -= len;
@@ -270,31 +316,205 @@ void ast_smoother_free(struct ast_smoother *s)
 	free(s);
 }
 
+#if !defined(LOW_MEMORY)
+static struct frame_slab *frame_slab_get(void)
+{
+	struct frame_slab *slab;
+
+	if (!(slab = ast_threadstorage_get(&frame_slabs, sizeof(*slab))))
+		return NULL;
+	if (!slab->registered) {
+		ast_mutex_init(&slab->lock);
+		slab->registered = 1;
+		AST_LIST_LOCK(&frame_slab_list);
+		AST_LIST_INSERT_HEAD(&frame_slab_list, slab, list);
+		AST_LIST_UNLOCK(&frame_slab_list);
+	}
+	return slab;
+}
+
+static void frame_slab_destroy(struct frame_slab *slab)
+{
+	unsigned int x;
+
+	AST_LIST_LOCK(&frame_slab_list);
+	AST_LIST_REMOVE(&frame_slab_list, slab, list);
+	for (x = 0; x < FRAME_SLAB_CLASSES; x++) {
+		frame_slab_retired[x].allocs += slab->stats[x].allocs;
+		frame_slab_retired[x].hits += slab->stats[x].hits;
+		frame_slab_retired[x].remote += slab->stats[x].remote;
+		frame_slab_retired[x].released += slab->stats[x].released;
+	}
+	AST_LIST_UNLOCK(&frame_slab_list);
+	ast_mutex_destroy(&slab->lock);
+	free(slab);
+}
+
+/*! \brief Put a block on the free list of its (calling) owner */
+static void frame_slab_keep(struct frame_slab *slab, struct frame_slab_block *b)
+{
+	if (slab->nfree[b->class] >= FRAME_SLAB_MAX_FREE) {
+		slab->stats[b->class].released++;
+		free(b);
+		return;
+	}
+	b->next = slab->free[b->class];
+	slab->free[b->class] = b;
+	slab->nfree[b->class]++;
+}
+
+/*! \brief Take back the blocks other threads have freed for us */
+static void frame_slab_drain(struct frame_slab *slab)
+{
+	struct frame_slab_block *b, *next;
+
+	ast_mutex_lock(&slab->lock);
+	b = slab->remote;
+	slab->remote = NULL;
+	slab->nremote = 0;
+	ast_mutex_unlock(&slab->lock);
+
+	for (; b; b = next) {
+		next = b->next;
+		frame_slab_keep(slab, b);
+	}
+}
+
+/*!
+ * \brief Get a zeroed frame header with room for len bytes counted from
+ * the start of the header.
+ * \retval NULL if len is too large for a slab or out of memory
+ */
+static struct ast_frame *frame_slab_alloc(size_t len)
+{
+	struct frame_slab *slab;
+	struct frame_slab_block *b;
+	struct ast_frame *f;
+	unsigned int class;
+
+	for (class = 0; class < FRAME_SLAB_CLASSES; class++) {
+		if (frame_slab_sizes[class] - FRAME_SLAB_BLOCK_HDR >= len)
+			break;
+	}
+	if (class == FRAME_SLAB_CLASSES || !(slab = frame_slab_get()))
+		return NULL;
+
+	/* Unlocked peek, the worst case is one trip to malloc too many */
+	if (!slab->free[class] && slab->remote)
+		frame_slab_drain(slab);
+
+	if ((b = slab->free[class])) {
+		slab->free[class] = b->next;
+		slab->nfree[class]--;
+		slab->stats[class].hits++;
+	} else if (!(b = ast_malloc(frame_slab_sizes[class])))
+		return NULL;
+
+	b->owner = slab;
+	b->class = class;
+	slab->stats[class].allocs++;
+	ast_atomic_fetchadd_int(&slab->inuse, 1);
+
+	f = (struct ast_frame *) ((char *) b + FRAME_SLAB_BLOCK_HDR);
+	memset(f, 0, sizeof(*f));
+	f->mallocd_hdr_len = frame_slab_sizes[class] - FRAME_SLAB_BLOCK_HDR;
+	f->mallocd = AST_MALLOCD_HDR | AST_MALLOCD_SLAB;
+
+	return f;
+}
+
+static void frame_slab_free(struct ast_frame *fr, int cache)
+{
+	struct frame_slab_block *b = (struct frame_slab_block *) ((char *) fr - FRAME_SLAB_BLOCK_HDR);
+	struct frame_slab *slab = b->owner;
+	int destroy = 0;
+
+	if (slab == pthread_getspecific(frame_slabs.key)) {
+		ast_atomic_fetchadd_int(&slab->inuse, -1);
+		if (cache)
+			frame_slab_keep(slab, b);
+		else {
+			slab->stats[b->class].released++;
+			free(b);
+		}
+		return;
+	}
+
+	ast_mutex_lock(&slab->lock);
+	slab->stats[b->class].remote++;
+	if (!cache || slab->dead || slab->nremote >= FRAME_SLAB_MAX_REMOTE) {
+		slab->stats[b->class].released++;
+		free(b);
+	} else {
+		b->next = slab->remote;
+		slab->remote = b;
+		slab->nremote++;
+	}
+	if (ast_atomic_dec_and_test(&slab->inuse) && slab->dead)
+		destroy = 1;
+	ast_mutex_unlock(&slab->lock);
+
+	if (destroy)
+		frame_slab_destroy(slab);
+}
+
+/*!
+ * \brief Thread exit. The pool itself has to stay around until every block
+ * it handed out has come back, whichever thread ends up freeing it.
+ */
+static void frame_slab_cleanup(void *data)
+{
+	struct frame_slab *slab = data;
+	struct frame_slab_block *b;
+	unsigned int x;
+	int destroy;
+
+	if (!slab->registered) {
+		free(slab);
+		return;
+	}
+
+	for (x = 0; x < FRAME_SLAB_CLASSES; x++) {
+		while ((b = slab->free[x])) {
+			slab->free[x] = b->next;
+			free(b);
+		}
+		slab->nfree[x] = 0;
+	}
+
+	ast_mutex_lock(&slab->lock);
+	while ((b = slab->remote)) {
+		slab->remote = b->next;
+		free(b);
+	}
+	slab->nremote = 0;
+	slab->dead = 1;
+	destroy = !slab->inuse;
+	ast_mutex_unlock(&slab->lock);
+
+	if (destroy)
+		frame_slab_destroy(slab);
+}
+#endif
+
 static struct ast_frame *ast_frame_header_new(void)
 {
 	struct ast_frame *f;
 
 #if !defined(LOW_MEMORY)
-	struct ast_frame_cache *frames;
-
-	if ((frames = ast_threadstorage_get(&frame_cache, sizeof(*frames)))) {
-		if ((f = AST_LIST_REMOVE_HEAD(&frames->list, frame_list))) {
-			size_t mallocd_len = f->mallocd_hdr_len;
-			memset(f, 0, sizeof(*f));
-			f->mallocd_hdr_len = mallocd_len;
-			f->mallocd = AST_MALLOCD_HDR;
-			frames->size--;
-			return f;
-		}
+	if (!(f = frame_slab_alloc(sizeof(*f)))) {
+		if (!(f = ast_calloc_cache(1, sizeof(*f))))
+			return NULL;
+		f->mallocd_hdr_len = sizeof(*f);
+		f->mallocd = AST_MALLOCD_HDR;
 	}
-	if (!(f = ast_calloc_cache(1, sizeof(*f))))
-		return NULL;
 #else
 	if (!(f = ast_calloc(1, sizeof(*f))))
 		return NULL;
+	f->mallocd_hdr_len = sizeof(*f);
+	f->mallocd = AST_MALLOCD_HDR;
 #endif
 
-	f->mallocd_hdr_len = sizeof(*f);
 #ifdef TRACE_FRAMES
 	AST_LIST_LOCK(&headerlist);
 	headers++;
@@ -305,19 +525,6 @@ static struct ast_frame *ast_frame_header_new(void)
 	return f;
 }
 
-#if !defined(LOW_MEMORY)
-static void frame_cache_cleanup(void *data)
-{
-	struct ast_frame_cache *frames = data;
-	struct ast_frame *f;
-
-	while ((f = AST_LIST_REMOVE_HEAD(&frames->list, frame_list)))
-		free(f);
-	
-	free(frames);
-}
-#endif
-
 void ast_frame_free(struct ast_frame *fr, int cache)
 {
 	if (ast_test_flag(fr, AST_FRFLAG_FROM_TRANSLATOR))
@@ -328,21 +535,6 @@ void ast_frame_free(struct ast_frame *fr, int cache)
 	if (!fr->mallocd)
 		return;
 
-#if !defined(LOW_MEMORY)
-	if (cache && fr->mallocd == AST_MALLOCD_HDR) {
-		/* Cool, only the header is malloc'd, let's just cache those for now 
-		 * to keep things simple... */
-		struct ast_frame_cache *frames;
-
-		if ((frames = ast_threadstorage_get(&frame_cache, sizeof(*frames))) 
-		    && frames->size < FRAME_CACHE_MAX_SIZE) {
-			AST_LIST_INSERT_HEAD(&frames->list, fr, frame_list);
-			frames->size++;
-			return;
-		}
-	}
-#endif
-	
 	if (fr->mallocd & AST_MALLOCD_DATA) {
 		if (fr->data) 
 			free(fr->data - fr->offset);
@@ -358,6 +550,12 @@ void ast_frame_free(struct ast_frame *fr, int cache)
 		AST_LIST_REMOVE(&headerlist, fr, frame_list);
 		AST_LIST_UNLOCK(&headerlist);
 #endif			
+#if !defined(LOW_MEMORY)
+		if (fr->mallocd & AST_MALLOCD_SLAB) {
+			frame_slab_free(fr, cache);
+			return;
+		}
+#endif
 		free(fr);
 	}
 }
@@ -365,7 +563,8 @@ void ast_frame_free(struct ast_frame *fr, int cache)
 /*!
  * \brief 'isolates' a frame by duplicating non-malloc'ed components
  * (header, src, data).
- * On return all components are malloc'ed
+ * On return the frame owns all of them, and ast_frfree() frees them.  A frame
+ * that owned none of them comes back as a single ast_frdup() allocation.
  */
 struct ast_frame *ast_frisolate(struct ast_frame *fr)
 {
@@ -375,6 +574,10 @@ struct ast_frame *ast_frisolate(struct ast_frame *fr)
 	ast_clear_flag(fr, AST_FRFLAG_FROM_TRANSLATOR);
 	ast_clear_flag(fr, AST_FRFLAG_FROM_DSP);
 
+	/* Nothing of it is ours, one allocation for all of it will do */
+	if (!fr->mallocd)
+		return ast_frdup(fr);
+
 	if (!(fr->mallocd & AST_MALLOCD_HDR)) {
 		/* Allocate a new header if needed */
 		if (!(out = ast_frame_header_new()))
@@ -385,6 +588,7 @@ struct ast_frame *ast_frisolate(struct ast_frame *fr)
 		out->samples = fr->samples;
 		out->offset = fr->offset;
 		out->data = fr->data;
+		out->ingress = fr->ingress;
 		/* Copy the timing data */
 		ast_copy_flags(out, fr, AST_FRFLAG_HAS_TIMING_INFO);
 		if (ast_test_flag(fr, AST_FRFLAG_HAS_TIMING_INFO)) {
@@ -399,7 +603,7 @@ struct ast_frame *ast_frisolate(struct ast_frame *fr)
 		if (fr->src) {
 			if (!(out->src = ast_strdup(fr->src))) {
 				if (out != fr)
-					free(out);
+					ast_frame_free(out, 0);
 				return NULL;
 			}
 		}
@@ -411,7 +615,7 @@ struct ast_frame *ast_frisolate(struct ast_frame *fr)
 			if (out->src != fr->src)
 				free((void *) out->src);
 			if (out != fr)
-				free(out);
+				ast_frame_free(out, 0);
 			return NULL;
 		}
 		newdata += AST_FRIENDLY_OFFSET;
@@ -421,7 +625,7 @@ struct ast_frame *ast_frisolate(struct ast_frame *fr)
 		out->data = newdata;
 	}
 
-	out->mallocd = AST_MALLOCD_HDR | AST_MALLOCD_SRC | AST_MALLOCD_DATA;
+	out->mallocd |= AST_MALLOCD_HDR | AST_MALLOCD_SRC | AST_MALLOCD_DATA;
 	
 	return out;
 }
@@ -432,10 +636,6 @@ struct ast_frame *ast_frdup(const struct ast_frame *f)
 	int len, srclen = 0;
 	void *buf = NULL;
 
-#if !defined(LOW_MEMORY)
-	struct ast_frame_cache *frames;
-#endif
-
 	/* Start with standard stuff */
 	len = sizeof(*out) + AST_FRIENDLY_OFFSET + f->datalen;
 	/* If we have a source, add space for it */
@@ -449,20 +649,7 @@ struct ast_frame *ast_frdup(const struct ast_frame *f)
 		len += srclen + 1;
 	
 #if !defined(LOW_MEMORY)
-	if ((frames = ast_threadstorage_get(&frame_cache, sizeof(*frames)))) {
-		AST_LIST_TRAVERSE_SAFE_BEGIN(&frames->list, out, frame_list) {
-			if (out->mallocd_hdr_len >= len) {
-				size_t mallocd_len = out->mallocd_hdr_len;
-				AST_LIST_REMOVE_CURRENT(&frames->list, frame_list);
-				memset(out, 0, sizeof(*out));
-				out->mallocd_hdr_len = mallocd_len;
-				buf = out;
-				frames->size--;
-				break;
-			}
-		}
-		AST_LIST_TRAVERSE_SAFE_END
-	}
+	buf = out = frame_slab_alloc(len);
 #endif
 
 	if (!buf) {
@@ -470,6 +657,9 @@ struct ast_frame *ast_frdup(const struct ast_frame *f)
 			return NULL;
 		out = buf;
 		out->mallocd_hdr_len = len;
+		/* Set us as having malloc'd header only, so it will eventually
+		   get freed. */
+		out->mallocd = AST_MALLOCD_HDR;
 	}
 
 	out->frametype = f->frametype;
@@ -477,9 +667,7 @@ struct ast_frame *ast_frdup(const struct ast_frame *f)
 	out->datalen = f->datalen;
 	out->samples = f->samples;
 	out->delivery = f->delivery;
-	/* Set us as having malloc'd header only, so it will eventually
-	   get freed. */
-	out->mallocd = AST_MALLOCD_HDR;
+	out->ingress = f->ingress;
 	out->offset = AST_FRIENDLY_OFFSET;
 	if (out->datalen) {
 		out->data = buf + sizeof(*out) + AST_FRIENDLY_OFFSET;
@@ -954,6 +1142,293 @@ static char frame_stats_usage[] =
 "       Displays debugging statistics from framer\n";
 #endif
 
+#if !defined(LOW_MEMORY)
+static int show_frame_slabs(int fd, int argc, char *argv[])
+{
+	struct frame_slab *slab;
+	struct frame_slab_stats total[FRAME_SLAB_CLASSES];
+	unsigned int nfree[FRAME_SLAB_CLASSES];
+	unsigned int x, threads = 0;
+	int blocks = 0;
+
+	if (argc != 4)
+		return RESULT_SHOWUSAGE;
+
+	memset(nfree, 0, sizeof(nfree));
+
+	/* The counters are bumped without locking by their owners, close enough here */
+	AST_LIST_LOCK(&frame_slab_list);
+	memcpy(total, frame_slab_retired, sizeof(total));
+	AST_LIST_TRAVERSE(&frame_slab_list, slab, list) {
+		if (!slab->dead)
+			threads++;
+		blocks += slab->inuse;
+		for (x = 0; x < FRAME_SLAB_CLASSES; x++) {
+			total[x].allocs += slab->stats[x].allocs;
+			total[x].hits += slab->stats[x].hits;
+			total[x].remote += slab->stats[x].remote;
+			total[x].released += slab->stats[x].released;
+			nfree[x] += slab->nfree[x];
+		}
+	}
+	AST_LIST_UNLOCK(&frame_slab_list);
+
+	ast_cli(fd, "%-6s %12s %12s %6s %12s %12s %6s\n",
+		"Size", "Allocs", "Hits", "Hit%", "RemoteFree", "Released", "Free");
+	for (x = 0; x < FRAME_SLAB_CLASSES; x++) {
+		ast_cli(fd, "%-6d %12u %12u %5u%% %12u %12u %6u\n",
+			(int) frame_slab_sizes[x], total[x].allocs, total[x].hits,
+			total[x].allocs ? (unsigned int) ((100ULL * total[x].hits) / total[x].allocs) : 0,
+			total[x].remote, total[x].released, nfree[x]);
+	}
+	ast_cli(fd, "%u thread pools, %d blocks in use\n", threads, blocks);
+
+	return RESULT_SUCCESS;
+}
+
+static char frame_slabs_usage[] =
+"Usage: core show frame slabs\n"
+"       Displays allocation counters of the per-thread frame slab pools.\n"
+"       Hits are allocations served from a pool instead of malloc,\n"
+"       RemoteFree counts blocks freed by a thread other than their owner.\n";
+#endif
+
+/*! \brief Latency histograms go in steps of a millisecond, the last catching anything longer */
+#define LATENCY_BUCKETS 1000
+/*! \brief How many stage and channel type pairs are kept apart */
+#define LATENCY_ROWS 48
+
+int ast_latency_tracing;
+
+struct latency_row {
+	enum ast_latency_stage stage;
+	char where[20];
+	unsigned int count;
+	uint64_t total_us;
+	unsigned int max_us;
+	unsigned int hist[LATENCY_BUCKETS];
+};
+
+AST_MUTEX_DEFINE_STATIC(latency_lock);
+static struct latency_row *latency_rows;
+static int latency_num_rows;
+
+static const char *latency_stages[AST_LATENCY_STAGES] = {
+	[AST_LATENCY_READ] = "read",
+	[AST_LATENCY_TRANSLATE] = "translate",
+	[AST_LATENCY_CONFERENCE] = "conference",
+	[AST_LATENCY_WRITE] = "write",
+};
+
+/*! \brief How old a stamp is, or -1 if it is none (or makes no sense, as from a frame nobody cleared) */
+static int64_t latency_age(const struct ast_frame *fr, struct timeval now)
+{
+	int64_t us;
+
+	if (ast_tvzero(fr->ingress))
+		return -1;
+	us = (int64_t) (now.tv_sec - fr->ingress.tv_sec) * 1000000 + (now.tv_usec - fr->ingress.tv_usec);
+	if (us < 0 || us > 60 * 1000000)
+		return -1;
+	return us;
+}
+
+void __ast_frame_stamp(struct ast_frame *fr)
+{
+	fr->ingress = ast_tvnow();
+}
+
+void __ast_latency_mark(const struct ast_frame *fr, enum ast_latency_stage stage, const char *where)
+{
+	struct latency_row *row = NULL;
+	int64_t us;
+	int x;
+
+	if (fr->frametype != AST_FRAME_VOICE || (us = latency_age(fr, ast_tvnow())) < 0)
+		return;
+	if (!where)
+		where = "";
+
+	ast_mutex_lock(&latency_lock);
+	if (!latency_rows) {
+		ast_mutex_unlock(&latency_lock);
+		return;
+	}
+	for (x = 0; x < latency_num_rows; x++) {
+		row = &latency_rows[x];
+		if (row->stage == stage && !strcmp(row->where, where))
+			break;
+	}
+	if (x == latency_num_rows) {
+		if (x == LATENCY_ROWS) {
+			ast_mutex_unlock(&latency_lock);
+			return;
+		}
+		row = &latency_rows[latency_num_rows++];
+		row->stage = stage;
+		ast_copy_string(row->where, where, sizeof(row->where));
+	}
+	row->count++;
+	row->total_us += us;
+	if (us > row->max_us)
+		row->max_us = us;
+	row->hist[us / 1000 < LATENCY_BUCKETS ? us / 1000 : LATENCY_BUCKETS - 1]++;
+	ast_mutex_unlock(&latency_lock);
+}
+
+/*! \brief The age (in ms) that a given share (in percent) of what a row counted came in under */
+static int latency_percentile(const struct latency_row *row, int percent)
+{
+	uint64_t sum = 0;
+	int x;
+
+	for (x = 0; x < LATENCY_BUCKETS - 1; x++) {
+		sum += row->hist[x];
+		if (sum * 100 >= (uint64_t) row->count * percent)
+			break;
+	}
+	return x + 1;
+}
+
+/*! \brief A copy of the rows, in stage order, for showing */
+static struct latency_row *latency_snapshot(int *num)
+{
+	struct latency_row *rows;
+	int stage, x;
+
+	*num = 0;
+	ast_mutex_lock(&latency_lock);
+	if (!latency_num_rows || !(rows = ast_calloc(latency_num_rows, sizeof(*rows)))) {
+		ast_mutex_unlock(&latency_lock);
+		return NULL;
+	}
+	for (stage = 0; stage < AST_LATENCY_STAGES; stage++) {
+		for (x = 0; x < latency_num_rows; x++) {
+			if (latency_rows[x].stage == stage)
+				rows[(*num)++] = latency_rows[x];
+		}
+	}
+	ast_mutex_unlock(&latency_lock);
+
+	return rows;
+}
+
+static int show_latency(int fd, int argc, char *argv[])
+{
+	struct latency_row *rows, *row;
+	int num, x;
+
+	if (argc != 3)
+		return RESULT_SHOWUSAGE;
+
+	ast_cli(fd, "Latency tracing is %s\n", ast_latency_tracing ? "on" : "off");
+	if (!(rows = latency_snapshot(&num)))
+		return RESULT_SUCCESS;
+
+	ast_cli(fd, "%-11s %-16s %10s %9s %7s %7s %7s %9s\n",
+		"Stage", "Through", "Frames", "Avg(ms)", "p50", "p90", "p99", "Max(ms)");
+	for (x = 0; x < num; x++) {
+		row = &rows[x];
+		ast_cli(fd, "%-11s %-16s %10u %9.2f %5dms %5dms %5dms %9.2f\n",
+			latency_stages[row->stage], S_OR(row->where, "-"), row->count,
+			row->count ? row->total_us / 1000.0 / row->count : 0.0,
+			latency_percentile(row, 50), latency_percentile(row, 90), latency_percentile(row, 99),
+			row->max_us / 1000.0);
+	}
+	free(rows);
+
+	return RESULT_SUCCESS;
+}
+
+static int set_latency(int fd, int argc, char *argv[])
+{
+	struct latency_row *rows = NULL;
+
+	if (argc != 4)
+		return RESULT_SHOWUSAGE;
+
+	if (!strcasecmp(argv[3], "off")) {
+		ast_latency_tracing = 0;
+		ast_cli(fd, "Latency tracing stopped\n");
+		return RESULT_SUCCESS;
+	}
+	if (strcasecmp(argv[3], "on"))
+		return RESULT_SHOWUSAGE;
+
+	/* Start again from nothing */
+	if (!(rows = ast_calloc(LATENCY_ROWS, sizeof(*rows))))
+		return RESULT_FAILURE;
+	ast_mutex_lock(&latency_lock);
+	if (latency_rows)
+		free(latency_rows);
+	latency_rows = rows;
+	latency_num_rows = 0;
+	ast_latency_tracing = 1;
+	ast_mutex_unlock(&latency_lock);
+
+	ast_cli(fd, "Latency tracing started\n");
+
+	return RESULT_SUCCESS;
+}
+
+static int manager_latency(struct mansession *s, const struct message *m)
+{
+	const char *id = astman_get_header(m, "ActionID");
+	char idText[256] = "";
+	struct latency_row *rows, *row;
+	int num, x;
+
+	if (!ast_strlen_zero(id))
+		snprintf(idText, sizeof(idText), "ActionID: %s\r\n", id);
+
+	rows = latency_snapshot(&num);
+	astman_send_ack(s, m, "Latency statistics will follow");
+	for (x = 0; x < num; x++) {
+		row = &rows[x];
+		astman_append(s, "Event: Latency\r\n"
+			"Stage: %s\r\n"
+			"Through: %s\r\n"
+			"Frames: %u\r\n"
+			"AverageUS: %u\r\n"
+			"P50MS: %d\r\n"
+			"P90MS: %d\r\n"
+			"P99MS: %d\r\n"
+			"MaxUS: %u\r\n"
+			"%s"
+			"\r\n",
+			latency_stages[row->stage], row->where, row->count,
+			row->count ? (unsigned int) (row->total_us / row->count) : 0,
+			latency_percentile(row, 50), latency_percentile(row, 90), latency_percentile(row, 99),
+			row->max_us, idText);
+	}
+	astman_append(s, "Event: LatencyComplete\r\n"
+		"Tracing: %s\r\n"
+		"Items: %d\r\n"
+		"%s"
+		"\r\n", ast_latency_tracing ? "On" : "Off", num, idText);
+	if (rows)
+		free(rows);
+
+	return 0;
+}
+
+static char show_latency_usage[] =
+"Usage: core show latency\n"
+"       Shows how long the audio in voice frames had been in Asterisk by the\n"
+"time it got to each stage of the voice path: read from a channel, out of a\n"
+"translator, out of a conference, and written to a channel.  The age is\n"
+"counted from when the channel driver got the audio, where the driver notes\n"
+"it, and otherwise from when the frame was queued on the channel.\n";
+
+static char set_latency_usage[] =
+"Usage: core set latency {on|off}\n"
+"       Starts (clearing anything counted before) or stops latency tracing.\n";
+
+static char manager_latency_usage[] =
+"Description: Lists the latency seen at each stage of the voice path,\n"
+"as 'core show latency' does.\n"
+"Variables: ActionID: <id>	Action ID for this transaction. Will be returned.\n";
+
 /* Builtin Asterisk CLI-commands for debugging */
 static struct ast_cli_entry cli_show_codecs = {
 	{ "show", "codecs", NULL },
@@ -1008,16 +1483,31 @@ static struct ast_cli_entry my_clis[] = {
 	show_codec_n, "Shows a specific codec",
 	frame_show_codec_n_usage, NULL, &cli_show_codec },
 
+#if !defined(LOW_MEMORY)
+	{ { "core", "show", "frame", "slabs", NULL },
+	show_frame_slabs, "Shows frame slab allocator statistics",
+	frame_slabs_usage },
+#endif
+
 #ifdef TRACE_FRAMES
 	{ { "core", "show", "frame", "stats", NULL },
 	show_frame_stats, "Shows frame statistics",
 	frame_stats_usage, NULL, &cli_show_frame_stats },
 #endif
+
+	{ { "core", "show", "latency", NULL },
+	show_latency, "Shows voice path latency",
+	show_latency_usage },
+
+	{ { "core", "set", "latency", NULL },
+	set_latency, "Start or stop voice path latency tracing",
+	set_latency_usage },
 };
 
 int init_framer(void)
 {
 	ast_cli_register_multiple(my_clis, sizeof(my_clis) / sizeof(struct ast_cli_entry));
+	ast_manager_register2("Latency", EVENT_FLAG_SYSTEM, manager_latency, "Show voice path latency", manager_latency_usage);
 	return 0;	
 }
 
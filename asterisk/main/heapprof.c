@@ -0,0 +1,585 @@
+/*
+ * Asterisk -- An open source telephony toolkit.
+ *
+ * Copyright (C) 1999 - 2008, Digium, Inc.
+ *
+ * See http://www.asterisk.org for more information about
+ * the Asterisk project. Please do not directly contact
+ * any of the maintainers of this project for assistance;
+ * the project provides a web site, mailing lists and IRC
+ * channels for your use.
+ *
+ * This program is free software, distributed under the terms of
+ * the GNU General Public License Version 2. See the LICENSE file
+ * at the top of the source tree.
+ */
+
+/*! \file
+ *
+ * \brief Sampling heap profiler
+ *
+ * Unlike astmm (MALLOC_DEBUG), which keeps every allocation, this notes
+ * about one allocation in every ast_heap_sample_rate bytes made through
+ * ast_malloc() and friends: where it was made, the stack, and its size.
+ * That is cheap enough to leave running on a live system.  From the samples
+ * we estimate, for each place in the source, how much of what it allocated
+ * is still live and how fast it allocates.
+ *
+ * To know when a sampled allocation is freed, free() and realloc() are
+ * replaced (with glibc only) by versions that look the pointer up before
+ * handing it on; that costs nothing until something has been sampled, and
+ * a glance at a hash bucket after.
+ */
+
+#include "asterisk.h"
+
+ASTERISK_FILE_VERSION(__FILE__, "$Revision$")
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#if defined(__GLIBC__)
+#include <execinfo.h>
+#endif
+
+#include "asterisk/options.h"
+#include "asterisk/utils.h"
+#include "asterisk/cli.h"
+#include "asterisk/paths.h"
+
+int ast_heap_sample_rate;
+
+#ifndef __AST_DEBUG_MALLOC
+
+#if defined(__GLIBC__)
+#define HEAP_PROF_FREE
+#endif
+
+/*! \brief Bytes between samples unless told otherwise */
+#define HEAP_PROF_DEFAULT_RATE	524288
+/*! \brief How many places (each with its stack) can be told apart */
+#define HEAP_PROF_RECORDS	1024
+/*! \brief Stack frames kept with each place */
+#define HEAP_PROF_DEPTH		12
+/*! \brief Sampled allocations that can be tracked until they are freed */
+#define HEAP_PROF_LIVE		8192
+/*! \brief Hash buckets for those; free() only locks anything when it hits a used one */
+#define HEAP_PROF_BUCKETS	16384
+
+#define HEAP_PROF_BUCKET(ptr) ((((unsigned long) (ptr) >> 4) ^ ((unsigned long) (ptr) >> 18)) & (HEAP_PROF_BUCKETS - 1))
+
+struct heap_prof_record {
+	const char *file_key;		/*!< __FILE__ as given, to match on */
+	int lineno;
+	char file[32];			/*!< Copies, for after the module the strings were in is gone */
+	char func[40];
+	int depth;
+	void *stack[HEAP_PROF_DEPTH];
+	int next;			/*!< The next record in the same hash bucket */
+	/* Counted as sampled, not as estimated */
+	uint64_t live_samples;
+	uint64_t live_bytes;
+	uint64_t total_samples;
+	uint64_t total_bytes;
+};
+
+struct heap_prof_live {
+	void *ptr;
+	size_t len;
+	int record;
+	int next;
+};
+
+/* Not an ast_mutex: its hooks (the lock profiler) may allocate */
+#undef pthread_mutex_t
+#undef pthread_mutex_lock
+#undef pthread_mutex_unlock
+static pthread_mutex_t heap_prof_lock = PTHREAD_MUTEX_INITIALIZER;
+/*! \brief Each thread's bytes to go before the next sample, as the key's value */
+static pthread_key_t heap_prof_key;
+static int heap_prof_rate;		/*!< The rate the samples now held were taken at */
+static struct timeval heap_prof_started;
+static struct heap_prof_record *heap_records;
+static int heap_record_buckets[HEAP_PROF_RECORDS];
+static int heap_num_records;
+static struct heap_prof_live *heap_live;
+static int *heap_live_buckets;
+static int heap_live_free;
+static volatile int heap_live_count;
+static unsigned int heap_dropped;
+
+/*! \brief Bytes until the next sample, spread out so allocations made in step with the rate are still fairly sampled */
+static intptr_t heap_prof_interval(int rate)
+{
+	return rate / 2 + ast_random() % rate + 1;
+}
+
+/*! \brief Count a sample against its place, and track it until it is freed; called with heap_prof_lock held */
+static void heap_prof_note(void *p, size_t len, const char *file, int lineno, const char *func, void **stack, int depth)
+{
+	struct heap_prof_record *rec;
+	struct heap_prof_live *live;
+	unsigned int hash;
+	const char *base;
+	int i, x;
+
+	hash = ((unsigned long) file >> 3) ^ (lineno * 2654435761U);
+	for (i = 0; i < depth; i++)
+		hash = hash * 31 + ((unsigned long) stack[i] >> 2);
+	hash %= HEAP_PROF_RECORDS;
+
+	for (x = heap_record_buckets[hash]; x >= 0; x = rec->next) {
+		rec = &heap_records[x];
+		if (rec->file_key == file && rec->lineno == lineno && rec->depth == depth &&
+		    !memcmp(rec->stack, stack, depth * sizeof(*stack)))
+			break;
+	}
+	if (x < 0) {
+		if (heap_num_records == HEAP_PROF_RECORDS) {
+			heap_dropped++;
+			return;
+		}
+		x = heap_num_records++;
+		rec = &heap_records[x];
+		memset(rec, 0, sizeof(*rec));
+		rec->file_key = file;
+		rec->lineno = lineno;
+		base = strrchr(file, '/');
+		ast_copy_string(rec->file, base ? base + 1 : file, sizeof(rec->file));
+		ast_copy_string(rec->func, func, sizeof(rec->func));
+		rec->depth = depth;
+		memcpy(rec->stack, stack, depth * sizeof(*stack));
+		rec->next = heap_record_buckets[hash];
+		heap_record_buckets[hash] = x;
+	}
+	rec->total_samples++;
+	rec->total_bytes += len;
+
+	if (heap_live_free < 0) {
+		heap_dropped++;
+		return;
+	}
+	live = &heap_live[heap_live_free];
+	heap_live_free = live->next;
+	live->ptr = p;
+	live->len = len;
+	live->record = x;
+	live->next = heap_live_buckets[HEAP_PROF_BUCKET(p)];
+	heap_live_buckets[HEAP_PROF_BUCKET(p)] = live - heap_live;
+	rec->live_samples++;
+	rec->live_bytes += len;
+	heap_live_count++;
+}
+
+void __ast_heap_alloc(void *p, size_t len, const char *file, int lineno, const char *func)
+{
+	void *stack[HEAP_PROF_DEPTH + 1];
+	int rate = ast_heap_sample_rate, depth = 0;
+	intptr_t left;
+
+	if (rate <= 0 || !p)
+		return;
+
+	if (!(left = (intptr_t) pthread_getspecific(heap_prof_key)))
+		left = heap_prof_interval(rate);
+	if ((left -= len) > 0) {
+		pthread_setspecific(heap_prof_key, (void *) left);
+		return;
+	}
+	pthread_setspecific(heap_prof_key, (void *) heap_prof_interval(rate));
+
+#if defined(__GLIBC__)
+	/* Outside the lock, since this may allocate and free; the first frame is our own */
+	if ((depth = backtrace(stack, HEAP_PROF_DEPTH + 1) - 1) < 0)
+		depth = 0;
+#endif
+
+	pthread_mutex_lock(&heap_prof_lock);
+	if (ast_heap_sample_rate)
+		heap_prof_note(p, len, file, lineno, func, stack + 1, depth);
+	pthread_mutex_unlock(&heap_prof_lock);
+}
+
+#ifdef HEAP_PROF_FREE
+extern void __libc_free(void *ptr);
+extern void *__libc_realloc(void *ptr, size_t len);
+
+/*! \brief Stop tracking a sampled allocation that is going away */
+static void heap_prof_forget(void *ptr)
+{
+	struct heap_prof_live *live;
+	struct heap_prof_record *rec;
+	int *prev, x;
+
+	pthread_mutex_lock(&heap_prof_lock);
+	for (prev = &heap_live_buckets[HEAP_PROF_BUCKET(ptr)]; (x = *prev) >= 0; prev = &live->next) {
+		live = &heap_live[x];
+		if (live->ptr != ptr)
+			continue;
+		*prev = live->next;
+		rec = &heap_records[live->record];
+		rec->live_samples--;
+		rec->live_bytes -= live->len;
+		live->next = heap_live_free;
+		heap_live_free = x;
+		heap_live_count--;
+		break;
+	}
+	pthread_mutex_unlock(&heap_prof_lock);
+}
+
+void free(void *ptr)
+{
+	if (heap_live_count && ptr && heap_live_buckets[HEAP_PROF_BUCKET(ptr)] >= 0)
+		heap_prof_forget(ptr);
+	__libc_free(ptr);
+}
+
+void *realloc(void *ptr, size_t len)
+{
+	if (heap_live_count && ptr && heap_live_buckets[HEAP_PROF_BUCKET(ptr)] >= 0)
+		heap_prof_forget(ptr);
+	return __libc_realloc(ptr, len);
+}
+#endif /* HEAP_PROF_FREE */
+
+/*! \brief Start sampling afresh, one allocation in every rate bytes */
+static int heap_prof_start(int rate)
+{
+	void *stack[HEAP_PROF_DEPTH];
+	int x;
+
+	/* The profiler's own tables are left out of what it samples */
+	if (!heap_records) {
+		if (pthread_key_create(&heap_prof_key, NULL))
+			return -1;
+		if (!(heap_records = calloc(HEAP_PROF_RECORDS, sizeof(*heap_records))) ||
+		    !(heap_live = calloc(HEAP_PROF_LIVE, sizeof(*heap_live))) ||
+		    !(heap_live_buckets = calloc(HEAP_PROF_BUCKETS, sizeof(*heap_live_buckets)))) {
+			/* Nothing can have been sampled yet, so these are safe to free */
+			if (heap_records)
+				free(heap_records);
+			if (heap_live)
+				free(heap_live);
+			heap_records = NULL;
+			heap_live = NULL;
+			pthread_key_delete(heap_prof_key);
+			return -1;
+		}
+#if defined(__GLIBC__)
+		/* The first backtrace() loads what it needs, and is best done now */
+		backtrace(stack, HEAP_PROF_DEPTH);
+#endif
+	}
+
+	pthread_mutex_lock(&heap_prof_lock);
+	ast_heap_sample_rate = 0;
+	heap_live_count = 0;
+	for (x = 0; x < HEAP_PROF_BUCKETS; x++)
+		heap_live_buckets[x] = -1;
+	for (x = 0; x < HEAP_PROF_LIVE; x++)
+		heap_live[x].next = x + 1 < HEAP_PROF_LIVE ? x + 1 : -1;
+	heap_live_free = 0;
+	for (x = 0; x < HEAP_PROF_RECORDS; x++)
+		heap_record_buckets[x] = -1;
+	heap_num_records = 0;
+	heap_dropped = 0;
+	heap_prof_rate = rate;
+	heap_prof_started = ast_tvnow();
+	ast_heap_sample_rate = rate;
+	pthread_mutex_unlock(&heap_prof_lock);
+
+	return 0;
+}
+
+/*! \brief A copy of the records, to look at without holding the lock; NULL if there are none */
+static struct heap_prof_record *heap_prof_snapshot(int *num, unsigned int *dropped, int *rate, struct timeval *started)
+{
+	struct heap_prof_record *recs;
+
+	*num = 0;
+	/* Allocated before locking, and not through ast_calloc(), so it isn't sampled itself */
+	if (!heap_records || !(recs = calloc(HEAP_PROF_RECORDS, sizeof(*recs))))
+		return NULL;
+
+	pthread_mutex_lock(&heap_prof_lock);
+	*num = heap_num_records;
+	memcpy(recs, heap_records, heap_num_records * sizeof(*recs));
+	*dropped = heap_dropped;
+	*rate = heap_prof_rate;
+	*started = heap_prof_started;
+	pthread_mutex_unlock(&heap_prof_lock);
+
+	if (!*num) {
+		free(recs);
+		return NULL;
+	}
+
+	return recs;
+}
+
+/*!
+ * \brief Estimate the real figure from a sampled one
+ *
+ * An allocation of len bytes is sampled with probability 1 - exp(-len / rate),
+ * so each one sampled stands for the inverse of that many.
+ */
+static double heap_prof_scale(uint64_t samples, uint64_t bytes, int rate)
+{
+	double avg;
+
+	if (!samples)
+		return 0.0;
+	avg = (double) bytes / samples;
+	return 1.0 / (1.0 - exp(-avg / rate));
+}
+
+struct heap_prof_site {
+	const char *file;
+	int lineno;
+	const char *func;
+	double live_objs;
+	double live_bytes;
+	double total_objs;
+	double total_bytes;
+};
+
+static int heap_prof_cmp(const void *a, const void *b)
+{
+	const struct heap_prof_site *sa = a, *sb = b;
+
+	if (sa->live_bytes != sb->live_bytes)
+		return sa->live_bytes < sb->live_bytes ? 1 : -1;
+	if (sa->total_bytes != sb->total_bytes)
+		return sa->total_bytes < sb->total_bytes ? 1 : -1;
+	return 0;
+}
+
+static int handle_show_heap_profile(int fd, int argc, char *argv[])
+{
+	struct heap_prof_record *recs, *rec;
+	struct heap_prof_site *sites, *site;
+	double scale, secs, live_bytes = 0.0, live_objs = 0.0;
+	unsigned int dropped = 0;
+	int max = 20, num, num_sites = 0, rate = 0, i, j;
+	struct timeval started;
+	char where[80];
+
+	if (argc > 5 || (argc == 5 && (sscanf(argv[4], "%d", &max) != 1 || max < 1)))
+		return RESULT_SHOWUSAGE;
+
+	if (ast_heap_sample_rate)
+		ast_cli(fd, "Heap profiling is on, sampling about 1 in every %d bytes allocated\n", ast_heap_sample_rate);
+	else
+		ast_cli(fd, "Heap profiling is off\n");
+#ifndef HEAP_PROF_FREE
+	ast_cli(fd, "Frees can't be seen on this platform, so nothing is shown as freed\n");
+#endif
+
+	if (!(recs = heap_prof_snapshot(&num, &dropped, &rate, &started)))
+		return RESULT_SUCCESS;
+	if (!(sites = calloc(num, sizeof(*sites)))) {
+		free(recs);
+		return RESULT_FAILURE;
+	}
+
+	/* The same place, reached by different stacks, is shown once */
+	for (i = 0; i < num; i++) {
+		rec = &recs[i];
+		for (j = 0; j < num_sites; j++) {
+			if (sites[j].lineno == rec->lineno && !strcmp(sites[j].file, rec->file) && !strcmp(sites[j].func, rec->func))
+				break;
+		}
+		site = &sites[j];
+		if (j == num_sites) {
+			site->file = rec->file;
+			site->lineno = rec->lineno;
+			site->func = rec->func;
+			num_sites++;
+		}
+		scale = heap_prof_scale(rec->live_samples, rec->live_bytes, rate);
+		site->live_objs += rec->live_samples * scale;
+		site->live_bytes += rec->live_bytes * scale;
+		scale = heap_prof_scale(rec->total_samples, rec->total_bytes, rate);
+		site->total_objs += rec->total_samples * scale;
+		site->total_bytes += rec->total_bytes * scale;
+	}
+	qsort(sites, num_sites, sizeof(*sites), heap_prof_cmp);
+
+	if ((secs = ast_tvdiff_ms(ast_tvnow(), started) / 1000.0) < 1.0)
+		secs = 1.0;
+	ast_cli(fd, "%10s %9s %12s %10s  %s\n", "Live(KB)", "Objects", "Alloc(KB/s)", "Allocs/s", "Where");
+	for (i = 0; i < num_sites; i++) {
+		site = &sites[i];
+		live_bytes += site->live_bytes;
+		live_objs += site->live_objs;
+		if (i >= max)
+			continue;
+		snprintf(where, sizeof(where), "%s:%d %s()", site->file, site->lineno, site->func);
+		ast_cli(fd, "%10.0f %9.0f %12.1f %10.1f  %s\n",
+			site->live_bytes / 1024, site->live_objs,
+			site->total_bytes / 1024 / secs, site->total_objs / secs, where);
+	}
+	ast_cli(fd, "About %.0f KB live in %.0f allocations, from %d places, over the last %.0f seconds",
+		live_bytes / 1024, live_objs, num_sites, secs);
+	if (dropped)
+		ast_cli(fd, " (%u samples lost for lack of room)", dropped);
+	ast_cli(fd, "\n");
+
+	free(sites);
+	free(recs);
+
+	return RESULT_SUCCESS;
+}
+
+static int handle_set_heap_profile(int fd, int argc, char *argv[])
+{
+	int rate = HEAP_PROF_DEFAULT_RATE;
+
+	if (argc < 5 || argc > 6)
+		return RESULT_SHOWUSAGE;
+
+	if (!strcasecmp(argv[4], "off")) {
+		ast_heap_sample_rate = 0;
+		ast_cli(fd, "Heap profiling stopped; what was sampled is still shown, and still tracked as it is freed\n");
+		return RESULT_SUCCESS;
+	}
+	if (strcasecmp(argv[4], "on") || (argc == 6 && (sscanf(argv[5], "%d", &rate) != 1 || rate < 1)))
+		return RESULT_SHOWUSAGE;
+
+	if (heap_prof_start(rate)) {
+		ast_cli(fd, "Unable to start heap profiling\n");
+		return RESULT_FAILURE;
+	}
+	ast_cli(fd, "Heap profiling started, sampling about 1 in every %d bytes allocated\n", rate);
+
+	return RESULT_SUCCESS;
+}
+
+/*!
+ * \brief Write the samples out as a heap profile that pprof reads
+ *
+ * This is the text format gperftools writes, with the counts as sampled;
+ * pprof scales them up itself, knowing the rate from the header.
+ */
+static int handle_dump_heap_profile(int fd, int argc, char *argv[])
+{
+	struct heap_prof_record *recs, *rec;
+	uint64_t live_samples = 0, live_bytes = 0, total_samples = 0, total_bytes = 0;
+	unsigned int dropped;
+	int num, rate, i, j;
+	struct timeval started;
+	char path[PATH_MAX], buf[1024];
+	FILE *out, *maps;
+	size_t len;
+
+	if (argc != 5)
+		return RESULT_SHOWUSAGE;
+
+	if (argv[4][0] == '/')
+		len = snprintf(path, sizeof(path), "%s", argv[4]);
+	else
+		len = snprintf(path, sizeof(path), "%s/%s", ast_config_AST_LOG_DIR, argv[4]);
+	if (len >= sizeof(path)) {
+		ast_cli(fd, "File name '%s' is too long\n", argv[4]);
+		return RESULT_FAILURE;
+	}
+
+	if (!(recs = heap_prof_snapshot(&num, &dropped, &rate, &started))) {
+		ast_cli(fd, "Nothing has been sampled\n");
+		return RESULT_SUCCESS;
+	}
+
+	if (!(out = fopen(path, "w"))) {
+		ast_cli(fd, "Unable to open '%s' for writing: %s\n", path, strerror(errno));
+		free(recs);
+		return RESULT_FAILURE;
+	}
+
+	for (i = 0; i < num; i++) {
+		live_samples += recs[i].live_samples;
+		live_bytes += recs[i].live_bytes;
+		total_samples += recs[i].total_samples;
+		total_bytes += recs[i].total_bytes;
+	}
+	fprintf(out, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%d\n",
+		(unsigned long long) live_samples, (unsigned long long) live_bytes,
+		(unsigned long long) total_samples, (unsigned long long) total_bytes, rate);
+	for (i = 0; i < num; i++) {
+		rec = &recs[i];
+		fprintf(out, "%llu: %llu [%llu: %llu] @",
+			(unsigned long long) rec->live_samples, (unsigned long long) rec->live_bytes,
+			(unsigned long long) rec->total_samples, (unsigned long long) rec->total_bytes);
+		for (j = 0; j < rec->depth; j++)
+			fprintf(out, " %p", rec->stack[j]);
+		fprintf(out, "\n");
+	}
+
+	/* So pprof can tell which addresses are in which module */
+	fprintf(out, "\nMAPPED_LIBRARIES:\n");
+	if ((maps = fopen("/proc/self/maps", "r"))) {
+		while ((len = fread(buf, 1, sizeof(buf), maps)) > 0)
+			fwrite(buf, 1, len, out);
+		fclose(maps);
+	}
+	fclose(out);
+	free(recs);
+
+	ast_cli(fd, "Heap profile of %d stacks written to '%s'\n", num, path);
+
+	return RESULT_SUCCESS;
+}
+
+static char show_heap_profile_help[] =
+"Usage: core show heap profile [<count>]\n"
+"       Shows the places in the source that the most memory allocated since\n"
+"heap profiling was started is still live from, with how fast each one\n"
+"allocates.  The figures are estimates from the allocations sampled.  Only\n"
+"the first <count> (default 20) are shown.\n";
+
+static char set_heap_profile_help[] =
+"Usage: core set heap profile {on [<bytes>]|off}\n"
+"       Starts (clearing anything found before) or stops heap profiling.\n"
+"About one allocation in every <bytes> (default 524288) allocated through\n"
+"ast_malloc() and friends is sampled; the fewer bytes, the sharper the\n"
+"picture and the higher the cost.\n";
+
+static char dump_heap_profile_help[] =
+"Usage: core dump heap profile <file>\n"
+"       Writes what heap profiling has sampled to <file> (in the log directory,\n"
+"unless the path is absolute), as a heap profile for pprof:\n"
+"           pprof --text /usr/sbin/asterisk <file>\n";
+
+static struct ast_cli_entry heap_prof_cli[] = {
+	{ { "core", "show", "heap", "profile", NULL }, handle_show_heap_profile,
+	  "Show where live memory was allocated", show_heap_profile_help },
+
+	{ { "core", "set", "heap", "profile", NULL }, handle_set_heap_profile,
+	  "Start or stop heap profiling", set_heap_profile_help },
+
+	{ { "core", "dump", "heap", "profile", NULL }, handle_dump_heap_profile,
+	  "Write a heap profile for pprof", dump_heap_profile_help },
+};
+
+int ast_heapprof_init(void)
+{
+	ast_cli_register_multiple(heap_prof_cli, sizeof(heap_prof_cli) / sizeof(heap_prof_cli[0]));
+
+	if (option_heapsample > 0 && heap_prof_start(option_heapsample))
+		ast_log(LOG_WARNING, "Unable to start heap profiling\n");
+
+	return 0;
+}
+
+#else /* __AST_DEBUG_MALLOC */
+
+/* astmm keeps every allocation already; the sampling profiler stays out of its way */
+int ast_heapprof_init(void)
+{
+	return 0;
+}
+
+#endif /* __AST_DEBUG_MALLOC */
@@ -39,6 +39,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 147386 $")
 #include <time.h>
 #include <string.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/time.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -47,6 +48,11 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 147386 $")
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#endif
 
 #include "asterisk/cli.h"
 #include "asterisk/http.h"
@@ -56,15 +62,40 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 147386 $")
 #include "asterisk/config.h"
 #include "asterisk/version.h"
 #include "asterisk/manager.h"
+#include "asterisk/threadstorage.h"
 
 #define MAX_PREFIX 80
 #define DEFAULT_PREFIX "/asterisk"
 
+/*! Room for a request's headers, and any requests pipelined after it */
+#define HTTP_BUF_LEN 8192
+#define DEFAULT_WORKERS 8
+#define DEFAULT_KEEPALIVE 15
+#define HTTP_MAX_CONNS 1024
+
+/*!
+ * \brief A connection from a browser
+ *
+ * The connections are all watched by one thread (http_root), which hands
+ * a connection with a request waiting on it to the next free worker
+ * thread.  The worker serves every complete request it has, then gives
+ * it back to be watched for the next one, unless it's to be closed.
+ */
 struct ast_http_server_instance {
-	FILE *f;
 	int fd;
 	struct sockaddr_in requestor;
-	ast_http_callback callback;
+	time_t lastactive;
+	unsigned int busy:1;	/*!< With a worker, so not being watched */
+	int len;		/*!< How much is in buf */
+	char buf[HTTP_BUF_LEN];
+	AST_LIST_ENTRY(ast_http_server_instance) list;
+	AST_LIST_ENTRY(ast_http_server_instance) work;
+};
+
+/*! \brief An open static file, to go out with sendfile() */
+struct http_file {
+	int fd;
+	struct stat st;
 };
 
 AST_RWLOCK_DEFINE_STATIC(uris_lock);
@@ -76,6 +107,31 @@ static char prefix[MAX_PREFIX];
 static int prefix_len;
 static struct sockaddr_in oldsin;
 static int enablestatic;
+static int keepalive = DEFAULT_KEEPALIVE;
+static int newworkers = DEFAULT_WORKERS;
+
+/*! All the connections, and those waiting for a worker, under conns_lock */
+AST_MUTEX_DEFINE_STATIC(conns_lock);
+static ast_cond_t work_cond;
+static AST_LIST_HEAD_NOLOCK_STATIC(conns, ast_http_server_instance);
+static AST_LIST_HEAD_NOLOCK_STATIC(work, ast_http_server_instance);
+static int nconns;
+static int nworkers;
+static int nblocked;	/*!< Workers in a blocking callback, which don't count against newworkers */
+
+/*! \brief Set in the worker threads, so ast_http_blocking() knows where it's called from */
+AST_THREADSTORAGE(http_worker_thread, http_worker_thread_init);
+#ifdef __linux__
+static int epfd = -1;
+#else
+static int wakepipe[2] = { -1, -1 };
+#endif
+
+/*! Statistics, under conns_lock too; service times in a histogram of powers of two microseconds */
+static unsigned int accepted;
+static unsigned int requests;
+static unsigned int notmodified;
+static unsigned int latency[32];
 
 /*! \brief Limit the kinds of files we're willing to serve up */
 static struct {
@@ -105,18 +161,19 @@ static const char *ftype2mtype(const char *ftype, char *wkspace, int wkspacelen)
 	return wkspace;
 }
 
-static char *static_callback(struct sockaddr_in *req, const char *uri, struct ast_variable *vars, int *status, char **title, int *contentlength)
+/*! \brief Open a file for the static URI, leaving sending it to the caller
+ *
+ * Returns the headers to send with the file, and the file in *file, or an
+ * error page.
+ */
+static char *static_open(const char *uri, int *status, char **title, struct http_file *file)
 {
-	char result[4096];
-	char *c=result;
 	char *path;
 	char *ftype;
 	const char *mtype;
 	char wkspace[80];
-	struct stat st;
+	char *c;
 	int len;
-	int fd;
-	void *blob;
 
 	/* Yuck.  I'm not really sold on this, but if you don't deliver static content it makes your configuration 
 	   substantially more challenging, but this seems like a rather irritating feature creep on Asterisk. */
@@ -139,30 +196,20 @@ static char *static_callback(struct sockaddr_in *req, const char *uri, struct as
 		
 	path = alloca(len);
 	sprintf(path, "%s/static-http/%s", ast_config_AST_DATA_DIR, uri);
-	if (stat(path, &st))
+	if (stat(path, &file->st))
 		goto out404;
-	if (S_ISDIR(st.st_mode))
+	if (S_ISDIR(file->st.st_mode))
 		goto out404;
-	fd = open(path, O_RDONLY);
-	if (fd < 0)
+	file->fd = open(path, O_RDONLY);
+	if (file->fd < 0)
 		goto out403;
-	
-	len = st.st_size + strlen(mtype) + 40;
-	
-	blob = malloc(len);
-	if (blob) {
-		c = blob;
-		sprintf(c, "Content-type: %s\r\n\r\n", mtype);
-		c += strlen(c);
-		*contentlength = read(fd, c, st.st_size);
-		if (*contentlength < 0) {
-			close(fd);
-			free(blob);
-			goto out403;
-		}
+
+	if (asprintf(&c, "Content-type: %s\r\n\r\n", mtype) < 0) {
+		close(file->fd);
+		file->fd = -1;
+		return NULL;
 	}
-	close(fd);
-	return blob;
+	return c;
 
 out404:
 	*status = 404;
@@ -220,8 +267,9 @@ static struct ast_http_uri statusuri = {
 	.has_subtree = 0,
 };
 	
+/*! Served by static_open(), as the file has to go out by itself */
 static struct ast_http_uri staticuri = {
-	.callback = static_callback,
+	.callback = NULL,
 	.description = "Asterisk HTTP Static Delivery",
 	.uri = "static",
 	.has_subtree = 1,
@@ -292,9 +340,42 @@ void ast_http_uri_unlink(struct ast_http_uri *urih)
 	ast_rwlock_unlock(&uris_lock);
 }
 
+static void *http_worker(void *data);
+
+/*!
+ * \brief Note a worker going into, or coming back from, a long wait
+ *
+ * A manager WaitEvent can sit in its callback until the session times out,
+ * so enough of them would leave nobody to serve anything else.  Another
+ * worker is started for each one, and the spare ones go as they come back.
+ */
+void ast_http_blocking(int start)
+{
+	pthread_t worker;
+	int *inworker = ast_threadstorage_get(&http_worker_thread, sizeof(*inworker));
+
+	/* Manager sessions over TCP have threads of their own */
+	if (!inworker || !*inworker)
+		return;
+
+	ast_mutex_lock(&conns_lock);
+	if (!start)
+		nblocked--;
+	else if (nworkers - ++nblocked < newworkers) {
+		if (ast_pthread_create_background(&worker, NULL, http_worker, NULL))
+			ast_log(LOG_WARNING, "Unable to launch http worker: %s\n", strerror(errno));
+		else
+			nworkers++;
+	}
+	ast_mutex_unlock(&conns_lock);
+	/* Wake an idle one to see if it's still needed */
+	if (!start)
+		ast_cond_signal(&work_cond);
+}
+
 static char *handle_uri(struct sockaddr_in *sin, char *uri, int *status, 
 	char **title, int *contentlength, struct ast_variable **cookies, 
-	unsigned int *static_content)
+	unsigned int *static_content, struct http_file *file)
 {
 	char *c;
 	char *turi;
@@ -363,7 +444,10 @@ static char *handle_uri(struct sockaddr_in *sin, char *uri, int *status,
 	if (urih) {
 		if (urih->static_content)
 			*static_content = 1;
-		c = urih->callback(sin, uri, vars, status, title, contentlength);
+		if (urih == &staticuri)
+			c = static_open(uri, status, title, file);
+		else
+			c = urih->callback(sin, uri, vars, status, title, contentlength);
 		ast_rwlock_unlock(&uris_lock);
 	} else if (ast_strlen_zero(uri) && ast_strlen_zero(prefix)) {
 		/* Special case: If no prefix, and no URI, send to /static/index.html */
@@ -416,120 +500,384 @@ static struct ast_variable *parse_cookies(char *cookies)
 	return vars;
 }
 
-static void *ast_httpd_helper_thread(void *data)
+/*! \brief Write it all, waiting for the socket as need be (up to its timeout) */
+static int http_writev(int fd, struct iovec *iov, int iovcnt)
 {
+	ssize_t res;
+
+	while (iovcnt) {
+		if ((res = writev(fd, iov, iovcnt)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		while (iovcnt && res >= iov->iov_len) {
+			res -= iov->iov_len;
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt) {
+			iov->iov_base = (char *) iov->iov_base + res;
+			iov->iov_len -= res;
+		}
+	}
+	return 0;
+}
+
+/*! \brief Send a static file, straight from the page cache where we can */
+static int http_sendfile(int fd, struct http_file *file)
+{
+	off_t offset = 0;
+	ssize_t res;
+#ifdef __linux__
+
+	while (offset < file->st.st_size) {
+		if ((res = sendfile(fd, file->fd, &offset, file->st.st_size - offset)) <= 0) {
+			if (res < 0 && errno == EINTR)
+				continue;
+			/* It's shrunk, or they've gone; either way we can't keep to the Content-length */
+			return -1;
+		}
+	}
+#else
 	char buf[4096];
-	char cookie[4096];
-	char timebuf[256];
-	struct ast_http_server_instance *ser = data;
+	struct iovec iov;
+
+	while (offset < file->st.st_size) {
+		if ((res = read(file->fd, buf, sizeof(buf))) <= 0)
+			return -1;
+		iov.iov_base = buf;
+		iov.iov_len = res;
+		if (http_writev(fd, &iov, 1))
+			return -1;
+		offset += res;
+	}
+#endif
+	return 0;
+}
+
+/*! \brief Where the request at the start of buf ends, if its headers have all arrived */
+static char *http_request_end(char *buf)
+{
+	char *c;
+
+	for (c = buf; (c = strchr(c, '\n')); c++) {
+		if (c[1] == '\n')
+			return c + 2;
+		if (c[1] == '\r' && c[2] == '\n')
+			return c + 3;
+	}
+	return NULL;
+}
+
+/*!
+ * \brief Answer one request
+ * \return non-zero if the connection may be kept for another
+ */
+static int http_request(struct ast_http_server_instance *ser, char *req)
+{
+	char timebuf[80];
+	char lastmod[80];
+	char etag[80];
+	char headers[512];
+	char *hdr = headers;
+	size_t hdrlen = sizeof(headers);
 	struct ast_variable *vars = NULL;
-	char *uri, *c, *title=NULL;
-	int status = 200, contentlength = 0;
+	struct http_file file = { .fd = -1 };
+	struct iovec iov[3];
+	struct timeval start = ast_tvnow(), d;
+	struct tm tm;
+	char *method, *uri, *version, *line, *c, *body, *title = NULL;
+	const char *inm = NULL, *ims = NULL;
+	int status = 200, contentlength = 0, keep, res, x;
+	unsigned int static_content = 0, us;
 	time_t t;
-	unsigned int static_content = 0;
-
-	if (fgets(buf, sizeof(buf), ser->f)) {
-		/* Skip method */
-		uri = buf;
-		while(*uri && (*uri > 32))
-			uri++;
-		if (*uri) {
-			*uri = '\0';
-			uri++;
+
+	/* The request line: method, URI and version */
+	method = uri = strsep(&req, "\n");
+	while(*uri && (*uri > 32))
+		uri++;
+	if (*uri) {
+		*uri = '\0';
+		uri++;
+	}
+	while (*uri && (*uri < 33))
+		uri++;
+	version = uri;
+	while (*version && (*version > 32))
+		version++;
+	if (*version) {
+		*version = '\0';
+		version++;
+	}
+	while (*version && (*version < 33))
+		version++;
+	for (c = version; *c > 32; c++);
+	*c = '\0';
+
+	/* HTTP/1.1 connections stay open unless asked not to, older ones only if asked to */
+	keep = keepalive && !strcasecmp(version, "HTTP/1.1");
+	while ((line = strsep(&req, "\n"))) {
+		/* Trim trailing characters */
+		while(!ast_strlen_zero(line) && (line[strlen(line) - 1] < 33)) {
+			line[strlen(line) - 1] = '\0';
 		}
+		if (ast_strlen_zero(line))
+			break;
+		if (!strncasecmp(line, "Cookie: ", 8)) {
+			if (vars)
+				ast_variables_destroy(vars);
+			vars = parse_cookies(line);
+		} else if (!strncasecmp(line, "Connection:", 11)) {
+			if (strcasestr(line + 11, "close"))
+				keep = 0;
+			else if (keepalive && strcasestr(line + 11, "keep-alive"))
+				keep = 1;
+		} else if (!strncasecmp(line, "If-None-Match:", 14))
+			inm = ast_skip_blanks(line + 14);
+		else if (!strncasecmp(line, "If-Modified-Since:", 18))
+			ims = ast_skip_blanks(line + 18);
+		else if (!strncasecmp(line, "Content-Length:", 15) || !strncasecmp(line, "Transfer-Encoding:", 18)) {
+			/* We've no use for a body, but would have to read it to get to the next request */
+			keep = 0;
+		}
+	}
 
-		/* Skip white space */
-		while (*uri && (*uri < 33))
-			uri++;
+	if (*uri) {
+		if (!strcasecmp(method, "get")) 
+			c = handle_uri(&ser->requestor, uri, &status, &title, &contentlength, &vars, &static_content, &file);
+		else 
+			c = ast_http_error(501, "Not Implemented", NULL, "Attempt to use unimplemented / unsupported method");
+	} else 
+		c = ast_http_error(400, "Bad Request", NULL, "Invalid Request");
+
+	/* If they aren't mopped up already, clean up the cookies */
+	if (vars)
+		ast_variables_destroy(vars);
+
+	if (!c)
+		c = ast_http_error(500, "Internal Error", NULL, "Internal Server Error");
+	if (!c) {
+		if (file.fd > -1)
+			close(file.fd);
+		if (title)
+			free(title);
+		return 0;
+	}
 
-		if (*uri) {
-			c = uri;
-			while (*c && (*c > 32))
-				 c++;
-			if (*c) {
-				*c = '\0';
-			}
+	if (file.fd > -1) {
+		snprintf(etag, sizeof(etag), "\"%lx-%lx-%lx\"", (unsigned long) file.st.st_ino,
+			(unsigned long) file.st.st_size, (unsigned long) file.st.st_mtime);
+		strftime(lastmod, sizeof(lastmod), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&file.st.st_mtime, &tm));
+		/* Browsers give back what we sent them, so there's no need to parse the dates */
+		if (inm ? !strcmp(inm, etag) : (ims && !strcmp(ims, lastmod))) {
+			status = 304;
+			close(file.fd);
+			file.fd = -1;
 		}
+	}
 
-		while (fgets(cookie, sizeof(cookie), ser->f)) {
-			/* Trim trailing characters */
-			while(!ast_strlen_zero(cookie) && (cookie[strlen(cookie) - 1] < 33)) {
-				cookie[strlen(cookie) - 1] = '\0';
-			}
-			if (ast_strlen_zero(cookie))
-				break;
-			if (!strncasecmp(cookie, "Cookie: ", 8)) {
-				vars = parse_cookies(cookie);
+	/* The callback's own headers, and what follows them */
+	iov[1].iov_base = c;
+	if (!strncmp(c, "\r\n", 2))
+		body = c + 2;
+	else if ((body = strstr(c, "\r\n\r\n")))
+		body += 4;
+	if (body) {
+		iov[1].iov_len = body - c;
+		if (status == 304)
+			contentlength = 0;
+		else if (!contentlength)
+			contentlength = strlen(body);
+		iov[2].iov_base = body;
+		iov[2].iov_len = contentlength;
+	} else {
+		/* No end to the headers, so only closing the connection will mark the end */
+		iov[1].iov_len = strlen(c);
+		iov[2].iov_len = 0;
+		keep = 0;
+	}
+
+	time(&t);
+	strftime(timebuf, sizeof(timebuf), "%a, %d %b %Y %H:%M:%S GMT", gmtime_r(&t, &tm));
+	ast_build_string(&hdr, &hdrlen, "HTTP/1.1 %d %s\r\n", status, title ? title : (status == 304 ? "Not Modified" : "OK"));
+	ast_build_string(&hdr, &hdrlen, "Server: Asterisk/%s\r\n", ASTERISK_VERSION);
+	ast_build_string(&hdr, &hdrlen, "Date: %s\r\n", timebuf);
+	if (!keep)
+		ast_build_string(&hdr, &hdrlen, "Connection: close\r\n");
+	else if (strcasecmp(version, "HTTP/1.1"))
+		ast_build_string(&hdr, &hdrlen, "Connection: Keep-Alive\r\n");
+	if (!static_content)
+		ast_build_string(&hdr, &hdrlen, "Cache-Control: no-cache, no-store\r\n");
+		/* We set the no-cache headers only for dynamic content.
+		* If you want to make sure the static file you requested is not from cache,
+		* append a random variable to your GET request.  Ex: 'something.html?r=109987734'
+		*/
+	if (file.fd > -1 || status == 304)
+		ast_build_string(&hdr, &hdrlen, "ETag: %s\r\nLast-Modified: %s\r\n", etag, lastmod);
+	if (file.fd > -1)
+		ast_build_string(&hdr, &hdrlen, "Content-length: %ld\r\n", (long) file.st.st_size);
+	else if (body && status != 304)
+		ast_build_string(&hdr, &hdrlen, "Content-length: %d\r\n", contentlength);
+	iov[0].iov_base = headers;
+	iov[0].iov_len = hdr - headers;
+
+	if (file.fd > -1) {
+#ifdef TCP_CORK
+		/* Headers and file in full packets, or the ACK delay costs 40ms a file */
+		x = 1;
+		setsockopt(ser->fd, IPPROTO_TCP, TCP_CORK, &x, sizeof(x));
+#endif
+		if (!(res = http_writev(ser->fd, iov, 3)))
+			res = http_sendfile(ser->fd, &file);
+#ifdef TCP_CORK
+		x = 0;
+		setsockopt(ser->fd, IPPROTO_TCP, TCP_CORK, &x, sizeof(x));
+#endif
+	} else
+		res = http_writev(ser->fd, iov, 3);
+
+	if (file.fd > -1)
+		close(file.fd);
+	free(c);
+	if (title)
+		free(title);
+
+	d = ast_tvsub(ast_tvnow(), start);
+	us = d.tv_sec * 1000000 + d.tv_usec;
+	for (x = 0; x < 31 && (us >> x); x++);
+	ast_mutex_lock(&conns_lock);
+	requests++;
+	if (status == 304)
+		notmodified++;
+	latency[x]++;
+	ast_mutex_unlock(&conns_lock);
+
+	return keep && !res;
+}
+
+/*! \brief Answer whatever has arrived on a connection.  Non-zero means close it. */
+static int http_serve(struct ast_http_server_instance *ser)
+{
+	char *end, saved;
+	int res;
+
+	if ((res = read(ser->fd, ser->buf + ser->len, sizeof(ser->buf) - 1 - ser->len)) <= 0)
+		return -1;
+	ser->len += res;
+	ser->buf[ser->len] = '\0';
+
+	/* Every request that's all there, in the order they came */
+	while ((end = http_request_end(ser->buf))) {
+		saved = *end;
+		*end = '\0';
+		res = http_request(ser, ser->buf);
+		*end = saved;
+		ser->len -= end - ser->buf;
+		memmove(ser->buf, end, ser->len + 1);
+		if (!res)
+			return -1;
+	}
+
+	/* A full buffer and still no end to the headers */
+	if (ser->len == sizeof(ser->buf) - 1)
+		return -1;
+
+	return 0;
+}
+
+/*! \brief Stop watching a connection and close it
+ * \note Don't call without conns_lock locked, and the connection already off the list */
+static void http_destroy(struct ast_http_server_instance *ser)
+{
+	nconns--;
+#ifdef __linux__
+	epoll_ctl(epfd, EPOLL_CTL_DEL, ser->fd, NULL);
+#endif
+	close(ser->fd);
+	free(ser);
+}
+
+/*! \brief Watch a connection for its next request
+ * \note Don't call without conns_lock locked */
+static int http_watch(struct ast_http_server_instance *ser, int add)
+{
+#ifdef __linux__
+	struct epoll_event ev;
+
+	ev.events = EPOLLIN | EPOLLONESHOT;
+	ev.data.ptr = ser;
+#endif
+	ser->busy = 0;
+	time(&ser->lastactive);
+#ifdef __linux__
+	return epoll_ctl(epfd, add ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, ser->fd, &ev);
+#else
+	/* Have http_root look at its list again */
+	write(wakepipe[1], "", 1);
+	return 0;
+#endif
+}
+
+static void *http_worker(void *data)
+{
+	struct ast_http_server_instance *ser;
+	int res, *inworker;
+
+	if ((inworker = ast_threadstorage_get(&http_worker_thread, sizeof(*inworker))))
+		*inworker = 1;
+
+	for (;;) {
+		ast_mutex_lock(&conns_lock);
+		while (!(ser = AST_LIST_REMOVE_HEAD(&work, work))) {
+			/* One too many now that a blocking callback has come back */
+			if (nworkers - nblocked > newworkers) {
+				nworkers--;
+				ast_mutex_unlock(&conns_lock);
+				return NULL;
 			}
+			ast_cond_wait(&work_cond, &conns_lock);
 		}
+		ast_mutex_unlock(&conns_lock);
 
-		if (*uri) {
-			if (!strcasecmp(buf, "get")) 
-				c = handle_uri(&ser->requestor, uri, &status, &title, &contentlength, &vars, &static_content);
-			else 
-				c = ast_http_error(501, "Not Implemented", NULL, "Attempt to use unimplemented / unsupported method");\
-		} else 
-			c = ast_http_error(400, "Bad Request", NULL, "Invalid Request");
-
-		/* If they aren't mopped up already, clean up the cookies */
-		if (vars)
-			ast_variables_destroy(vars);
-
-		if (!c)
-			c = ast_http_error(500, "Internal Error", NULL, "Internal Server Error");
-		if (c) {
-			time(&t);
-			strftime(timebuf, sizeof(timebuf), "%a, %d %b %Y %H:%M:%S GMT", gmtime(&t));
-			ast_cli(ser->fd, "HTTP/1.1 %d %s\r\n", status, title ? title : "OK");
-			ast_cli(ser->fd, "Server: Asterisk/%s\r\n", ASTERISK_VERSION);
-			ast_cli(ser->fd, "Date: %s\r\n", timebuf);
-			ast_cli(ser->fd, "Connection: close\r\n");
-			if (!static_content)
-				ast_cli(ser->fd, "Cache-Control: no-cache, no-store\r\n");
-				/* We set the no-cache headers only for dynamic content.
-				* If you want to make sure the static file you requested is not from cache,
-				* append a random variable to your GET request.  Ex: 'something.html?r=109987734'
-				*/
-
-			if (contentlength) {
-				char *tmp;
-				tmp = strstr(c, "\r\n\r\n");
-				if (tmp) {
-					ast_cli(ser->fd, "Content-length: %d\r\n", contentlength);
-					write(ser->fd, c, (tmp + 4 - c));
-					write(ser->fd, tmp + 4, contentlength);
-				}
-			} else
-				ast_cli(ser->fd, "%s", c);
-			free(c);
+		res = http_serve(ser);
+
+		ast_mutex_lock(&conns_lock);
+		if (res || httpfd < 0 || http_watch(ser, 0)) {
+			AST_LIST_REMOVE(&conns, ser, list);
+			http_destroy(ser);
 		}
-		if (title)
-			free(title);
+		ast_mutex_unlock(&conns_lock);
 	}
-	fclose(ser->f);
-	free(ser);
 	return NULL;
 }
 
-static void *http_root(void *data)
+/*! \brief Give a connection with a request on it to the next free worker */
+static void http_dispatch(struct ast_http_server_instance *ser)
+{
+	ast_mutex_lock(&conns_lock);
+	ser->busy = 1;
+	AST_LIST_INSERT_TAIL(&work, ser, work);
+	ast_cond_signal(&work_cond);
+	ast_mutex_unlock(&conns_lock);
+}
+
+static void http_accept(void)
 {
 	int fd;
+	int flags;
 	struct sockaddr_in sin;
 	socklen_t sinlen;
 	struct ast_http_server_instance *ser;
-	pthread_t launched;
-	pthread_attr_t attr;
-	
-	for (;;) {
-		int flags;
+	struct timeval tv = { .tv_sec = 30 };
 
-		ast_wait_for_input(httpfd, -1);
+	for (;;) {
 		sinlen = sizeof(sin);
 		fd = accept(httpfd, (struct sockaddr *)&sin, &sinlen);
 		if (fd < 0) {
-			if ((errno != EAGAIN) && (errno != EINTR))
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
 				ast_log(LOG_WARNING, "Accept failed: %s\n", strerror(errno));
-			continue;
+			return;
 		}
 		ser = ast_calloc(1, sizeof(*ser));
 		if (!ser) {
@@ -537,24 +885,117 @@ static void *http_root(void *data)
 			close(fd);
 			continue;
 		}
+		/* Workers block on their connection, but not forever */
 		flags = fcntl(fd, F_GETFL);
 		fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
 		ser->fd = fd;
 		memcpy(&ser->requestor, &sin, sizeof(ser->requestor));
-		if ((ser->f = fdopen(ser->fd, "w+"))) {
-			pthread_attr_init(&attr);
-			pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
-			
-			if (ast_pthread_create_background(&launched, &attr, ast_httpd_helper_thread, ser)) {
-				ast_log(LOG_WARNING, "Unable to launch helper thread: %s\n", strerror(errno));
-				fclose(ser->f);
-				free(ser);
-			}
-			pthread_attr_destroy(&attr);
-		} else {
-			ast_log(LOG_WARNING, "fdopen failed!\n");
-			close(ser->fd);
+
+		ast_mutex_lock(&conns_lock);
+		if (nconns >= HTTP_MAX_CONNS) {
+			ast_mutex_unlock(&conns_lock);
+			ast_log(LOG_WARNING, "Too many HTTP connections, dropping one from %s\n", ast_inet_ntoa(sin.sin_addr));
+			close(fd);
 			free(ser);
+			continue;
+		}
+		AST_LIST_INSERT_TAIL(&conns, ser, list);
+		nconns++;
+		accepted++;
+		if (http_watch(ser, 1)) {
+			AST_LIST_REMOVE(&conns, ser, list);
+			http_destroy(ser);
+		}
+		ast_mutex_unlock(&conns_lock);
+	}
+}
+
+/*! \brief Close connections that have waited too long for their next request */
+static void http_expire(time_t now, int all)
+{
+	struct ast_http_server_instance *ser;
+	int timeout = keepalive ? keepalive : DEFAULT_KEEPALIVE;
+
+	ast_mutex_lock(&conns_lock);
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&conns, ser, list) {
+		if (!ser->busy && (all || now - ser->lastactive > timeout)) {
+			AST_LIST_REMOVE_CURRENT(&conns, list);
+			http_destroy(ser);
+		}
+	}
+	AST_LIST_TRAVERSE_SAFE_END
+	ast_mutex_unlock(&conns_lock);
+}
+
+static void *http_root(void *data)
+{
+	time_t now, lastexpire = 0;
+	int res, x;
+#ifdef __linux__
+	struct epoll_event events[64];
+#else
+	struct pollfd *pfds = NULL;
+	struct ast_http_server_instance **sers = NULL, *ser;
+	int npfds = 0, n;
+	char buf[64];
+#endif
+
+	/* Only ever cancelled while waiting */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	for (;;) {
+#ifdef __linux__
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		res = epoll_wait(epfd, events, sizeof(events) / sizeof(events[0]), 1000);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		for (x = 0; x < res; x++) {
+			if (!events[x].data.ptr)
+				http_accept();
+			else
+				http_dispatch(events[x].data.ptr);
+		}
+#else
+		/* The listener, the wakeup pipe, then every connection not with a worker */
+		ast_mutex_lock(&conns_lock);
+		if (npfds < nconns + 2) {
+			npfds = nconns + 2;
+			pfds = ast_realloc(pfds, npfds * sizeof(*pfds));
+			sers = ast_realloc(sers, npfds * sizeof(*sers));
+		}
+		n = 0;
+		if (pfds && sers) {
+			pfds[n].fd = httpfd;
+			pfds[n++].events = POLLIN;
+			pfds[n].fd = wakepipe[0];
+			pfds[n++].events = POLLIN;
+			AST_LIST_TRAVERSE(&conns, ser, list) {
+				if (!ser->busy) {
+					sers[n] = ser;
+					pfds[n].fd = ser->fd;
+					pfds[n++].events = POLLIN;
+				}
+			}
+		}
+		ast_mutex_unlock(&conns_lock);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		res = poll(pfds, n, 1000);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		if (res > 0) {
+			if (pfds[1].revents)
+				read(wakepipe[0], buf, sizeof(buf));
+			for (x = 2; x < n; x++) {
+				if (pfds[x].revents)
+					http_dispatch(sers[x]);
+			}
+			if (pfds[0].revents)
+				http_accept();
+		}
+#endif
+		time(&now);
+		if (now != lastexpire) {
+			http_expire(now, 0);
+			lastexpire = now;
 		}
 	}
 	return NULL;
@@ -576,6 +1017,19 @@ static void http_server_start(struct sockaddr_in *sin)
 {
 	int flags;
 	int x = 1;
+	pthread_t worker;
+#ifdef __linux__
+	struct epoll_event ev;
+#endif
+
+	/* More workers can be had on reload, but not fewer */
+	while (sin->sin_family && nworkers < newworkers) {
+		if (ast_pthread_create_background(&worker, NULL, http_worker, NULL)) {
+			ast_log(LOG_WARNING, "Unable to launch http worker: %s\n", strerror(errno));
+			break;
+		}
+		nworkers++;
+	}
 	
 	/* Do nothing if nothing has changed */
 	if (!memcmp(&oldsin, sin, sizeof(oldsin))) {
@@ -592,12 +1046,25 @@ static void http_server_start(struct sockaddr_in *sin)
 		pthread_join(master, NULL);
 	}
 	
-	if (httpfd != -1)
+	if (httpfd != -1) {
 		close(httpfd);
+		httpfd = -1;
+	}
 
 	/* If there's no new server, stop here */
-	if (!sin->sin_family)
+	if (!sin->sin_family) {
+		http_expire(0, 1);
+		return;
+	}
+
+#ifdef __linux__
+	if (epfd < 0) {
+#else
+	if (wakepipe[0] < 0) {
+#endif
+		ast_log(LOG_WARNING, "Unable to start http server, no way to watch the connections\n");
 		return;
+	}
 	
 	
 	httpfd = socket(AF_INET, SOCK_STREAM, 0);
@@ -623,6 +1090,16 @@ static void http_server_start(struct sockaddr_in *sin)
 	}
 	flags = fcntl(httpfd, F_GETFL);
 	fcntl(httpfd, F_SETFL, flags | O_NONBLOCK);
+#ifdef __linux__
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(epfd, EPOLL_CTL_ADD, httpfd, &ev)) {
+		ast_log(LOG_WARNING, "Unable to watch http server socket: %s\n", strerror(errno));
+		close(httpfd);
+		httpfd = -1;
+		return;
+	}
+#endif
 	if (ast_pthread_create_background(&master, NULL, http_root, NULL)) {
 		ast_log(LOG_NOTICE, "Unable to launch http server on %s:%d: %s\n",
 				ast_inet_ntoa(sin->sin_addr), ntohs(sin->sin_port),
@@ -638,6 +1115,7 @@ static int __ast_http_load(int reload)
 	struct ast_variable *v;
 	int enabled=0;
 	int newenablestatic=0;
+	int newkeepalive = DEFAULT_KEEPALIVE;
 	struct sockaddr_in sin;
 	struct hostent *hp;
 	struct ast_hostent ahp;
@@ -648,6 +1126,7 @@ static int __ast_http_load(int reload)
 
 	strcpy(newprefix, DEFAULT_PREFIX);
 
+	newworkers = DEFAULT_WORKERS;
 	cfg = ast_config_load("http.conf");
 	if (cfg) {
 		v = ast_variable_browse(cfg, "general");
@@ -656,7 +1135,17 @@ static int __ast_http_load(int reload)
 				enabled = ast_true(v->value);
 			else if (!strcasecmp(v->name, "enablestatic"))
 				newenablestatic = ast_true(v->value);
-			else if (!strcasecmp(v->name, "bindport"))
+			else if (!strcasecmp(v->name, "keepalive")) {
+				if (sscanf(v->value, "%d", &newkeepalive) != 1 || newkeepalive < 0) {
+					ast_log(LOG_WARNING, "Invalid keepalive '%s' at line %d\n", v->value, v->lineno);
+					newkeepalive = DEFAULT_KEEPALIVE;
+				}
+			} else if (!strcasecmp(v->name, "workers")) {
+				if (sscanf(v->value, "%d", &newworkers) != 1 || newworkers < 1) {
+					ast_log(LOG_WARNING, "Invalid workers '%s' at line %d\n", v->value, v->lineno);
+					newworkers = DEFAULT_WORKERS;
+				}
+			} else if (!strcasecmp(v->name, "bindport"))
 				sin.sin_port = ntohs(atoi(v->value));
 			else if (!strcasecmp(v->name, "bindaddr")) {
 				if ((hp = ast_gethostbyname(v->value, &ahp))) {
@@ -684,6 +1173,7 @@ static int __ast_http_load(int reload)
 		prefix_len = strlen(prefix);
 	}
 	enablestatic = newenablestatic;
+	keepalive = newkeepalive;
 
 	http_server_start(&sin);
 
@@ -694,6 +1184,8 @@ static int __ast_http_load(int reload)
 static int handle_show_http(int fd, int argc, char *argv[])
 {
 	struct ast_http_uri *urih;
+	unsigned int total, n;
+	int x;
 
 	if (argc != 3)
 		return RESULT_SHOWUSAGE;
@@ -706,6 +1198,17 @@ static int handle_show_http(int fd, int argc, char *argv[])
 			ntohs(oldsin.sin_port));
 	else
 		ast_cli(fd, "Server Disabled\n\n");
+
+	ast_mutex_lock(&conns_lock);
+	for (x = 0, total = 0; x < 32; x++)
+		total += latency[x];
+	for (x = 0, n = 0; x < 31 && n + latency[x] < total - total / 100; x++)
+		n += latency[x];
+	ast_cli(fd, "Workers: %d (%d waiting for manager events), keepalive %d seconds\n", nworkers, nblocked, keepalive);
+	ast_cli(fd, "Connections: %d open, %u accepted\n", nconns, accepted);
+	ast_cli(fd, "Requests: %u served (%u not modified), 99%% in under %u us\n\n", requests, notmodified, 1U << x);
+	ast_mutex_unlock(&conns_lock);
+
 	ast_cli(fd, "Enabled URI's:\n");
 	ast_rwlock_rdlock(&uris_lock);
 	urih = uris;
@@ -737,6 +1240,19 @@ static struct ast_cli_entry cli_http[] = {
 
 int ast_http_init(void)
 {
+	ast_cond_init(&work_cond, NULL);
+#ifdef __linux__
+	if ((epfd = epoll_create(HTTP_MAX_CONNS)) < 0)
+		ast_log(LOG_WARNING, "Unable to create epoll fd: %s\n", strerror(errno));
+#else
+	if (pipe(wakepipe))
+		ast_log(LOG_WARNING, "Unable to create http wakeup pipe: %s\n", strerror(errno));
+	else {
+		fcntl(wakepipe[0], F_SETFL, fcntl(wakepipe[0], F_GETFL) | O_NONBLOCK);
+		fcntl(wakepipe[1], F_SETFL, fcntl(wakepipe[1], F_GETFL) | O_NONBLOCK);
+	}
+#endif
+
 	ast_http_uri_link(&statusuri);
 	ast_http_uri_link(&staticuri);
 	ast_cli_register_multiple(cli_http, sizeof(cli_http) / sizeof(struct ast_cli_entry));
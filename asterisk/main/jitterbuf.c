@@ -125,13 +125,132 @@ static int longcmp(const void *a, const void *b)
 
 /*!	\brief simple history manipulation 
  	\note maybe later we can make the history buckets variable size, or something? */
+
+/* The delays in the history are also kept in a treap, keyed on the delay
+ * (ties broken by slot) with a subtree size in each node, so history_get()
+ * can pick the n'th highest and lowest delay in O(log n) instead of
+ * sorting the history again whenever the extremes change.  Nodes are
+ * numbered slot + 1 and live in jb->hist_tree; 0 is the empty tree. */
+#define HIST_NODE(jb, n) (&(jb)->hist_tree[(n) - 1])
+#define HIST_SIZE(jb, n) ((n) ? HIST_NODE(jb, n)->size : 0)
+
+/* the heap priority of a node, a fixed hash of its slot */
+static unsigned int hist_prio(unsigned short n)
+{
+	return n * 2654435761U;
+}
+
+static int hist_less(jitterbuf *jb, unsigned short a, unsigned short b)
+{
+	long da = jb->history[a - 1], db = jb->history[b - 1];
+
+	return da < db || (da == db && a < b);
+}
+
+static void hist_update(jitterbuf *jb, unsigned short n)
+{
+	struct jb_hist_node *node = HIST_NODE(jb, n);
+
+	node->size = 1 + HIST_SIZE(jb, node->left) + HIST_SIZE(jb, node->right);
+}
+
+static unsigned short hist_insert(jitterbuf *jb, unsigned short t, unsigned short n)
+{
+	struct jb_hist_node *node;
+	unsigned short c;
+
+	if (!t) {
+		node = HIST_NODE(jb, n);
+		node->left = node->right = 0;
+		node->size = 1;
+		return n;
+	}
+	node = HIST_NODE(jb, t);
+	if (hist_less(jb, n, t)) {
+		node->left = hist_insert(jb, node->left, n);
+		if (hist_prio(node->left) > hist_prio(t)) {
+			/* rotate right */
+			c = node->left;
+			node->left = HIST_NODE(jb, c)->right;
+			HIST_NODE(jb, c)->right = t;
+			hist_update(jb, t);
+			hist_update(jb, c);
+			return c;
+		}
+	} else {
+		node->right = hist_insert(jb, node->right, n);
+		if (hist_prio(node->right) > hist_prio(t)) {
+			/* rotate left */
+			c = node->right;
+			node->right = HIST_NODE(jb, c)->left;
+			HIST_NODE(jb, c)->left = t;
+			hist_update(jb, t);
+			hist_update(jb, c);
+			return c;
+		}
+	}
+	node->size++;
+	return t;
+}
+
+static unsigned short hist_merge(jitterbuf *jb, unsigned short a, unsigned short b)
+{
+	if (!a)
+		return b;
+	if (!b)
+		return a;
+	if (hist_prio(a) > hist_prio(b)) {
+		HIST_NODE(jb, a)->right = hist_merge(jb, HIST_NODE(jb, a)->right, b);
+		hist_update(jb, a);
+		return a;
+	}
+	HIST_NODE(jb, b)->left = hist_merge(jb, a, HIST_NODE(jb, b)->left);
+	hist_update(jb, b);
+	return b;
+}
+
+/* n must be in the tree, with its delay not yet overwritten */
+static unsigned short hist_remove(jitterbuf *jb, unsigned short t, unsigned short n)
+{
+	struct jb_hist_node *node = HIST_NODE(jb, t);
+
+	if (t == n)
+		return hist_merge(jb, node->left, node->right);
+	if (hist_less(jb, n, t))
+		node->left = hist_remove(jb, node->left, n);
+	else
+		node->right = hist_remove(jb, node->right, n);
+	node->size--;
+	return t;
+}
+
+/* the k'th lowest delay in the history, counting from 0 */
+static long hist_select(jitterbuf *jb, int k)
+{
+	unsigned short t = jb->hist_root;
+	int left;
+
+	while (t) {
+		left = HIST_SIZE(jb, HIST_NODE(jb, t)->left);
+		if (k == left)
+			break;
+		if (k < left)
+			t = HIST_NODE(jb, t)->left;
+		else {
+			k -= left + 1;
+			t = HIST_NODE(jb, t)->right;
+		}
+	}
+	return t ? jb->history[t - 1] : 0;
+}
+
 /* drop parameter determines whether we will drop outliers to minimize
  * delay */
 static int history_put(jitterbuf *jb, long ts, long now, long ms) 
 {
 	long delay = now - (ts - jb->info.resync_offset);
 	long threshold = 2 * jb->info.jitter + jb->info.conf.resync_threshold;
-	long kicked;
+	int slot;
 
 	/* don't add special/negative times to history */
 	if (ts <= 0) 
@@ -145,7 +264,7 @@ static int history_put(jitterbuf *jb, long ts, long now, long ms)
 				/* resync the jitterbuffer */
 				jb->info.cnt_delay_discont = 0;
 				jb->hist_ptr = 0;
-				jb->hist_maxbuf_valid = 0;
+				jb->hist_root = 0;
 
 				jb_warn("Resyncing the jb. last_delay %ld, this delay %ld, threshold %ld, new offset %ld\n", jb->info.last_delay, delay, threshold, ts - now);
 				jb->info.resync_offset = ts - now;
@@ -159,124 +278,17 @@ static int history_put(jitterbuf *jb, long ts, long now, long ms)
 		}
 	}
 
-	kicked = jb->history[jb->hist_ptr % JB_HISTORY_SZ];
+	slot = jb->hist_ptr % JB_HISTORY_SZ;
 
-	jb->history[(jb->hist_ptr++) % JB_HISTORY_SZ] = delay;
-
-	/* optimization; the max/min buffers don't need to be recalculated, if this packet's
-	 * entry doesn't change them.  This happens if this packet is not involved, _and_ any packet
-	 * that got kicked out of the history is also not involved 
-	 * We do a number of comparisons, but it's probably still worthwhile, because it will usually
-	 * succeed, and should be a lot faster than going through all 500 packets in history */
-	if (!jb->hist_maxbuf_valid)
-		return 0;
+	/* kick out the delay this one replaces */
+	if (jb->hist_ptr >= JB_HISTORY_SZ)
+		jb->hist_root = hist_remove(jb, jb->hist_root, slot + 1);
 
-	/* don't do this until we've filled history 
-	 * (reduces some edge cases below) */
-	if (jb->hist_ptr < JB_HISTORY_SZ)
-		goto invalidate;
+	jb->history[slot] = delay;
+	jb->hist_ptr++;
+	jb->hist_root = hist_insert(jb, jb->hist_root, slot + 1);
 
-	/* if the new delay would go into min */
-	if (delay < jb->hist_minbuf[JB_HISTORY_MAXBUF_SZ-1])
-		goto invalidate;
-    
-	/* or max.. */
-	if (delay > jb->hist_maxbuf[JB_HISTORY_MAXBUF_SZ-1])
-		goto invalidate;
-
-	/* or the kicked delay would be in min */
-	if (kicked <= jb->hist_minbuf[JB_HISTORY_MAXBUF_SZ-1]) 
-		goto invalidate;
-
-	if (kicked >= jb->hist_maxbuf[JB_HISTORY_MAXBUF_SZ-1]) 
-		goto invalidate;
-
-	/* if we got here, we don't need to invalidate, 'cause this delay didn't 
-	 * affect things */
 	return 0;
-	/* end optimization */
-
-
-invalidate:
-	jb->hist_maxbuf_valid = 0;
-	return 0;
-}
-
-static void history_calc_maxbuf(jitterbuf *jb) 
-{
-	int i,j;
-
-	if (jb->hist_ptr == 0) 
-		return;
-
-
-	/* initialize maxbuf/minbuf to the latest value */
-	for (i=0;i<JB_HISTORY_MAXBUF_SZ;i++) {
-/*
- * jb->hist_maxbuf[i] = jb->history[(jb->hist_ptr-1) % JB_HISTORY_SZ];
- * jb->hist_minbuf[i] = jb->history[(jb->hist_ptr-1) % JB_HISTORY_SZ];
- */
-		jb->hist_maxbuf[i] = JB_LONGMIN;
-		jb->hist_minbuf[i] = JB_LONGMAX;
-	}
-
-	/* use insertion sort to populate maxbuf */
-	/* we want it to be the top "n" values, in order */
-
-	/* start at the beginning, or JB_HISTORY_SZ frames ago */
-	i = (jb->hist_ptr > JB_HISTORY_SZ) ? (jb->hist_ptr - JB_HISTORY_SZ) : 0; 
-
-	for (;i<jb->hist_ptr;i++) {
-		long toins = jb->history[i % JB_HISTORY_SZ];
-
-		/* if the maxbuf should get this */
-		if (toins > jb->hist_maxbuf[JB_HISTORY_MAXBUF_SZ-1])  {
-
-			/* insertion-sort it into the maxbuf */
-			for (j=0;j<JB_HISTORY_MAXBUF_SZ;j++) {
-				/* found where it fits */
-				if (toins > jb->hist_maxbuf[j]) {
-					/* move over */
-					memmove(jb->hist_maxbuf + j + 1, jb->hist_maxbuf + j, (JB_HISTORY_MAXBUF_SZ - (j + 1)) * sizeof(jb->hist_maxbuf[0]));
-					/* insert */
-					jb->hist_maxbuf[j] = toins;
-
-					break;
-				}
-			}
-		}
-
-		/* if the minbuf should get this */
-		if (toins < jb->hist_minbuf[JB_HISTORY_MAXBUF_SZ-1])  {
-
-			/* insertion-sort it into the maxbuf */
-			for (j=0;j<JB_HISTORY_MAXBUF_SZ;j++) {
-				/* found where it fits */
-				if (toins < jb->hist_minbuf[j]) {
-					/* move over */
-					memmove(jb->hist_minbuf + j + 1, jb->hist_minbuf + j, (JB_HISTORY_MAXBUF_SZ - (j + 1)) * sizeof(jb->hist_minbuf[0]));
-					/* insert */
-					jb->hist_minbuf[j] = toins;
-
-					break;
-				}
-			}
-		}
-
-		if (0) { 
-			int k;
-			fprintf(stderr, "toins = %ld\n", toins);
-			fprintf(stderr, "maxbuf =");
-			for (k=0;k<JB_HISTORY_MAXBUF_SZ;k++) 
-				fprintf(stderr, "%ld ", jb->hist_maxbuf[k]);
-			fprintf(stderr, "\nminbuf =");
-			for (k=0;k<JB_HISTORY_MAXBUF_SZ;k++) 
-				fprintf(stderr, "%ld ", jb->hist_minbuf[k]);
-			fprintf(stderr, "\n");
-		}
-	}
-
-	jb->hist_maxbuf_valid = 1;
 }
 
 static void history_get(jitterbuf *jb) 
@@ -285,9 +297,6 @@ static void history_get(jitterbuf *jb)
 	int index;
 	int count;
 
-	if (!jb->hist_maxbuf_valid) 
-		history_calc_maxbuf(jb);
-
 	/* count is how many items in history we're examining */
 	count = (jb->hist_ptr < JB_HISTORY_SZ) ? jb->hist_ptr : JB_HISTORY_SZ;
 
@@ -299,14 +308,14 @@ static void history_get(jitterbuf *jb)
 		index = JB_HISTORY_MAXBUF_SZ - 1;
 
 
-	if (index < 0) {
+	if (index < 0 || !count) {
 		jb->info.min = 0;
 		jb->info.jitter = 0;
 		return;
 	}
 
-	max = jb->hist_maxbuf[index];
-	min = jb->hist_minbuf[index];
+	max = hist_select(jb, count - 1 - index);
+	min = hist_select(jb, index);
 
 	jitter = max - min;
 
@@ -314,7 +323,7 @@ static void history_get(jitterbuf *jb)
 	 * values we get by throwing away the outliers */
 	/*
 	fprintf(stderr, "[%d] min=%d, max=%d, jitter=%d\n", index, min, max, jitter);
-	fprintf(stderr, "[%d] min=%d, max=%d, jitter=%d\n", 0, jb->hist_minbuf[0], jb->hist_maxbuf[0], jb->hist_maxbuf[0]-jb->hist_minbuf[0]);
+	fprintf(stderr, "[%d] min=%d, max=%d, jitter=%d\n", 0, hist_select(jb, 0), hist_select(jb, count - 1), hist_select(jb, count - 1) - hist_select(jb, 0));
 	*/
 
 	jb->info.min = min;
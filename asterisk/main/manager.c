@@ -50,6 +50,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 147386 $")
 #include <signal.h>
 #include <errno.h>
 #include <unistd.h>
+#include <sys/uio.h>
 
 #include "asterisk/channel.h"
 #include "asterisk/file.h"
@@ -91,6 +92,7 @@ struct fast_originate_helper {
 struct eventqent {
 	int usecount;
 	int category;
+	unsigned int seq;		/*!< Position in the event stream, used to measure session lag */
 	struct eventqent *next;
 	char eventdata[1];
 };
@@ -101,6 +103,7 @@ static int asock = -1;
 static int displayconnects = 1;
 static int timestampevents;
 static int httptimeout = 60;
+static int eventqmaxlag;
 
 static pthread_t t;
 static int block_sockets;
@@ -108,6 +111,11 @@ static int num_sessions;
 
 /* Protected by the sessions list lock */
 struct eventqent *master_eventq = NULL;
+static struct eventqent *master_eventq_tail = NULL;
+static unsigned int master_eventq_seq;
+
+/*! \brief Maximum number of queued events handed to a single writev() */
+#define MANAGER_EVENT_IOV	32
 
 AST_THREADSTORAGE(manager_event_buf, manager_event_buf_init);
 #define MANAGER_EVENT_BUF_INITSIZE   256
@@ -180,6 +188,8 @@ struct mansession {
 	/* Timeout for ast_carefulwrite() */
 	int writetimeout;
 	int pending_event;         /*!< Pending events indicator in case when waiting_thread is NULL */
+	/*! Events skipped because this session fell more than eventqmaxlag behind */
+	unsigned int dropped_events;
 	AST_LIST_ENTRY(mansession) list;
 };
 
@@ -626,13 +636,15 @@ static int handle_showmancmds(int fd, int argc, char *argv[])
 static int handle_showmanconn(int fd, int argc, char *argv[])
 {
 	struct mansession *s;
-	char *format = "  %-15.15s  %-15.15s\n";
+	char *format = "  %-15.15s  %-15.15s  %-8.8s  %-8.8s\n";
+	char *format2 = "  %-15.15s  %-15.15s  %-8u  %-8u\n";
 
-	ast_cli(fd, format, "Username", "IP Address");
+	ast_cli(fd, format, "Username", "IP Address", "Lag", "Dropped");
 	
 	AST_LIST_LOCK(&sessions);
 	AST_LIST_TRAVERSE(&sessions, s, list)
-		ast_cli(fd, format,s->username, ast_inet_ntoa(s->sin.sin_addr));
+		ast_cli(fd, format2, s->username, ast_inet_ntoa(s->sin.sin_addr),
+			s->eventq ? master_eventq_seq - s->eventq->seq : 0, s->dropped_events);
 	AST_LIST_UNLOCK(&sessions);
 
 	return RESULT_SUCCESS;
@@ -1305,6 +1317,7 @@ static int action_waitevent(struct mansession *s, const struct message *m)
 	s->waiting_thread = pthread_self();
 	if (option_debug)
 		ast_log(LOG_DEBUG, "Starting waiting for an event!\n");
+	ast_http_blocking(1);
 	for (x=0; ((x < timeout) || (timeout < 0)); x++) {
 		ast_mutex_lock(&s->__lock);
 		if (s->eventq && s->eventq->next)
@@ -1323,6 +1336,7 @@ static int action_waitevent(struct mansession *s, const struct message *m)
 			sleep(1);
 		}
 	}
+	ast_http_blocking(0);
 	if (option_debug)
 		ast_log(LOG_DEBUG, "Finished waiting for an event!\n");
 	ast_mutex_lock(&s->__lock);
@@ -2094,27 +2108,90 @@ static int action_timeout(struct mansession *s, const struct message *m)
 	return 0;
 }
 
-static int process_events(struct mansession *s)
+/*! \brief Send a batch of events with one writev(), finishing any short write with ast_carefulwrite() */
+static int send_eventv(struct mansession *s, struct iovec *iov, int iovcnt)
+{
+	ssize_t res;
+	int x;
+
+	res = writev(s->fd, iov, iovcnt);
+	if (res < 0) {
+		if ((errno != EAGAIN) && (errno != EINTR))
+			return -1;
+		res = 0;
+	}
+	for (x = 0; x < iovcnt; x++) {
+		if (res >= iov[x].iov_len) {
+			res -= iov[x].iov_len;
+			continue;
+		}
+		if (ast_carefulwrite(s->fd, (char *) iov[x].iov_base + res, iov[x].iov_len - res, s->writetimeout) < 0)
+			return -1;
+		res = 0;
+	}
+	return 0;
+}
+
+/*! \brief Skip a session past events it can no longer catch up on
+ * \note Don't call without the session lock */
+static void drop_lagging_events(struct mansession *s)
 {
 	struct eventqent *eqe;
+	unsigned int lag = master_eventq_seq - s->eventq->seq;
+	unsigned int maxlag = eventqmaxlag;
+	unsigned int dropped = 0;
+
+	if (lag <= maxlag)
+		return;
+	while (s->eventq->next && (lag-- > maxlag)) {
+		eqe = s->eventq;
+		s->eventq = eqe->next;
+		unuse_eventqent(eqe);
+		dropped++;
+	}
+	if (!s->dropped_events)
+		ast_log(LOG_NOTICE, "Manager session '%s' from %s is more than %d events behind, dropping events\n",
+			s->username, ast_inet_ntoa(s->sin.sin_addr), eventqmaxlag);
+	s->dropped_events += dropped;
+}
+
+static int process_events(struct mansession *s)
+{
+	struct eventqent *eqe, *last;
+	struct iovec iov[MANAGER_EVENT_IOV];
+	int iovcnt;
 	int ret = 0;
 	ast_mutex_lock(&s->__lock);
 	if (!s->eventq)
 		s->eventq = master_eventq;
-	while(s->eventq->next) {
-		eqe = s->eventq->next;
-		if ((s->authenticated && (s->readperm & eqe->category) == eqe->category) &&
-				   ((s->send_events & eqe->category) == eqe->category)) {
-			if (s->fd > -1) {
-				if (!ret && ast_carefulwrite(s->fd, eqe->eventdata, strlen(eqe->eventdata), s->writetimeout) < 0)
+	if (eventqmaxlag)
+		drop_lagging_events(s);
+	while (s->eventq->next) {
+		last = s->eventq;
+		iovcnt = 0;
+		while (last->next && (iovcnt < MANAGER_EVENT_IOV)) {
+			eqe = last->next;
+			if ((s->authenticated && (s->readperm & eqe->category) == eqe->category) &&
+					   ((s->send_events & eqe->category) == eqe->category)) {
+				if (s->fd > -1) {
+					iov[iovcnt].iov_base = eqe->eventdata;
+					iov[iovcnt].iov_len = strlen(eqe->eventdata);
+					iovcnt++;
+				} else if (!s->outputstr && !(s->outputstr = ast_calloc(1, sizeof(*s->outputstr)))) 
 					ret = -1;
-			} else if (!s->outputstr && !(s->outputstr = ast_calloc(1, sizeof(*s->outputstr)))) 
-				ret = -1;
-			else 
-				ast_dynamic_str_append(&s->outputstr, 0, "%s", eqe->eventdata);
+				else 
+					ast_dynamic_str_append(&s->outputstr, 0, "%s", eqe->eventdata);
+			}
+			last = eqe;
+		}
+		if (iovcnt && !ret && send_eventv(s, iov, iovcnt) < 0)
+			ret = -1;
+		/* Only release events once they are on the wire, the last user frees them */
+		while (s->eventq != last) {
+			eqe = s->eventq;
+			s->eventq = eqe->next;
+			unuse_eventqent(eqe);
 		}
-		unuse_eventqent(s->eventq);
-		s->eventq = eqe;
 	}
 	ast_mutex_unlock(&s->__lock);
 	return ret;
@@ -2441,9 +2518,7 @@ static void *accept_thread(void *ignore)
 		num_sessions++;
 		/* Find the last place in the master event queue and hook ourselves
 		   in there */
-		s->eventq = master_eventq;
-		while(s->eventq->next)
-			s->eventq = s->eventq->next;
+		s->eventq = master_eventq_tail;
 		ast_atomic_fetchadd_int(&s->eventq->usecount, 1);
 		AST_LIST_UNLOCK(&sessions);
 		if (ast_pthread_create_background(&s->t, &attr, session_do, s))
@@ -2453,9 +2528,10 @@ static void *accept_thread(void *ignore)
 	return NULL;
 }
 
+/*! \note Don't call without the sessions list lock */
 static int append_event(const char *str, int category)
 {
-	struct eventqent *tmp, *prev = NULL;
+	struct eventqent *tmp;
 	tmp = ast_malloc(sizeof(*tmp) + strlen(str));
 
 	if (!tmp)
@@ -2463,16 +2539,14 @@ static int append_event(const char *str, int category)
 
 	tmp->next = NULL;
 	tmp->category = category;
+	tmp->seq = ++master_eventq_seq;
 	strcpy(tmp->eventdata, str);
 	
-	if (master_eventq) {
-		prev = master_eventq;
-		while (prev->next) 
-			prev = prev->next;
-		prev->next = tmp;
-	} else {
+	if (master_eventq_tail)
+		master_eventq_tail->next = tmp;
+	else
 		master_eventq = tmp;
-	}
+	master_eventq_tail = tmp;
 	
 	tmp->usecount = num_sessions;
 	
@@ -2732,9 +2806,7 @@ static char *generic_http_callback(int format, struct sockaddr_in *requestor, co
 		AST_LIST_LOCK(&sessions);
 		AST_LIST_INSERT_HEAD(&sessions, s, list);
 		/* Hook into the last spot in the event queue */
-		s->eventq = master_eventq;
-		while (s->eventq->next)
-			s->eventq = s->eventq->next;
+		s->eventq = master_eventq_tail;
 		ast_atomic_fetchadd_int(&s->eventq->usecount, 1);
 		ast_atomic_fetchadd_int(&num_sessions, 1);
 		AST_LIST_UNLOCK(&sessions);
@@ -2960,6 +3032,14 @@ int init_manager(void)
 	if ((val = ast_variable_retrieve(cfg, "general", "httptimeout")))
 		newhttptimeout = atoi(val);
 
+	eventqmaxlag = 0;
+	if ((val = ast_variable_retrieve(cfg, "general", "eventqmaxlag"))) {
+		if ((sscanf(val, "%d", &eventqmaxlag) != 1) || (eventqmaxlag < 0)) {
+			ast_log(LOG_WARNING, "Invalid eventqmaxlag '%s', not limiting event queue lag\n", val);
+			eventqmaxlag = 0;
+		}
+	}
+
 	memset(&ba, 0, sizeof(ba));
 	ba.sin_family = AF_INET;
 	ba.sin_port = htons(portno);
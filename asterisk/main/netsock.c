@@ -74,6 +74,7 @@ struct ast_netsock {
 struct ast_netsock_list {
 	ASTOBJ_CONTAINER_COMPONENTS(struct ast_netsock);
 	struct io_context *ioc;
+	int reuseport;
 };
 
 static void ast_netsock_destroy(struct ast_netsock *netsock)
@@ -96,6 +97,16 @@ int ast_netsock_init(struct ast_netsock_list *list)
 	return 0;
 }
 
+int ast_netsock_set_reuseport(struct ast_netsock_list *list, int reuseport)
+{
+#ifdef SO_REUSEPORT
+	list->reuseport = reuseport;
+	return 0;
+#else
+	return reuseport ? -1 : 0;
+#endif
+}
+
 int ast_netsock_release(struct ast_netsock_list *list)
 {
 	ASTOBJ_CONTAINER_DESTROYALL(list, ast_netsock_destroy);
@@ -137,6 +148,13 @@ struct ast_netsock *ast_netsock_bindaddr(struct ast_netsock_list *list, struct i
 	if (setsockopt(netsocket, SOL_SOCKET, SO_REUSEADDR, (char *)&reuseFlag, sizeof reuseFlag) < 0) {
 			ast_log(LOG_WARNING, "Error setting SO_REUSEADDR on sockfd '%d'\n", netsocket);
 	}
+#ifdef SO_REUSEPORT
+	/* Several sockets bound to the same address let the kernel spread
+	   incoming datagrams across reader threads, keyed on the sender */
+	if (list->reuseport && setsockopt(netsocket, SOL_SOCKET, SO_REUSEPORT, (char *)&reuseFlag, sizeof reuseFlag) < 0) {
+			ast_log(LOG_WARNING, "Error setting SO_REUSEPORT on sockfd '%d'\n", netsocket);
+	}
+#endif
 	if (bind(netsocket,(struct sockaddr *)bindaddr, sizeof(struct sockaddr_in))) {
 		ast_log(LOG_ERROR, "Unable to bind to %s port %d: %s\n", ast_inet_ntoa(bindaddr->sin_addr), ntohs(bindaddr->sin_port), strerror(errno));
 		close(netsocket);
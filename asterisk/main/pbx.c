@@ -107,6 +107,9 @@ AST_APP_OPTIONS(waitexten_opts, {
 struct ast_context;
 
 AST_THREADSTORAGE(switch_data, switch_data_init);
+AST_THREADSTORAGE(match_cands, match_cands_init);
+
+struct match_node;
 
 /*!
    \brief ast_exten: An extension
@@ -127,6 +130,10 @@ struct ast_exten {
 	struct ast_exten *peer;		/*!< Next higher priority with our extension */
 	const char *registrar;		/*!< Registrar */
 	struct ast_exten *next;		/*!< Extension with a greater ID */
+	int seq;			/*!< Position in the context, kept on the first priority only */
+	struct match_node *tree_node;	/*!< Match tree node we hang off, NULL on tree_misc */
+	struct ast_exten **tree_list;	/*!< Match tree list holding us, NULL if not the first priority */
+	struct ast_exten *tree_next;	/*!< Next extension in that list */
 	char stuff[0];
 };
 
@@ -168,6 +175,10 @@ struct ast_context {
 	const char *registrar;			/*!< Registrar */
 	AST_LIST_HEAD_NOLOCK(, ast_sw) alts;	/*!< Alternative switches */
 	ast_mutex_t macrolock;			/*!< A lock to implement "exclusive" macros - held whilst a call is executing in the macro */
+	struct match_node *lit_tree;		/*!< Match tree of the plain extensions */
+	struct match_node *pat_tree;		/*!< Match tree of the patterns */
+	struct ast_exten *tree_misc;		/*!< Patterns the match tree can't hold */
+	int tree_nodes;				/*!< Nodes in both match trees */
 	char name[0];				/*!< Name of the context */
 };
 
@@ -880,6 +891,440 @@ static int extension_match_core(const char *pattern, const char *data, enum ext_
 	return i;
 }
 
+/*!
+ * \brief Match trees.
+ *
+ * Each context keeps its extensions in two tries, so pbx_find_extension()
+ * does not have to run extension_match_core() on every extension.
+ * Plain extensions are in lit_tree, keyed on lowercased characters, since
+ * partial matches on them are case insensitive (exact ones are confirmed
+ * with strcmp()). Patterns are in pat_tree, where an edge is a literal
+ * character or a set of characters (N, X, Z and [...] are all sets).
+ * The first priority of an extension hangs off the node where its name
+ * ends, on the ends, dots or bangs list according to what follows: the
+ * end of the pattern, '.' or '!'. Patterns the tree can't represent
+ * exactly go on tree_misc and are matched the old way.
+ *
+ * A lookup walks the trees once over the dialed string and returns the
+ * candidates with their extension_match_core() result. Sorting them on
+ * seq restores the order of the extension list, so the first suitable
+ * candidate is the one the linear scan would have found.
+ */
+struct match_edge;
+
+struct match_node {
+	struct match_edge *edges;	/*!< Children */
+	struct match_node *parent;
+	struct ast_exten *ends;		/*!< Extensions ending here */
+	struct ast_exten *dots;		/*!< Patterns continuing with '.' */
+	struct ast_exten *bangs;	/*!< Patterns continuing with '!' */
+	int count;			/*!< Extensions at or below this node */
+};
+
+struct match_edge {
+	struct match_edge *next;
+	struct match_node *node;
+	int c;				/*!< Literal character, or -1 for a set */
+	uint32_t set[8];		/*!< Characters accepted by a set */
+};
+
+struct match_candidate {
+	struct ast_exten *e;
+	int match;			/*!< What extension_match_core() would return */
+};
+
+#define MATCH_MAX_CANDIDATES	64	/*!< More than this and we scan the list instead */
+#define MATCH_MAX_ACTIVE	128	/*!< Pattern nodes followed at once */
+#define EXTEN_SEQ_GAP		1024
+
+static int tree_lookups;		/*!< Lookups answered from the match trees */
+static int tree_fallbacks;		/*!< Lookups that had to scan the extension list */
+
+/*! \brief Parse one element of a pattern into the set of characters it accepts,
+ *	testing them the way _extension_match_core() does.
+ * \return the length of the element, -1 if it can't go in the tree */
+static int pattern_element(const char *p, uint32_t *set, int *c)
+{
+	const char *end, *q;
+	int v;
+
+	memset(set, 0, 8 * sizeof(*set));
+	*c = -1;
+	switch (toupper(*p)) {
+	case 'N':
+		for (v = '2'; v <= '9'; v++)
+			set[v >> 5] |= 1 << (v & 31);
+		return 1;
+	case 'X':
+		for (v = '0'; v <= '9'; v++)
+			set[v >> 5] |= 1 << (v & 31);
+		return 1;
+	case 'Z':
+		for (v = '1'; v <= '9'; v++)
+			set[v >> 5] |= 1 << (v & 31);
+		return 1;
+	case '[':
+		if (!(end = strchr(p + 1, ']')))
+			return -1;
+		for (q = p + 1; q != end; q++) {
+			int range = (q + 2 < end && q[1] == '-');
+
+			for (v = 0; v < 256; v++) {
+				char ch = v;
+
+				if (range ? (ch >= q[0] && ch <= q[2]) : ch == q[0])
+					set[v >> 5] |= 1 << (v & 31);
+			}
+			if (range)
+				q += 2;
+		}
+		return end - p + 1;
+	default:
+		*c = (unsigned char) *p;
+		return 1;
+	}
+}
+
+/*! \brief Find or add the child reached through an edge
+ * \note Don't call without con->lock locked */
+static struct match_node *match_child(struct ast_context *con, struct match_node *node, int c, const uint32_t *set)
+{
+	struct match_edge *edge;
+
+	for (edge = node->edges; edge; edge = edge->next) {
+		if (edge->c == c && (c > -1 || !memcmp(edge->set, set, sizeof(edge->set))))
+			return edge->node;
+	}
+	if (!(edge = ast_calloc(1, sizeof(*edge))))
+		return NULL;
+	if (!(edge->node = ast_calloc(1, sizeof(*edge->node)))) {
+		free(edge);
+		return NULL;
+	}
+	edge->c = c;
+	if (c < 0)
+		memcpy(edge->set, set, sizeof(edge->set));
+	edge->node->parent = node;
+	edge->next = node->edges;
+	node->edges = edge;
+	con->tree_nodes++;
+	return edge->node;
+}
+
+/*! \brief Free the empty nodes from node up towards the root
+ * \note Don't call without con->lock locked */
+static void match_prune(struct ast_context *con, struct match_node *node)
+{
+	struct match_node *parent;
+	struct match_edge **pe, *edge;
+
+	while ((parent = node->parent) && !node->count && !node->edges) {
+		for (pe = &parent->edges; *pe && (*pe)->node != node; pe = &(*pe)->next)
+			;
+		if ((edge = *pe)) {
+			*pe = edge->next;
+			free(edge);
+		}
+		free(node);
+		con->tree_nodes--;
+		node = parent;
+	}
+}
+
+static void match_free(struct match_node *node)
+{
+	struct match_edge *edge;
+
+	if (!node)
+		return;
+	while ((edge = node->edges)) {
+		node->edges = edge->next;
+		match_free(edge->node);
+		free(edge);
+	}
+	free(node);
+}
+
+/*! \brief Get the root of a match tree, creating it if needed */
+static struct match_node *match_root(struct ast_context *con, struct match_node **root)
+{
+	if (!*root && (*root = ast_calloc(1, sizeof(**root))))
+		con->tree_nodes++;
+	return *root;
+}
+
+/*! \brief Add the first priority of a new extension to the match trees
+ * \note Don't call without con->lock locked */
+static void match_tree_add(struct ast_context *con, struct ast_exten *e)
+{
+	const char *p = e->exten, *q;
+	struct match_node *node;
+	struct ast_exten **list = NULL;
+	uint32_t set[8];
+	int c, len;
+
+	if (*p != '_') {
+		for (node = match_root(con, &con->lit_tree); node && *p; p++)
+			node = match_child(con, node, tolower((unsigned char) *p), set);
+		if (node)
+			list = &node->ends;
+	} else {
+		for (p++, node = match_root(con, &con->pat_tree); node && !list; ) {
+			if (*p == ' ' || *p == '-') {
+				/* Separators are skipped while there is data left, but data
+				   ending on one is a partial match, not an exact one */
+				for (q = p; *q == ' ' || *q == '-'; q++)
+					;
+				if (!*q || *q == '/' || *q == '!')
+					break;
+				p = q;
+			} else if (!*p || *p == '/')
+				list = &node->ends;
+			else if (*p == '.')
+				list = &node->dots;
+			else if (*p == '!')
+				list = &node->bangs;
+			else if ((len = pattern_element(p, set, &c)) < 0)
+				break;
+			else {
+				node = match_child(con, node, c, set);
+				p += len;
+			}
+		}
+	}
+	if (!list) {
+		if (node)
+			match_prune(con, node);
+		node = NULL;
+		list = &con->tree_misc;
+	}
+	e->tree_node = node;
+	e->tree_list = list;
+	e->tree_next = *list;
+	*list = e;
+	for (; node; node = node->parent)
+		node->count++;
+}
+
+/*! \brief Remove the first priority of an extension that is going away
+ * \note Don't call without con->lock locked */
+static void match_tree_remove(struct ast_context *con, struct ast_exten *e)
+{
+	struct ast_exten **pe;
+	struct match_node *node;
+
+	if (!e->tree_list)
+		return;
+	for (pe = e->tree_list; *pe; pe = &(*pe)->tree_next) {
+		if (*pe == e) {
+			*pe = e->tree_next;
+			break;
+		}
+	}
+	for (node = e->tree_node; node; node = node->parent)
+		node->count--;
+	if (e->tree_node)
+		match_prune(con, e->tree_node);
+	e->tree_list = NULL;
+	e->tree_node = NULL;
+}
+
+/*! \brief Let another priority take over as the first priority of an extension
+ * \note Don't call without con->lock locked */
+static void match_tree_replace(struct ast_exten *old, struct ast_exten *new)
+{
+	struct ast_exten **pe;
+
+	new->seq = old->seq;
+	new->tree_node = old->tree_node;
+	new->tree_list = old->tree_list;
+	if (!old->tree_list)
+		return;
+	for (pe = old->tree_list; *pe; pe = &(*pe)->tree_next) {
+		if (*pe == old) {
+			new->tree_next = old->tree_next;
+			*pe = new;
+			break;
+		}
+	}
+	old->tree_list = NULL;
+	old->tree_node = NULL;
+}
+
+/*! \brief Number a new extension between its neighbours in the list,
+ *	renumbering the whole context when there is no room left
+ * \note Don't call without con->lock locked */
+static void exten_set_seq(struct ast_context *con, struct ast_exten *el, struct ast_exten *e)
+{
+	int lo = el ? el->seq : 0, seq = 0;
+
+	if (!e->next && lo < INT_MAX - EXTEN_SEQ_GAP)
+		e->seq = lo + EXTEN_SEQ_GAP;
+	else if (e->next && e->next->seq - lo > 1)
+		e->seq = lo + (e->next->seq - lo) / 2;
+	else {
+		for (e = con->root; e; e = e->next)
+			e->seq = (seq += EXTEN_SEQ_GAP);
+	}
+}
+
+static int match_add(struct ast_exten *e, int match, struct match_candidate *cands, int *n)
+{
+	if (*n == MATCH_MAX_CANDIDATES)
+		return -1;
+	cands[*n].e = e;
+	cands[(*n)++].match = match;
+	return 0;
+}
+
+static int match_add_list(struct ast_exten *e, int match, struct match_candidate *cands, int *n)
+{
+	for (; e; e = e->tree_next) {
+		if (match_add(e, match, cands, n))
+			return -1;
+	}
+	return 0;
+}
+
+/*! \brief Add everything at or below a node as a partial match */
+static int match_add_subtree(struct match_node *node, struct match_candidate *cands, int *n)
+{
+	struct match_edge *edge;
+
+	if (*n + node->count > MATCH_MAX_CANDIDATES)
+		return -1;
+	match_add_list(node->ends, 1, cands, n);
+	match_add_list(node->dots, 1, cands, n);
+	match_add_list(node->bangs, 1, cands, n);
+	for (edge = node->edges; edge; edge = edge->next)
+		match_add_subtree(edge->node, cands, n);
+	return 0;
+}
+
+static int match_edge_accepts(const struct match_edge *edge, const char *d)
+{
+	unsigned char v = *d;
+
+	if (edge->c > -1)
+		return edge->c == v;
+	return (edge->set[v >> 5] >> (v & 31)) & 1;
+}
+
+/*! \brief Collect the plain extensions matching exten
+ * \note Don't call without con->lock locked */
+static int match_literal(struct ast_context *con, const char *exten, int mode, struct match_candidate *cands, int *n)
+{
+	struct match_node *node = con->lit_tree;
+	struct match_edge *edge;
+	struct ast_exten *e;
+	const char *d;
+
+	for (d = exten; node && *d; d++) {
+		int c = tolower((unsigned char) *d);
+
+		for (edge = node->edges; edge && edge->c != c; edge = edge->next)
+			;
+		node = edge ? edge->node : NULL;
+	}
+	if (!node)
+		return 0;
+	if (mode == E_MATCH) {
+		for (e = node->ends; e; e = e->tree_next) {
+			if (!strcmp(e->exten, exten) && match_add(e, 1, cands, n))
+				return -1;
+		}
+		return 0;
+	}
+	if (mode == E_CANMATCH && match_add_list(node->ends, 1, cands, n))
+		return -1;
+	for (edge = node->edges; edge; edge = edge->next) {
+		if (match_add_subtree(edge->node, cands, n))
+			return -1;
+	}
+	return 0;
+}
+
+/*! \brief Find the extensions of a context that match exten, in list order
+ * \return the number of candidates, or -1 if the caller has to scan the list */
+static int match_tree_lookup(struct ast_context *con, const char *exten, enum ext_match_t action, struct match_candidate *cands)
+{
+	struct match_node *active[MATCH_MAX_ACTIVE], *next[MATCH_MAX_ACTIVE], *node;
+	struct match_edge *edge;
+	struct match_candidate tmp;
+	struct ast_exten *e;
+	const char *d = exten, *d2;
+	int mode = action & E_MATCH_MASK, n = 0, nactive = 0, nnext, x, y, res = 0;
+
+	/* _extension_match_core() also lets a pattern match its own name */
+	if (mode == E_MATCH && exten[0] == '_') {
+		ast_atomic_fetchadd_int(&tree_fallbacks, 1);
+		return -1;
+	}
+
+	ast_mutex_lock(&con->lock);
+	if (con->lit_tree)
+		res = match_literal(con, exten, mode, cands, &n);
+	if (con->pat_tree)
+		active[nactive++] = con->pat_tree;
+	while (!res && nactive) {
+		for (d2 = d; *d2 == '-'; d2++)	/* '-' in the data is a separator */
+			;
+		if (!*d2) {
+			/* Out of data. A pattern ending here is only an exact
+			   match if no separator was left over in the data. */
+			for (x = 0; !res && x < nactive; x++) {
+				node = active[x];
+				if (!*d && mode != E_MATCHMORE)
+					res = match_add_list(node->ends, 1, cands, &n);
+				if (!res)
+					res = match_add_list(node->bangs, 2, cands, &n);
+				if (!res && mode != E_MATCH) {
+					res = match_add_list(node->dots, 1, cands, &n);
+					for (edge = node->edges; !res && edge; edge = edge->next)
+						res = match_add_subtree(edge->node, cands, &n);
+				}
+			}
+			break;
+		}
+		for (x = 0, nnext = 0; !res && x < nactive; x++) {
+			node = active[x];
+			res = match_add_list(node->dots, 1, cands, &n);
+			if (!res)
+				res = match_add_list(node->bangs, 2, cands, &n);
+			for (edge = node->edges; !res && edge; edge = edge->next) {
+				if (!match_edge_accepts(edge, d2))
+					continue;
+				if (nnext == MATCH_MAX_ACTIVE)
+					res = -1;
+				else
+					next[nnext++] = edge->node;
+			}
+		}
+		memcpy(active, next, nnext * sizeof(*active));
+		nactive = nnext;
+		d = d2 + 1;
+	}
+	for (e = con->tree_misc; !res && e; e = e->tree_next) {
+		if ((x = extension_match_core(e->exten, exten, action)))
+			res = match_add(e, x, cands, &n);
+	}
+	ast_mutex_unlock(&con->lock);
+
+	if (res) {
+		ast_atomic_fetchadd_int(&tree_fallbacks, 1);
+		return -1;
+	}
+	ast_atomic_fetchadd_int(&tree_lookups, 1);
+	/* Back to the order of the extension list */
+	for (x = 1; x < n; x++) {
+		tmp = cands[x];
+		for (y = x; y > 0 && cands[y - 1].e->seq > tmp.e->seq; y--)
+			cands[y] = cands[y - 1];
+		cands[y] = tmp;
+	}
+	return n;
+}
+
 int ast_extension_match(const char *pattern, const char *data)
 {
 	return extension_match_core(pattern, data, E_MATCH);
@@ -951,6 +1396,8 @@ static struct ast_exten *pbx_find_extension(struct ast_channel *chan,
 	struct ast_exten *e, *eroot;
 	struct ast_include *i;
 	struct ast_sw *sw;
+	struct match_candidate *cands;
+	int ncands = -1, cand = 0;
 	char *tmpdata = NULL;
 
 	/* Initialize status if appropriate */
@@ -984,12 +1431,22 @@ static struct ast_exten *pbx_find_extension(struct ast_channel *chan,
 	if (q->status < STATUS_NO_EXTENSION)
 		q->status = STATUS_NO_EXTENSION;
 
-	/* scan the list trying to match extension and CID */
+	/* get the matching extensions from the match trees, or failing that
+	   scan the list trying to match extension and CID */
+	if ((cands = ast_threadstorage_get(&match_cands, MATCH_MAX_CANDIDATES * sizeof(*cands))))
+		ncands = match_tree_lookup(tmp, exten, action, cands);
 	eroot = NULL;
-	while ( (eroot = ast_walk_context_extensions(tmp, eroot)) ) {
-		int match = extension_match_core(eroot->exten, exten, action);
+	while (ncands < 0 ? (eroot = ast_walk_context_extensions(tmp, eroot)) != NULL : cand < ncands) {
+		int match;
 		/* 0 on fail, 1 on match, 2 on earlymatch */
 
+		if (ncands < 0)
+			match = extension_match_core(eroot->exten, exten, action);
+		else {
+			eroot = cands[cand].e;
+			match = cands[cand++].match;
+		}
+
 		if (!match || (eroot->matchcid && !matchcid(eroot->cidmatch, callerid)))
 			continue;	/* keep trying */
 		if (match == 2 && action == E_MATCHMORE) {
@@ -2890,12 +3347,14 @@ int ast_context_remove_extension_callerid2(struct ast_context *con, const char *
 				}
 				if (peer->peer)	{ /* update the new head of the pri list */
 					peer->peer->next = peer->next;
+					match_tree_replace(peer, peer->peer);
 				}
 			} else { /* easy, we are not first priority in extension */
 				previous_peer->peer = peer->peer;
 			}
 
 			/* now, free whole priority extension */
+			match_tree_remove(con, peer);
 			destroy_exten(peer);
 		} else {
 			previous_peer = peer;
@@ -3493,6 +3952,7 @@ struct dialplan_counters {
 	int total_context;
 	int total_exten;
 	int total_prio;
+	int tree_nodes;
 	int context_existence;
 	int extension_existence;
 };
@@ -3542,6 +4002,7 @@ static int show_dialplan_helper(int fd, const char *context, const char *exten,
 		 */
 		if (!exten) {
 			dpc->total_context++;
+			dpc->tree_nodes += c->tree_nodes;
 			ast_cli(fd, "[ Context '%s' created by '%s' ]\n",
 				ast_get_context_name(c), ast_get_context_registrar(c));
 			context_info_printed = 1;
@@ -3560,6 +4021,7 @@ static int show_dialplan_helper(int fd, const char *context, const char *exten,
 			/* may we print context info? */
 			if (!context_info_printed) {
 				dpc->total_context++;
+				dpc->tree_nodes += c->tree_nodes;
 				if (rinclude) { /* TODO Print more info about rinclude */
 					ast_cli(fd, "[ Included context '%s' created by '%s' ]\n",
 						ast_get_context_name(c), ast_get_context_registrar(c));
@@ -3710,6 +4172,9 @@ static int handle_show_dialplan(int fd, int argc, char *argv[])
 				counters.total_exten, counters.total_exten == 1 ? "extension" : "extensions",
 				counters.total_prio, counters.total_prio == 1 ? "priority" : "priorities",
 				counters.total_context, counters.total_context == 1 ? "context" : "contexts");
+	ast_cli(fd, "-= Match trees: %d %s; %d lookups from the trees, %d list scans =-\n",
+				counters.tree_nodes, counters.tree_nodes == 1 ? "node" : "nodes",
+				tree_lookups, tree_fallbacks);
 
 	/* everything ok */
 	return RESULT_SUCCESS;
@@ -4716,6 +5181,8 @@ static int add_pri(struct ast_context *con, struct ast_exten *tmp,
 			el->next = tmp;
 		else			/* We're the very first extension.  */
 			con->root = tmp;
+		if (!ep)
+			match_tree_replace(e, tmp);
 		if (tmp->priority == PRIORITY_HINT)
 			ast_change_hint(e,tmp);
 		/* Destroy the old one */
@@ -4733,6 +5200,7 @@ static int add_pri(struct ast_context *con, struct ast_exten *tmp,
 			else
 				con->root = tmp; /* ... or at the head */
 			e->next = NULL;	/* e is no more at the head, so e->next must be reset */
+			match_tree_replace(e, tmp);
 		}
 		/* And immediately return success. */
 		if (tmp->priority == PRIORITY_HINT)
@@ -4866,6 +5334,8 @@ int ast_add_extension2(struct ast_context *con,
 			el->next = tmp;
 		else
 			con->root = tmp;
+		exten_set_seq(con, el, tmp);
+		match_tree_add(con, tmp);
 		ast_mutex_unlock(&con->lock);
 		if (tmp->priority == PRIORITY_HINT)
 			ast_add_hint(tmp);
@@ -5340,6 +5810,8 @@ void __ast_context_destroy(struct ast_context *con, const char *registrar)
 			e = e->next;
 			destroy_exten(el);
 		}
+		match_free(tmp->lit_tree);
+		match_free(tmp->pat_tree);
 		ast_mutex_destroy(&tmp->lock);
 		free(tmp);
 		/* if we have a specific match, we are done, otherwise continue */
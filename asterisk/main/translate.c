@@ -69,6 +69,29 @@ struct translator_path {
  */
 static struct translator_path tr_matrix[MAX_FORMAT][MAX_FORMAT];
 
+/*! \brief Most idle paths kept for any source/destination pair */
+#define TR_POOL_SIZE 4
+
+/*! \brief Idle translation paths, per source/destination pair.
+ *
+ * Channels (and app_rpt/chan_voter style pseudo channels) build and tear
+ * down the same few paths all the time. A freed path is parked here, with
+ * its translators' destroy() already called, and is reset and handed out
+ * again by the next ast_translator_build_path() for the same pair instead
+ * of walking the matrix and allocating every step again.
+ *
+ * Protected by the translators list lock, like tr_matrix. Every change to
+ * the matrix empties the pool.
+ */
+struct translator_pool {
+	struct ast_trans_pvt *paths[TR_POOL_SIZE];
+	int count;
+	unsigned int hits;	/*!< paths reused from the pool */
+	unsigned int misses;	/*!< paths built from scratch */
+};
+
+static struct translator_pool tr_pool[MAX_FORMAT][MAX_FORMAT];
+
 /*! \todo
  * TODO: sample frames for each supported input format.
  * We build this on the fly, by taking an SLIN frame and using
@@ -92,31 +115,24 @@ static force_inline int powerof(unsigned int d)
  * wrappers around the translator routines.
  */
 
-/*!
- * \brief Allocate the descriptor, required outbuf space,
- * and possibly also plc and desc.
- */
-static void *newpvt(struct ast_translator *t)
+/*! \brief space needed for a pvt of translator t, descriptor, plc and buffer included */
+static int pvt_size(struct ast_translator *t, int useplc)
 {
-	struct ast_trans_pvt *pvt;
-	int len;
-	int useplc = t->plc_samples > 0 && t->useplc;	/* cache, because it can change on the fly */
-	char *ofs;
+	int len = sizeof(struct ast_trans_pvt) + t->desc_size;
 
-	/*
-	 * compute the required size adding private descriptor,
-	 * plc, buffer, AST_FRIENDLY_OFFSET.
-	 */
-	len = sizeof(*pvt) + t->desc_size;
 	if (useplc)
 		len += sizeof(plc_state_t);
 	if (t->buf_size)
 		len += AST_FRIENDLY_OFFSET + t->buf_size;
-	pvt = ast_calloc(1, len);
-	if (!pvt)
-		return NULL;
+	return len;
+}
+
+/*! \brief carve descriptor, plc and buffer out of a zeroed pvt */
+static void pvt_setup(struct ast_trans_pvt *pvt, struct ast_translator *t, int useplc)
+{
+	char *ofs = (char *)(pvt + 1);	/* pointer to data space */
+
 	pvt->t = t;
-	ofs = (char *)(pvt + 1);	/* pointer to data space */
 	if (t->desc_size) {		/* first comes the descriptor */
 		pvt->pvt = ofs;
 		ofs += t->desc_size;
@@ -127,6 +143,25 @@ static void *newpvt(struct ast_translator *t)
 	}
 	if (t->buf_size)		/* finally buffer and header */
 		pvt->outbuf = ofs + AST_FRIENDLY_OFFSET;
+}
+
+/*!
+ * \brief Allocate the descriptor, required outbuf space,
+ * and possibly also plc and desc.
+ */
+static void *newpvt(struct ast_translator *t)
+{
+	struct ast_trans_pvt *pvt;
+	int useplc = t->plc_samples > 0 && t->useplc;	/* cache, because it can change on the fly */
+
+	/*
+	 * compute the required size adding private descriptor,
+	 * plc, buffer, AST_FRIENDLY_OFFSET.
+	 */
+	pvt = ast_calloc(1, pvt_size(t, useplc));
+	if (!pvt)
+		return NULL;
+	pvt_setup(pvt, t, useplc);
 	/* call local init routine, if present */
 	if (t->newpvt && t->newpvt(pvt)) {
 		free(pvt);
@@ -136,6 +171,25 @@ static void *newpvt(struct ast_translator *t)
 	return pvt;
 }
 
+/*!
+ * \brief Bring a pooled pvt back to the state newpvt() leaves it in.
+ * Its translator's destroy() has already been called when it was pooled.
+ */
+static int resetpvt(struct ast_trans_pvt *pvt)
+{
+	struct ast_translator *t = pvt->t;
+	struct ast_trans_pvt *next = pvt->next;
+	int useplc = (pvt->plc != NULL);
+
+	memset(pvt, 0, pvt_size(t, useplc));
+	pvt_setup(pvt, t, useplc);
+	pvt->next = next;
+	if (t->newpvt && t->newpvt(pvt))
+		return -1;
+	ast_module_ref(t->module);
+	return 0;
+}
+
 static void destroy(struct ast_trans_pvt *pvt)
 {
 	struct ast_translator *t = pvt->t;
@@ -257,9 +311,110 @@ static struct ast_frame *default_frameout(struct ast_trans_pvt *pvt)
 
 /* end of callback wrappers and helpers */
 
+/*!
+ * \brief Free the pvts of a pooled path
+ * \note Don't call without the translators list locked
+ */
+static void translator_pool_discard(struct ast_trans_pvt *p)
+{
+	struct ast_trans_pvt *pn = p;
+
+	while ( (p = pn) ) {
+		pn = p->next;
+		free(p);
+	}
+}
+
+/*!
+ * \brief Empty the pool, the paths in it may not match the matrix any more
+ * \note Don't call without the translators list locked
+ */
+static void translator_pool_flush(void)
+{
+	int x, y;
+
+	for (x = 0; x < MAX_FORMAT; x++) {
+		for (y = 0; y < MAX_FORMAT; y++) {
+			while (tr_pool[x][y].count)
+				translator_pool_discard(tr_pool[x][y].paths[--tr_pool[x][y].count]);
+		}
+	}
+}
+
+/*!
+ * \brief Take an idle path off the pool and reset it
+ * \note Don't call without the translators list locked
+ */
+static struct ast_trans_pvt *translator_pool_get(int source, int dest)
+{
+	struct translator_pool *pool = &tr_pool[source][dest];
+	struct ast_trans_pvt *path, *p, *pn, *next;
+
+	while (pool->count) {
+		path = pool->paths[--pool->count];
+		for (p = path; p; p = p->next) {
+			if (resetpvt(p))
+				break;
+		}
+		if (!p) {
+			pool->hits++;
+			return path;
+		}
+		/* A translator refused to start over, drop this path. Steps
+		   before the failed one are live again, the rest are not. */
+		ast_log(LOG_WARNING, "Failed to reset translator step from %s to %s\n",
+			ast_getformatname(1 << p->t->srcfmt), ast_getformatname(1 << p->t->dstfmt));
+		for (pn = path; pn != p; pn = next) {
+			next = pn->next;
+			destroy(pn);
+		}
+		translator_pool_discard(p);
+	}
+	pool->misses++;
+	return NULL;
+}
+
+/*!
+ * \brief Park a path in the pool
+ * \retval 0 the pool took it
+ * \retval -1 it has to be destroyed
+ */
+static int translator_pool_put(struct ast_trans_pvt *path)
+{
+	struct ast_trans_pvt *p, *last = path;
+	struct translator_pool *pool;
+
+	for (p = path; p; p = p->next) {
+		/* A frame of this path is still out there, leave it to destroy() */
+		if (ast_test_flag(&p->f, AST_FRFLAG_FROM_TRANSLATOR))
+			return -1;
+		last = p;
+	}
+
+	AST_LIST_LOCK(&translators);
+	pool = &tr_pool[path->t->srcfmt][last->t->dstfmt];
+	if (pool->count >= TR_POOL_SIZE) {
+		AST_LIST_UNLOCK(&translators);
+		return -1;
+	}
+	for (p = path; p; p = p->next) {
+		if (p->t->destroy)
+			p->t->destroy(p);
+		ast_module_unref(p->t->module);
+	}
+	pool->paths[pool->count++] = path;
+	AST_LIST_UNLOCK(&translators);
+
+	return 0;
+}
+
 void ast_translator_free_path(struct ast_trans_pvt *p)
 {
 	struct ast_trans_pvt *pn = p;
+
+	if (p && !translator_pool_put(p))
+		return;
+
 	while ( (p = pn) ) {
 		pn = p->next;
 		destroy(p);
@@ -281,6 +436,11 @@ struct ast_trans_pvt *ast_translator_build_path(int dest, int source)
 
 	AST_LIST_LOCK(&translators);
 
+	if (source != dest && (head = translator_pool_get(source, dest))) {
+		AST_LIST_UNLOCK(&translators);
+		return head;
+	}
+
 	while (source != dest) {
 		struct ast_trans_pvt *cur;
 		struct ast_translator *t = tr_matrix[source][dest].step;
@@ -311,22 +471,9 @@ struct ast_trans_pvt *ast_translator_build_path(int dest, int source)
 	return head;
 }
 
-/*! \brief do the actual translation */
-struct ast_frame *ast_translate(struct ast_trans_pvt *path, struct ast_frame *f, int consume)
+/*! \brief track the delivery times coming into a path */
+static void translate_timing_in(struct ast_trans_pvt *path, struct ast_frame *f)
 {
-	struct ast_trans_pvt *p = path;
-	struct ast_frame *out = f;
-	struct timeval delivery;
-	int has_timing_info;
-	long ts;
-	long len;
-	int seqno;
-
-	has_timing_info = ast_test_flag(f, AST_FRFLAG_HAS_TIMING_INFO);
-	ts = f->ts;
-	len = f->len;
-	seqno = f->seqno;
-
 	/* XXX hmmm... check this below */
 	if (!ast_tvzero(f->delivery)) {
 		if (!ast_tvzero(path->nextin)) {
@@ -349,17 +496,12 @@ struct ast_frame *ast_translate(struct ast_trans_pvt *path, struct ast_frame *f,
 		/* Predict next incoming sample */
 		path->nextin = ast_tvadd(path->nextin, ast_samp2tv(f->samples, ast_format_rate(f->subclass)));
 	}
-	delivery = f->delivery;
-	for ( ; out && p ; p = p->next) {
-		framein(p, out);
-		if (out != f)
-			ast_frfree(out);
-		out = p->t->frameout(p);
-	}
-	if (consume)
-		ast_frfree(f);
-	if (out == NULL)
-		return NULL;
+}
+
+/*! \brief stamp a frame coming out of a path, in is the (last) frame that went in */
+static void translate_timing_out(struct ast_trans_pvt *path, struct ast_frame *out,
+	struct timeval delivery, int has_timing_info, long ts, long len, int seqno)
+{
 	/* we have a frame, play with times */
 	if (!ast_tvzero(delivery)) {
 		/* Regenerate prediction after a discontinuity */
@@ -384,9 +526,114 @@ struct ast_frame *ast_translate(struct ast_trans_pvt *path, struct ast_frame *f,
 	/* Invalidate prediction if we're entering a silence period */
 	if (out->frametype == AST_FRAME_CNG)
 		path->nextout = ast_tv(0, 0);
+}
+
+/*! \brief do the actual translation */
+struct ast_frame *ast_translate(struct ast_trans_pvt *path, struct ast_frame *f, int consume)
+{
+	struct ast_trans_pvt *p = path;
+	struct ast_frame *out = f;
+	struct timeval delivery;
+	struct timeval ingress;
+	int has_timing_info;
+	long ts;
+	long len;
+	int seqno;
+
+	has_timing_info = ast_test_flag(f, AST_FRFLAG_HAS_TIMING_INFO);
+	ts = f->ts;
+	len = f->len;
+	seqno = f->seqno;
+	ingress = f->ingress;
+
+	translate_timing_in(path, f);
+	delivery = f->delivery;
+	for ( ; out && p ; p = p->next) {
+		framein(p, out);
+		if (out != f)
+			ast_frfree(out);
+		out = p->t->frameout(p);
+	}
+	if (consume)
+		ast_frfree(f);
+	if (out == NULL)
+		return NULL;
+	translate_timing_out(path, out, delivery, has_timing_info, ts, len, seqno);
+	out->ingress = ingress;
+	ast_latency_mark(out, AST_LATENCY_TRANSLATE, path->t->name);
 	return out;
 }
 
+AST_LIST_HEAD_NOLOCK(translate_frames, ast_frame);
+
+/*! \brief take a frame's worth of what a step has buffered up, as a frame of our own
+ * \return 0 if the step had nothing to give */
+static int translate_collect(struct ast_trans_pvt *p, struct translate_frames *out)
+{
+	struct ast_frame *f, *dup;
+
+	if (!(f = p->t->frameout(p)))
+		return 0;
+	dup = ast_frdup(f);
+	ast_frfree(f);
+	if (dup)
+		AST_LIST_INSERT_TAIL(out, dup, frame_list);
+	return 1;
+}
+
+struct ast_frame *ast_translate_frames(struct ast_trans_pvt *path, struct ast_frame **frames, int count, int consume)
+{
+	struct translate_frames in = { NULL, }, out = { NULL, };
+	struct ast_trans_pvt *p;
+	struct ast_frame *f, *last;
+	int x;
+
+	if (count < 1)
+		return NULL;
+
+	for (x = 0; x < count; x++)
+		translate_timing_in(path, frames[x]);
+
+	for (p = path; p; p = p->next) {
+		AST_LIST_HEAD_INIT_NOLOCK(&out);
+		for (x = 0; ; x++) {
+			if (p == path) {
+				if (x == count)
+					break;
+				f = frames[x];
+			} else if (!(f = AST_LIST_REMOVE_HEAD(&in, frame_list)))
+				break;
+			/* Only take out what has piled up when the next frame would not fit,
+			   and as much as it takes to make room for it.  A step that does not
+			   say how much it holds gets emptied before every frame. */
+			while (p->samples && (!p->t->buffer_samples || p->samples + f->samples > p->t->buffer_samples)) {
+				if (!translate_collect(p, &out))
+					break;
+			}
+			framein(p, f);
+			if (p != path)
+				ast_frfree(f);
+		}
+		while (translate_collect(p, &out));
+		in = out;
+	}
+
+	last = frames[count - 1];
+	AST_LIST_TRAVERSE(&in, f, frame_list) {
+		translate_timing_out(path, f, frames[0]->delivery,
+			ast_test_flag(last, AST_FRFLAG_HAS_TIMING_INFO), last->ts, last->len, last->seqno);
+		f->ingress = frames[0]->ingress;
+		ast_latency_mark(f, AST_LATENCY_TRANSLATE, path->t->name);
+	}
+
+	if (consume) {
+		for (x = 0; x < count; x++)
+			ast_frfree(frames[x]);
+	}
+
+	return AST_LIST_FIRST(&in);
+}
+
 /*! \brief compute the cost of a single translation step */
 static void calc_cost(struct ast_translator *t, int seconds)
 {
@@ -456,6 +703,7 @@ static void rebuild_matrix(int samples)
 	if (option_debug)
 		ast_log(LOG_DEBUG, "Resetting translation matrix\n");
 
+	translator_pool_flush();
 	bzero(tr_matrix, sizeof(tr_matrix));
 
 	/* first, compute all direct costs */
@@ -519,6 +767,28 @@ static void rebuild_matrix(int samples)
 	}
 }
 
+/*! \brief list the pool counters of every pair that has been asked for */
+static void show_translation_pool(int fd)
+{
+	int x, y;
+	char path[40];
+
+	ast_cli(fd, "\n         Translation path pool (up to %d idle paths per pair)\n", TR_POOL_SIZE);
+	ast_cli(fd, "%-24s %10s %10s %5s %5s\n", "Path", "Reused", "Built", "Hit%", "Idle");
+	for (x = 0; x < MAX_FORMAT; x++) {
+		for (y = 0; y < MAX_FORMAT; y++) {
+			struct translator_pool *pool = &tr_pool[x][y];
+			unsigned int total = pool->hits + pool->misses;
+
+			if (!total)
+				continue;
+			snprintf(path, sizeof(path), "%s -> %s", ast_getformatname(1 << x), ast_getformatname(1 << y));
+			ast_cli(fd, "%-24s %10u %10u %4u%% %5d\n", path, pool->hits, pool->misses,
+				(unsigned int) ((100ULL * pool->hits) / total), pool->count);
+		}
+	}
+}
+
 /*! \brief CLI "show translation" command handler */
 static int show_translation_deprecated(int fd, int argc, char *argv[])
 {
@@ -586,6 +856,7 @@ static int show_translation_deprecated(int fd, int argc, char *argv[])
 		ast_build_string(&buf, &left, "\n");
 		ast_cli(fd, line);			
 	}
+	show_translation_pool(fd);
 	AST_LIST_UNLOCK(&translators);
 	return RESULT_SUCCESS;
 }
@@ -655,6 +926,7 @@ static int show_translation(int fd, int argc, char *argv[])
 		ast_build_string(&buf, &left, "\n");
 		ast_cli(fd, line);			
 	}
+	show_translation_pool(fd);
 	AST_LIST_UNLOCK(&translators);
 	return RESULT_SUCCESS;
 }
@@ -664,7 +936,9 @@ static char show_trans_usage[] =
 "       Displays known codec translators and the cost associated\n"
 "with each conversion.  If the argument 'recalc' is supplied along\n"
 "with optional number of seconds to test a new test will be performed\n"
-"as the chart is being displayed.\n";
+"as the chart is being displayed.\n"
+"       Also shows how often translation paths were reused from the pool\n"
+"of idle paths instead of being built from scratch.\n";
 
 static struct ast_cli_entry cli_show_translation_deprecated = {
 	{ "show", "translation", NULL },
@@ -27,7 +27,15 @@
 
 ASTERISK_FILE_VERSION(__FILE__, "$Revision: 40722 $")
 
+#if (defined(__x86_64__) || defined(__i386__)) && \
+	(defined(__clang__) || __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define ULAW_SSE2
+#include <cpuid.h>
+#include <emmintrin.h>
+#endif
+
 #include "asterisk/ulaw.h"
+#include "asterisk/logger.h"
 
 #define ZEROTRAP    /*!< turn on the trap as per the MIL-STD */
 #define BIAS 0x84   /*!< define the add-in bias for 16 bit samples */
@@ -79,6 +87,150 @@ static unsigned char linear2ulaw(short sample)
 	return ulawbyte;
 }
 
+static void generic_lin2mu_buf(unsigned char *dst, const short *src, int samples)
+{
+	while (samples--)
+		*dst++ = AST_LIN2MU(*src++);
+}
+
+static void generic_mulaw_buf(short *dst, const unsigned char *src, int samples)
+{
+	while (samples--)
+		*dst++ = AST_MULAW(*src++);
+}
+
+#ifdef ULAW_SSE2
+#define SSE2_TARGET __attribute__((target("sse2")))
+
+static int sse2_available(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+	return (edx & bit_SSE2) ? 1 : 0;
+}
+
+/*! \brief Exponent and mantissa bits of four positive 32 bit integers, as
+ * ((floor(log2(x)) - 7) << 4) | the four bits after the leading one.
+ * Converting to float does the normalizing for us. */
+static SSE2_TARGET __m128i sse2_expmant(__m128i x)
+{
+	__m128i bits = _mm_castps_si128(_mm_cvtepi32_ps(x));
+
+	return _mm_sub_epi32(_mm_srli_epi32(bits, 19), _mm_set1_epi32((127 + 7) << 4));
+}
+
+/*! \brief linear2ulaw() on eight samples, computed rather than looked up.
+ * The table entry for a sample is linear2ulaw() of the last of the four
+ * samples sharing it, so the two low bits are set first. */
+static SSE2_TARGET __m128i sse2_lin2mu(__m128i s)
+{
+	__m128i sign, mag, res, zero = _mm_setzero_si128();
+
+	s = _mm_or_si128(s, _mm_set1_epi16(3));
+	sign = _mm_srai_epi16(s, 15);
+	mag = _mm_sub_epi16(_mm_xor_si128(s, sign), sign);
+	mag = _mm_min_epi16(mag, _mm_set1_epi16(CLIP));
+	mag = _mm_add_epi16(mag, _mm_set1_epi16(BIAS));
+	/* with the bias added the magnitude is at least 0x84, so the
+	   exponent comes out as 0 to 7 */
+	res = _mm_packs_epi32(sse2_expmant(_mm_unpacklo_epi16(mag, zero)),
+		sse2_expmant(_mm_unpackhi_epi16(mag, zero)));
+	res = _mm_or_si128(res, _mm_and_si128(sign, _mm_set1_epi16(0x80)));
+	res = _mm_xor_si128(res, _mm_set1_epi16(0xff));
+#ifdef ZEROTRAP
+	res = _mm_or_si128(res, _mm_and_si128(_mm_cmpeq_epi16(res, zero), _mm_set1_epi16(0x02)));
+#endif
+	return res;
+}
+
+static SSE2_TARGET void sse2_lin2mu_buf(unsigned char *dst, const short *src, int samples)
+{
+	__m128i lo, hi;
+
+	for (; samples >= 16; samples -= 16, src += 16, dst += 16) {
+		lo = sse2_lin2mu(_mm_loadu_si128((const __m128i *) src));
+		hi = sse2_lin2mu(_mm_loadu_si128((const __m128i *) (src + 8)));
+		_mm_storeu_si128((__m128i *) dst, _mm_packus_epi16(lo, hi));
+	}
+	generic_lin2mu_buf(dst, src, samples);
+}
+
+/*! \brief 1 << exponent for eight samples, built as floats */
+static SSE2_TARGET __m128i sse2_pow2(__m128i exp)
+{
+	__m128i zero = _mm_setzero_si128(), bias = _mm_set1_epi32(127);
+	__m128 lo, hi;
+
+	lo = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_unpacklo_epi16(exp, zero), bias), 23));
+	hi = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(_mm_unpackhi_epi16(exp, zero), bias), 23));
+	return _mm_packs_epi32(_mm_cvttps_epi32(lo), _mm_cvttps_epi32(hi));
+}
+
+/*! \brief The __ast_mulaw table entries for eight samples, computed as
+ * ((mantissa << 3) + 132) << exponent, less 132 */
+static SSE2_TARGET void sse2_mulaw_buf(short *dst, const unsigned char *src, int samples)
+{
+	__m128i mu, exp, y, sign, bias = _mm_set1_epi16(132);
+
+	for (; samples >= 8; samples -= 8, src += 8, dst += 8) {
+		mu = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *) src), _mm_setzero_si128());
+		mu = _mm_xor_si128(mu, _mm_set1_epi16(0xff));
+		exp = _mm_and_si128(_mm_srli_epi16(mu, 4), _mm_set1_epi16(7));
+		y = _mm_add_epi16(_mm_slli_epi16(_mm_and_si128(mu, _mm_set1_epi16(0x0f)), 3), bias);
+		y = _mm_sub_epi16(_mm_mullo_epi16(y, sse2_pow2(exp)), bias);
+		sign = _mm_cmpeq_epi16(_mm_and_si128(mu, _mm_set1_epi16(0x80)), _mm_set1_epi16(0x80));
+		y = _mm_sub_epi16(_mm_xor_si128(y, sign), sign);
+		_mm_storeu_si128((__m128i *) dst, y);
+	}
+	generic_mulaw_buf(dst, src, samples);
+}
+#endif /* ULAW_SSE2 */
+
+static void (*lin2mu_buf)(unsigned char *dst, const short *src, int samples) = generic_lin2mu_buf;
+static void (*mulaw_buf)(short *dst, const unsigned char *src, int samples) = generic_mulaw_buf;
+
+void ast_lin2mu_buf(unsigned char *dst, const short *src, int samples)
+{
+	lin2mu_buf(dst, src, samples);
+}
+
+void ast_mulaw_buf(short *dst, const unsigned char *src, int samples)
+{
+	mulaw_buf(dst, src, samples);
+}
+
+/*! \brief Check a pair of block converters against the tables, for every input value */
+static int ulaw_selftest(void (*enc)(unsigned char *dst, const short *src, int samples),
+	void (*dec)(short *dst, const unsigned char *src, int samples))
+{
+	short lin[256], back[256];
+	unsigned char mu[256];
+	int i, j;
+
+	for (i = -32768; i < 32768; i += 256) {
+		for (j = 0; j < 256; j++)
+			lin[j] = i + j;
+		/* odd lengths, so the scalar tail gets some of the work too */
+		enc(mu, lin, 250);
+		enc(mu + 250, lin + 250, 6);
+		for (j = 0; j < 256; j++) {
+			if (mu[j] != AST_LIN2MU(lin[j]))
+				return -1;
+		}
+	}
+	for (i = 0; i < 256; i++)
+		mu[i] = i;
+	dec(back, mu, 250);
+	dec(back + 250, mu + 250, 6);
+	for (i = 0; i < 256; i++) {
+		if (back[i] != AST_MULAW(i))
+			return -1;
+	}
+	return 0;
+}
+
 /*!
  * \brief  Set up mu-law conversion table
  */
@@ -102,5 +254,14 @@ void ast_ulaw_init(void)
 	for (i = -32768; i < 32768; i++) {
 		__ast_lin2mu[((unsigned short)i) >> 2] = linear2ulaw(i);
 	}
+#ifdef ULAW_SSE2
+	if (sse2_available()) {
+		if (!ulaw_selftest(sse2_lin2mu_buf, sse2_mulaw_buf)) {
+			lin2mu_buf = sse2_lin2mu_buf;
+			mulaw_buf = sse2_mulaw_buf;
+		} else
+			ast_log(LOG_WARNING, "SSE2 mu-law conversion does not match the tables, not using it\n");
+	}
+#endif
 }
 
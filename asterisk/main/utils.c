@@ -878,6 +878,7 @@ struct thr_arg {
 	void *(*start_routine)(void *);
 	void *data;
 	char *name;
+	char subsystem[32];	/*!< What started it, for CPU accounting: the source file's name, less the extension */
 };
 
 /*
@@ -902,7 +903,7 @@ static void *dummy_start(void *data)
 	   free the memory
 	*/
 	free(data);
-	ast_register_thread(a.name);
+	ast_register_thread_subsystem(a.name, a.subsystem);
 	pthread_cleanup_push(ast_unregister_thread, (void *) pthread_self());
 
 #ifdef DEBUG_THREADS
@@ -937,6 +938,7 @@ int ast_pthread_create_stack(pthread_t *thread, pthread_attr_t *attr, void *(*st
 {
 #if !defined(LOW_MEMORY)
 	struct thr_arg *a;
+	const char *base;
 #endif
 char	__mystorage[sizeof(*attr)];
 
@@ -970,6 +972,9 @@ char	__mystorage[sizeof(*attr)];
 		start_routine = dummy_start;
 		asprintf(&a->name, "%-20s started at [%5d] %s %s()",
 			 start_fn, line, file, caller);
+		base = strrchr(file, '/');
+		ast_copy_string(a->subsystem, base ? base + 1 : file, sizeof(a->subsystem));
+		a->subsystem[strcspn(a->subsystem, ".")] = '\0';
 		data = a;
 	}
 #endif /* !LOW_MEMORY */
@@ -1411,9 +1416,471 @@ void ast_enable_packet_fragmentation(int sock)
 #endif /* HAVE_IP_MTU_DISCOVER */
 }
 
+/*
+ * The lock contention profiler.  While it runs, every contended lock, and
+ * one in lock_prof_rate of the rest, is timed: how long the thread waited
+ * for it, and how long it then held it.  The times go into histograms kept
+ * by each thread for each place in the source a lock is taken, so threads
+ * never share anything to record them.
+ */
+
+/* The profiler's own bookkeeping must not go through the ast_mutex wrappers */
+#undef pthread_mutex_t
+#undef pthread_mutex_lock
+#undef pthread_mutex_unlock
+#undef pthread_mutex_trylock
+
+/*! \brief Places in the source a thread can keep track of (a power of two) */
+#define LOCK_PROF_SITES 256
+/*! \brief Locks a thread can be timing at once */
+#define LOCK_PROF_HELD 32
+/*! \brief Histogram buckets: under 1us, then powers of two up to 16ms and over */
+#define LOCK_PROF_BUCKETS 16
+
+int ast_lock_profiling;
+
+/*! \brief Bumped each time the profiler starts, so old figures can be told apart */
+static unsigned int lock_prof_gen;
+static unsigned int lock_prof_rate = 1;
+
+struct lock_prof_site {
+	const char *file;
+	int line;
+	const char *name;
+	unsigned int samples;
+	unsigned int contended;
+	uint64_t wait_ns;
+	uint64_t hold_ns;
+	unsigned int held;
+	unsigned int wait_hist[LOCK_PROF_BUCKETS];
+	unsigned int hold_hist[LOCK_PROF_BUCKETS];
+};
+
+struct lock_prof_thread {
+	unsigned int gen;
+	unsigned int count;
+	/*! Timings thrown away because sites[] had no room left for where they were taken */
+	unsigned int dropped;
+	int num_held;
+	struct {
+		pthread_mutex_t *mutex;
+		struct lock_prof_site *site;
+		/*! When it was got, or 0 while a condition wait has let go of it */
+		uint64_t start;
+	} held[LOCK_PROF_HELD];
+	struct lock_prof_site sites[LOCK_PROF_SITES];
+	AST_LIST_ENTRY(lock_prof_thread) list;
+};
+
+/*! \brief Stands in for a thread's figures while they are being set up */
+#define LOCK_PROF_BUSY ((void *) 1)
+
+static pthread_key_t lock_prof_key;
+static pthread_once_t lock_prof_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t lock_prof_lock = PTHREAD_MUTEX_INITIALIZER;
+static AST_LIST_HEAD_NOLOCK_STATIC(lock_prof_threads, lock_prof_thread);
+/*! \brief What threads that have since exited found */
+static struct lock_prof_thread lock_prof_gone;
+
+static uint64_t lock_prof_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int lock_prof_bucket(uint64_t ns)
+{
+	unsigned int us = ns / 1000;
+
+	if (!us)
+		return 0;
+	if (us >= (1 << (LOCK_PROF_BUCKETS - 2)))
+		return LOCK_PROF_BUCKETS - 1;
+	return 32 - __builtin_clz(us);
+}
+
+static struct lock_prof_site *lock_prof_find(struct lock_prof_thread *pt, const char *file, int line, const char *name, int create)
+{
+	unsigned int i, n;
+	struct lock_prof_site *site;
+
+	i = ((unsigned long) file >> 3) ^ (line * 2654435761U);
+	for (n = 0; n < LOCK_PROF_SITES; n++, i++) {
+		site = &pt->sites[i & (LOCK_PROF_SITES - 1)];
+		if (site->file == file && site->line == line)
+			return site;
+		if (!site->file) {
+			if (!create)
+				return NULL;
+			site->line = line;
+			site->name = name;
+			site->file = file;
+			return site;
+		}
+	}
+
+	return NULL;
+}
+
+/*! \brief Add one thread's figures into another's, or a thread's that has gone */
+static void lock_prof_merge(struct lock_prof_thread *to, struct lock_prof_thread *from)
+{
+	struct lock_prof_site *s, *d;
+	int i, j;
+
+	to->dropped += from->dropped;
+	for (i = 0; i < LOCK_PROF_SITES; i++) {
+		s = &from->sites[i];
+		if (!s->file)
+			continue;
+		if (!(d = lock_prof_find(to, s->file, s->line, s->name, 1))) {
+			to->dropped += s->samples;
+			continue;
+		}
+		d->samples += s->samples;
+		d->contended += s->contended;
+		d->wait_ns += s->wait_ns;
+		d->hold_ns += s->hold_ns;
+		d->held += s->held;
+		for (j = 0; j < LOCK_PROF_BUCKETS; j++) {
+			d->wait_hist[j] += s->wait_hist[j];
+			d->hold_hist[j] += s->hold_hist[j];
+		}
+	}
+}
+
+static void lock_prof_thread_destroy(void *data)
+{
+	struct lock_prof_thread *pt = data;
+
+	if (pt == LOCK_PROF_BUSY)
+		return;
+
+	pthread_mutex_lock(&lock_prof_lock);
+	AST_LIST_REMOVE(&lock_prof_threads, pt, list);
+	if (pt->gen == lock_prof_gen)
+		lock_prof_merge(&lock_prof_gone, pt);
+	pthread_mutex_unlock(&lock_prof_lock);
+
+	free(pt);
+}
+
+static void lock_prof_key_init(void)
+{
+	pthread_key_create(&lock_prof_key, lock_prof_thread_destroy);
+}
+
+/*! \brief This thread's figures, with any from before the profiler was last started thrown away */
+static struct lock_prof_thread *lock_prof_self(void)
+{
+	struct lock_prof_thread *pt;
+
+	pthread_once(&lock_prof_once, lock_prof_key_init);
+
+	if (!(pt = pthread_getspecific(lock_prof_key))) {
+		/* Allocating may take locks of its own */
+		pthread_setspecific(lock_prof_key, LOCK_PROF_BUSY);
+		if ((pt = calloc(1, sizeof(*pt)))) {
+			pt->gen = lock_prof_gen;
+			pthread_mutex_lock(&lock_prof_lock);
+			AST_LIST_INSERT_TAIL(&lock_prof_threads, pt, list);
+			pthread_mutex_unlock(&lock_prof_lock);
+		}
+		pthread_setspecific(lock_prof_key, pt);
+	}
+
+	if (pt == LOCK_PROF_BUSY)
+		return NULL;
+
+	if (pt && pt->gen != lock_prof_gen) {
+		pthread_mutex_lock(&lock_prof_lock);
+		memset(pt->sites, 0, sizeof(pt->sites));
+		pt->dropped = 0;
+		pt->num_held = 0;
+		pt->gen = lock_prof_gen;
+		pthread_mutex_unlock(&lock_prof_lock);
+	}
+
+	return pt;
+}
+
+int __ast_lock_prof_lock(pthread_mutex_t *mutex, const char *filename, int lineno, const char *lock_name, int try)
+{
+	struct lock_prof_thread *pt;
+	struct lock_prof_site *site;
+	uint64_t start = 0, now;
+	int res, b;
+
+	if (!(pt = lock_prof_self()))
+		return try ? pthread_mutex_trylock(mutex) : pthread_mutex_lock(mutex);
+
+	if (!(res = pthread_mutex_trylock(mutex))) {
+		/* Got it straight away, which is only worth timing now and then */
+		if (++pt->count < lock_prof_rate)
+			return 0;
+		pt->count = 0;
+	} else if (try) {
+		return res;
+	} else {
+		start = lock_prof_now();
+		if ((res = pthread_mutex_lock(mutex)))
+			return res;
+	}
+
+	now = lock_prof_now();
+	if (!(site = lock_prof_find(pt, filename, lineno, lock_name, 1))) {
+		pt->dropped++;
+		return 0;
+	}
+
+	site->samples++;
+	if (start) {
+		site->contended++;
+		site->wait_ns += now - start;
+		b = lock_prof_bucket(now - start);
+	} else
+		b = 0;
+	site->wait_hist[b]++;
+
+	if (pt->num_held < LOCK_PROF_HELD) {
+		pt->held[pt->num_held].mutex = mutex;
+		pt->held[pt->num_held].site = site;
+		pt->held[pt->num_held].start = now;
+		pt->num_held++;
+	}
+
+	return 0;
+}
+
+/*! \brief The most recent timing of a mutex by this thread */
+static int lock_prof_held(struct lock_prof_thread *pt, pthread_mutex_t *mutex)
+{
+	int i;
+
+	for (i = pt->num_held - 1; i >= 0; i--) {
+		if (pt->held[i].mutex == mutex)
+			return i;
+	}
+
+	return -1;
+}
+
+static void lock_prof_release(struct lock_prof_thread *pt, int i)
+{
+	struct lock_prof_site *site = pt->held[i].site;
+	uint64_t held;
+
+	if (!pt->held[i].start)
+		return;
+	held = lock_prof_now() - pt->held[i].start;
+	site->held++;
+	site->hold_ns += held;
+	site->hold_hist[lock_prof_bucket(held)]++;
+	pt->held[i].start = 0;
+}
+
+void __ast_lock_prof_unlock(pthread_mutex_t *mutex)
+{
+	struct lock_prof_thread *pt;
+	int i;
+
+	if (!(pt = lock_prof_self()) || (i = lock_prof_held(pt, mutex)) < 0)
+		return;
+
+	lock_prof_release(pt, i);
+	pt->num_held--;
+	if (i < pt->num_held)
+		memmove(&pt->held[i], &pt->held[i + 1], (pt->num_held - i) * sizeof(pt->held[0]));
+}
+
+void __ast_lock_prof_cond(pthread_mutex_t *mutex, int waiting)
+{
+	struct lock_prof_thread *pt;
+	int i;
+
+	if (!(pt = lock_prof_self()) || (i = lock_prof_held(pt, mutex)) < 0)
+		return;
+
+	/* Time spent waiting on the condition isn't time spent holding the lock */
+	if (waiting)
+		lock_prof_release(pt, i);
+	else
+		pt->held[i].start = lock_prof_now();
+}
+
+/*! \brief The time under which nearly all (99%) of a histogram's entries fall, in microseconds */
+static unsigned int lock_prof_p99(const unsigned int *hist, unsigned int total)
+{
+	unsigned int sum = 0;
+	int b;
+
+	if (!total)
+		return 0;
+	for (b = 0; b < LOCK_PROF_BUCKETS - 1; b++) {
+		sum += hist[b];
+		if (sum * 100ULL >= total * 99ULL)
+			break;
+	}
+	return 1 << b;
+}
+
+static int lock_prof_cmp(const void *a, const void *b)
+{
+	const struct lock_prof_site *sa = a, *sb = b;
+
+	if (sa->wait_ns != sb->wait_ns)
+		return sa->wait_ns < sb->wait_ns ? 1 : -1;
+	if (sa->hold_ns != sb->hold_ns)
+		return sa->hold_ns < sb->hold_ns ? 1 : -1;
+	return 0;
+}
+
+static int handle_show_locks_profile(int fd, int argc, char *argv[])
+{
+	struct lock_prof_thread *all, *pt;
+	struct lock_prof_site *sites, *site, *by_lock;
+	int by_site = 0, max = 20, num = 0, i, j;
+	unsigned int dropped;
+	char where[64];
+
+	for (i = 4; i < argc; i++) {
+		if (!strcasecmp(argv[i], "sites"))
+			by_site = 1;
+		else if (sscanf(argv[i], "%d", &max) != 1 || max < 1)
+			return RESULT_SHOWUSAGE;
+	}
+
+	if (!(all = ast_calloc(1, sizeof(*all))))
+		return RESULT_FAILURE;
+
+	pthread_mutex_lock(&lock_prof_lock);
+	all->gen = lock_prof_gen;
+	lock_prof_merge(all, &lock_prof_gone);
+	AST_LIST_TRAVERSE(&lock_prof_threads, pt, list) {
+		if (pt->gen == lock_prof_gen)
+			lock_prof_merge(all, pt);
+	}
+	pthread_mutex_unlock(&lock_prof_lock);
+
+	if (!(sites = ast_calloc(LOCK_PROF_SITES, sizeof(*sites)))) {
+		free(all);
+		return RESULT_FAILURE;
+	}
+
+	/* Either each place a lock is taken, or each lock (going by its name) */
+	for (i = 0; i < LOCK_PROF_SITES; i++) {
+		site = &all->sites[i];
+		if (!site->file)
+			continue;
+		by_lock = NULL;
+		if (!by_site) {
+			for (j = 0; j < num; j++) {
+				if (!strcmp(sites[j].name, site->name)) {
+					by_lock = &sites[j];
+					break;
+				}
+			}
+		}
+		if (!by_lock) {
+			sites[num++] = *site;
+			continue;
+		}
+		by_lock->samples += site->samples;
+		by_lock->contended += site->contended;
+		by_lock->wait_ns += site->wait_ns;
+		by_lock->hold_ns += site->hold_ns;
+		by_lock->held += site->held;
+		for (j = 0; j < LOCK_PROF_BUCKETS; j++) {
+			by_lock->wait_hist[j] += site->wait_hist[j];
+			by_lock->hold_hist[j] += site->hold_hist[j];
+		}
+		by_lock->file = NULL;
+	}
+	dropped = all->dropped;
+	free(all);
+
+	qsort(sites, num, sizeof(*sites), lock_prof_cmp);
+
+	ast_cli(fd, "Lock profiling is %s (timing 1 in %u uncontended locks)\n",
+		ast_lock_profiling ? "on" : "off", lock_prof_rate);
+	ast_cli(fd, "%-28.28s %-26.26s %9s %9s %11s %8s %10s %8s\n",
+		"Lock", "Where", "Samples", "Contended", "Waited(ms)", "Wait p99", "Held(ms)", "Hold p99");
+	for (i = 0; i < num && i < max; i++) {
+		site = &sites[i];
+		if (site->file)
+			snprintf(where, sizeof(where), "%s:%d", site->file, site->line);
+		else
+			ast_copy_string(where, "(several)", sizeof(where));
+		ast_cli(fd, "%-28.28s %-26.26s %9u %9u %11.3f %6uus %10.3f %6uus\n",
+			site->name, where, site->samples, site->contended,
+			site->wait_ns / 1000000.0, lock_prof_p99(site->wait_hist, site->samples),
+			site->hold_ns / 1000000.0, lock_prof_p99(site->hold_hist, site->held));
+	}
+	free(sites);
+	if (dropped)
+		ast_cli(fd, "%u timings were dropped: locks were taken in more than %d places\n",
+			dropped, LOCK_PROF_SITES);
+
+	return RESULT_SUCCESS;
+}
+
+static int handle_set_locks_profile(int fd, int argc, char *argv[])
+{
+	unsigned int rate = 1;
+
+	if (argc < 5 || argc > 6)
+		return RESULT_SHOWUSAGE;
+
+	if (!strcasecmp(argv[4], "off")) {
+		ast_lock_profiling = 0;
+		ast_cli(fd, "Lock profiling stopped\n");
+		return RESULT_SUCCESS;
+	}
+	if (strcasecmp(argv[4], "on") || (argc == 6 && (sscanf(argv[5], "%u", &rate) != 1 || !rate)))
+		return RESULT_SHOWUSAGE;
+
+	/* Start again from nothing: each thread clears its own figures when it next locks something */
+	pthread_mutex_lock(&lock_prof_lock);
+	ast_lock_profiling = 0;
+	lock_prof_gen++;
+	memset(&lock_prof_gone, 0, sizeof(lock_prof_gone));
+	lock_prof_rate = rate;
+	ast_lock_profiling = 1;
+	pthread_mutex_unlock(&lock_prof_lock);
+
+	ast_cli(fd, "Lock profiling started, timing 1 in %u uncontended locks\n", rate);
+
+	return RESULT_SUCCESS;
+}
+
+static char show_locks_profile_help[] =
+"Usage: core show locks profile [sites] [<count>]\n"
+"       Shows the locks that were waited for longest since lock profiling\n"
+"was started, with how long they were held.  With 'sites', each place in\n"
+"the source a lock is taken is shown separately.  Only the first <count>\n"
+"(default 20) are shown.  Up to 256 places are kept track of; timings\n"
+"from any more than that are only counted.\n";
+
+static char set_locks_profile_help[] =
+"Usage: core set locks profile {on [<rate>]|off}\n"
+"       Starts (clearing anything found before) or stops lock profiling.\n"
+"Every lock that has to be waited for is timed, along with 1 in <rate>\n"
+"(default 1) of the rest.\n";
+
+static struct ast_cli_entry lock_prof_cli[] = {
+	{ { "core", "show", "locks", "profile", NULL }, handle_show_locks_profile,
+	  "Show where threads wait for locks", show_locks_profile_help },
+
+	{ { "core", "set", "locks", "profile", NULL }, handle_set_locks_profile,
+	  "Start or stop lock profiling", set_locks_profile_help },
+};
+
 int ast_utils_init(void)
 {
 	base64_init();
+	ast_cli_register_multiple(lock_prof_cli, sizeof(lock_prof_cli) / sizeof(lock_prof_cli[0]));
 #ifdef DEBUG_THREADS
 #if !defined(LOW_MEMORY)
 	ast_cli_register_multiple(utils_cli, sizeof(utils_cli) / sizeof(utils_cli[0]));
@@ -1431,7 +1898,8 @@ int _ast_asprintf(char **ret, const char *file, int lineno, const char *func, co
 	va_start(ap, fmt);
 	if ((res = vasprintf(ret, fmt, ap)) == -1) {
 		MALLOC_FAILURE_MSG;
-	}
+	} else
+		ast_heap_alloc(*ret, res + 1, file, lineno, func);
 	va_end(ap);
 
 	return res;
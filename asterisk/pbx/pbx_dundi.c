@@ -1326,33 +1326,15 @@ static int update_key(struct dundi_peer *peer)
 static int encrypt_memcpy(unsigned char *dst, unsigned char *src, int len, unsigned char *iv, aes_encrypt_ctx *ecx) 
 {
 	unsigned char curblock[16];
-	int x;
 	memcpy(curblock, iv, sizeof(curblock));
-	while(len > 0) {
-		for (x=0;x<16;x++)
-			curblock[x] ^= src[x];
-		aes_encrypt(curblock, dst, ecx);
-		memcpy(curblock, dst, sizeof(curblock)); 
-		dst += 16;
-		src += 16;
-		len -= 16;
-	}
+	aes_cbc_encrypt(src, dst, len, curblock, ecx);
 	return 0;
 }
 static int decrypt_memcpy(unsigned char *dst, unsigned char *src, int len, unsigned char *iv, aes_decrypt_ctx *dcx) 
 {
 	unsigned char lastblock[16];
-	int x;
 	memcpy(lastblock, iv, sizeof(lastblock));
-	while(len > 0) {
-		aes_decrypt(src, dst, dcx);
-		for (x=0;x<16;x++)
-			dst[x] ^= lastblock[x];
-		memcpy(lastblock, src, sizeof(lastblock));
-		dst += 16;
-		src += 16;
-		len -= 16;
-	}
+	aes_cbc_decrypt(src, dst, len, lastblock, dcx);
 	return 0;
 }
 
@@ -1430,7 +1412,7 @@ static int dundi_encrypt(struct dundi_transaction *trans, struct dundi_packet *p
 		/* Add the field, rounded up to 16 bytes */
 		dundi_ie_append_encdata(&ied, DUNDI_IE_ENCDATA, iv, NULL, ((bytes + 15) / 16) * 16);
 		/* Copy the data */
-		if ((ied.pos + bytes) >= sizeof(ied.buf)) {
+		if ((ied.pos + ((bytes + 15) / 16) * 16) >= sizeof(ied.buf)) {
 			ast_log(LOG_NOTICE, "Final packet too large!\n");
 			return -1;
 		}
@@ -44,6 +44,7 @@ ASTERISK_FILE_VERSION(__FILE__, "$Revision: 147386 $")
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/wait.h>
+#include <time.h>
 
 #include "asterisk/file.h"
 #include "asterisk/logger.h"
@@ -112,6 +113,57 @@ static int agidebug = 0;
 
 #define AGI_PORT 4573
 
+/* How many idle connections we keep to each FastAGI server, and for how long */
+#define AGI_POOL_MAX 16
+#define AGI_POOL_IDLE 60
+
+/* Local scripts are started with posix_spawn where we can close the
+   descriptors we don't pass on without doing it one at a time */
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 34))
+#define AGI_SPAWN
+#include <spawn.h>
+#include <sched.h>
+extern char **environ;
+#endif
+
+struct agi_launch_stats {
+	unsigned int launches;
+	unsigned int failures;
+	unsigned long long total_us;	/*!< Time spent getting scripts ready to talk to */
+	unsigned int max_us;
+};
+
+struct agi_conn {
+	int fd;
+	time_t since;		/*!< When it went idle */
+	AST_LIST_ENTRY(agi_conn) list;
+};
+
+/*!
+ * \brief A FastAGI server, with the connections to it we have kept open
+ *
+ * We offer a server to reuse its connection by sending agi_network_reuse
+ * with the environment.  A server that takes us up on it ends the session
+ * with "SESSION END" instead of closing the connection, waits for the
+ * 200 result, and can then be sent the next session's environment on the
+ * same connection.  Servers that don't know about it just close, as before.
+ */
+struct agi_server {
+	char name[80];		/*!< host:port */
+	AST_LIST_HEAD_NOLOCK(, agi_conn) idle;	/*!< Newest first */
+	int nidle;
+	unsigned int connects;
+	unsigned int reuses;
+	unsigned int stale;	/*!< Idle connections found closed, or too old */
+	struct agi_launch_stats stats;
+	AST_LIST_ENTRY(agi_server) list;
+};
+
+static AST_LIST_HEAD_STATIC(agi_servers, agi_server);
+
+/*! \brief Local scripts, under the agi_servers lock too */
+static struct agi_launch_stats local_stats;
+
 enum agi_result {
 	AGI_RESULT_FAILURE = -1,
 	AGI_RESULT_SUCCESS,
@@ -140,9 +192,121 @@ static int agi_debug_cli(int fd, char *fmt, ...)
 	return res;
 }
 
+static void agi_stats_add(struct agi_launch_stats *stats, struct timeval start, int failed)
+{
+	struct timeval d = ast_tvsub(ast_tvnow(), start);
+	unsigned int us = d.tv_sec * 1000000 + d.tv_usec;
+
+	AST_LIST_LOCK(&agi_servers);
+	if (failed)
+		stats->failures++;
+	else {
+		stats->launches++;
+		stats->total_us += us;
+		if (us > stats->max_us)
+			stats->max_us = us;
+	}
+	AST_LIST_UNLOCK(&agi_servers);
+}
+
+/*! \brief An idle connection is fit to use if there's nothing to read on it, not even EOF */
+static int agi_conn_alive(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+	return poll(&pfd, 1, 0) == 0;
+}
+
+/*! \brief Find the server, and an idle connection to it if there's one good one */
+static struct agi_server *agi_pool_get(const char *host, int port, int *fd)
+{
+	struct agi_server *server;
+	struct agi_conn *conn;
+	char name[80];
+	time_t now = time(NULL);
+
+	*fd = -1;
+	snprintf(name, sizeof(name), "%s:%d", host, port);
+
+	AST_LIST_LOCK(&agi_servers);
+	AST_LIST_TRAVERSE(&agi_servers, server, list) {
+		if (!strcasecmp(server->name, name))
+			break;
+	}
+	if (!server) {
+		if (!(server = ast_calloc(1, sizeof(*server)))) {
+			AST_LIST_UNLOCK(&agi_servers);
+			return NULL;
+		}
+		ast_copy_string(server->name, name, sizeof(server->name));
+		AST_LIST_INSERT_HEAD(&agi_servers, server, list);
+	}
+	while (*fd < 0 && (conn = AST_LIST_REMOVE_HEAD(&server->idle, list))) {
+		server->nidle--;
+		if (now - conn->since < AGI_POOL_IDLE && agi_conn_alive(conn->fd)) {
+			*fd = conn->fd;
+			server->reuses++;
+		} else {
+			close(conn->fd);
+			server->stale++;
+		}
+		free(conn);
+	}
+	AST_LIST_UNLOCK(&agi_servers);
+
+	return server;
+}
+
+/*! \brief Keep a connection for the next session, if it's fit for one, or close it */
+static void agi_pool_put(struct agi_server *server, int fd, int reusable)
+{
+	struct agi_conn *conn, *old;
+	time_t now = time(NULL);
+	int x = 0;
+
+	if (!server || !reusable || !(conn = ast_calloc(1, sizeof(*conn)))) {
+		close(fd);
+		return;
+	}
+	conn->fd = fd;
+	conn->since = now;
+
+	AST_LIST_LOCK(&agi_servers);
+	AST_LIST_INSERT_HEAD(&server->idle, conn, list);
+	server->nidle++;
+	/* Newest first: keep the first AGI_POOL_MAX, less any past their time */
+	AST_LIST_TRAVERSE_SAFE_BEGIN(&server->idle, old, list) {
+		if (++x > AGI_POOL_MAX || (old != conn && now - old->since >= AGI_POOL_IDLE)) {
+			AST_LIST_REMOVE_CURRENT(&server->idle, list);
+			server->nidle--;
+			server->stale++;
+			close(old->fd);
+			free(old);
+		}
+	}
+	AST_LIST_TRAVERSE_SAFE_END
+	AST_LIST_UNLOCK(&agi_servers);
+}
+
+static void agi_pool_destroy(void)
+{
+	struct agi_server *server;
+	struct agi_conn *conn;
+
+	AST_LIST_LOCK(&agi_servers);
+	while ((server = AST_LIST_REMOVE_HEAD(&agi_servers, list))) {
+		while ((conn = AST_LIST_REMOVE_HEAD(&server->idle, list))) {
+			close(conn->fd);
+			free(conn);
+		}
+		free(server);
+	}
+	AST_LIST_UNLOCK(&agi_servers);
+}
+
 /* launch_netscript: The fastagi handler.
 	FastAGI defaults to port 4573 */
-static enum agi_result launch_netscript(char *agiurl, char *argv[], int *fds, int *efd, int *opid)
+static enum agi_result launch_netscript(char *agiurl, char *argv[], int *fds, int *efd, int *opid, struct agi_server **server)
 {
 	int s;
 	int flags;
@@ -153,6 +317,7 @@ static enum agi_result launch_netscript(char *agiurl, char *argv[], int *fds, in
 	struct sockaddr_in sin;
 	struct hostent *hp;
 	struct ast_hostent ahp;
+	struct timeval start = ast_tvnow();
 	int res;
 
 	/* agiusl is "agi://host.domain[:port][/script/name]" */
@@ -172,9 +337,20 @@ static enum agi_result launch_netscript(char *agiurl, char *argv[], int *fds, in
 		ast_log(LOG_WARNING, "AGI URI's don't support Enhanced AGI yet\n");
 		return -1;
 	}
+
+	/* Pick up where a previous session left off, if we can */
+	*server = agi_pool_get(host, port, &s);
+	if (s > -1) {
+		if (fdprintf(s, "agi_network: yes\n") >= 0)
+			goto connected;
+		close(s);
+	}
+
 	hp = ast_gethostbyname(host, &ahp);
 	if (!hp) {
 		ast_log(LOG_WARNING, "Unable to locate host '%s'\n", host);
+		if (*server)
+			agi_stats_add(&(*server)->stats, start, 1);
 		return -1;
 	}
 	s = socket(AF_INET, SOCK_STREAM, 0);
@@ -213,6 +389,8 @@ static enum agi_result launch_netscript(char *agiurl, char *argv[], int *fds, in
 			} else
 				ast_log(LOG_WARNING, "Connect to '%s' failed: %s\n", agiurl, strerror(errno));
 			close(s);
+			if (*server)
+				agi_stats_add(&(*server)->stats, start, 1);
 			return AGI_RESULT_FAILURE;
 		}
 	}
@@ -221,13 +399,25 @@ static enum agi_result launch_netscript(char *agiurl, char *argv[], int *fds, in
 		if (errno != EINTR) {
 			ast_log(LOG_WARNING, "Connect to '%s' failed: %s\n", agiurl, strerror(errno));
 			close(s);
+			if (*server)
+				agi_stats_add(&(*server)->stats, start, 1);
 			return AGI_RESULT_FAILURE;
 		}
 	}
+	if (*server) {
+		AST_LIST_LOCK(&agi_servers);
+		(*server)->connects++;
+		AST_LIST_UNLOCK(&agi_servers);
+	}
 
+connected:
 	/* If we have a script parameter, relay it to the fastagi server */
 	if (!ast_strlen_zero(script))
 		fdprintf(s, "agi_network_script: %s\n", script);
+	if (*server) {
+		fdprintf(s, "agi_network_reuse: yes\n");
+		agi_stats_add(&(*server)->stats, start, 0);
+	}
 
 	if (option_debug > 3)
 		ast_log(LOG_DEBUG, "Wow, connected!\n");
@@ -237,19 +427,119 @@ static enum agi_result launch_netscript(char *agiurl, char *argv[], int *fds, in
 	return AGI_RESULT_SUCCESS_FAST;
 }
 
-static enum agi_result launch_script(char *script, char *argv[], int *fds, int *efd, int *opid)
+#ifdef AGI_SPAWN
+/*!
+ * \brief Start a script the way the fork() in launch_script would, but with posix_spawn
+ *
+ * posix_spawn doesn't copy our address space (glibc uses a vfork style clone),
+ * which with all the memory and threads we have makes starting a script a lot
+ * quicker.  Returns the pid, or -1 with errno set.
+ */
+static int spawn_script(char *script, char *argv[], int in, int out, int audio)
+{
+	static const int defsigs[] = { SIGHUP, SIGCHLD, SIGINT, SIGURG, SIGTERM, SIGPIPE, SIGXFSZ };
+	struct {
+		const char *name;
+		const char *value;
+	} vars[] = {
+		{ "AST_CONFIG_DIR", ast_config_AST_CONFIG_DIR },
+		{ "AST_CONFIG_FILE", ast_config_AST_CONFIG_FILE },
+		{ "AST_MODULE_DIR", ast_config_AST_MODULE_DIR },
+		{ "AST_SPOOL_DIR", ast_config_AST_SPOOL_DIR },
+		{ "AST_MONITOR_DIR", ast_config_AST_MONITOR_DIR },
+		{ "AST_VAR_DIR", ast_config_AST_VAR_DIR },
+		{ "AST_DATA_DIR", ast_config_AST_DATA_DIR },
+		{ "AST_LOG_DIR", ast_config_AST_LOG_DIR },
+		{ "AST_AGI_DIR", ast_config_AST_AGI_DIR },
+		{ "AST_KEY_DIR", ast_config_AST_KEY_DIR },
+		{ "AST_RUN_DIR", ast_config_AST_RUN_DIR },
+	};
+	int nvars = sizeof(vars) / sizeof(vars[0]);
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	struct sched_param sched;
+	sigset_t sigs;
+	char **envp;
+	pid_t pid;
+	int n, ours, x, y, res;
+
+	/* Our environment, with the paths to everything set as in the child of a fork() */
+	for (n = 0; environ[n]; n++);
+	if (!(envp = ast_calloc(n + nvars + 1, sizeof(*envp)))) {
+		errno = ENOMEM;
+		return -1;
+	}
+	for (x = 0, n = 0; environ[x]; x++) {
+		for (y = 0; y < nvars; y++) {
+			if (!strncmp(environ[x], vars[y].name, strlen(vars[y].name)) && environ[x][strlen(vars[y].name)] == '=')
+				break;
+		}
+		if (y == nvars)
+			envp[n++] = environ[x];
+	}
+	for (ours = n, y = 0; y < nvars; y++) {
+		if (asprintf(&envp[n], "%s=%s", vars[y].name, vars[y].value) < 0) {
+			envp[n] = NULL;
+			break;
+		}
+		n++;
+	}
+
+	/* stdin and out, the enhanced audio channel if wanted, and nothing else */
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+	posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+	if (audio > -1)
+		posix_spawn_file_actions_adddup2(&actions, audio, STDERR_FILENO + 1);
+	else
+		posix_spawn_file_actions_addclose(&actions, STDERR_FILENO + 1);
+	posix_spawn_file_actions_addclosefrom_np(&actions, STDERR_FILENO + 2);
+
+	/* Default signal handling, nothing blocked, and no realtime priority */
+	posix_spawnattr_init(&attr);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSCHEDULER);
+	sigemptyset(&sigs);
+	posix_spawnattr_setsigmask(&attr, &sigs);
+	for (x = 0; x < sizeof(defsigs) / sizeof(defsigs[0]); x++)
+		sigaddset(&sigs, defsigs[x]);
+	posix_spawnattr_setsigdefault(&attr, &sigs);
+	memset(&sched, 0, sizeof(sched));
+	posix_spawnattr_setschedpolicy(&attr, SCHED_OTHER);
+	posix_spawnattr_setschedparam(&attr, &sched);
+
+	res = posix_spawn(&pid, script, &actions, &attr, argv, envp);
+
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+	while (n > ours)
+		free(envp[--n]);
+	free(envp);
+
+	if (res) {
+		errno = res;
+		return -1;
+	}
+	return pid;
+}
+#endif
+
+static enum agi_result launch_script(char *script, char *argv[], int *fds, int *efd, int *opid, struct agi_server **server)
 {
 	char tmp[256];
 	int pid;
 	int toast[2];
 	int fromast[2];
 	int audio[2];
-	int x;
 	int res;
+	struct timeval start;
+#ifndef AGI_SPAWN
+	int x;
 	sigset_t signal_set, old_set;
+#endif
 	
+	*server = NULL;
 	if (!strncasecmp(script, "agi://", 6))
-		return launch_netscript(script, argv, fds, efd, opid);
+		return launch_netscript(script, argv, fds, efd, opid, server);
 	
 	if (script[0] != '/') {
 		snprintf(tmp, sizeof(tmp), "%s/%s", (char *)ast_config_AST_AGI_DIR, script);
@@ -289,6 +579,22 @@ static enum agi_result launch_script(char *script, char *argv[], int *fds, int *
 		}
 	}
 
+	start = ast_tvnow();
+#ifdef AGI_SPAWN
+	if ((pid = spawn_script(script, argv, fromast[0], toast[1], efd ? audio[0] : -1)) < 0) {
+		ast_log(LOG_WARNING, "Failed to execute '%s': %s\n", script, strerror(errno));
+		close(fromast[0]);
+		close(fromast[1]);
+		close(toast[0]);
+		close(toast[1]);
+		if (efd) {
+			close(audio[0]);
+			close(audio[1]);
+		}
+		agi_stats_add(&local_stats, start, 1);
+		return AGI_RESULT_FAILURE;
+	}
+#else
 	/* Block SIGHUP during the fork - prevents a race */
 	sigfillset(&signal_set);
 	pthread_sigmask(SIG_BLOCK, &signal_set, &old_set);
@@ -296,6 +602,7 @@ static enum agi_result launch_script(char *script, char *argv[], int *fds, int *
 	if (pid < 0) {
 		ast_log(LOG_WARNING, "Failed to fork(): %s\n", strerror(errno));
 		pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+		agi_stats_add(&local_stats, start, 1);
 		return AGI_RESULT_FAILURE;
 	}
 	if (!pid) {
@@ -353,6 +660,8 @@ static enum agi_result launch_script(char *script, char *argv[], int *fds, int *
 		_exit(1);
 	}
 	pthread_sigmask(SIG_SETMASK, &old_set, NULL);
+#endif
+	agi_stats_add(&local_stats, start, 0);
 	if (option_verbose > 2) 
 		ast_verbose(VERBOSE_PREFIX_3 "Launched AGI Script %s\n", script);
 	fds[0] = toast[0];
@@ -1845,12 +2154,15 @@ static enum agi_result run_agi(struct ast_channel *chan, char *request, AGI *agi
 	/* how many times we'll retry if ast_waitfor_nandfs will return without either 
 	  channel or file descriptor in case select is interrupted by a system call (EINTR) */
 	int retry = AGI_NANDFS_RETRY;
+	int ctrl = agi->ctrl;
 
-	if (!(readf = fdopen(agi->ctrl, "r"))) {
+	/* A FastAGI connection may outlive the session, so read a copy of it */
+	if ((agi->fast && (ctrl = dup(agi->ctrl)) < 0) || !(readf = fdopen(ctrl, "r"))) {
 		ast_log(LOG_WARNING, "Unable to fdopen file descriptor\n");
 		if (pid > -1)
 			kill(pid, SIGHUP);
-		close(agi->ctrl);
+		if (ctrl > -1)
+			close(ctrl);
 		return AGI_RESULT_FAILURE;
 	}
 	setlinebuf(readf);
@@ -1916,6 +2228,17 @@ static enum agi_result run_agi(struct ast_channel *chan, char *request, AGI *agi
 				break;
 			}
 
+			/* The FastAGI server is done, and keeps the connection for the next session */
+			if (agi->fast && !strncasecmp(buf, "SESSION END", 11) && (!buf[11] || buf[11] == '\n')) {
+				if (agidebug)
+					ast_verbose("AGI Rx << %s", buf);
+				if (returnstatus >= 0 && fdprintf(agi->fd, "200 result=0\n") >= 0)
+					agi->reusable = 1;
+				if (option_verbose > 2) 
+					ast_verbose(VERBOSE_PREFIX_3 "AGI Script %s completed, returning %d\n", request, returnstatus);
+				break;
+			}
+
 			/* get rid of trailing newline, if any */
 			if (*buf && buf[strlen(buf) - 1] == '\n')
 				buf[strlen(buf) - 1] = 0;
@@ -2028,6 +2351,37 @@ static int handle_agidumphtml(int fd, int argc, char *argv[])
 	return RESULT_SUCCESS;
 }
 
+static void agi_show_launches(int fd, const char *name, struct agi_launch_stats *stats)
+{
+	ast_cli(fd, "%-30s %8u %8u %10u %10u\n", name, stats->launches, stats->failures,
+		stats->launches ? (unsigned int) (stats->total_us / stats->launches) : 0, stats->max_us);
+}
+
+static int handle_agishowpool(int fd, int argc, char *argv[])
+{
+	struct agi_server *server;
+
+	if (argc != 3)
+		return RESULT_SHOWUSAGE;
+
+	AST_LIST_LOCK(&agi_servers);
+	ast_cli(fd, "%-30s %8s %8s %10s %10s\n", "Script", "Launched", "Failed", "Avg (us)", "Max (us)");
+#ifdef AGI_SPAWN
+	agi_show_launches(fd, "local (posix_spawn)", &local_stats);
+#else
+	agi_show_launches(fd, "local (fork)", &local_stats);
+#endif
+	AST_LIST_TRAVERSE(&agi_servers, server, list)
+		agi_show_launches(fd, server->name, &server->stats);
+
+	ast_cli(fd, "\n%-30s %6s %10s %10s %10s\n", "FastAGI server", "Idle", "Connects", "Reused", "Stale");
+	AST_LIST_TRAVERSE(&agi_servers, server, list)
+		ast_cli(fd, "%-30s %6d %10u %10u %10u\n", server->name, server->nidle, server->connects, server->reuses, server->stale);
+	AST_LIST_UNLOCK(&agi_servers);
+
+	return RESULT_SUCCESS;
+}
+
 static int agi_exec_full(struct ast_channel *chan, void *data, int enhanced, int dead)
 {
 	enum agi_result res;
@@ -2040,6 +2394,7 @@ static int agi_exec_full(struct ast_channel *chan, void *data, int enhanced, int
 	int efd = -1;
 	int pid;
 	char *stringp;
+	struct agi_server *server;
 	AGI agi;
 
 	if (ast_strlen_zero(data)) {
@@ -2064,7 +2419,7 @@ static int agi_exec_full(struct ast_channel *chan, void *data, int enhanced, int
 	}
 #endif
 	ast_replace_sigchld();
-	res = launch_script(argv[0], argv, fds, enhanced ? &efd : NULL, &pid);
+	res = launch_script(argv[0], argv, fds, enhanced ? &efd : NULL, &pid, &server);
 	if (res == AGI_RESULT_SUCCESS || res == AGI_RESULT_SUCCESS_FAST) {
 		int status = 0;
 		agi.fd = fds[1];
@@ -2075,7 +2430,9 @@ static int agi_exec_full(struct ast_channel *chan, void *data, int enhanced, int
 		/* If the fork'd process returns non-zero, set AGISTATUS to FAILURE */
 		if ((res == AGI_RESULT_SUCCESS || res == AGI_RESULT_SUCCESS_FAST) && status)
 			res = AGI_RESULT_FAILURE;
-		if (fds[1] != fds[0])
+		if (agi.fast)
+			agi_pool_put(server, fds[0], agi.reusable);
+		else if (fds[1] != fds[0])
 			close(fds[1]);
 		if (efd > -1)
 			close(efd);
@@ -2145,6 +2502,11 @@ static char dumpagihtml_help[] =
 "Usage: agi dumphtml <filename>\n"
 "	Dumps the agi command list in html format to given filename\n";
 
+static char showagipool_help[] =
+"Usage: agi show pool\n"
+"       Shows how long AGI scripts have taken to start, and the\n"
+"       connections kept open to each FastAGI server.\n";
+
 static struct ast_cli_entry cli_show_agi_deprecated = {
 	{ "show", "agi", NULL },
 	handle_showagi, NULL,
@@ -2173,6 +2535,10 @@ static struct ast_cli_entry cli_agi[] = {
 	handle_showagi, "List AGI commands or specific help",
 	showagi_help, NULL, &cli_show_agi_deprecated },
 
+	{ { "agi", "show", "pool", NULL },
+	handle_agishowpool, "Show AGI launch times and FastAGI connections",
+	showagipool_help },
+
 	{ { "agi", "dumphtml", NULL },
 	handle_agidumphtml, "Dumps a list of agi commands in html format",
 	dumpagihtml_help, NULL, &cli_dump_agihtml_deprecated },
@@ -2180,11 +2546,15 @@ static struct ast_cli_entry cli_agi[] = {
 
 static int unload_module(void)
 {
+	int res;
+
 	ast_module_user_hangup_all();
 	ast_cli_unregister_multiple(cli_agi, sizeof(cli_agi) / sizeof(struct ast_cli_entry));
 	ast_unregister_application(eapp);
 	ast_unregister_application(deadapp);
-	return ast_unregister_application(app);
+	res = ast_unregister_application(app);
+	agi_pool_destroy();
+	return res;
 }
 
 static int load_module(void)
@@ -125,6 +125,33 @@ struct moh_files_state {
 #define MOH_SINGLE		(1 << 1)
 #define MOH_CUSTOM		(1 << 2)
 #define MOH_RANDOMIZE		(1 << 3)
+#define MOH_BROADCAST		(1 << 4)
+
+/*
+ * A broadcast class has one thread decoding its files and encoding each
+ * 20ms frame once for every format its listeners want, into a ring of
+ * slots the listeners copy from.  The thread is the only writer: a slot's
+ * seq is odd while it is being filled, so a listener that sees the same
+ * even seq before and after copying knows it got a whole frame.
+ */
+#define MOH_BCAST_SAMPLES	160	/*!< Samples in each frame */
+#define MOH_BCAST_BYTES		(MOH_BCAST_SAMPLES * 2)	/*!< Room for a frame in any format */
+#define MOH_BCAST_FORMATS	8	/*!< Formats one class will encode to */
+#define MOH_BCAST_RING		16	/*!< Frames kept, 320ms */
+
+struct moh_bcast_slot {
+	/*! 2n+1 while frame n is being written, 2n+2 once it's there */
+	volatile unsigned int seq;
+	int samples[MOH_BCAST_FORMATS];
+	/*! 0 if there's nothing in that format */
+	int datalen[MOH_BCAST_FORMATS];
+	unsigned char data[MOH_BCAST_FORMATS][MOH_BCAST_BYTES];
+};
+
+struct moh_bcast_format {
+	int format;
+	int listeners;
+};
 
 struct mohclass {
 	char name[MAX_MUSICCLASS];
@@ -133,6 +160,8 @@ struct mohclass {
 	char mode[80];
 	/*! A dynamically sized array to hold the list of filenames in "files" mode */
 	char **filearray;
+	/*! The extension of each of those, for broadcast classes to open it by */
+	char **extarray;
 	/*! The current size of the filearray */
 	int allowed_files;
 	/*! The current number of files loaded into the filearray */
@@ -151,6 +180,13 @@ struct mohclass {
 	/*! Number of users */
 	int inuse;
 	unsigned int delete:1;
+	/*! Broadcast classes: the frames, and the formats they're in */
+	struct moh_bcast_slot *bcast_ring;
+	volatile unsigned int bcast_head;	/*!< Frames sent so far */
+	struct moh_bcast_format bcast_formats[MOH_BCAST_FORMATS];
+	volatile int bcast_nformats;
+	int bcast_listeners;
+	volatile int bcast_stop;
 	AST_LIST_HEAD_NOLOCK(, mohdata) members;
 	AST_LIST_ENTRY(mohclass) list;
 };
@@ -182,15 +218,24 @@ static void ast_moh_free_class(struct mohclass **mohclass)
 		free(member);
 	
 	if (class->thread) {
-		pthread_cancel(class->thread);
+		if (ast_test_flag(class, MOH_BROADCAST)) {
+			class->bcast_stop = 1;
+			pthread_join(class->thread, NULL);
+		} else
+			pthread_cancel(class->thread);
 		class->thread = 0;
 	}
 
 	if (class->filearray) {
-		for (i = 0; i < class->total_files; i++)
+		for (i = 0; i < class->total_files; i++) {
 			free(class->filearray[i]);
+			free(class->extarray[i]);
+		}
 		free(class->filearray);
+		free(class->extarray);
 	}
+	if (class->bcast_ring)
+		free(class->bcast_ring);
 
 	free(class);
 	*mohclass = NULL;
@@ -353,6 +398,276 @@ static struct ast_generator moh_file_stream =
 	generate: moh_files_generator,
 };
 
+struct moh_bcast_member {
+	struct mohclass *class;
+	int origwfmt;
+	int index;		/*!< Which of the class's formats we get */
+	unsigned int next;	/*!< The next frame to send */
+	struct ast_frame f;
+	unsigned char buf[AST_FRIENDLY_OFFSET + MOH_BCAST_BYTES];
+};
+
+static struct ast_filestream *moh_broadcast_open(struct mohclass *class, int *pos)
+{
+	struct ast_filestream *fs;
+	int tries;
+
+	for (tries = 0; tries < class->total_files; tries++) {
+		if (ast_test_flag(class, MOH_RANDOMIZE))
+			*pos = ast_random() % class->total_files;
+		else
+			*pos = (*pos + 1) % class->total_files;
+		if ((fs = ast_readfile(class->filearray[*pos], class->extarray[*pos], NULL, O_RDONLY, 0, 0))) {
+			if (option_debug)
+				ast_log(LOG_DEBUG, "Broadcasting file %d '%s' on class '%s'\n", *pos, class->filearray[*pos], class->name);
+			return fs;
+		}
+	}
+	return NULL;
+}
+
+/*! \brief Put a frame in the next slot, in every format somebody is listening in */
+static void moh_broadcast_publish(struct mohclass *class, struct ast_frame *f, struct ast_trans_pvt **encoders, int *failed)
+{
+	unsigned int n = class->bcast_head;
+	struct moh_bcast_slot *slot = &class->bcast_ring[n % MOH_BCAST_RING];
+	struct moh_bcast_format *fmt;
+	struct ast_frame *ef;
+	int nformats = class->bcast_nformats;
+	int i;
+
+	slot->seq = 2 * n + 1;
+	__sync_synchronize();
+	for (i = 0; i < nformats; i++) {
+		fmt = &class->bcast_formats[i];
+		slot->datalen[i] = 0;
+		if (!fmt->listeners || failed[i])
+			continue;
+		if (fmt->format == AST_FORMAT_SLINEAR)
+			ef = f;
+		else {
+			if (!encoders[i] && !(encoders[i] = ast_translator_build_path(fmt->format, AST_FORMAT_SLINEAR))) {
+				failed[i] = 1;
+				continue;
+			}
+			ef = ast_translate(encoders[i], f, 0);
+		}
+		if (ef && ef->datalen <= MOH_BCAST_BYTES) {
+			memcpy(slot->data[i], ef->data, ef->datalen);
+			slot->datalen[i] = ef->datalen;
+			slot->samples[i] = ef->samples;
+		}
+	}
+	__sync_synchronize();
+	slot->seq = 2 * n + 2;
+	__sync_synchronize();
+	class->bcast_head = n + 1;
+}
+
+static void *moh_broadcast_thread(void *data)
+{
+	struct mohclass *class = data;
+	struct ast_filestream *fs = NULL;
+	struct ast_trans_pvt *decoder = NULL;
+	struct ast_trans_pvt *encoders[MOH_BCAST_FORMATS] = { NULL, };
+	int failed[MOH_BCAST_FORMATS] = { 0, };
+	struct ast_smoother *smoother;
+	struct ast_frame *f, *sf;
+	struct timeval next = ast_tvnow();
+	int pos = -1;
+	long delta;
+	int i;
+
+	if (!(smoother = ast_smoother_new(MOH_BCAST_BYTES))) {
+		ast_log(LOG_WARNING, "Unable to create smoother for class '%s'\n", class->name);
+		return NULL;
+	}
+
+	while (!class->bcast_stop) {
+		/* Nobody is listening, so hold our place */
+		if (!class->bcast_listeners) {
+			usleep(100000);
+			next = ast_tvnow();
+			continue;
+		}
+
+		/* Get the next 20ms of signed linear */
+		while (!(sf = ast_smoother_read(smoother))) {
+			if (!fs || !(f = ast_readframe(fs))) {
+				if (fs)
+					ast_closestream(fs);
+				if (!(fs = moh_broadcast_open(class, &pos)) || !(f = ast_readframe(fs)))
+					break;
+			}
+			if (f->subclass != AST_FORMAT_SLINEAR) {
+				if (!decoder || decoder->t->srcfmt != f->subclass) {
+					if (decoder)
+						ast_translator_free_path(decoder);
+					if (!(decoder = ast_translator_build_path(AST_FORMAT_SLINEAR, f->subclass)))
+						break;
+				}
+				f = ast_translate(decoder, f, 0);
+			}
+			if (f)
+				ast_smoother_feed(smoother, f);
+		}
+		if (!sf) {
+			ast_log(LOG_WARNING, "Unable to read any file of class '%s'\n", class->name);
+			if (fs) {
+				ast_closestream(fs);
+				fs = NULL;
+			}
+			sleep(1);
+			next = ast_tvnow();
+			continue;
+		}
+
+		moh_broadcast_publish(class, sf, encoders, failed);
+
+		/* Keep to real time, but don't rush to catch up after a stall */
+		next = ast_tvadd(next, ast_samp2tv(MOH_BCAST_SAMPLES, 8000));
+		delta = ast_tvdiff_ms(next, ast_tvnow());
+		if (delta > 0)
+			usleep(delta * 1000);
+		else if (delta < -100)
+			next = ast_tvnow();
+	}
+
+	if (fs)
+		ast_closestream(fs);
+	if (decoder)
+		ast_translator_free_path(decoder);
+	for (i = 0; i < MOH_BCAST_FORMATS; i++) {
+		if (encoders[i])
+			ast_translator_free_path(encoders[i]);
+	}
+	ast_smoother_free(smoother);
+	return NULL;
+}
+
+static void moh_broadcast_release(struct ast_channel *chan, void *data)
+{
+	struct moh_bcast_member *m = data;
+	struct mohclass *class = m->class;
+
+	ast_atomic_fetchadd_int(&class->bcast_formats[m->index].listeners, -1);
+	ast_atomic_fetchadd_int(&class->bcast_listeners, -1);
+	if (chan) {
+		if (m->origwfmt && ast_set_write_format(chan, m->origwfmt))
+			ast_log(LOG_WARNING, "Unable to restore channel '%s' to format %s\n", chan->name, ast_getformatname(m->origwfmt));
+		if (option_verbose > 2)
+			ast_verbose(VERBOSE_PREFIX_3 "Stopped music on hold on %s\n", chan->name);
+	}
+	free(m);
+	if (ast_atomic_dec_and_test(&class->inuse) && class->delete)
+		ast_moh_destroy_one(class);
+}
+
+static void *moh_broadcast_alloc(struct ast_channel *chan, void *params)
+{
+	struct mohclass *class = params;
+	struct moh_bcast_member *m;
+	int format;
+	int i;
+
+	if (!(m = ast_calloc(1, sizeof(*m))))
+		return NULL;
+	m->class = class;
+	m->origwfmt = chan->writeformat;
+
+	/* Send the channel its own codec if we can make it, so it needn't translate */
+	format = ast_best_codec(chan->nativeformats & AST_FORMAT_AUDIO_MASK);
+	if (!format || ast_translate_path_steps(format, AST_FORMAT_SLINEAR) == -1)
+		format = AST_FORMAT_SLINEAR;
+
+	AST_LIST_LOCK(&mohclasses);
+	for (i = 0; i < class->bcast_nformats; i++) {
+		if (class->bcast_formats[i].format == format)
+			break;
+	}
+	if (i == class->bcast_nformats) {
+		if (i == MOH_BCAST_FORMATS) {
+			/* all in use, have signed linear (always the first) */
+			i = 0;
+			format = AST_FORMAT_SLINEAR;
+		} else {
+			class->bcast_formats[i].format = format;
+			__sync_synchronize();
+			class->bcast_nformats++;
+		}
+	}
+	ast_atomic_fetchadd_int(&class->bcast_formats[i].listeners, 1);
+	ast_atomic_fetchadd_int(&class->bcast_listeners, 1);
+	AST_LIST_UNLOCK(&mohclasses);
+
+	m->index = i;
+	m->next = class->bcast_head;
+	m->f.frametype = AST_FRAME_VOICE;
+	m->f.subclass = format;
+	m->f.src = "moh_broadcast";
+
+	if (ast_set_write_format(chan, format)) {
+		ast_log(LOG_WARNING, "Unable to set channel '%s' to format '%s'\n", chan->name, ast_codec2str(format));
+		moh_broadcast_release(NULL, m);
+		return NULL;
+	}
+	if (option_verbose > 2)
+		ast_verbose(VERBOSE_PREFIX_3 "Started music on hold, class '%s', on channel '%s'\n", class->name, chan->name);
+	return m;
+}
+
+/*! \brief Send the frames the class has put out since last time, up to samples' worth */
+static int moh_broadcast_generate(struct ast_channel *chan, void *data, int len, int samples)
+{
+	struct moh_bcast_member *m = data;
+	struct mohclass *class = m->class;
+	struct moh_bcast_slot *slot;
+	unsigned int head = class->bcast_head;
+	unsigned int seq;
+	int sent = 0;
+
+	__sync_synchronize();
+	/* Too far behind, skip to the latest */
+	if (head - m->next > MOH_BCAST_RING / 2)
+		m->next = head - 1;
+
+	while (sent < samples && m->next != head) {
+		slot = &class->bcast_ring[m->next % MOH_BCAST_RING];
+		seq = slot->seq;
+		__sync_synchronize();
+		len = 0;
+		if (seq == 2 * m->next + 2) {
+			len = slot->datalen[m->index];
+			memcpy(m->buf + AST_FRIENDLY_OFFSET, slot->data[m->index], len);
+			m->f.samples = slot->samples[m->index];
+			__sync_synchronize();
+			if (slot->seq != seq)
+				len = 0;	/* overwritten while we copied */
+		}
+		m->next++;
+		if (!len)
+			continue;
+
+		m->f.datalen = len;
+		m->f.data = m->buf + AST_FRIENDLY_OFFSET;
+		m->f.offset = AST_FRIENDLY_OFFSET;
+		if (ast_write(chan, &m->f) < 0) {
+			ast_log(LOG_WARNING, "Failed to write frame to '%s': %s\n", chan->name, strerror(errno));
+			return -1;
+		}
+		sent += m->f.samples;
+	}
+
+	return 0;
+}
+
+static struct ast_generator moh_broadcast_stream = 
+{
+	alloc: moh_broadcast_alloc,
+	release: moh_broadcast_release,
+	generate: moh_broadcast_generate,
+};
+
 static int spawn_mp3(struct mohclass *class)
 {
 	int fds[2];
@@ -772,14 +1087,20 @@ static struct ast_generator mohgen =
 	generate: moh_generate,
 };
 
-static int moh_add_file(struct mohclass *class, const char *filepath)
+static int moh_add_file(struct mohclass *class, const char *filepath, const char *ext)
 {
 	if (!class->allowed_files) {
 		if (!(class->filearray = ast_calloc(1, INITIAL_NUM_FILES * sizeof(*class->filearray))))
 			return -1;
+		if (!(class->extarray = ast_calloc(1, INITIAL_NUM_FILES * sizeof(*class->extarray)))) {
+			free(class->filearray);
+			class->filearray = NULL;
+			return -1;
+		}
 		class->allowed_files = INITIAL_NUM_FILES;
 	} else if (class->total_files == class->allowed_files) {
-		if (!(class->filearray = ast_realloc(class->filearray, class->allowed_files * sizeof(*class->filearray) * 2))) {
+		if (!(class->filearray = ast_realloc(class->filearray, class->allowed_files * sizeof(*class->filearray) * 2)) ||
+		    !(class->extarray = ast_realloc(class->extarray, class->allowed_files * sizeof(*class->extarray) * 2))) {
 			class->allowed_files = 0;
 			class->total_files = 0;
 			return -1;
@@ -789,6 +1110,10 @@ static int moh_add_file(struct mohclass *class, const char *filepath)
 
 	if (!(class->filearray[class->total_files] = ast_strdup(filepath)))
 		return -1;
+	if (!(class->extarray[class->total_files] = ast_strdup(ext))) {
+		free(class->filearray[class->total_files]);
+		return -1;
+	}
 
 	class->total_files++;
 
@@ -812,8 +1137,10 @@ static int moh_scan_files(struct mohclass *class) {
 		return -1;
 	}
 
-	for (i = 0; i < class->total_files; i++)
+	for (i = 0; i < class->total_files; i++) {
 		free(class->filearray[i]);
+		free(class->extarray[i]);
+	}
 
 	class->total_files = 0;
 	dirnamelen = strlen(class->dir) + 2;
@@ -851,7 +1178,7 @@ static int moh_scan_files(struct mohclass *class) {
 				break;
 
 		if (i == class->total_files) {
-			if (moh_add_file(class, filepath))
+			if (moh_add_file(class, filepath, ext))
 				break;
 		}
 	}
@@ -895,6 +1222,20 @@ static int moh_register(struct mohclass *moh, int reload)
 		}
 		if (strchr(moh->args, 'r'))
 			ast_set_flag(moh, MOH_RANDOMIZE);
+		if (ast_test_flag(moh, MOH_BROADCAST)) {
+			if (!(moh->bcast_ring = ast_calloc(MOH_BCAST_RING, sizeof(*moh->bcast_ring)))) {
+				ast_moh_free_class(&moh);
+				return -1;
+			}
+			/* signed linear is always there, for whoever can't have anything else */
+			moh->bcast_formats[0].format = AST_FORMAT_SLINEAR;
+			moh->bcast_nformats = 1;
+			if (ast_pthread_create_background(&moh->thread, NULL, moh_broadcast_thread, moh)) {
+				ast_log(LOG_WARNING, "Unable to create moh broadcast thread...\n");
+				ast_moh_free_class(&moh);
+				return -1;
+			}
+		}
 	} else if (!strcasecmp(moh->mode, "mp3") || !strcasecmp(moh->mode, "mp3nb") || !strcasecmp(moh->mode, "quietmp3") || !strcasecmp(moh->mode, "quietmp3nb") || !strcasecmp(moh->mode, "httpmp3") || !strcasecmp(moh->mode, "custom")) {
 
 		if (!strcasecmp(moh->mode, "custom"))
@@ -984,7 +1325,9 @@ static int local_ast_moh_start(struct ast_channel *chan, const char *mclass, con
 		return -1;
 
 	ast_set_flag(chan, AST_FLAG_MOH);
-	if (mohclass->total_files) {
+	if (ast_test_flag(mohclass, MOH_BROADCAST) && mohclass->total_files) {
+		return ast_activate_generator(chan, &moh_broadcast_stream, mohclass);
+	} else if (mohclass->total_files) {
 		return ast_activate_generator(chan, &moh_file_stream, mohclass);
 	} else
 		return ast_activate_generator(chan, &mohgen, mohclass);
@@ -1053,6 +1396,8 @@ static int load_moh_classes(int reload)
 					ast_copy_string(class->args, var->value, sizeof(class->args));
 				else if (!strcasecmp(var->name, "random"))
 					ast_set2_flag(class, ast_true(var->value), MOH_RANDOMIZE);
+				else if (!strcasecmp(var->name, "broadcast"))
+					ast_set2_flag(class, ast_true(var->value), MOH_BROADCAST);
 				else if (!strcasecmp(var->name, "format")) {
 					class->format = ast_getformatbyname(var->value);
 					if (!class->format) {
@@ -1235,6 +1580,13 @@ static int moh_classes_show(int fd, int argc, char *argv[])
 			ast_cli(fd, "\tApplication: %s\n", S_OR(class->args, "<none>"));
 		if (strcasecmp(class->mode, "files"))
 			ast_cli(fd, "\tFormat: %s\n", ast_getformatname(class->format));
+		if (ast_test_flag(class, MOH_BROADCAST)) {
+			int i;
+
+			ast_cli(fd, "\tBroadcast: %d listeners, %u frames sent\n", class->bcast_listeners, class->bcast_head);
+			for (i = 0; i < class->bcast_nformats; i++)
+				ast_cli(fd, "\t\t%s: %d listeners\n", ast_getformatname(class->bcast_formats[i].format), class->bcast_formats[i].listeners);
+		}
 	}
 	AST_LIST_UNLOCK(&mohclasses);
 
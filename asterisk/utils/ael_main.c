@@ -403,6 +403,13 @@ void ast_verbose(const char *fmt, ...)
         va_end(vars);
 }
 
+/* The ast_malloc() family tells the heap profiler about what it allocates */
+int ast_heap_sample_rate = 0;
+
+void __ast_heap_alloc(void *p, size_t len, const char *file, int lineno, const char *func)
+{
+}
+
 char *ast_process_quotes_and_slashes(char *start, char find, char replace_with)
 {
         char *dataPut = start;